@@ -0,0 +1,553 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - C++
+
+    The embedding API declared in expense.h, on top of the engine in
+    expense_internal.h. The command-line modes live in expense_tools.cpp
+    and the app in expense_app.cpp is a thin client of both.
+
+    Features:
+    - User registration and login
+    - Three split methods:  EQUAL, EXACT, PERCENTAGE
+    - Balance calculation
+    - File-based data persistence
+    - CSV export
+    - Expense search with indexed, batch-filtered queries
+    - Monthly / quarterly reports served from rollup tables
+    - Top-K debtors, creditors and pairwise debts
+    - Debt simplification (cycle cancellation, per-group settlement)
+    - Approximate sharing insights (HyperLogLog, count-min sketch)
+    - Name / email autocomplete for finding users and adding participants
+    - Interned names, emails and descriptions (32-bit handles)
+    - Packed 8-byte participants stored inline for small groups
+    - Per-subsystem memory accounting and a benchmark mode
+    - Memory budget mode that spills cold expense pages to disk
+    - Out-of-core balance audit using an external merge sort
+    - CSV export sorted by date, amount or counterparty, with top-N limits
+    - Change feed of every mutation (data/changes.jsonl), resumable by sequence
+    - Read-only replica process that follows the change feed
+    - Safe sharing of one data directory by several processes (file locks,
+      append-only writes, incremental reloads)
+    - Watch mode: inotify-driven incremental reload of externally appended records
+    - Offline replicas: globally unique expense IDs, deletions as tombstones,
+      incremental merge of another data directory
+    - Many tenant ledgers in one process (LedgerPool, and a tenant field in
+      the JSON and server protocols), loaded lazily and evicted LRU under a
+      memory budget
+    - Sharded balances (ShardedLedger): expenses and balances split across
+      per-core shards with their own logs, replayed on open, and a
+      benchmark of write scaling
+    - Shared work-stealing task scheduler with priorities and cancellation
+    - Request server: coroutine pipeline per connection on an epoll loop
+    - JSON-lines protocol (stdin or server) with an in-place request parser
+    - Embeddable library: Status / Result error codes, no printing, no
+      exceptions past the API
+
+    This file is the public API (expense.h) over ExpenseManager; the
+    engine itself is declared in expense_internal.h and defined in
+    expense_support.cpp, expense_model.cpp, expense_analytics.cpp,
+    expense_storage.cpp and expense_manager.cpp. ShardedLedger wraps the
+    sharded engine in expense_shards.cpp.
+
+    Build the library:
+      g++ -std=c++20 -pthread -O2 -c expense.cpp expense_support.cpp expense_model.cpp \
+          expense_analytics.cpp expense_storage.cpp expense_manager.cpp expense_shards.cpp
+      ar rcs libexpense.a expense.o expense_support.o expense_model.o \
+          expense_analytics.o expense_storage.o expense_manager.o expense_shards.o
+      g++ -std=c++20 -pthread -O2 -fPIC -shared expense.cpp expense_support.cpp expense_model.cpp \
+          expense_analytics.cpp expense_storage.cpp expense_manager.cpp expense_shards.cpp \
+          -o libexpense.so
+    Run the tests (tests/test_*.cpp):
+      sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense_internal.h"
+
+using namespace std;
+
+// ============================================================================
+// PUBLIC API (expense.h)
+// ============================================================================
+
+namespace expense {
+
+using namespace detail;
+
+const char* errorCodeName(ErrorCode code) {
+    switch (code) {
+        case ErrorCode::OK: return "OK";
+        case ErrorCode::INVALID_ARGUMENT: return "INVALID_ARGUMENT";
+        case ErrorCode::NOT_LOGGED_IN: return "NOT_LOGGED_IN";
+        case ErrorCode::AUTHENTICATION_FAILED: return "AUTHENTICATION_FAILED";
+        case ErrorCode::NOT_FOUND: return "NOT_FOUND";
+        case ErrorCode::ALREADY_EXISTS: return "ALREADY_EXISTS";
+        case ErrorCode::PERMISSION_DENIED: return "PERMISSION_DENIED";
+        case ErrorCode::READ_ONLY: return "READ_ONLY";
+        case ErrorCode::IO_ERROR: return "IO_ERROR";
+        case ErrorCode::RESOURCE_EXHAUSTED: return "RESOURCE_EXHAUSTED";
+        case ErrorCode::INTERNAL: return "INTERNAL";
+        default: return "UNKNOWN";
+    }
+}
+
+namespace {
+
+UserInfo toUserInfo(const User& user) {
+    return UserInfo{user.getId(), user.getName(), user.getEmail(), user.getPhone()};
+}
+
+ExpenseInfo toExpenseInfo(const Expense& expense) {
+    ExpenseInfo info{expense.getId(), expense.getDescription(), expense.getAmount(), expense.getSplitMethod(),
+                     expense.getCreatedBy(), expense.getCreatedAt(), {}};
+    for (const auto& participant : expense.getParticipants()) {
+        info.shares.push_back(ShareInfo{(int)participant.getUserId(), participant.getShare()});
+    }
+    return info;
+}
+
+vector<ExpenseInfo> toExpenseInfos(const vector<Expense>& expenses) {
+    vector<ExpenseInfo> infos;
+    infos.reserve(expenses.size());
+    for (const Expense& expense : expenses) infos.push_back(toExpenseInfo(expense));
+    return infos;
+}
+
+// Text of a report that renders into a stream and returns a Status
+template <typename Render>
+Result<string> renderText(Render render) {
+    ostringstream out;
+    Status status = render(out);
+    if (!status) return status;
+    return out.str();
+}
+
+// Run one call, turning exceptions from the engine into a Status: a lock
+// file or sort run that cannot be opened, a full string pool, a corrupt
+// record, running out of memory. Nothing throws past the API.
+template <typename Call>
+auto guarded(Call call) -> decltype(call()) {
+    try {
+        return call();
+    } catch (const bad_alloc&) {
+        return Status(ErrorCode::RESOURCE_EXHAUSTED, "Out of memory!");
+    } catch (const length_error& error) {
+        return Status(ErrorCode::RESOURCE_EXHAUSTED, error.what());
+    } catch (const runtime_error& error) {
+        return Status(ErrorCode::IO_ERROR, error.what());
+    } catch (const exception& error) {
+        return Status(ErrorCode::INTERNAL, error.what());
+    }
+}
+
+}  // namespace
+
+// The manager is not thread-safe; every call takes the lock, and so does
+// the watcher when it applies records other processes appended
+struct Ledger::Impl {
+    mutex lock;
+    ExpenseManager manager;
+    unique_ptr<DataWatcher> watcher;   // declared last, so stopped first
+
+    explicit Impl(const LedgerOptions& options)
+        : manager(options.dataDir, options.sketches, options.memoryBudgetBytes) {
+        manager.setIdempotencyLimits(options.idempotencyKeys, options.idempotencyWindowSeconds);
+    }
+
+    // Render a report under the lock
+    template <typename Render>
+    Result<string> report(Render render) {
+        return guarded([&]() -> Result<string> {
+            lock_guard<mutex> guard(lock);
+            return renderText(render);
+        });
+    }
+};
+
+Ledger::Ledger(const LedgerOptions& options) : impl(new Impl(options)) {
+    if (options.watch) {
+        impl->watcher.reset(new DataWatcher(options.dataDir, {"users.txt", "expenses.txt", "tombstones.txt"},
+                                            [this]() { return refresh().ok(); }));
+    }
+}
+
+Ledger::~Ledger() = default;
+
+Result<unique_ptr<Ledger>> Ledger::open(const LedgerOptions& options) {
+    return guarded([&]() -> Result<unique_ptr<Ledger>> { return unique_ptr<Ledger>(new Ledger(options)); });
+}
+
+Result<int> Ledger::registerUser(const string& name, const string& email, const string& phone,
+                                 const string& password) {
+    return guarded([&]() -> Result<int> {
+        lock_guard<mutex> guard(impl->lock);
+        return impl->manager.registerUser(name, email, phone, password);
+    });
+}
+
+Result<UserInfo> Ledger::login(const string& email, const string& password) {
+    return guarded([&]() -> Result<UserInfo> {
+        lock_guard<mutex> guard(impl->lock);
+        Status status = impl->manager.login(email, password);
+        if (!status) return status;
+        return toUserInfo(*impl->manager.getCurrentUser());
+    });
+}
+
+void Ledger::logout() {
+    lock_guard<mutex> guard(impl->lock);
+    impl->manager.logout();
+}
+
+Status Ledger::resumeSession(int userId) {
+    lock_guard<mutex> guard(impl->lock);
+    if (impl->manager.resumeSession(userId)) return Status();
+    return Status(ErrorCode::NOT_FOUND, "User ID " + to_string(userId) + " not found!");
+}
+
+Result<UserInfo> Ledger::currentUser() const {
+    return guarded([&]() -> Result<UserInfo> {
+        lock_guard<mutex> guard(impl->lock);
+        const User* user = impl->manager.getCurrentUser();
+        if (user == nullptr) return Status(ErrorCode::NOT_LOGGED_IN, "Please login first!");
+        return toUserInfo(*user);
+    });
+}
+
+Result<vector<UserInfo>> Ledger::users() const {
+    return guarded([&]() -> Result<vector<UserInfo>> {
+        lock_guard<mutex> guard(impl->lock);
+        vector<UserInfo> result;
+        for (const User* user : impl->manager.allUsers()) result.push_back(toUserInfo(*user));
+        return result;
+    });
+}
+
+Result<vector<UserInfo>> Ledger::findUsers(const string& prefix, size_t limit) const {
+    return guarded([&]() -> Result<vector<UserInfo>> {
+        lock_guard<mutex> guard(impl->lock);
+        vector<UserInfo> result;
+        for (const User* user : impl->manager.findUsers(prefix, limit)) result.push_back(toUserInfo(*user));
+        return result;
+    });
+}
+
+Result<int> Ledger::addExpense(const string& description, double amount, SplitMethod method,
+                               const vector<int>& participantIds, const vector<double>& shares,
+                               const string& idempotencyKey) {
+    return guarded([&]() -> Result<int> {
+        lock_guard<mutex> guard(impl->lock);
+        return impl->manager.addExpense(description, amount, method, participantIds, shares, idempotencyKey);
+    });
+}
+
+Status Ledger::deleteExpense(int expenseId) {
+    return guarded([&]() -> Status {
+        lock_guard<mutex> guard(impl->lock);
+        return impl->manager.deleteExpense(expenseId);
+    });
+}
+
+Result<vector<ExpenseInfo>> Ledger::myExpenses() const {
+    return guarded([&]() -> Result<vector<ExpenseInfo>> {
+        lock_guard<mutex> guard(impl->lock);
+        const User* user = impl->manager.getCurrentUser();
+        if (user == nullptr) return Status(ErrorCode::NOT_LOGGED_IN, "Please login first!");
+        ExpenseQuery query;
+        query.participantIds.push_back(user->getId());
+        return toExpenseInfos(impl->manager.findExpenses(query));
+    });
+}
+
+Result<vector<ExpenseInfo>> Ledger::search(const string& queryText) const {
+    return guarded([&]() -> Result<vector<ExpenseInfo>> {
+        lock_guard<mutex> guard(impl->lock);
+        if (impl->manager.getCurrentUser() == nullptr) return Status(ErrorCode::NOT_LOGGED_IN, "Please login first!");
+        ExpenseQuery query;
+        string error;
+        if (!ExpenseQuery::parse(queryText, query, error)) return Status(ErrorCode::INVALID_ARGUMENT, error);
+        return toExpenseInfos(impl->manager.findExpenses(query));
+    });
+}
+
+Result<vector<BalanceInfo>> Ledger::balances() const {
+    return guarded([&]() -> Result<vector<BalanceInfo>> {
+        lock_guard<mutex> guard(impl->lock);
+        const User* user = impl->manager.getCurrentUser();
+        if (user == nullptr) return Status(ErrorCode::NOT_LOGGED_IN, "Please login first!");
+        vector<BalanceInfo> result;
+        for (const auto& entry : impl->manager.balances().balancesFor(user->getId())) {
+            if (abs(entry.amount) <= 0.01) continue;
+            result.push_back(BalanceInfo{entry.counterpartyId, impl->manager.nameOf(entry.counterpartyId), entry.amount});
+        }
+        return result;
+    });
+}
+
+Result<ExportInfo> Ledger::exportBalances(const string& path, ExportOrder order, bool descending,
+                                          size_t limit) const {
+    return guarded([&]() -> Result<ExportInfo> {
+        lock_guard<mutex> guard(impl->lock);
+        return impl->manager.exportBalanceToCSV(path, order, descending, limit);
+    });
+}
+
+Result<string> Ledger::usersText() const {
+    return impl->report([&](ostream& out) {
+        impl->manager.displayAllUsers(out);
+        return Status();
+    });
+}
+
+Result<string> Ledger::userSearchText(const string& prefix) const {
+    return impl->report([&](ostream& out) {
+        impl->manager.displayUserSearch(prefix, out);
+        return Status();
+    });
+}
+
+Result<string> Ledger::myExpensesText() const {
+    return impl->report([&](ostream& out) { return impl->manager.displayUserExpenses(out); });
+}
+
+Result<string> Ledger::allExpensesText() const {
+    return impl->report([&](ostream& out) { return impl->manager.displayAllExpenses(out); });
+}
+
+Result<string> Ledger::searchText(const string& query) const {
+    return impl->report([&](ostream& out) { return impl->manager.searchExpenses(query, out); });
+}
+
+Result<string> Ledger::balanceText() const {
+    return impl->report([&](ostream& out) { return impl->manager.displayBalance(out); });
+}
+
+Result<string> Ledger::topBalancesText(size_t k) const {
+    return impl->report([&](ostream& out) { return impl->manager.displayTopBalances(k, out); });
+}
+
+Result<string> Ledger::monthlyText(const string& from, const string& to) const {
+    return impl->report([&](ostream& out) { return impl->manager.displayMonthlySpending(from, to, out); });
+}
+
+Result<string> Ledger::pairText(int otherUserId, const string& from, const string& to) const {
+    return impl->report([&](ostream& out) { return impl->manager.displayPairReport(otherUserId, from, to, out); });
+}
+
+Result<string> Ledger::simplificationText() const {
+    return impl->report([&](ostream& out) { return impl->manager.displayDebtSimplification(out); });
+}
+
+Result<string> Ledger::insightsText() const {
+    return impl->report([&](ostream& out) { return impl->manager.displaySharingInsights(out); });
+}
+
+Result<string> Ledger::memoryText() const {
+    return impl->report([&](ostream& out) {
+        impl->manager.displayMemoryUsage(out);
+        return Status();
+    });
+}
+
+Status Ledger::refresh() {
+    return guarded([&]() -> Status {
+        lock_guard<mutex> guard(impl->lock);
+        impl->manager.refresh();
+        return Status();
+    });
+}
+
+Status Ledger::compact() {
+    return guarded([&]() -> Status {
+        lock_guard<mutex> guard(impl->lock);
+        return impl->manager.compactData();
+    });
+}
+
+Result<uint64_t> Ledger::malformedLines() const {
+    return guarded([&]() -> Result<uint64_t> {
+        lock_guard<mutex> guard(impl->lock);
+        return impl->manager.malformedLineCount();
+    });
+}
+
+Result<MergeInfo> Ledger::mergeFrom(const string& peerDir) {
+    return guarded([&]() -> Result<MergeInfo> {
+        lock_guard<mutex> guard(impl->lock);
+        return impl->manager.mergeFrom(peerDir);
+    });
+}
+
+// ============================================================================
+// LEDGER POOL (expense.h)
+// ============================================================================
+
+struct LedgerPool::Impl {
+    TenantPool<Ledger> tenants;
+
+    explicit Impl(const LedgerPoolOptions& options)
+        : tenants(options.baseDir, options.memoryBudgetBytes,
+                  [ledger = options.ledger](const string& dataDir) -> Result<shared_ptr<Ledger>> {
+                      LedgerOptions tenantOptions = ledger;
+                      tenantOptions.dataDir = dataDir;
+                      Result<unique_ptr<Ledger>> opened = Ledger::open(tenantOptions);
+                      if (!opened) return opened.status();
+                      return shared_ptr<Ledger>(move(opened.value()));
+                  },
+                  options.stringBudgetBytes) {}
+};
+
+LedgerPool::LedgerPool(const LedgerPoolOptions& options) : impl(new Impl(options)) {}
+
+LedgerPool::~LedgerPool() = default;
+
+Result<unique_ptr<LedgerPool>> LedgerPool::open(const LedgerPoolOptions& options) {
+    return guarded([&]() -> Result<unique_ptr<LedgerPool>> { return unique_ptr<LedgerPool>(new LedgerPool(options)); });
+}
+
+bool LedgerPool::isValidTenantId(const string& tenantId) {
+    return TenantPool<Ledger>::isValidTenantId(tenantId);
+}
+
+Result<shared_ptr<Ledger>> LedgerPool::acquire(const string& tenantId) {
+    return guarded([&]() { return impl->tenants.acquire(tenantId); });
+}
+
+Status LedgerPool::evict(const string& tenantId) {
+    if (impl->tenants.evict(tenantId)) return Status();
+    return Status(ErrorCode::NOT_FOUND, "Tenant '" + tenantId + "' is not open");
+}
+
+bool LedgerPool::isResident(const string& tenantId) const {
+    return impl->tenants.isResident(tenantId);
+}
+
+LedgerPoolStats LedgerPool::stats() const {
+    TenantPool<Ledger>::Stats stats = impl->tenants.stats();
+    return LedgerPoolStats{stats.residentTenants, stats.residentBytes, stats.sharedBytes, stats.sharedBudget,
+                           stats.memoryBudget, stats.hits, stats.loads, stats.evictions};
+}
+
+// ============================================================================
+// SHARDED LEDGER (expense.h)
+// ============================================================================
+
+struct ShardedLedger::Impl {
+    ShardedEngine engine;
+
+    explicit Impl(const ShardedLedgerOptions& options) : engine(options.dataDir, options.shards) {}
+};
+
+namespace {
+
+// An ExpenseInfo as an engine expense with its shares as given; the empty
+// status if it is valid
+Status toShardedExpense(const ExpenseInfo& info, Expense& expense) {
+    const Status invalid(ErrorCode::INVALID_ARGUMENT, "Invalid expense '" + info.description + "': ");
+    if (!Utils::isRecordSafe(info.description)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, invalid.message + "'|' or control characters in the description");
+    }
+    if (!(info.amount > 0 && info.amount <= ExpenseParticipant::MAX_SHARE)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, invalid.message + "amount out of range");
+    }
+    if (info.paidBy <= 0 || info.shares.empty()) {
+        return Status(ErrorCode::INVALID_ARGUMENT, invalid.message + "needs a payer and shares");
+    }
+    expense = Expense(1, info.description, info.amount, info.splitMethod, info.paidBy);
+    double total = 0.0;
+    for (const ShareInfo& share : info.shares) {
+        if (share.userId <= 0 || !(abs(share.amount) <= ExpenseParticipant::MAX_SHARE)) {
+            return Status(ErrorCode::INVALID_ARGUMENT, invalid.message + "bad share");
+        }
+        expense.addParticipant(ExpenseParticipant(share.userId, share.amount));
+        total += share.amount;
+    }
+    if (abs(total - info.amount) > 0.01) {
+        return Status(ErrorCode::INVALID_ARGUMENT, invalid.message + "shares add up to " + Utils::formatCurrency(total));
+    }
+    return Status();
+}
+
+vector<BalanceInfo> toBalanceInfos(const vector<BalanceLedger::Entry>& entries, bool byCounterparty) {
+    vector<BalanceInfo> infos;
+    infos.reserve(entries.size());
+    for (const auto& entry : entries) {
+        infos.push_back(BalanceInfo{byCounterparty ? entry.counterpartyId : entry.userId, string(), entry.amount});
+    }
+    return infos;
+}
+
+}  // namespace
+
+ShardedLedger::ShardedLedger(const ShardedLedgerOptions& options) : impl(new Impl(options)) {}
+
+ShardedLedger::~ShardedLedger() = default;
+
+Result<unique_ptr<ShardedLedger>> ShardedLedger::open(const ShardedLedgerOptions& options) {
+    return guarded([&]() -> Result<unique_ptr<ShardedLedger>> {
+        return unique_ptr<ShardedLedger>(new ShardedLedger(options));
+    });
+}
+
+Result<vector<int>> ShardedLedger::addExpenses(const vector<ExpenseInfo>& expenses) {
+    return guarded([&]() -> Result<vector<int>> {
+        vector<Expense> batch(expenses.size());
+        for (size_t i = 0; i < expenses.size(); i++) {
+            Status valid = toShardedExpense(expenses[i], batch[i]);
+            if (!valid) return valid;
+        }
+        vector<int> ids = impl->engine.add(batch);
+        size_t exhausted = (size_t)count(ids.begin(), ids.end(), -1);
+        if (exhausted > 0) {
+            return Status(ErrorCode::RESOURCE_EXHAUSTED, to_string(exhausted) + " of " + to_string(ids.size()) +
+                          " expenses were not stored: their shards ran out of expense IDs");
+        }
+        size_t failed = (size_t)count(ids.begin(), ids.end(), 0);
+        if (failed > 0) {
+            return Status(ErrorCode::IO_ERROR, to_string(failed) + " of " + to_string(ids.size()) +
+                          " expenses could not be written to their shard logs");
+        }
+        return ids;
+    });
+}
+
+Status ShardedLedger::drain() {
+    return guarded([&]() {
+        impl->engine.drain();
+        return Status();
+    });
+}
+
+Result<vector<BalanceInfo>> ShardedLedger::balancesFor(int userId) const {
+    return guarded([&]() -> Result<vector<BalanceInfo>> {
+        return toBalanceInfos(impl->engine.balancesFor(userId), true);
+    });
+}
+
+Result<vector<BalanceInfo>> ShardedLedger::topDebtors(size_t k) const {
+    return guarded([&]() -> Result<vector<BalanceInfo>> { return toBalanceInfos(impl->engine.topDebtors(k), false); });
+}
+
+Result<vector<BalanceInfo>> ShardedLedger::topCreditors(size_t k) const {
+    return guarded([&]() -> Result<vector<BalanceInfo>> { return toBalanceInfos(impl->engine.topCreditors(k), false); });
+}
+
+Result<vector<PairBalanceInfo>> ShardedLedger::topPairs(size_t k) const {
+    return guarded([&]() -> Result<vector<PairBalanceInfo>> {
+        vector<PairBalanceInfo> pairs;
+        for (const auto& entry : impl->engine.topPairs(k)) {
+            pairs.push_back(PairBalanceInfo{entry.userId, entry.counterpartyId, entry.amount});
+        }
+        return pairs;
+    });
+}
+
+Result<ShardedLedgerStats> ShardedLedger::stats() const {
+    return guarded([&]() -> Result<ShardedLedgerStats> {
+        ShardedEngine::Stats stats = impl->engine.stats();
+        return ShardedLedgerStats{impl->engine.shardCount(), stats.expenses, stats.localDeltas, stats.remoteDeltas,
+                                  stats.recovered, stats.malformedLines, stats.failedWrites};
+    });
+}
+
+}  // namespace expense
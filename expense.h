@@ -0,0 +1,377 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - PUBLIC API
+
+    Embeds an expense ledger (one data directory) in another program. Calls
+    return a Status or a Result instead of printing; nothing here writes to
+    stdout. The command-line app (expense_app.cpp) is a client of this API.
+
+    Library: g++ -std=c++20 -pthread -O2 -c expense.cpp expense_support.cpp expense_model.cpp \
+                 expense_analytics.cpp expense_storage.cpp expense_manager.cpp expense_shards.cpp
+             ar rcs libexpense.a expense.o expense_support.o expense_model.o \
+                 expense_analytics.o expense_storage.o expense_manager.o expense_shards.o
+    Client:  g++ -std=c++17 -pthread my_service.cpp -L. -lexpense -o my_service
+===============================================================================
+*/
+
+#ifndef EXPENSE_H
+#define EXPENSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace expense {
+
+// ============================================================================
+// ERRORS
+// ============================================================================
+
+enum class ErrorCode {
+    OK = 0,
+    INVALID_ARGUMENT,        // malformed input: email, amount, shares, query, dates
+    NOT_LOGGED_IN,
+    AUTHENTICATION_FAILED,   // wrong email or password
+    NOT_FOUND,               // unknown user or expense
+    ALREADY_EXISTS,          // email already registered
+    PERMISSION_DENIED,       // e.g. deleting someone else's expense
+    READ_ONLY,               // the ledger is a read-only replica
+    IO_ERROR,                // a data or lock file could not be read or written
+    RESOURCE_EXHAUSTED,      // out of memory, or the string pool is full
+    INTERNAL                 // an unexpected failure inside the library
+};
+
+// Stable name of a code, e.g. "NOT_FOUND"
+const char* errorCodeName(ErrorCode code);
+
+// Outcome of a call: a code and, on failure, a message for people
+struct Status {
+    ErrorCode code = ErrorCode::OK;
+    std::string message;
+
+    Status() = default;
+    Status(ErrorCode code, std::string message) : code(code), message(std::move(message)) {}
+
+    bool ok() const { return code == ErrorCode::OK; }
+    explicit operator bool() const { return ok(); }
+};
+
+// A value, or the Status explaining why there is none
+template <typename T>
+class Result {
+private:
+    Status outcome;
+    T result{};
+
+public:
+    Result(T value) : result(std::move(value)) {}
+    Result(Status status) : outcome(std::move(status)) {}
+
+    bool ok() const { return outcome.ok(); }
+    explicit operator bool() const { return ok(); }
+    const Status& status() const { return outcome; }
+
+    // Only meaningful when ok()
+    const T& value() const { return result; }
+    T& value() { return result; }
+    const T& operator*() const { return result; }
+    const T* operator->() const { return &result; }
+};
+
+// ============================================================================
+// VALUES
+// ============================================================================
+
+enum class SplitMethod : uint8_t {
+    EQUAL,
+    EXACT,        // shares are amounts
+    PERCENTAGE    // shares are percentages adding up to 100
+};
+
+// Row order for CSV exports
+enum class ExportOrder : uint8_t {
+    STORAGE,
+    DATE,
+    AMOUNT,
+    COUNTERPARTY
+};
+
+struct UserInfo {
+    int id = 0;
+    std::string name;
+    std::string email;
+    std::string phone;
+};
+
+struct ShareInfo {
+    int userId = 0;
+    double amount = 0.0;
+};
+
+struct ExpenseInfo {
+    int id = 0;
+    std::string description;
+    double amount = 0.0;
+    SplitMethod splitMethod = SplitMethod::EQUAL;
+    int paidBy = 0;
+    std::string createdAt;   // "YYYY-MM-DD HH:MM:SS"
+    std::vector<ShareInfo> shares;
+};
+
+// What one other user and the current user owe each other, net.
+// Positive: they owe you. Negative: you owe them.
+struct BalanceInfo {
+    int userId = 0;
+    std::string name;
+    double amount = 0.0;
+};
+
+struct ExportInfo {
+    std::string path;
+    size_t rows = 0;
+    size_t sortRuns = 0;   // external sort runs spilled to disk, 0 if sorted in memory
+};
+
+struct MergeInfo {
+    std::string peerReplica;   // the peer's replica ID in hex
+    size_t newUsers = 0;
+    size_t newExpenses = 0;
+    size_t newDeletions = 0;
+    size_t alreadyPresent = 0;
+    size_t skippedUnknownUser = 0;   // users not known yet; retried by the next merge
+    uint64_t peerBytesRead = 0;
+    size_t filesReadFromStart = 0;   // peer files that were rewritten since the last merge
+    bool progressSaved = true;       // false: the next merge rereads more of the peer
+};
+
+struct LedgerOptions {
+    std::string dataDir = "data";
+    size_t memoryBudgetBytes = 0;   // cap on resident expense records, 0 = unlimited
+    bool sketches = false;          // approximate sharing insights (~1 KB per user, 16 MB cap)
+    bool watch = false;             // apply records other processes append as they land
+    size_t idempotencyKeys = 100000;                      // addExpense keys remembered at most
+    long long idempotencyWindowSeconds = 24 * 60 * 60;   // and for how long
+};
+
+// ============================================================================
+// LEDGER
+// ============================================================================
+
+// One data directory, loaded once and kept in memory. Other processes may
+// share the directory; refresh() (or watch mode) picks up what they
+// append. A Ledger has one session, the logged-in user. Every member
+// function is safe to call from any thread, and none of them throws:
+// failures come back as a Status.
+class Ledger {
+public:
+    // Load the data directory
+    static Result<std::unique_ptr<Ledger>> open(const LedgerOptions& options = LedgerOptions());
+    ~Ledger();
+
+    Ledger(const Ledger&) = delete;
+    Ledger& operator=(const Ledger&) = delete;
+
+    // Users and the session
+    Result<int> registerUser(const std::string& name, const std::string& email, const std::string& phone,
+                             const std::string& password);
+    Result<UserInfo> login(const std::string& email, const std::string& password);
+    void logout();
+    // For callers that authenticate users themselves and keep one session
+    // per client, like the request server: switch to a known user ID
+    Status resumeSession(int userId);
+    Result<UserInfo> currentUser() const;
+    Result<std::vector<UserInfo>> users() const;
+    // Users whose name (any word) or email starts with the prefix
+    Result<std::vector<UserInfo>> findUsers(const std::string& prefix, size_t limit = 10) const;
+
+    // Expenses of the logged-in user. The payer is always a participant.
+    // An idempotency key (up to 128 characters, no '|') makes retries safe:
+    // reusing one of your keys within the window returns the ID of the
+    // expense it created instead of adding another.
+    Result<int> addExpense(const std::string& description, double amount, SplitMethod method,
+                           const std::vector<int>& participantIds, const std::vector<double>& shares = {},
+                           const std::string& idempotencyKey = std::string());
+    Status deleteExpense(int expenseId);
+    Result<std::vector<ExpenseInfo>> myExpenses() const;
+    // Query syntax: payer=3 amount>500 quarter=2024-Q2 participant=7 desc~"lunch"
+    Result<std::vector<ExpenseInfo>> search(const std::string& query) const;
+    Result<std::vector<BalanceInfo>> balances() const;
+    Result<ExportInfo> exportBalances(const std::string& path, ExportOrder order = ExportOrder::STORAGE,
+                                      bool descending = false, size_t limit = 0) const;
+
+    // Reports rendered as text, as the command-line app shows them
+    Result<std::string> usersText() const;
+    Result<std::string> userSearchText(const std::string& prefix) const;
+    Result<std::string> myExpensesText() const;
+    Result<std::string> allExpensesText() const;
+    Result<std::string> searchText(const std::string& query) const;
+    Result<std::string> balanceText() const;
+    Result<std::string> topBalancesText(size_t k) const;
+    // Dates are YYYY-MM or YYYY-MM-DD
+    Result<std::string> monthlyText(const std::string& from, const std::string& to) const;
+    Result<std::string> pairText(int otherUserId, const std::string& from, const std::string& to) const;
+    Result<std::string> simplificationText() const;
+    Result<std::string> insightsText() const;
+    Result<std::string> memoryText() const;
+
+    // Maintenance
+    Status refresh();
+    Status compact();
+    // Data file lines skipped on load because they do not parse
+    Result<uint64_t> malformedLines() const;
+    // Pull in what another data directory has that this one lacks
+    Result<MergeInfo> mergeFrom(const std::string& peerDir);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+    explicit Ledger(const LedgerOptions& options);
+};
+
+// ============================================================================
+// LEDGER POOL
+// ============================================================================
+
+struct LedgerPoolOptions {
+    std::string baseDir = "data";   // tenant <id> lives in <baseDir>/tenants/<id>
+    size_t memoryBudgetBytes = 0;   // tracked memory of resident tenants except strings, 0 = unlimited
+    size_t stringBudgetBytes = 0;   // interned strings of the whole process, 0 = unlimited
+    LedgerOptions ledger;           // for every tenant's ledger; dataDir is ignored
+};
+
+struct LedgerPoolStats {
+    size_t residentTenants = 0;
+    size_t residentBytes = 0;       // tracked memory charged to resident tenants
+    size_t sharedStringBytes = 0;   // interned strings shared by all tenants, outside the budget
+    size_t stringBudgetBytes = 0;   // the process's string limit, 0 = none
+    size_t memoryBudgetBytes = 0;
+    uint64_t hits = 0;
+    uint64_t loads = 0;
+    uint64_t evictions = 0;
+};
+
+// One Ledger per tenant, for a service hosting many small ledgers. A
+// tenant's ledger is opened on first use; when the resident ledgers go
+// over the memory budget the least recently used are closed. Their data
+// is on disk, so that only costs a reload later.
+//
+// The memory budget covers everything but interned strings (names,
+// emails, descriptions). Those are shared by every Ledger in the process
+// and never freed, so closing tenants cannot reclaim them; they are
+// reported apart (LedgerPoolStats::sharedStringBytes) and capped by
+// stringBudgetBytes instead. That cap is process-wide and the lowest one
+// any pool asked for wins. Once it is reached, opening a tenant or adding
+// records with text not seen before fails with RESOURCE_EXHAUSTED.
+// Without it, strings grow with every tenant ever opened.
+// Safe to call from any thread.
+class LedgerPool {
+public:
+    static Result<std::unique_ptr<LedgerPool>> open(const LedgerPoolOptions& options = LedgerPoolOptions());
+    ~LedgerPool();
+
+    LedgerPool(const LedgerPool&) = delete;
+    LedgerPool& operator=(const LedgerPool&) = delete;
+
+    // Letters, digits, '-' and '_', at most 64 characters
+    static bool isValidTenantId(const std::string& tenantId);
+
+    // The tenant's ledger, opening it if needed. A closed ledger stays
+    // usable for as long as the caller holds it, and until it is released
+    // acquire() returns that same ledger rather than opening another.
+    Result<std::shared_ptr<Ledger>> acquire(const std::string& tenantId);
+    // Close a resident tenant's ledger; NOT_FOUND if it is not open
+    Status evict(const std::string& tenantId);
+    bool isResident(const std::string& tenantId) const;
+    LedgerPoolStats stats() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+    explicit LedgerPool(const LedgerPoolOptions& options);
+};
+
+// ============================================================================
+// SHARDED LEDGER
+// ============================================================================
+
+struct ShardedLedgerOptions {
+    std::string dataDir = "shards";
+    size_t shards = 0;   // 0: the count dataDir was created with, or one per hardware thread
+};
+
+struct ShardedLedgerStats {
+    size_t shards = 0;
+    size_t expenses = 0;
+    uint64_t localDeltas = 0;      // balance updates kept on the payer's shard
+    uint64_t remoteDeltas = 0;     // balance updates sent to another shard
+    size_t recoveredExpenses = 0;  // replayed from the shard logs on open
+    uint64_t malformedLines = 0;   // shard log lines skipped on open
+    uint64_t failedWrites = 0;     // expenses not stored: a log append failed or IDs ran out
+};
+
+// A debt between two users: userId owes counterpartyId amount
+struct PairBalanceInfo {
+    int userId = 0;
+    int counterpartyId = 0;
+    double amount = 0.0;
+};
+
+// Expenses and balances split across shards by user, each shard with its
+// own thread, log and balances, for ingest that outgrows the one lock of a
+// Ledger. Writes are acknowledged once their shard's log is synced to
+// disk, and open() replays the logs, so everything acknowledged survives a
+// restart or a crash. One ShardedLedger at a time, in any process, may
+// have a directory open; open() returns IO_ERROR while another holds it.
+//
+// This is not a Ledger: users are plain IDs (no accounts or sessions) and
+// there are no deletions, search or reports. Its directory holds shard
+// logs, not Ledger data files, and its shard count is fixed when it is
+// created. Balance updates reach the participants' shards shortly after
+// addExpenses() returns; drain() waits for them. Safe to call from any
+// thread; calls from several threads run on the shards in parallel.
+class ShardedLedger {
+public:
+    static Result<std::unique_ptr<ShardedLedger>> open(const ShardedLedgerOptions& options = ShardedLedgerOptions());
+    ~ShardedLedger();
+
+    ShardedLedger(const ShardedLedger&) = delete;
+    ShardedLedger& operator=(const ShardedLedger&) = delete;
+
+    // Store expenses and return their IDs, in order. Each needs paidBy and
+    // shares (the amount each participant owes, adding up to amount); id
+    // and createdAt are ignored, and the creation time is now. Nothing is
+    // stored if any expense is invalid. IO_ERROR if a shard log could not
+    // be written, RESOURCE_EXHAUSTED if a shard ran out of expense IDs
+    // (they stop at INT_MAX); either way expenses routed to other shards
+    // may still be stored.
+    Result<std::vector<int>> addExpenses(const std::vector<ExpenseInfo>& expenses);
+    // Wait until the balance updates of every expense added so far are
+    // applied on every shard
+    Status drain();
+
+    // Net balances of the user with everyone they share expenses with
+    // (userId is the counterparty, name is empty). Positive: they owe the user.
+    Result<std::vector<BalanceInfo>> balancesFor(int userId) const;
+    // Users with the most negative and the most positive net balance
+    // (name is empty)
+    Result<std::vector<BalanceInfo>> topDebtors(size_t k) const;
+    Result<std::vector<BalanceInfo>> topCreditors(size_t k) const;
+    // The largest debts between two users
+    Result<std::vector<PairBalanceInfo>> topPairs(size_t k) const;
+    Result<ShardedLedgerStats> stats() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+    explicit ShardedLedger(const ShardedLedgerOptions& options);
+};
+
+}  // namespace expense
+
+#endif
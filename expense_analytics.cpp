@@ -0,0 +1,1292 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - INDEXES AND ANALYTICS
+
+    Compressed bitmaps, the query engine, rollup tables, the balance
+    ledger, debt graph analytics, sketches and the prefix index
+    declared in expense_internal.h.
+===============================================================================
+*/
+
+#include "expense_internal.h"
+
+namespace expense {
+namespace detail {
+
+// ============================================================================
+// COMPRESSED BITMAPS
+// ============================================================================
+
+bool RoaringBitmap::Container::contains(uint16_t low) const {
+    if (isBitset()) return (bits[low >> 6] >> (low & 63)) & 1;
+    return binary_search(values.begin(), values.end(), low);
+}
+
+void RoaringBitmap::Container::toBitset() {
+    bits.assign(BITSET_WORDS, 0);
+    for (uint16_t v : values) bits[v >> 6] |= 1ULL << (v & 63);
+    values.clear();
+    values.shrink_to_fit();
+}
+
+void RoaringBitmap::Container::normalize() {
+    if (isBitset() && cardinality <= ARRAY_LIMIT) {
+        values.clear();
+        values.reserve(cardinality);
+        for (size_t w = 0; w < BITSET_WORDS; w++) {
+            for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+                values.push_back((uint16_t)(w * 64 + __builtin_ctzll(word)));
+            }
+        }
+        bits.clear();
+        bits.shrink_to_fit();
+    } else if (!isBitset() && cardinality > ARRAY_LIMIT) {
+        toBitset();
+    }
+}
+
+void RoaringBitmap::Container::add(uint16_t low) {
+    if (isBitset()) {
+        uint64_t mask = 1ULL << (low & 63);
+        if (!(bits[low >> 6] & mask)) {
+            bits[low >> 6] |= mask;
+            cardinality++;
+        }
+        return;
+    }
+    if (values.empty() || low > values.back()) {
+        values.push_back(low);
+    } else {
+        auto it = lower_bound(values.begin(), values.end(), low);
+        if (*it == low) return;
+        values.insert(it, low);
+    }
+    cardinality++;
+    if (cardinality > ARRAY_LIMIT) toBitset();
+}
+
+RoaringBitmap::Words RoaringBitmap::Container::asBits() const {
+    if (isBitset()) return bits;
+    Words result(BITSET_WORDS, 0);
+    for (uint16_t v : values) result[v >> 6] |= 1ULL << (v & 63);
+    return result;
+}
+
+uint32_t RoaringBitmap::popcount(const Words& words) {
+    uint32_t count = 0;
+    for (uint64_t w : words) count += (uint32_t)__builtin_popcountll(w);
+    return count;
+}
+
+RoaringBitmap::Container RoaringBitmap::intersect(const Container& a, const Container& b) {
+    Container out;
+    out.key = a.key;
+    if (!a.isBitset() && !b.isBitset()) {
+        set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+                         back_inserter(out.values));
+        out.cardinality = (uint32_t)out.values.size();
+    } else if (!a.isBitset() || !b.isBitset()) {
+        const Container& small = a.isBitset() ? b : a;
+        const Container& large = a.isBitset() ? a : b;
+        for (uint16_t v : small.values) {
+            if (large.contains(v)) out.values.push_back(v);
+        }
+        out.cardinality = (uint32_t)out.values.size();
+    } else {
+        out.bits.resize(BITSET_WORDS);
+        for (size_t w = 0; w < BITSET_WORDS; w++) out.bits[w] = a.bits[w] & b.bits[w];
+        out.cardinality = popcount(out.bits);
+        out.normalize();
+    }
+    return out;
+}
+
+RoaringBitmap::Container RoaringBitmap::unite(const Container& a, const Container& b) {
+    Container out;
+    out.key = a.key;
+    if (!a.isBitset() && !b.isBitset() && a.cardinality + b.cardinality <= ARRAY_LIMIT) {
+        set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+                  back_inserter(out.values));
+        out.cardinality = (uint32_t)out.values.size();
+        return out;
+    }
+    out.bits = a.asBits();
+    if (b.isBitset()) {
+        for (size_t w = 0; w < BITSET_WORDS; w++) out.bits[w] |= b.bits[w];
+    } else {
+        for (uint16_t v : b.values) out.bits[v >> 6] |= 1ULL << (v & 63);
+    }
+    out.cardinality = popcount(out.bits);
+    out.normalize();
+    return out;
+}
+
+RoaringBitmap::Container RoaringBitmap::subtract(const Container& a, const Container& b) {
+    Container out;
+    out.key = a.key;
+    if (!a.isBitset()) {
+        for (uint16_t v : a.values) {
+            if (!b.contains(v)) out.values.push_back(v);
+        }
+        out.cardinality = (uint32_t)out.values.size();
+        return out;
+    }
+    out.bits = a.bits;
+    if (b.isBitset()) {
+        for (size_t w = 0; w < BITSET_WORDS; w++) out.bits[w] &= ~b.bits[w];
+    } else {
+        for (uint16_t v : b.values) out.bits[v >> 6] &= ~(1ULL << (v & 63));
+    }
+    out.cardinality = popcount(out.bits);
+    out.normalize();
+    return out;
+}
+
+void RoaringBitmap::add(uint32_t value) {
+    uint16_t key = (uint16_t)(value >> 16);
+    if (containers.empty() || containers.back().key < key) {
+        containers.emplace_back();
+        containers.back().key = key;
+        containers.back().add((uint16_t)value);
+        return;
+    }
+    auto it = lower_bound(containers.begin(), containers.end(), key,
+                          [](const Container& c, uint16_t k) { return c.key < k; });
+    if (it == containers.end() || it->key != key) {
+        it = containers.insert(it, Container());
+        it->key = key;
+    }
+    it->add((uint16_t)value);
+}
+
+bool RoaringBitmap::contains(uint32_t value) const {
+    uint16_t key = (uint16_t)(value >> 16);
+    auto it = lower_bound(containers.begin(), containers.end(), key,
+                          [](const Container& c, uint16_t k) { return c.key < k; });
+    return it != containers.end() && it->key == key && it->contains((uint16_t)value);
+}
+
+uint64_t RoaringBitmap::cardinality() const {
+    uint64_t total = 0;
+    for (const auto& c : containers) total += c.cardinality;
+    return total;
+}
+
+vector<uint32_t> RoaringBitmap::toVector() const {
+    vector<uint32_t> result;
+    result.reserve(cardinality());
+    for (const auto& c : containers) {
+        uint32_t high = (uint32_t)c.key << 16;
+        if (c.isBitset()) {
+            for (size_t w = 0; w < BITSET_WORDS; w++) {
+                for (uint64_t word = c.bits[w]; word != 0; word &= word - 1) {
+                    result.push_back(high | (uint32_t)(w * 64 + __builtin_ctzll(word)));
+                }
+            }
+        } else {
+            for (uint16_t v : c.values) result.push_back(high | v);
+        }
+    }
+    return result;
+}
+
+size_t RoaringBitmap::memoryBytes() const {
+    size_t bytes = containers.capacity() * sizeof(Container);
+    for (const auto& c : containers) {
+        bytes += c.values.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+RoaringBitmap RoaringBitmap::intersectionOf(const RoaringBitmap& a, const RoaringBitmap& b) {
+    RoaringBitmap out;
+    size_t i = 0, j = 0;
+    while (i < a.containers.size() && j < b.containers.size()) {
+        if (a.containers[i].key < b.containers[j].key) i++;
+        else if (a.containers[i].key > b.containers[j].key) j++;
+        else {
+            Container c = intersect(a.containers[i++], b.containers[j++]);
+            if (c.cardinality > 0) out.containers.push_back(move(c));
+        }
+    }
+    return out;
+}
+
+RoaringBitmap RoaringBitmap::unionOf(const RoaringBitmap& a, const RoaringBitmap& b) {
+    RoaringBitmap out;
+    size_t i = 0, j = 0;
+    while (i < a.containers.size() || j < b.containers.size()) {
+        if (j == b.containers.size() || (i < a.containers.size() && a.containers[i].key < b.containers[j].key)) {
+            out.containers.push_back(a.containers[i++]);
+        } else if (i == a.containers.size() || b.containers[j].key < a.containers[i].key) {
+            out.containers.push_back(b.containers[j++]);
+        } else {
+            out.containers.push_back(unite(a.containers[i++], b.containers[j++]));
+        }
+    }
+    return out;
+}
+
+RoaringBitmap RoaringBitmap::differenceOf(const RoaringBitmap& a, const RoaringBitmap& b) {
+    RoaringBitmap out;
+    size_t j = 0;
+    for (const auto& c : a.containers) {
+        while (j < b.containers.size() && b.containers[j].key < c.key) j++;
+        if (j < b.containers.size() && b.containers[j].key == c.key) {
+            Container d = subtract(c, b.containers[j]);
+            if (d.cardinality > 0) out.containers.push_back(move(d));
+        } else {
+            out.containers.push_back(c);
+        }
+    }
+    return out;
+}
+
+// ============================================================================
+// EXPENSE QUERY ENGINE
+// ============================================================================
+
+bool ExpenseQuery::hasAmountFilter() const {
+    return minAmount > 0.0 || maxAmount < numeric_limits<double>::max();
+}
+
+bool ExpenseQuery::hasTimeFilter() const {
+    return fromTime > 0 || toTime < numeric_limits<long long>::max();
+}
+
+vector<string> ExpenseQuery::tokenize(const string& text) {
+    vector<string> tokens;
+    string current;
+    bool inQuotes = false;
+    for (char c : text) {
+        if (c == '"') {
+            inQuotes = !inQuotes;
+        } else if (isspace((unsigned char)c) && !inQuotes) {
+            if (!current.empty()) tokens.push_back(current);
+            current.clear();
+        } else {
+            current += c;
+        }
+    }
+    if (!current.empty()) tokens.push_back(current);
+    return tokens;
+}
+
+bool ExpenseQuery::parse(const string& text, ExpenseQuery& query, string& error) {
+    query = ExpenseQuery();
+    for (const string& token : tokenize(text)) {
+        size_t opPos = token.find_first_of("=<>~");
+        if (opPos == string::npos || opPos == 0) {
+            error = "Cannot understand '" + token + "'";
+            return false;
+        }
+        string key = Utils::toLower(token.substr(0, opPos));
+        string op(1, token[opPos]);
+        if (opPos + 1 < token.size() && token[opPos + 1] == '=' && op != "=") {
+            op += "=";
+        }
+        string value = token.substr(opPos + op.size());
+        if (value.empty()) {
+            error = "Missing value for '" + key + "'";
+            return false;
+        }
+
+        try {
+            if (key == "payer" && op == "=") {
+                query.payerId = stoi(value);
+            }
+            else if ((key == "participant" || key == "with") && op == "=") {
+                for (const string& id : Utils::split(value, ',')) query.participantIds.push_back(stoi(id));
+            }
+            else if (key == "anyof" && op == "=") {
+                for (const string& id : Utils::split(value, ',')) query.anyParticipantIds.push_back(stoi(id));
+            }
+            else if (key == "without" && op == "=") {
+                for (const string& id : Utils::split(value, ',')) query.excludedParticipantIds.push_back(stoi(id));
+            }
+            else if (key == "amount") {
+                double amount = stod(value);
+                if (op == ">")       query.minAmount = max(query.minAmount, nextafter(amount, numeric_limits<double>::max()));
+                else if (op == ">=") query.minAmount = max(query.minAmount, amount);
+                else if (op == "<")  query.maxAmount = min(query.maxAmount, nextafter(amount, 0.0));
+                else if (op == "<=") query.maxAmount = min(query.maxAmount, amount);
+                else if (op == "=")  { query.minAmount = amount; query.maxAmount = amount; }
+                else { error = "Unsupported operator for amount"; return false; }
+            }
+            else if ((key == "from" || key == "to") && op == "=") {
+                long long day = Utils::dateTimeKey(value);
+                if (day < 0) { error = "Bad date '" + value + "'"; return false; }
+                if (key == "from") query.fromTime = max(query.fromTime, day);
+                else               query.toTime = min(query.toTime, day + 235959);
+            }
+            else if (key == "month" && op == "=") {
+                long long first = Utils::dateTimeKey(value + "-01");
+                if (first < 0) { error = "Bad month '" + value + "'"; return false; }
+                query.fromTime = max(query.fromTime, first);
+                query.toTime = min(query.toTime, first + 30000000LL + 235959);  // through day 31
+            }
+            else if (key == "quarter" && op == "=") {
+                // e.g. 2024-Q2 covers April through June
+                int year = 0, quarter = 0;
+                if (sscanf(value.c_str(), "%d-%*[Qq]%d", &year, &quarter) != 2 || quarter < 1 || quarter > 4) {
+                    error = "Bad quarter '" + value + "' (use YYYY-QN)";
+                    return false;
+                }
+                long long firstMonth = year * 100LL + (quarter - 1) * 3 + 1;
+                query.fromTime = max(query.fromTime, (firstMonth * 100 + 1) * 1000000LL);
+                query.toTime = min(query.toTime, ((firstMonth + 2) * 100 + 31) * 1000000LL + 235959);
+            }
+            else if (key == "method" && op == "=") {
+                string upper = value;
+                for (char& c : upper) c = (char)toupper((unsigned char)c);
+                if (upper != "EQUAL" && upper != "EXACT" && upper != "PERCENTAGE") {
+                    error = "Unknown split method '" + value + "'";
+                    return false;
+                }
+                query.hasMethod = true;
+                query.method = stringToSplitMethod(upper);
+            }
+            else if ((key == "desc" || key == "description") && op == "=") {
+                query.descriptionEquals = Utils::toLower(value);
+            }
+            else if ((key == "desc" || key == "description") && op == "~") {
+                query.descriptionContains = Utils::toLower(value);
+            }
+            else {
+                error = "Unsupported filter '" + token + "'";
+                return false;
+            }
+        } catch (const exception&) {
+            error = "Bad number in '" + token + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+const ExpenseIndex::PostingList& ExpenseIndex::emptyList() {
+    static const PostingList empty;
+    return empty;
+}
+
+const RoaringBitmap& ExpenseIndex::bitmapFor(int userId) const {
+    static const RoaringBitmap empty;
+    auto it = byParticipant.find(userId);
+    return it == byParticipant.end() ? empty : it->second;
+}
+
+const ExpenseIndex::PostingList& ExpenseIndex::lookup(const TrackedHashMap<int, PostingList, MemoryCategory::INDEXES>& index, int key) {
+    auto it = index.find(key);
+    return it == index.end() ? emptyList() : it->second;
+}
+
+void ExpenseIndex::clear() {
+    payerColumn.clear();
+    amountColumn.clear();
+    timeColumn.clear();
+    methodColumn.clear();
+    descriptionColumn.clear();
+    loweredDescriptions.clear();
+    descriptionLimit = 0;
+    byPayer.clear();
+    byParticipant.clear();
+    deleted = RoaringBitmap();
+    timeSorted = true;
+}
+
+void ExpenseIndex::add(uint32_t ordinal, const Expense& expense) {
+    long long time = expense.getCreatedAtKey();
+    if (!timeColumn.empty() && time < timeColumn.back()) {
+        timeSorted = false;
+    }
+    payerColumn.push_back(expense.getCreatedBy());
+    amountColumn.push_back(expense.getAmount());
+    timeColumn.push_back(time);
+    methodColumn.push_back((uint8_t)expense.getSplitMethod());
+    uint32_t description = expense.getDescriptionId();
+    descriptionColumn.push_back(description);
+    if (loweredDescriptions.find(description) == loweredDescriptions.end()) {
+        loweredDescriptions.emplace(description, Utils::toLower(expense.getDescription()));
+        descriptionLimit = max(descriptionLimit, description + 1);
+    }
+
+    byPayer[expense.getCreatedBy()].push_back(ordinal);
+    for (const auto& participant : expense.getParticipants()) {
+        byParticipant[participant.getUserId()].add(ordinal);
+    }
+}
+
+vector<uint32_t> ExpenseIndex::run(const ExpenseQuery& query, string* plan) const {
+    // 1. Pick the access path. Participant constraints become bitmap
+    // algebra: AND over required users, OR over "any of" users, then
+    // AND NOT over excluded users.
+    bool hasMembership = !query.participantIds.empty() || !query.anyParticipantIds.empty();
+    // Deleted rows are always excluded; the union with excluded users is
+    // only built when the query names some
+    RoaringBitmap deletedOrExcluded;
+    if (!query.excludedParticipantIds.empty()) {
+        deletedOrExcluded = deleted;
+        for (int userId : query.excludedParticipantIds) {
+            deletedOrExcluded = RoaringBitmap::unionOf(deletedOrExcluded, bitmapFor(userId));
+        }
+    }
+    const RoaringBitmap& excluded = query.excludedParticipantIds.empty() ? deleted : deletedOrExcluded;
+
+    vector<uint32_t> candidates;
+    bool useRange = query.payerId == 0 && !hasMembership;
+    size_t rangeBegin = 0, rangeEnd = size();
+    string access;
+
+    if (hasMembership) {
+        vector<const RoaringBitmap*> required;
+        for (int userId : query.participantIds) required.push_back(&bitmapFor(userId));
+        sort(required.begin(), required.end(), [](const RoaringBitmap* a, const RoaringBitmap* b) {
+            return a->cardinality() < b->cardinality();
+        });
+
+        RoaringBitmap members;
+        if (!required.empty()) {
+            members = *required[0];
+            for (size_t i = 1; i < required.size() && !members.empty(); i++) {
+                members = RoaringBitmap::intersectionOf(members, *required[i]);
+            }
+        }
+        if (!query.anyParticipantIds.empty()) {
+            RoaringBitmap anyOf;
+            for (int userId : query.anyParticipantIds) {
+                anyOf = RoaringBitmap::unionOf(anyOf, bitmapFor(userId));
+            }
+            members = required.empty() ? anyOf : RoaringBitmap::intersectionOf(members, anyOf);
+        }
+        if (!excluded.empty()) {
+            members = RoaringBitmap::differenceOf(members, excluded);
+        }
+
+        if (query.payerId != 0) {
+            for (uint32_t ordinal : lookup(byPayer, query.payerId)) {
+                if (members.contains(ordinal)) candidates.push_back(ordinal);
+            }
+        } else {
+            candidates = members.toVector();
+        }
+        access = "bitmap index (" + to_string(query.participantIds.size()) + " AND, "
+               + to_string(query.anyParticipantIds.size()) + " OR, "
+               + to_string(query.excludedParticipantIds.size()) + " ANDNOT"
+               + (query.payerId != 0 ? ", payer postings" : "") + ", "
+               + to_string(candidates.size()) + " candidates)";
+    }
+    else if (query.payerId != 0) {
+        const PostingList& postings = lookup(byPayer, query.payerId);
+        candidates.assign(postings.begin(), postings.end());
+        access = "payer index (" + to_string(candidates.size()) + " candidates)";
+    }
+    else if (query.hasTimeFilter() && timeSorted) {
+        rangeBegin = lower_bound(timeColumn.begin(), timeColumn.end(), query.fromTime) - timeColumn.begin();
+        rangeEnd = upper_bound(timeColumn.begin(), timeColumn.end(), query.toTime) - timeColumn.begin();
+        if (rangeEnd < rangeBegin) rangeEnd = rangeBegin;
+        access = "time range scan (" + to_string(rangeEnd - rangeBegin) + " candidates)";
+    }
+    else {
+        access = "full scan (" + to_string(size()) + " rows)";
+    }
+
+    // 2. Residual predicates, evaluated a batch at a time
+    bool checkExcluded = !excluded.empty() && !hasMembership;
+    bool checkAmount = query.hasAmountFilter();
+    bool checkTime = query.hasTimeFilter();
+    bool checkMethod = query.hasMethod;
+    bool checkDescription = !query.descriptionEquals.empty() || !query.descriptionContains.empty();
+    uint8_t method = (uint8_t)query.method;
+
+    // Description filters are resolved once per distinct description;
+    // rows are then matched by handle.
+    vector<bool> descriptionMatches;
+    if (checkDescription) {
+        descriptionMatches.assign(descriptionLimit, false);
+        for (const auto& [id, text] : loweredDescriptions) {
+            bool match = (query.descriptionEquals.empty() || text == query.descriptionEquals) &&
+                         (query.descriptionContains.empty() || text.find(query.descriptionContains) != string::npos);
+            descriptionMatches[id] = match;
+        }
+    }
+
+    vector<uint32_t> results;
+    uint32_t selection[BATCH_SIZE];
+    size_t total = useRange ? rangeEnd - rangeBegin : candidates.size();
+
+    for (size_t start = 0; start < total; start += BATCH_SIZE) {
+        size_t count = min(BATCH_SIZE, total - start);
+        for (size_t i = 0; i < count; i++) {
+            selection[i] = useRange ? (uint32_t)(rangeBegin + start + i) : candidates[start + i];
+        }
+
+        // Each pass compacts the selection vector without branching on the result
+        if (checkExcluded) {
+            size_t kept = 0;
+            for (size_t i = 0; i < count; i++) {
+                selection[kept] = selection[i];
+                kept += !excluded.contains(selection[i]);
+            }
+            count = kept;
+        }
+        if (checkAmount) {
+            size_t kept = 0;
+            for (size_t i = 0; i < count; i++) {
+                double amount = amountColumn[selection[i]];
+                selection[kept] = selection[i];
+                kept += (amount >= query.minAmount) & (amount <= query.maxAmount);
+            }
+            count = kept;
+        }
+        if (checkTime) {
+            size_t kept = 0;
+            for (size_t i = 0; i < count; i++) {
+                long long time = timeColumn[selection[i]];
+                selection[kept] = selection[i];
+                kept += (time >= query.fromTime) & (time <= query.toTime);
+            }
+            count = kept;
+        }
+        if (checkMethod) {
+            size_t kept = 0;
+            for (size_t i = 0; i < count; i++) {
+                selection[kept] = selection[i];
+                kept += methodColumn[selection[i]] == method;
+            }
+            count = kept;
+        }
+
+        if (checkDescription) {
+            size_t kept = 0;
+            for (size_t i = 0; i < count; i++) {
+                uint32_t id = descriptionColumn[selection[i]];
+                selection[kept] = selection[i];
+                kept += id < descriptionMatches.size() && descriptionMatches[id];
+            }
+            count = kept;
+        }
+
+        results.insert(results.end(), selection, selection + count);
+    }
+
+    if (plan != nullptr) {
+        vector<string> residual;
+        if (checkExcluded) residual.push_back("excluded");
+        if (checkAmount) residual.push_back("amount");
+        if (checkTime) residual.push_back("time");
+        if (checkMethod) residual.push_back("method");
+        if (checkDescription) residual.push_back("description");
+        *plan = access;
+        if (!residual.empty()) {
+            *plan += "; filter:";
+            for (const auto& name : residual) *plan += " " + name;
+        }
+    }
+    return results;
+}
+
+// ============================================================================
+// ROLLUP TABLES
+// ============================================================================
+
+int monthKeyOf(long long dateTimeKey) {
+    return (int)(dateTimeKey / 100000000LL);
+}
+
+void UserMonthTotals::merge(const UserMonthTotals& other) {
+    paid += other.paid;
+    spent += other.spent;
+    expenseCount += other.expenseCount;
+}
+
+void PairFlow::merge(const PairFlow& other) {
+    firstPaidForSecond += other.firstPaidForSecond;
+    secondPaidForFirst += other.secondPaidForFirst;
+}
+
+PairFlow PairFlow::swapped() const {
+    PairFlow flow;
+    flow.firstPaidForSecond = secondPaidForFirst;
+    flow.secondPaidForFirst = firstPaidForSecond;
+    return flow;
+}
+
+uint64_t RollupTables::userMonthKey(int userId, int month) {
+    return ((uint64_t)(uint32_t)userId << 32) | (uint32_t)month;
+}
+
+void RollupTables::clear() {
+    byUserMonth.clear();
+    byPairMonth.clear();
+}
+
+void RollupTables::add(const Expense& expense, int sign) {
+    int month = monthKeyOf(expense.getCreatedAtKey());
+    int payer = expense.getCreatedBy();
+
+    UserMonthTotals& payerTotals = byUserMonth[userMonthKey(payer, month)];
+    payerTotals.paid += sign * expense.getAmount();
+
+    bool payerTookPart = false;
+    for (const auto& participant : expense.getParticipants()) {
+        int userId = participant.getUserId();
+        double share = sign * participant.getShare();
+
+        UserMonthTotals& totals = byUserMonth[userMonthKey(userId, month)];
+        totals.spent += share;
+        totals.expenseCount += sign;
+        if (userId == payer) {
+            payerTookPart = true;
+            continue;
+        }
+
+        PairMonthKey key{min(payer, userId), max(payer, userId), month};
+        PairFlow& flow = byPairMonth[key];
+        if (payer == key.first) flow.firstPaidForSecond += share;
+        else                    flow.secondPaidForFirst += share;
+    }
+    if (!payerTookPart) {
+        payerTotals.expenseCount += sign;
+    }
+}
+
+void RollupTables::merge(const RollupTables& other) {
+    for (const auto& [key, totals] : other.byUserMonth) {
+        byUserMonth[key].merge(totals);
+    }
+    for (const auto& [key, flow] : other.byPairMonth) {
+        byPairMonth[key].merge(flow);
+    }
+}
+
+UserMonthTotals RollupTables::userMonth(int userId, int month) const {
+    auto it = byUserMonth.find(userMonthKey(userId, month));
+    return it == byUserMonth.end() ? UserMonthTotals() : it->second;
+}
+
+PairFlow RollupTables::pairMonth(int userA, int userB, int month) const {
+    auto it = byPairMonth.find(PairMonthKey{min(userA, userB), max(userA, userB), month});
+    if (it == byPairMonth.end()) return PairFlow();
+    return userA <= userB ? it->second : it->second.swapped();
+}
+
+RollupTables RollupTables::build(const ExpenseList& expenses) {
+    size_t workers = TaskScheduler::global().workerCount();
+    workers = min(workers, max((size_t)1, expenses.size() / 4096));
+
+    vector<RollupTables> partials(workers);
+    size_t chunk = (expenses.size() + workers - 1) / workers;
+    TaskScheduler::global().parallelFor(0, workers, 1, [&](size_t w, size_t) {
+        size_t begin = w * chunk;
+        size_t end = min(expenses.size(), begin + chunk);
+        for (size_t i = begin; i < end; i++) {
+            partials[w].add(expenses[i]);
+        }
+    });
+
+    RollupTables result = move(partials[0]);
+    for (size_t w = 1; w < workers; w++) {
+        result.merge(partials[w]);
+    }
+    return result;
+}
+
+// ============================================================================
+// BALANCE LEDGER
+// ============================================================================
+
+void BalanceLedger::setNet(int userId, double value) {
+    auto it = netBalance.find(userId);
+    if (it != netBalance.end()) {
+        ranking.erase({it->second, userId});
+    }
+    if (abs(value) < EPSILON) {
+        if (it != netBalance.end()) netBalance.erase(it);
+        return;
+    }
+    netBalance[userId] = value;
+    ranking.insert({value, userId});
+}
+
+void BalanceLedger::clear() {
+    owedTo.clear();
+    netBalance.clear();
+    ranking.clear();
+}
+
+void BalanceLedger::apply(int payerId, int participantId, double share) {
+    if (payerId == participantId || share == 0.0) return;
+    credit(payerId, participantId, share);
+    credit(participantId, payerId, -share);
+}
+
+void BalanceLedger::credit(int userId, int counterpartyId, double amount) {
+    owedTo[userId][counterpartyId] += amount;
+    setNet(userId, net(userId) + amount);
+}
+
+void BalanceLedger::apply(const Expense& expense) {
+    for (const auto& participant : expense.getParticipants()) {
+        apply(expense.getCreatedBy(), participant.getUserId(), participant.getShare());
+    }
+}
+
+void BalanceLedger::revert(const Expense& expense) {
+    for (const auto& participant : expense.getParticipants()) {
+        apply(expense.getCreatedBy(), participant.getUserId(), -participant.getShare());
+    }
+}
+
+double BalanceLedger::net(int userId) const {
+    auto it = netBalance.find(userId);
+    return it == netBalance.end() ? 0.0 : it->second;
+}
+
+vector<BalanceLedger::Entry> BalanceLedger::balancesFor(int userId) const {
+    vector<Entry> result;
+    auto it = owedTo.find(userId);
+    if (it == owedTo.end()) return result;
+    for (const auto& [otherId, amount] : it->second) {
+        result.push_back({userId, otherId, amount});
+    }
+    sort(result.begin(), result.end(),
+         [](const Entry& a, const Entry& b) { return a.counterpartyId < b.counterpartyId; });
+    return result;
+}
+
+vector<BalanceLedger::Entry> BalanceLedger::topDebtors(size_t k) const {
+    vector<Entry> result;
+    for (auto it = ranking.begin(); it != ranking.end() && result.size() < k && it->first < 0; ++it) {
+        result.push_back({it->second, 0, it->first});
+    }
+    return result;
+}
+
+vector<BalanceLedger::Entry> BalanceLedger::topCreditors(size_t k) const {
+    vector<Entry> result;
+    for (auto it = ranking.rbegin(); it != ranking.rend() && result.size() < k && it->first > 0; ++it) {
+        result.push_back({it->second, 0, it->first});
+    }
+    return result;
+}
+
+vector<BalanceLedger::Entry> BalanceLedger::allDebts() const {
+    vector<Entry> result;
+    for (const auto& [creditorId, row] : owedTo) {
+        for (const auto& [debtorId, amount] : row) {
+            if (amount > EPSILON) {
+                result.push_back({debtorId, creditorId, amount});
+            }
+        }
+    }
+    return result;
+}
+
+vector<BalanceLedger::Entry> BalanceLedger::topPairs(size_t k) const {
+    auto smaller = [](const Entry& a, const Entry& b) { return a.amount > b.amount; };
+    vector<Entry> heap;
+    if (k == 0) return heap;
+    heap.reserve(k + 1);
+    for (const auto& [creditorId, row] : owedTo) {
+        for (const auto& [debtorId, amount] : row) {
+            // Each pair appears twice; keep the side where the amount is owed to creditorId
+            if (amount <= EPSILON) continue;
+            if (heap.size() < k) {
+                heap.push_back({debtorId, creditorId, amount});
+                push_heap(heap.begin(), heap.end(), smaller);
+            } else if (amount > heap.front().amount) {
+                pop_heap(heap.begin(), heap.end(), smaller);
+                heap.back() = {debtorId, creditorId, amount};
+                push_heap(heap.begin(), heap.end(), smaller);
+            }
+        }
+    }
+    sort_heap(heap.begin(), heap.end(), smaller);
+    return heap;
+}
+
+// ============================================================================
+// DEBT GRAPH ANALYTICS
+// ============================================================================
+
+vector<DebtGraph::Component> DebtGraph::analyze(const vector<BalanceLedger::Entry>& debts) {
+    // 1. Dense node numbering
+    unordered_map<int, int> nodeOf;
+    vector<int> userOf;
+    auto node = [&](int userId) {
+        auto [it, inserted] = nodeOf.emplace(userId, (int)userOf.size());
+        if (inserted) userOf.push_back(userId);
+        return it->second;
+    };
+    vector<pair<int, int>> endpoints;
+    endpoints.reserve(debts.size());
+    for (const auto& debt : debts) {
+        endpoints.push_back({node(debt.userId), node(debt.counterpartyId)});
+    }
+
+    // 2. Union-find with path halving and union by size
+    vector<int> parent(userOf.size()), size(userOf.size(), 1);
+    for (size_t i = 0; i < parent.size(); i++) parent[i] = (int)i;
+    auto find = [&](int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+    for (const auto& [a, b] : endpoints) {
+        int rootA = find(a), rootB = find(b);
+        if (rootA == rootB) continue;
+        if (size[rootA] < size[rootB]) swap(rootA, rootB);
+        parent[rootB] = rootA;
+        size[rootA] += size[rootB];
+    }
+
+    // 3. Bucket nodes and edges by component
+    unordered_map<int, int> componentOfRoot;
+    vector<vector<int>> componentNodes;
+    vector<vector<size_t>> componentEdges;
+    for (size_t n = 0; n < userOf.size(); n++) {
+        int root = find((int)n);
+        auto [it, inserted] = componentOfRoot.emplace(root, (int)componentNodes.size());
+        if (inserted) {
+            componentNodes.emplace_back();
+            componentEdges.emplace_back();
+        }
+        componentNodes[it->second].push_back((int)n);
+    }
+    for (size_t e = 0; e < endpoints.size(); e++) {
+        componentEdges[componentOfRoot[find(endpoints[e].first)]].push_back(e);
+    }
+
+    // 4. Cycle cancellation and settlement, one component per task.
+    // Runs at interactive priority since it answers a menu request.
+    vector<Component> components(componentNodes.size());
+    TaskScheduler::global().parallelFor(0, components.size(), 1, [&](size_t first, size_t last) {
+        for (size_t c = first; c < last; c++) {
+            components[c] = solveComponent(componentNodes[c], componentEdges[c], debts, userOf);
+        }
+    }, TaskPriority::INTERACTIVE);
+
+    sort(components.begin(), components.end(), [](const Component& a, const Component& b) {
+        return a.userIds.size() > b.userIds.size();
+    });
+    return components;
+}
+
+DebtGraph::Component DebtGraph::solveComponent(const vector<int>& nodes, const vector<size_t>& edgeIds,
+                                const vector<BalanceLedger::Entry>& debts, const vector<int>& userOf) {
+    Component component;
+    for (int n : nodes) {
+        component.userIds.push_back(userOf[n]);
+    }
+
+    unordered_map<int, int> localOfUser;
+    for (size_t i = 0; i < component.userIds.size(); i++) {
+        localOfUser[component.userIds[i]] = (int)i;
+    }
+
+    vector<Edge> edges;
+    edges.reserve(edgeIds.size());
+    for (size_t e : edgeIds) {
+        const auto& debt = debts[e];
+        edges.push_back({localOfUser[debt.userId], localOfUser[debt.counterpartyId], debt.amount, true});
+    }
+    component.edgesBefore = edges.size();
+
+    cancelCycles((int)component.userIds.size(), edges, component);
+
+    vector<double> net(component.userIds.size(), 0.0);
+    for (const auto& edge : edges) {
+        if (!edge.alive) continue;
+        component.remainingDebts.push_back({component.userIds[edge.from], component.userIds[edge.to], edge.amount});
+        net[edge.from] -= edge.amount;
+        net[edge.to] += edge.amount;
+    }
+    component.edgesAfterCancellation = component.remainingDebts.size();
+    component.settlement = settle(net, component.userIds);
+    return component;
+}
+
+void DebtGraph::cancelCycles(int nodeCount, vector<Edge>& edges, Component& component) {
+    vector<vector<int>> outgoing(nodeCount);
+    for (size_t e = 0; e < edges.size(); e++) {
+        outgoing[edges[e].from].push_back((int)e);
+    }
+
+    enum : uint8_t { WHITE, GRAY, BLACK };
+    vector<uint8_t> color(nodeCount, WHITE);
+    vector<size_t> nextEdge(nodeCount, 0);
+    vector<int> positionOnStack(nodeCount, -1);
+    vector<int> stack, via;   // via[i] = edge used to reach stack[i]
+
+    for (int root = 0; root < nodeCount; root++) {
+        if (color[root] != WHITE) continue;
+        stack.assign(1, root);
+        via.assign(1, -1);
+        color[root] = GRAY;
+        positionOnStack[root] = 0;
+
+        while (!stack.empty()) {
+            int u = stack.back();
+            if (nextEdge[u] == outgoing[u].size()) {
+                color[u] = BLACK;
+                positionOnStack[u] = -1;
+                stack.pop_back();
+                via.pop_back();
+                if (!stack.empty()) nextEdge[stack.back()]++;
+                continue;
+            }
+
+            int e = outgoing[u][nextEdge[u]];
+            int v = edges[e].to;
+            if (!edges[e].alive || color[v] == BLACK) {
+                nextEdge[u]++;
+                continue;
+            }
+            if (color[v] == WHITE) {
+                color[v] = GRAY;
+                positionOnStack[v] = (int)stack.size();
+                stack.push_back(v);
+                via.push_back(e);
+                continue;
+            }
+
+            // Back edge to v closes a cycle: via[pos(v)+1 .. top] then e
+            vector<int> cycle(via.begin() + positionOnStack[v] + 1, via.end());
+            cycle.push_back(e);
+            double smallest = numeric_limits<double>::max();
+            for (int c : cycle) smallest = min(smallest, edges[c].amount);
+
+            int firstDead = -1;
+            for (int c : cycle) {
+                edges[c].amount -= smallest;
+                if (edges[c].amount < EPSILON) {
+                    edges[c].alive = false;
+                    if (firstDead < 0) firstDead = c;
+                }
+            }
+            component.cyclesCancelled++;
+            component.amountCancelled += smallest * cycle.size();
+
+            // Unwind so the tail of the first dead edge is on top again
+            int resumeAt = positionOnStack[edges[firstDead].from];
+            while ((int)stack.size() > resumeAt + 1) {
+                color[stack.back()] = WHITE;
+                positionOnStack[stack.back()] = -1;
+                stack.pop_back();
+                via.pop_back();
+            }
+        }
+    }
+}
+
+vector<DebtGraph::Transfer> DebtGraph::settle(const vector<double>& net, const vector<int>& userIds) {
+    priority_queue<pair<double, int>> creditors, debtors;
+    for (size_t i = 0; i < net.size(); i++) {
+        if (net[i] > EPSILON) creditors.push({net[i], (int)i});
+        else if (net[i] < -EPSILON) debtors.push({-net[i], (int)i});
+    }
+
+    vector<Transfer> transfers;
+    while (!creditors.empty() && !debtors.empty()) {
+        auto [credit, creditor] = creditors.top();
+        auto [debt, debtor] = debtors.top();
+        creditors.pop();
+        debtors.pop();
+
+        double amount = min(credit, debt);
+        transfers.push_back({userIds[debtor], userIds[creditor], amount});
+        if (credit - amount > EPSILON) creditors.push({credit - amount, creditor});
+        if (debt - amount > EPSILON) debtors.push({debt - amount, debtor});
+    }
+    return transfers;
+}
+
+// ============================================================================
+// APPROXIMATE ANALYTICS (SKETCHES)
+// ============================================================================
+
+void HyperLogLog::add(uint64_t hash) {
+    size_t index = hash >> (64 - PRECISION);
+    uint64_t rest = hash << PRECISION;
+    uint8_t rank = rest == 0 ? (uint8_t)(64 - PRECISION + 1) : (uint8_t)(__builtin_clzll(rest) + 1);
+    if (rank > registers[index]) registers[index] = rank;
+}
+
+void HyperLogLog::merge(const HyperLogLog& other) {
+    for (size_t i = 0; i < REGISTERS; i++) {
+        registers[i] = max(registers[i], other.registers[i]);
+    }
+}
+
+double HyperLogLog::estimate() const {
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (uint8_t r : registers) {
+        sum += ldexp(1.0, -r);
+        if (r == 0) zeros++;
+    }
+    double m = (double)REGISTERS;
+    double raw = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    // Linear counting is more accurate while many registers are still empty
+    if (raw <= 2.5 * m && zeros > 0) {
+        return m * log(m / (double)zeros);
+    }
+    return raw;
+}
+
+size_t CountMinSketch::column(uint64_t key, size_t row) {
+    return (size_t)(Utils::hash64(key + row * 0x9E3779B97F4A7C15ULL) & (WIDTH - 1));
+}
+
+void CountMinSketch::add(uint64_t key, uint32_t count) {
+    for (size_t row = 0; row < DEPTH; row++) {
+        counters[row * WIDTH + column(key, row)] += count;
+    }
+    total += count;
+}
+
+uint32_t CountMinSketch::estimate(uint64_t key) const {
+    uint32_t result = numeric_limits<uint32_t>::max();
+    for (size_t row = 0; row < DEPTH; row++) {
+        result = min(result, counters[row * WIDTH + column(key, row)]);
+    }
+    return result;
+}
+
+void CountMinSketch::merge(const CountMinSketch& other) {
+    for (size_t i = 0; i < counters.size(); i++) {
+        counters[i] += other.counters[i];
+    }
+    total += other.total;
+}
+
+uint64_t ExpenseSketches::pairKey(int a, int b) {
+    return ((uint64_t)(uint32_t)min(a, b) << 32) | (uint32_t)max(a, b);
+}
+
+void ExpenseSketches::offerCandidate(uint64_t key) {
+    uint32_t count = pairCounts.estimate(key);
+    auto it = candidates.find(key);
+    if (it != candidates.end()) {
+        it->second = count;
+        return;
+    }
+    if (candidates.size() < MAX_CANDIDATES) {
+        candidates[key] = count;
+        return;
+    }
+    auto smallest = min_element(candidates.begin(), candidates.end(),
+                                [](const auto& a, const auto& b) { return a.second < b.second; });
+    if (count > smallest->second) {
+        candidates.erase(smallest);
+        candidates[key] = count;
+    }
+}
+
+HyperLogLog& ExpenseSketches::partnerSketch(int userId) {
+    PartnerSketch& entry = partners[userId];
+    entry.lastUsed = ++clock;
+    return entry.distinct;
+}
+
+void ExpenseSketches::trimPartners() {
+    if (partners.size() <= MAX_PARTNER_SKETCHES) return;
+    size_t keep = MAX_PARTNER_SKETCHES - MAX_PARTNER_SKETCHES / 8;
+    vector<uint64_t> stamps;
+    stamps.reserve(partners.size());
+    for (const auto& [userId, entry] : partners) stamps.push_back(entry.lastUsed);
+    auto cutoff = stamps.begin() + (stamps.size() - keep);
+    nth_element(stamps.begin(), cutoff, stamps.end());
+    uint64_t oldestKept = *cutoff;
+    for (auto it = partners.begin(); it != partners.end();) {
+        if (it->second.lastUsed < oldestKept) {
+            it = partners.erase(it);
+            evicted++;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ExpenseSketches::clear() {
+    partners.clear();
+    clock = 0;
+    evicted = 0;
+    pairCounts = CountMinSketch();
+    candidates.clear();
+}
+
+void ExpenseSketches::add(const Expense& expense) {
+    vector<int> people;
+    for (const auto& participant : expense.getParticipants()) {
+        people.push_back(participant.getUserId());
+    }
+    if (find(people.begin(), people.end(), expense.getCreatedBy()) == people.end()) {
+        people.push_back(expense.getCreatedBy());
+    }
+
+    for (size_t i = 0; i < people.size(); i++) {
+        for (size_t j = i + 1; j < people.size(); j++) {
+            if (people[i] == people[j]) continue;
+            partnerSketch(people[i]).add(Utils::hash64((uint64_t)people[j]));
+            partnerSketch(people[j]).add(Utils::hash64((uint64_t)people[i]));
+            uint64_t key = pairKey(people[i], people[j]);
+            pairCounts.add(key);
+            offerCandidate(key);
+        }
+    }
+    trimPartners();
+}
+
+void ExpenseSketches::merge(const ExpenseSketches& other) {
+    for (const auto& [userId, sketch] : other.partners) {
+        PartnerSketch& entry = partners[userId];
+        entry.distinct.merge(sketch.distinct);
+        entry.lastUsed = clock + sketch.lastUsed;
+    }
+    clock += other.clock;
+    evicted += other.evicted;
+    trimPartners();
+    pairCounts.merge(other.pairCounts);
+
+    // Re-rank the union of both candidate sets against the merged counts
+    vector<uint64_t> keys;
+    for (const auto& [key, count] : candidates) keys.push_back(key);
+    for (const auto& [key, count] : other.candidates) keys.push_back(key);
+    candidates.clear();
+    for (uint64_t key : keys) offerCandidate(key);
+}
+
+double ExpenseSketches::distinctPartners(int userId) const {
+    auto it = partners.find(userId);
+    return it == partners.end() ? 0.0 : it->second.distinct.estimate();
+}
+
+vector<ExpenseSketches::HeavyPair> ExpenseSketches::heavyPairs(size_t k) const {
+    vector<HeavyPair> result;
+    for (const auto& [key, count] : candidates) {
+        result.push_back({(int)(key >> 32), (int)(uint32_t)key, count});
+    }
+    sort(result.begin(), result.end(),
+         [](const HeavyPair& a, const HeavyPair& b) { return a.estimatedCount > b.estimatedCount; });
+    if (result.size() > k) result.resize(k);
+    return result;
+}
+
+size_t ExpenseSketches::memoryBytes() const {
+    return partners.size() * (HyperLogLog::bytes() + sizeof(int) + sizeof(uint64_t)) + CountMinSketch::bytes()
+         + candidates.size() * sizeof(uint64_t) * 2;
+}
+
+ExpenseSketches ExpenseSketches::build(const ExpenseList& expenses) {
+    size_t workers = TaskScheduler::global().workerCount();
+    workers = min(workers, max((size_t)1, expenses.size() / 4096));
+
+    vector<ExpenseSketches> partials(workers);
+    size_t chunk = (expenses.size() + workers - 1) / workers;
+    TaskScheduler::global().parallelFor(0, workers, 1, [&](size_t w, size_t) {
+        size_t begin = w * chunk;
+        size_t end = min(expenses.size(), begin + chunk);
+        for (size_t i = begin; i < end; i++) {
+            partials[w].add(expenses[i]);
+        }
+    });
+
+    ExpenseSketches result = move(partials[0]);
+    for (size_t w = 1; w < workers; w++) {
+        result.merge(partials[w]);
+    }
+    return result;
+}
+
+// ============================================================================
+// PREFIX INDEX
+// ============================================================================
+
+vector<string> PrefixIndex::keysFor(const string& text, bool everyWord) {
+    vector<string> keys;
+    string lower = Utils::toLower(Utils::trim(text));
+    if (lower.empty()) return keys;
+    keys.push_back(lower);
+    if (everyWord) {
+        for (size_t i = 1; i < lower.size(); i++) {
+            if (lower[i - 1] == ' ' && lower[i] != ' ') keys.push_back(lower.substr(i));
+        }
+    }
+    return keys;
+}
+
+PrefixIndex::Entries::const_iterator PrefixIndex::firstAtLeast(const Entries& list, const string& key) {
+    return lower_bound(list.begin(), list.end(), make_pair(key, numeric_limits<int>::min()));
+}
+
+void PrefixIndex::mergeDelta() {
+    Entries merged;
+    merged.reserve(entries.size() + delta.size());
+    merge(make_move_iterator(entries.begin()), make_move_iterator(entries.end()),
+          make_move_iterator(delta.begin()), make_move_iterator(delta.end()), back_inserter(merged));
+    entries.swap(merged);
+    delta.clear();
+}
+
+void PrefixIndex::clear() {
+    entries.clear();
+    delta.clear();
+}
+
+void PrefixIndex::append(const string& text, int userId) {
+    for (auto& key : keysFor(text, wordPrefixes)) {
+        entries.emplace_back(move(key), userId);
+    }
+}
+
+void PrefixIndex::build() {
+    sort(entries.begin(), entries.end());
+    if (!delta.empty()) mergeDelta();
+}
+
+void PrefixIndex::insert(const string& text, int userId) {
+    for (auto& key : keysFor(text, wordPrefixes)) {
+        Entry entry(move(key), userId);
+        delta.insert(lower_bound(delta.begin(), delta.end(), entry), move(entry));
+    }
+    if (delta.size() > max(MIN_DELTA, (size_t)sqrt((double)entries.size()))) mergeDelta();
+}
+
+vector<int> PrefixIndex::search(const string& prefix, size_t limit) const {
+    vector<int> result;
+    string lower = Utils::toLower(Utils::trim(prefix));
+    auto matches = [&](Entries::const_iterator it, const Entries& list) {
+        return it != list.end() && it->first.compare(0, lower.size(), lower) == 0;
+    };
+    auto main = firstAtLeast(entries, lower);
+    auto recent = firstAtLeast(delta, lower);
+    while (result.size() < limit) {
+        bool fromMain = matches(main, entries);
+        bool fromDelta = matches(recent, delta);
+        if (!fromMain && !fromDelta) break;
+        if (fromMain && fromDelta) fromMain = *main < *recent;
+        int userId = fromMain ? (main++)->second : (recent++)->second;
+        if (find(result.begin(), result.end(), userId) == result.end()) {
+            result.push_back(userId);
+        }
+    }
+    return result;
+}
+
+vector<int> PrefixIndex::exact(const string& text) const {
+    vector<int> result;
+    string lower = Utils::toLower(Utils::trim(text));
+    for (const Entries* list : {&entries, &delta}) {
+        for (auto it = firstAtLeast(*list, lower); it != list->end() && it->first == lower; ++it) {
+            result.push_back(it->second);
+        }
+    }
+    sort(result.begin(), result.end());
+    return result;
+}
+
+}  // namespace detail
+}  // namespace expense
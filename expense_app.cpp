@@ -2,45 +2,53 @@
 ===============================================================================
     EXPENSE SHARING APPLICATION - C++ CLI
 
-    Features:
-    - User registration and login
-    - Three split methods:  EQUAL, EXACT, PERCENTAGE
-    - Balance calculation
-    - File-based data persistence
-    - CSV export
-    
-    Compile: g++ -std=c++17 expense_app.cpp -o expense_app
-    Run: ./expense_app
+    Interactive menu and command-line modes on top of the expense library
+    (expense.h, expense_tools.h; the library sources are listed in expense.cpp).
+
+    Compile: g++ -std=c++20 -pthread expense.cpp expense_support.cpp expense_model.cpp \
+                 expense_analytics.cpp expense_storage.cpp expense_manager.cpp \
+                 expense_shards.cpp expense_tools.cpp expense_app.cpp -o expense_app
+    Or link: g++ -std=c++20 -pthread expense_tools.cpp expense_app.cpp -L. -lexpense -o expense_app
+    Run: ./expense_app [--memory-budget=MB] [--watch] [--sketches]
+    Benchmark: ./expense_app --bench [users] [expenses] [expense budget MB]
+    Tenant benchmark: ./expense_app --bench-tenants [tenants] [expenses each] [budget MB] [accesses]
+    Shard benchmark: ./expense_app --bench-shards [users] [expenses] [max shards]
+    Audit: ./expense_app --audit-balances out.csv [--mem=MB] [expense files...]
+    Change feed: ./expense_app --cdc-tail <seq> [--follow] [log]
+    Replica: ./expense_app --replica [data dir]
+    Compact: ./expense_app --compact [data dir]
+    Merge: ./expense_app --merge <peer data dir> [data dir]
+    Server: ./expense_app --serve [port] [data dir] [tenant budget MB]
+    Server load test: ./expense_app --bench-server [connections] [requests each]
+    JSON lines: ./expense_app --json [data dir] [tenant budget MB] < requests.jsonl
+    JSON benchmark: ./expense_app --bench-json [requests]
 ===============================================================================
 */
 
+#include "expense.h"
+#include "expense_tools.h"
+
 #include <iostream>
-#include <fstream>
-#include <sstream>
-#include <vector>
 #include <string>
-#include <iomanip>
-#include <ctime>
+#include <vector>
 #include <algorithm>
-#include <map>
-#include <cmath>
-#include <sys/stat.h>
+#include <memory>
+#include <cstdlib>
+#include <cctype>
 
 using namespace std;
+using expense::Ledger;
+using expense::Result;
+using expense::Status;
+using expense::SplitMethod;
+using expense::ExportOrder;
+using expense::UserInfo;
 
 // ============================================================================
-// UTILITY FUNCTIONS
+// CONSOLE HELPERS
 // ============================================================================
 
 namespace Utils {
-    // Get current date and time as string
-    string getCurrentDateTime() {
-        time_t now = time(0);
-        char buffer[80];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&now));
-        return string(buffer);
-    }
-
     // Clear console screen (cross-platform)
     void clearScreen() {
         #ifdef _WIN32
@@ -57,38 +65,6 @@ namespace Utils {
         cin.get();
     }
 
-    // Validate email format (basic check)
-    bool isValidEmail(const string& email) {
-        return email.find('@') != string::npos && email.find('.') != string::npos;
-    }
-
-    // Validate phone number (basic check - digits only)
-    bool isValidPhone(const string& phone) {
-        if (phone.empty() || phone.length() < 10) return false;
-        for (char c : phone) {
-            if (!isdigit(c)) return false;
-        }
-        return true;
-    }
-
-    // Format currency with 2 decimal places
-    string formatCurrency(double amount) {
-        stringstream ss;
-        ss << fixed << setprecision(2) << "$" << amount;
-        return ss.str();
-    }
-
-    // Split string by delimiter
-    vector<string> split(const string& str, char delimiter) {
-        vector<string> tokens;
-        stringstream ss(str);
-        string token;
-        while (getline(ss, token, delimiter)) {
-            tokens.push_back(token);
-        }
-        return tokens;
-    }
-
     // Trim whitespace from string
     string trim(const string& str) {
         size_t first = str.find_first_not_of(" \t\n\r");
@@ -97,692 +73,18 @@ namespace Utils {
         return str.substr(first, (last - first + 1));
     }
 
-    // Create directory if it doesn't exist
-    void createDirectory(const string& path) {
-        #ifdef _WIN32
-            _mkdir(path.c_str());
-        #else
-            mkdir(path.c_str(), 0777);
-        #endif
+    // Print "Error: <message>" for a failed call
+    void printError(const Status& status) {
+        if (!status) cout << "Error: " << status.message << endl;
     }
-}
-
-// ============================================================================
-// ENUMS
-// ============================================================================
 
-enum class SplitMethod {
-    EQUAL,
-    EXACT,
-    PERCENTAGE
-};
-
-string splitMethodToString(SplitMethod method) {
-    switch(method) {
-        case SplitMethod::EQUAL:  return "EQUAL";
-        case SplitMethod::EXACT:  return "EXACT";
-        case SplitMethod::PERCENTAGE:  return "PERCENTAGE";
-        default: return "UNKNOWN";
+    // Print a rendered report, or why there is none
+    void showText(const Result<string>& text) {
+        if (text) cout << *text;
+        else printError(text.status());
     }
 }
 
-SplitMethod stringToSplitMethod(const string& str) {
-    if (str == "EQUAL") return SplitMethod::EQUAL;
-    if (str == "EXACT") return SplitMethod:: EXACT;
-    if (str == "PERCENTAGE") return SplitMethod::PERCENTAGE;
-    return SplitMethod::EQUAL;
-}
-
-// ============================================================================
-// USER CLASS
-// ============================================================================
-
-class User {
-private:
-    int id;
-    string name;
-    string email;
-    string phone;
-    string password;
-
-public:
-    // Constructors
-    User() : id(0), name(""), email(""), phone(""), password("") {}
-    
-    User(int id, string name, string email, string phone, string password)
-        : id(id), name(name), email(email), phone(phone), password(password) {}
-
-    // Getters
-    int getId() const { return id; }
-    string getName() const { return name; }
-    string getEmail() const { return email; }
-    string getPhone() const { return phone; }
-    
-    // Password verification
-    bool verifyPassword(const string& pwd) const {
-        return password == pwd;
-    }
-
-    // Display user information
-    void display() const {
-        cout << "ID: " << id << " | Name: " << name 
-             << " | Email: " << email << " | Phone: " << phone << endl;
-    }
-
-    // Serialize to string for file storage
-    string serialize() const {
-        return to_string(id) + "|" + name + "|" + email + "|" + phone + "|" + password;
-    }
-
-    // Deserialize from string
-    static User deserialize(const string& data) {
-        vector<string> parts = Utils::split(data, '|');
-        if (parts.size() >= 5) {
-            return User(stoi(parts[0]), parts[1], parts[2], parts[3], parts[4]);
-        }
-        return User();
-    }
-};
-
-// ============================================================================
-// EXPENSE PARTICIPANT CLASS
-// ============================================================================
-
-class ExpenseParticipant {
-private:
-    int userId;
-    double share;
-
-public:
-    ExpenseParticipant() : userId(0), share(0.0) {}
-    
-    ExpenseParticipant(int userId, double share)
-        : userId(userId), share(share) {}
-
-    // Getters
-    int getUserId() const { return userId; }
-    double getShare() const { return share; }
-
-    // Serialization
-    string serialize() const {
-        stringstream ss;
-        ss << userId << ":" << fixed << setprecision(2) << share;
-        return ss. str();
-    }
-
-    static ExpenseParticipant deserialize(const string& data) {
-        vector<string> parts = Utils::split(data, ':');
-        if (parts.size() >= 2) {
-            return ExpenseParticipant(stoi(parts[0]), stod(parts[1]));
-        }
-        return ExpenseParticipant();
-    }
-};
-
-// ============================================================================
-// EXPENSE CLASS
-// ============================================================================
-
-class Expense {
-private:
-    int id;
-    string description;
-    double amount;
-    SplitMethod splitMethod;
-    int createdBy;
-    string createdAt;
-    vector<ExpenseParticipant> participants;
-
-public:
-    // Constructors
-    Expense() : id(0), description(""), amount(0.0), 
-                splitMethod(SplitMethod::EQUAL), createdBy(0), createdAt("") {}
-    
-    Expense(int id, string desc, double amt, SplitMethod method, int creator)
-        : id(id), description(desc), amount(amt), 
-          splitMethod(method), createdBy(creator) {
-        createdAt = Utils:: getCurrentDateTime();
-    }
-
-    // Getters
-    int getId() const { return id; }
-    string getDescription() const { return description; }
-    double getAmount() const { return amount; }
-    SplitMethod getSplitMethod() const { return splitMethod; }
-    int getCreatedBy() const { return createdBy; }
-    string getCreatedAt() const { return createdAt; }
-    vector<ExpenseParticipant> getParticipants() const { return participants; }
-
-    // Add participant
-    void addParticipant(const ExpenseParticipant& participant) {
-        participants.push_back(participant);
-    }
-
-    // Display expense details
-    void display(const vector<User>& users) const {
-        cout << "\n----------------------------------------" << endl;
-        cout << "Expense ID: " << id << endl;
-        cout << "Description: " << description << endl;
-        cout << "Amount: " << Utils::formatCurrency(amount) << endl;
-        cout << "Split Method: " << splitMethodToString(splitMethod) << endl;
-        cout << "Created At: " << createdAt << endl;
-        cout << "Participants:" << endl;
-        
-        for (const auto& p : participants) {
-            // Find user name
-            string userName = "Unknown";
-            for (const auto& user : users) {
-                if (user.getId() == p.getUserId()) {
-                    userName = user.getName();
-                    break;
-                }
-            }
-            cout << "  - " << userName << " (ID:  " << p.getUserId() << "): " 
-                 << Utils:: formatCurrency(p.getShare()) << endl;
-        }
-        cout << "----------------------------------------" << endl;
-    }
-
-    // Serialization
-    string serialize() const {
-        stringstream ss;
-        ss << id << "|" << description << "|" << fixed << setprecision(2) << amount 
-           << "|" << splitMethodToString(splitMethod) << "|" << createdBy 
-           << "|" << createdAt << "|";
-        
-        // Serialize participants
-        for (size_t i = 0; i < participants.size(); i++) {
-            ss << participants[i]. serialize();
-            if (i < participants.size() - 1) ss << ",";
-        }
-        
-        return ss.str();
-    }
-
-    static Expense deserialize(const string& data) {
-        vector<string> parts = Utils::split(data, '|');
-        if (parts. size() >= 7) {
-            Expense exp;
-            exp.id = stoi(parts[0]);
-            exp.description = parts[1];
-            exp.amount = stod(parts[2]);
-            exp.splitMethod = stringToSplitMethod(parts[3]);
-            exp.createdBy = stoi(parts[4]);
-            exp.createdAt = parts[5];
-            
-            // Deserialize participants
-            if (! parts[6].empty()) {
-                vector<string> participantStrings = Utils::split(parts[6], ',');
-                for (const auto& pStr : participantStrings) {
-                    exp.participants.push_back(ExpenseParticipant::deserialize(pStr));
-                }
-            }
-            
-            return exp;
-        }
-        return Expense();
-    }
-};
-
-// ============================================================================
-// EXPENSE MANAGER CLASS
-// ============================================================================
-
-class ExpenseManager {
-private: 
-    vector<User> users;
-    vector<Expense> expenses;
-    User* currentUser;
-    int nextUserId;
-    int nextExpenseId;
-    
-    const string DATA_DIR = "data";
-    const string USERS_FILE = "data/users.txt";
-    const string EXPENSES_FILE = "data/expenses.txt";
-
-public:
-    ExpenseManager() : currentUser(nullptr), nextUserId(1), nextExpenseId(1) {
-        loadData();
-    }
-
-    ~ExpenseManager() {
-        saveData();
-    }
-
-    // ========================================================================
-    // USER OPERATIONS
-    // ========================================================================
-
-    bool registerUser(string name, string email, string phone, string password) {
-        // Validate email
-        if (!Utils::isValidEmail(email)) {
-            cout << "Error: Invalid email format!" << endl;
-            return false;
-        }
-
-        // Validate phone
-        if (!Utils:: isValidPhone(phone)) {
-            cout << "Error: Invalid phone number!  (must be 10+ digits)" << endl;
-            return false;
-        }
-
-        // Check if email already exists
-        for (const auto& user : users) {
-            if (user.getEmail() == email) {
-                cout << "Error: Email already registered!" << endl;
-                return false;
-            }
-        }
-
-        // Create new user
-        User newUser(nextUserId++, name, email, phone, password);
-        users.push_back(newUser);
-        saveData();
-        
-        cout << "\n✓ User registered successfully!" << endl;
-        return true;
-    }
-
-    bool login(string email, string password) {
-        for (auto& user : users) {
-            if (user.getEmail() == email && user.verifyPassword(password)) {
-                currentUser = &user;
-                cout << "\n✓ Login successful!  Welcome, " << user.getName() << "!" << endl;
-                return true;
-            }
-        }
-        cout << "\nError: Invalid email or password!" << endl;
-        return false;
-    }
-
-    void logout() {
-        if (currentUser != nullptr) {
-            cout << "\n✓ Logged out successfully!" << endl;
-            currentUser = nullptr;
-        }
-    }
-
-    void displayAllUsers() const {
-        if (users.empty()) {
-            cout << "\nNo users registered yet." << endl;
-            return;
-        }
-
-        cout << "\n========================================" << endl;
-        cout << "         REGISTERED USERS" << endl;
-        cout << "========================================" << endl;
-        for (const auto& user : users) {
-            user.display();
-        }
-        cout << "========================================" << endl;
-    }
-
-    User* getCurrentUser() {
-        return currentUser;
-    }
-
-    // ========================================================================
-    // EXPENSE OPERATIONS
-    // ========================================================================
-
-    bool addExpense(string description, double amount, SplitMethod method, 
-                   vector<int> participantIds, vector<double> shares = {}) {
-        
-        if (currentUser == nullptr) {
-            cout << "Error: Please login first!" << endl;
-            return false;
-        }
-
-        if (amount <= 0) {
-            cout << "Error: Amount must be greater than 0!" << endl;
-            return false;
-        }
-
-        // Ensure creator is in participants
-        bool creatorIncluded = false;
-        for (int id : participantIds) {
-            if (id == currentUser->getId()) {
-                creatorIncluded = true;
-                break;
-            }
-        }
-        if (!creatorIncluded) {
-            participantIds.push_back(currentUser->getId());
-        }
-
-        // Validate participants exist
-        for (int id : participantIds) {
-            bool found = false;
-            for (const auto& user : users) {
-                if (user.getId() == id) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                cout << "Error:  User with ID " << id << " not found!" << endl;
-                return false;
-            }
-        }
-
-        // Create expense
-        Expense newExpense(nextExpenseId++, description, amount, method, currentUser->getId());
-
-        // Calculate shares based on split method
-        if (method == SplitMethod:: EQUAL) {
-            double shareAmount = amount / participantIds.size();
-            for (int userId : participantIds) {
-                newExpense.addParticipant(ExpenseParticipant(userId, shareAmount));
-            }
-        }
-        else if (method == SplitMethod::EXACT) {
-            if (shares.size() != participantIds.size()) {
-                cout << "Error: Number of shares doesn't match participants!" << endl;
-                return false;
-            }
-
-            double total = 0;
-            for (double share : shares) {
-                total += share;
-            }
-
-            if (abs(total - amount) > 0.01) {
-                cout << "Error: Sum of shares (" << Utils::formatCurrency(total) 
-                     << ") doesn't match total amount (" << Utils::formatCurrency(amount) << ")!" << endl;
-                return false;
-            }
-
-            for (size_t i = 0; i < participantIds.size(); i++) {
-                newExpense. addParticipant(ExpenseParticipant(participantIds[i], shares[i]));
-            }
-        }
-        else if (method == SplitMethod::PERCENTAGE) {
-            if (shares.size() != participantIds.size()) {
-                cout << "Error: Number of percentages doesn't match participants!" << endl;
-                return false;
-            }
-
-            double totalPercentage = 0;
-            for (double percentage : shares) {
-                totalPercentage += percentage;
-            }
-
-            if (abs(totalPercentage - 100.0) > 0.01) {
-                cout << "Error:  Percentages must add up to 100%!  (Current: " 
-                     << totalPercentage << "%)" << endl;
-                return false;
-            }
-
-            for (size_t i = 0; i < participantIds.size(); i++) {
-                double shareAmount = amount * (shares[i] / 100.0);
-                newExpense. addParticipant(ExpenseParticipant(participantIds[i], shareAmount));
-            }
-        }
-
-        expenses.push_back(newExpense);
-        saveData();
-        
-        cout << "\n✓ Expense added successfully!  (ID: " << newExpense. getId() << ")" << endl;
-        return true;
-    }
-
-    void displayUserExpenses() const {
-        if (currentUser == nullptr) {
-            cout << "Error: Please login first!" << endl;
-            return;
-        }
-
-        bool found = false;
-        cout << "\n========================================" << endl;
-        cout << "      YOUR EXPENSES" << endl;
-        cout << "========================================" << endl;
-
-        for (const auto& expense :  expenses) {
-            // Check if current user is a participant
-            for (const auto& participant : expense.getParticipants()) {
-                if (participant.getUserId() == currentUser->getId()) {
-                    expense.display(users);
-                    cout << "Your share: " << Utils::formatCurrency(participant.getShare()) << endl;
-                    found = true;
-                    break;
-                }
-            }
-        }
-
-        if (!found) {
-            cout << "No expenses found for you." << endl;
-        }
-    }
-
-    void displayAllExpenses() const {
-        if (currentUser == nullptr) {
-            cout << "Error: Please login first!" << endl;
-            return;
-        }
-
-        if (expenses.empty()) {
-            cout << "\nNo expenses recorded yet." << endl;
-            return;
-        }
-
-        cout << "\n========================================" << endl;
-        cout << "         ALL EXPENSES" << endl;
-        cout << "========================================" << endl;
-
-        for (const auto& expense : expenses) {
-            expense.display(users);
-        }
-    }
-
-    // ========================================================================
-    // BALANCE OPERATIONS
-    // ========================================================================
-
-    void displayBalance() const {
-        if (currentUser == nullptr) {
-            cout << "Error: Please login first!" << endl;
-            return;
-        }
-
-        // Calculate balance:  who owes whom
-        map<int, double> balance; // positive means they owe current user, negative means current user owes them
-
-        for (const auto& expense : expenses) {
-            int payer = expense.getCreatedBy();
-            
-            for (const auto& participant : expense. getParticipants()) {
-                int userId = participant.getUserId();
-                double share = participant.getShare();
-
-                // If current user is the payer
-                if (payer == currentUser->getId() && userId != currentUser->getId()) {
-                    balance[userId] += share; // Others owe current user
-                }
-                // If current user is a participant but not the payer
-                else if (userId == currentUser->getId() && payer != currentUser->getId()) {
-                    balance[payer] -= share; // Current user owes the payer
-                }
-            }
-        }
-
-        cout << "\n========================================" << endl;
-        cout << "         YOUR BALANCE" << endl;
-        cout << "========================================" << endl;
-
-        if (balance.empty()) {
-            cout << "No balances to show." << endl;
-            return;
-        }
-
-        bool hasBalance = false;
-        for (const auto& [userId, amount] : balance) {
-            if (abs(amount) > 0.01) {
-                hasBalance = true;
-                string userName = "Unknown";
-                for (const auto& user : users) {
-                    if (user.getId() == userId) {
-                        userName = user.getName();
-                        break;
-                    }
-                }
-
-                if (amount > 0) {
-                    cout << userName << " owes you: " << Utils::formatCurrency(amount) << endl;
-                } else {
-                    cout << "You owe " << userName << ": " << Utils::formatCurrency(-amount) << endl;
-                }
-            }
-        }
-
-        if (!hasBalance) {
-            cout << "All settled up!" << endl;
-        }
-        cout << "========================================" << endl;
-    }
-
-    void exportBalanceToCSV(const string& filename) const {
-        if (currentUser == nullptr) {
-            cout << "Error:  Please login first!" << endl;
-            return;
-        }
-
-        ofstream file(filename);
-        if (!file.is_open()) {
-            cout << "Error:  Could not create file!" << endl;
-            return;
-        }
-
-        // Write CSV header
-        file << "Expense ID,Description,Total Amount,Payer,Payer Name,User ID,User Name,Share,Created At\n";
-
-        // Write expense data
-        for (const auto& expense : expenses) {
-            bool isRelevant = false;
-            
-            // Check if current user is involved
-            for (const auto& participant : expense.getParticipants()) {
-                if (participant. getUserId() == currentUser->getId()) {
-                    isRelevant = true;
-                    break;
-                }
-            }
-
-            if (expense.getCreatedBy() == currentUser->getId()) {
-                isRelevant = true;
-            }
-
-            if (isRelevant) {
-                string payerName = "Unknown";
-                for (const auto& user : users) {
-                    if (user.getId() == expense.getCreatedBy()) {
-                        payerName = user.getName();
-                        break;
-                    }
-                }
-
-                for (const auto& participant : expense. getParticipants()) {
-                    string userName = "Unknown";
-                    for (const auto& user : users) {
-                        if (user.getId() == participant.getUserId()) {
-                            userName = user.getName();
-                            break;
-                        }
-                    }
-
-                    file << expense.getId() << ","
-                         << expense.getDescription() << ","
-                         << fixed << setprecision(2) << expense.getAmount() << ","
-                         << expense.getCreatedBy() << ","
-                         << payerName << ","
-                         << participant.getUserId() << ","
-                         << userName << ","
-                         << participant.getShare() << ","
-                         << expense.getCreatedAt() << "\n";
-                }
-            }
-        }
-
-        file.close();
-        cout << "\n✓ Balance sheet exported to " << filename << " successfully!" << endl;
-    }
-
-    // ========================================================================
-    // DATA PERSISTENCE
-    // ========================================================================
-
-    void loadData() {
-        Utils::createDirectory(DATA_DIR);
-
-        // Load users
-        ifstream usersFile(USERS_FILE);
-        if (usersFile.is_open()) {
-            string line;
-            while (getline(usersFile, line)) {
-                if (! line.empty()) {
-                    User user = User::deserialize(line);
-                    if (user.getId() > 0) {
-                        users.push_back(user);
-                        if (user.getId() >= nextUserId) {
-                            nextUserId = user.getId() + 1;
-                        }
-                    }
-                }
-            }
-            usersFile. close();
-        }
-
-        // Load expenses
-        ifstream expensesFile(EXPENSES_FILE);
-        if (expensesFile.is_open()) {
-            string line;
-            while (getline(expensesFile, line)) {
-                if (!line. empty()) {
-                    Expense expense = Expense::deserialize(line);
-                    if (expense.getId() > 0) {
-                        expenses.push_back(expense);
-                        if (expense.getId() >= nextExpenseId) {
-                            nextExpenseId = expense.getId() + 1;
-                        }
-                    }
-                }
-            }
-            expensesFile. close();
-        }
-    }
-
-    void saveData() {
-        Utils::createDirectory(DATA_DIR);
-
-        // Save users
-        ofstream usersFile(USERS_FILE);
-        if (usersFile.is_open()) {
-            for (const auto& user : users) {
-                usersFile << user.serialize() << "\n";
-            }
-            usersFile.close();
-        }
-
-        // Save expenses
-        ofstream expensesFile(EXPENSES_FILE);
-        if (expensesFile.is_open()) {
-            for (const auto& expense : expenses) {
-                expensesFile << expense.serialize() << "\n";
-            }
-            expensesFile.close();
-        }
-    }
-
-    // Get user by ID (helper function)
-    User* getUserById(int id) {
-        for (auto& user : users) {
-            if (user.getId() == id) {
-                return &user;
-            }
-        }
-        return nullptr;
-    }
-};
-
 // ============================================================================
 // MAIN MENU FUNCTIONS
 // ============================================================================
@@ -808,99 +110,164 @@ void showUserMenu(const string& userName) {
     cout << "3. View All Expenses" << endl;
     cout << "4. View Balance" << endl;
     cout << "5. Export Balance to CSV" << endl;
-    cout << "6. Logout" << endl;
-    cout << "7. Exit" << endl;
+    cout << "6. Search Expenses" << endl;
+    cout << "7. Monthly Reports" << endl;
+    cout << "8. Top Debtors & Creditors" << endl;
+    cout << "9. Simplify Debts" << endl;
+    cout << "10. Sharing Insights" << endl;
+    cout << "11. Find User" << endl;
+    cout << "12. Memory Usage" << endl;
+    cout << "13. Delete Expense" << endl;
+    cout << "14. Logout" << endl;
+    cout << "15. Exit" << endl;
     cout << "========================================" << endl;
     cout << "Enter your choice: ";
 }
 
-void handleRegister(ExpenseManager& manager) {
+void handleRegister(Ledger& ledger) {
     Utils::clearScreen();
     cout << "\n========== USER REGISTRATION ==========" << endl;
-    
+
     string name, email, phone, password;
-    
+
     cout << "Enter name: ";
     cin. ignore();
     getline(cin, name);
-    
+
     cout << "Enter email: ";
     getline(cin, email);
-    
+
     cout << "Enter phone:  ";
     getline(cin, phone);
-    
+
     cout << "Enter password: ";
     getline(cin, password);
-    
-    manager.registerUser(name, email, phone, password);
+
+    Result<int> registered = ledger.registerUser(name, email, phone, password);
+    if (registered) cout << "\n✓ User registered successfully!" << endl;
+    else Utils::printError(registered.status());
     Utils::pauseScreen();
 }
 
-void handleLogin(ExpenseManager& manager) {
+void handleLogin(Ledger& ledger) {
     Utils::clearScreen();
     cout << "\n============ USER LOGIN ============" << endl;
-    
+
     string email, password;
-    
+
     cout << "Enter email: ";
     cin.ignore();
     getline(cin, email);
-    
+
     cout << "Enter password: ";
     getline(cin, password);
-    
-    manager.login(email, password);
+
+    Result<UserInfo> user = ledger.login(email, password);
+    if (user) cout << "\n✓ Login successful!  Welcome, " << user->name << "!" << endl;
+    else Utils::printError(user.status());
+    Utils::pauseScreen();
+}
+
+// Ask for one user by ID or by name/email prefix, resolving ambiguous matches
+int promptForUser(const Ledger& ledger, const string& label) {
+    while (true) {
+        string input;
+        cout << label << ": ";
+        if (!getline(cin, input)) return 0;
+        input = Utils::trim(input);
+        if (input.empty()) continue;
+
+        if (all_of(input.begin(), input.end(), [](char c) { return isdigit((unsigned char)c); })) {
+            return stoi(input);
+        }
+
+        Result<vector<UserInfo>> found = ledger.findUsers(input, 10);
+        if (!found) {
+            Utils::printError(found.status());
+            return 0;
+        }
+        const vector<UserInfo>& matches = *found;
+        if (matches.empty()) {
+            cout << "  No user matches '" << input << "'. Try again." << endl;
+            continue;
+        }
+        if (matches.size() == 1) {
+            cout << "  -> " << matches[0].name << " (ID: " << matches[0].id << ")" << endl;
+            return matches[0].id;
+        }
+
+        for (size_t i = 0; i < matches.size(); i++) {
+            cout << "  " << (i + 1) << ". " << matches[i].name << " <" << matches[i].email
+                 << "> (ID: " << matches[i].id << ")" << endl;
+        }
+        cout << "  Pick 1-" << matches.size() << " (or 0 to search again): ";
+        string pick;
+        getline(cin, pick);
+        int index = atoi(pick.c_str());
+        if (index >= 1 && index <= (int)matches.size()) {
+            return matches[index - 1].id;
+        }
+    }
+}
+
+void handleFindUser(const Ledger& ledger) {
+    Utils::clearScreen();
+    cout << "\n========== FIND USER ==========" << endl;
+
+    string prefix;
+    cout << "Start of name or email: ";
+    cin.ignore();
+    getline(cin, prefix);
+
+    Utils::showText(ledger.userSearchText(prefix));
     Utils::pauseScreen();
 }
 
-void handleAddExpense(ExpenseManager& manager) {
+void handleAddExpense(Ledger& ledger) {
     Utils::clearScreen();
     cout << "\n========== ADD EXPENSE ==========" << endl;
-    
+
     string description;
     double amount;
     int methodChoice;
-    
+
     cout << "Enter description: ";
     cin.ignore();
     getline(cin, description);
-    
+
     cout << "Enter amount: $";
     cin >> amount;
-    
+
     cout << "\nSplit Method:" << endl;
     cout << "1. EQUAL - Split equally among all participants" << endl;
     cout << "2. EXACT - Specify exact amount for each participant" << endl;
     cout << "3. PERCENTAGE - Split by percentage" << endl;
     cout << "Enter choice (1-3): ";
     cin >> methodChoice;
-    
+
     SplitMethod method;
     switch(methodChoice) {
         case 1: method = SplitMethod::EQUAL; break;
         case 2: method = SplitMethod::EXACT; break;
         case 3: method = SplitMethod::PERCENTAGE; break;
-        default: 
+        default:
             cout << "Invalid choice!  Defaulting to EQUAL." << endl;
             method = SplitMethod::EQUAL;
     }
-    
+
     int numParticipants;
     cout << "Enter number of participants: ";
     cin >> numParticipants;
-    
+
     vector<int> participantIds;
     vector<double> shares;
-    
-    cout << "\nEnter participant user IDs:" << endl;
+
+    cout << "\nEnter participants by user ID, or the start of a name or email:" << endl;
+    cin.ignore();
     for (int i = 0; i < numParticipants; i++) {
-        int userId;
-        cout << "Participant " << (i + 1) << " ID: ";
-        cin >> userId;
-        participantIds.push_back(userId);
+        participantIds.push_back(promptForUser(ledger, "Participant " + to_string(i + 1)));
     }
-    
+
     if (method == SplitMethod:: EXACT) {
         cout << "\nEnter exact amounts for each participant:" << endl;
         for (int i = 0; i < numParticipants; i++) {
@@ -919,30 +286,283 @@ void handleAddExpense(ExpenseManager& manager) {
             shares.push_back(percentage);
         }
     }
-    
-    manager.addExpense(description, amount, method, participantIds, shares);
+
+    Result<int> added = ledger.addExpense(description, amount, method, participantIds, shares);
+    if (added) cout << "\n✓ Expense added successfully!  (ID: " << *added << ")" << endl;
+    else Utils::printError(added.status());
+    Utils::pauseScreen();
+}
+
+void handleSearchExpenses(const Ledger& ledger) {
+    Utils::clearScreen();
+    cout << "\n========== SEARCH EXPENSES ==========" << endl;
+    cout << "Filters (combine with spaces):" << endl;
+    cout << "  payer=ID  participant=ID,ID (all of)  anyof=ID,ID  without=ID" << endl;
+    cout << "  amount>500  amount<=20" << endl;
+    cout << "  from=2024-04-01  to=2024-06-30  month=2024-05  quarter=2024-Q2" << endl;
+    cout << "  method=EQUAL|EXACT|PERCENTAGE  desc=Groceries  desc~\"team lunch\"" << endl;
+
+    string queryText;
+    cout << "\nQuery: ";
+    cin.ignore();
+    getline(cin, queryText);
+
+    Utils::showText(ledger.searchText(queryText));
     Utils::pauseScreen();
 }
 
-void handleExportCSV(ExpenseManager& manager) {
+void handleReports(const Ledger& ledger) {
+    Utils::clearScreen();
+    cout << "\n========== MONTHLY REPORTS ==========" << endl;
+    cout << "1. My spending per month" << endl;
+    cout << "2. Exchange with another user per quarter" << endl;
+    cout << "Enter choice (1-2): ";
+
+    int reportChoice;
+    cin >> reportChoice;
+
+    int otherUserId = 0;
+    if (reportChoice == 2) {
+        cout << "Other user ID: ";
+        cin >> otherUserId;
+    }
+
+    string fromText, toText;
+    cout << "From (YYYY-MM or YYYY-MM-DD): ";
+    cin >> fromText;
+    cout << "To (YYYY-MM or YYYY-MM-DD): ";
+    cin >> toText;
+
+    if (reportChoice == 2) {
+        Utils::showText(ledger.pairText(otherUserId, fromText, toText));
+    } else {
+        Utils::showText(ledger.monthlyText(fromText, toText));
+    }
+    Utils::pauseScreen();
+}
+
+void handleTopBalances(const Ledger& ledger) {
+    Utils::clearScreen();
+    cout << "\n========== TOP BALANCES ==========" << endl;
+
+    int k;
+    cout << "How many entries (K): ";
+    cin >> k;
+    if (k <= 0) k = 10;
+
+    Utils::showText(ledger.topBalancesText((size_t)k));
+    Utils::pauseScreen();
+}
+
+void handleDeleteExpense(Ledger& ledger) {
+    Utils::clearScreen();
+    cout << "\n========== DELETE EXPENSE ==========" << endl;
+
+    int expenseId;
+    cout << "Expense ID to delete: ";
+    cin >> expenseId;
+
+    Status deleted = ledger.deleteExpense(expenseId);
+    if (deleted) cout << "\n✓ Expense deleted successfully!  (ID: " << expenseId << ")" << endl;
+    else Utils::printError(deleted);
+    Utils::pauseScreen();
+}
+
+void handleExportCSV(const Ledger& ledger) {
     Utils::clearScreen();
     cout << "\n========== EXPORT TO CSV ==========" << endl;
-    
-    string filename;
+
+    string filename, input;
     cout << "Enter filename (e.g., balance. csv): ";
     cin.ignore();
     getline(cin, filename);
-    
-    manager.exportBalanceToCSV(filename);
+
+    cout << "Sort by (1=Storage, 2=Date, 3=Amount, 4=Counterparty) [1]: ";
+    getline(cin, input);
+    ExportOrder order = ExportOrder::STORAGE;
+    if (input == "2") order = ExportOrder::DATE;
+    else if (input == "3") order = ExportOrder::AMOUNT;
+    else if (input == "4") order = ExportOrder::COUNTERPARTY;
+
+    cout << "Descending? (y/n) [n]: ";
+    getline(cin, input);
+    bool descending = !input.empty() && tolower(input[0]) == 'y';
+
+    cout << "Limit to first N rows (0 = all) [0]: ";
+    getline(cin, input);
+    size_t limit = input.empty() ? 0 : (size_t)max(0, atoi(input.c_str()));
+
+    Result<expense::ExportInfo> exported = ledger.exportBalances(filename, order, descending, limit);
+    if (exported) {
+        cout << "\n✓ Balance sheet exported to " << exported->path << " successfully! (" << exported->rows << " rows";
+        if (exported->sortRuns > 0) cout << ", " << exported->sortRuns << " sort runs";
+        cout << ")" << endl;
+    } else {
+        Utils::printError(exported.status());
+    }
     Utils::pauseScreen();
 }
 
+// ============================================================================
+// MAINTENANCE COMMANDS
+// ============================================================================
+
+// --compact [data dir]: rewrite the data files
+int runCompact(const string& dataDir) {
+    expense::LedgerOptions options;
+    options.dataDir = dataDir;
+    Result<unique_ptr<Ledger>> opened = Ledger::open(options);
+    if (!opened) {
+        Utils::printError(opened.status());
+        return 1;
+    }
+    Status compacted = opened.value()->compact();
+    Utils::printError(compacted);
+    return compacted ? 0 : 1;
+}
+
+// --merge <peer dir> [data dir]: pull in what another replica recorded
+int runMerge(const string& peerDir, const string& dataDir) {
+    expense::LedgerOptions options;
+    options.dataDir = dataDir;
+    Result<unique_ptr<Ledger>> opened = Ledger::open(options);
+    if (!opened) {
+        Utils::printError(opened.status());
+        return 1;
+    }
+    Result<expense::MergeInfo> merged = opened.value()->mergeFrom(peerDir);
+    if (!merged) {
+        Utils::printError(merged.status());
+        return 1;
+    }
+    if (!merged->progressSaved) {
+        cout << "Warning: Could not save merge progress; the next merge will read more of the peer." << endl;
+    }
+    cout << "\n✓ Merged " << peerDir << " (replica " << merged->peerReplica << ")" << endl;
+    cout << "New users: " << merged->newUsers << " | New expenses: " << merged->newExpenses
+         << " | New deletions: " << merged->newDeletions << endl;
+    cout << "Already present: " << merged->alreadyPresent << " | Pending (unknown user): "
+         << merged->skippedUnknownUser << " | Peer bytes read: " << merged->peerBytesRead;
+    if (merged->filesReadFromStart > 0) {
+        cout << " (" << merged->filesReadFromStart << " rewritten file(s) read from the start)";
+    }
+    cout << endl;
+    return 0;
+}
+
 // ============================================================================
 // MAIN FUNCTION
 // ============================================================================
 
-int main() {
-    ExpenseManager manager;
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        int userCount = argc > 2 ? atoi(argv[2]) : 10000;
+        int expenseCount = argc > 3 ? atoi(argv[3]) : 200000;
+        size_t budgetMB = argc > 4 ? (size_t)atoi(argv[4]) : 0;
+        return expense::tools::benchmark(max(userCount, 2), max(expenseCount, 1), budgetMB * 1024 * 1024);
+    }
+
+    if (argc > 1 && string(argv[1]) == "--bench-tenants") {
+        int tenantCount = argc > 2 ? atoi(argv[2]) : 2000;
+        int expensesPerTenant = argc > 3 ? atoi(argv[3]) : 200;
+        size_t budgetMB = argc > 4 ? (size_t)atoi(argv[4]) : 64;
+        int accesses = argc > 5 ? atoi(argv[5]) : 20000;
+        return expense::tools::tenantBenchmark(max(tenantCount, 1), max(expensesPerTenant, 1),
+                                               budgetMB * 1024 * 1024, max(accesses, 1));
+    }
+
+    if (argc > 1 && string(argv[1]) == "--bench-shards") {
+        int userCount = argc > 2 ? atoi(argv[2]) : 10000;
+        int expenseCount = argc > 3 ? atoi(argv[3]) : 500000;
+        int maxShards = argc > 4 ? atoi(argv[4]) : 32;
+        return expense::tools::shardBenchmark(max(userCount, 2), max(expenseCount, 1), max(maxShards, 1));
+    }
+
+    if (argc > 1 && string(argv[1]) == "--compact") {
+        return runCompact(argc > 2 ? argv[2] : "data");
+    }
+
+    if (argc > 2 && string(argv[1]) == "--merge") {
+        return runMerge(argv[2], argc > 3 ? argv[3] : "data");
+    }
+
+    // --json [data dir] [tenant budget MB]: JSON request lines on stdin, one
+    // response line each on stdout
+    if (argc > 1 && string(argv[1]) == "--json") {
+        size_t tenantBudgetMB = argc > 3 ? (size_t)atoi(argv[3]) : 64;
+        return expense::tools::jsonStream(argc > 2 ? argv[2] : "data", tenantBudgetMB * 1024 * 1024);
+    }
+
+    if (argc > 1 && string(argv[1]) == "--bench-json") {
+        int requestCount = argc > 2 ? atoi(argv[2]) : 200000;
+        return expense::tools::jsonBenchmark(max(requestCount, 1));
+    }
+
+    // --serve [port] [data dir] [tenant budget MB]: answer line requests over
+    // TCP on 127.0.0.1
+    if (argc > 1 && string(argv[1]) == "--serve") {
+        size_t tenantBudgetMB = argc > 4 ? (size_t)atoi(argv[4]) : 64;
+        return expense::tools::serve(argc > 2 ? atoi(argv[2]) : 7070, argc > 3 ? argv[3] : "data",
+                                     tenantBudgetMB * 1024 * 1024);
+    }
+
+    if (argc > 1 && string(argv[1]) == "--bench-server") {
+        int connectionCount = argc > 2 ? atoi(argv[2]) : 10000;
+        int requestsEach = argc > 3 ? atoi(argv[3]) : 20;
+        return expense::tools::serverLoadTest(max(connectionCount, 1), max(requestsEach, 1));
+    }
+
+    if (argc > 1 && string(argv[1]) == "--replica") {
+        return expense::tools::replica(argc > 2 ? argv[2] : "data");
+    }
+
+    // --cdc-tail <seq> [--follow] [log]: print change records after <seq>
+    if (argc > 2 && string(argv[1]) == "--cdc-tail") {
+        bool follow = false;
+        string logPath = "data/changes.jsonl";
+        for (int i = 3; i < argc; i++) {
+            if (string(argv[i]) == "--follow") follow = true;
+            else logPath = argv[i];
+        }
+        return expense::tools::tailChanges(logPath, strtoull(argv[2], nullptr, 10), follow);
+    }
+
+    if (argc > 2 && string(argv[1]) == "--audit-balances") {
+        size_t memoryMB = 64;
+        vector<string> inputs;
+        for (int i = 3; i < argc; i++) {
+            string arg = argv[i];
+            if (arg.rfind("--mem=", 0) == 0) {
+                memoryMB = max(1, atoi(arg.c_str() + 6));
+            } else {
+                inputs.push_back(arg);
+            }
+        }
+        if (inputs.empty()) inputs.push_back("data/expenses.txt");
+        return expense::tools::balanceAudit(argv[2], inputs, memoryMB * 1024 * 1024);
+    }
+
+    // --memory-budget=<MB> caps resident expense records, spilling cold ones to disk.
+    // --watch applies records other processes append as soon as they land.
+    // --sketches turns on the approximate sharing insights.
+    expense::LedgerOptions options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--memory-budget=", 0) == 0) {
+            options.memoryBudgetBytes = (size_t)atoi(arg.c_str() + 16) * 1024 * 1024;
+        } else if (arg == "--watch") {
+            options.watch = true;
+        } else if (arg == "--sketches") {
+            options.sketches = true;
+        }
+    }
+
+    Result<unique_ptr<Ledger>> opened = Ledger::open(options);
+    if (!opened) {
+        Utils::printError(opened.status());
+        return 1;
+    }
+    Ledger& ledger = *opened.value();
     int choice;
     bool running = true;
 
@@ -952,23 +572,24 @@ int main() {
     cout << "╚════════════════════════════════════════╝" << endl;
 
     while (running) {
-        User* currentUser = manager.getCurrentUser();
-        
-        if (currentUser == nullptr) {
+        Utils::printError(ledger.refresh());   // pick up records other processes appended
+        Result<UserInfo> currentUser = ledger.currentUser();
+
+        if (!currentUser) {
             // Main menu (not logged in)
             showMainMenu();
             cin >> choice;
-            
+
             switch(choice) {
-                case 1: 
-                    handleRegister(manager);
+                case 1:
+                    handleRegister(ledger);
                     break;
                 case 2:
-                    handleLogin(manager);
+                    handleLogin(ledger);
                     break;
                 case 3:
                     Utils::clearScreen();
-                    manager.displayAllUsers();
+                    Utils::showText(ledger.usersText());
                     Utils::pauseScreen();
                     break;
                 case 4:
@@ -982,36 +603,67 @@ int main() {
         }
         else {
             // User menu (logged in)
-            showUserMenu(currentUser->getName());
+            showUserMenu(currentUser->name);
             cin >> choice;
-            
+
             switch(choice) {
                 case 1:
-                    handleAddExpense(manager);
+                    handleAddExpense(ledger);
                     break;
                 case 2:
                     Utils::clearScreen();
-                    manager.displayUserExpenses();
+                    Utils::showText(ledger.myExpensesText());
                     Utils::pauseScreen();
                     break;
                 case 3:
                     Utils::clearScreen();
-                    manager.displayAllExpenses();
+                    Utils::showText(ledger.allExpensesText());
                     Utils::pauseScreen();
                     break;
                 case 4:
                     Utils::clearScreen();
-                    manager.displayBalance();
+                    Utils::showText(ledger.balanceText());
                     Utils::pauseScreen();
                     break;
                 case 5:
-                    handleExportCSV(manager);
+                    handleExportCSV(ledger);
                     break;
                 case 6:
-                    manager.logout();
-                    Utils::pauseScreen();
+                    handleSearchExpenses(ledger);
                     break;
                 case 7:
+                    handleReports(ledger);
+                    break;
+                case 8:
+                    handleTopBalances(ledger);
+                    break;
+                case 9:
+                    Utils::clearScreen();
+                    Utils::showText(ledger.simplificationText());
+                    Utils::pauseScreen();
+                    break;
+                case 10:
+                    Utils::clearScreen();
+                    Utils::showText(ledger.insightsText());
+                    Utils::pauseScreen();
+                    break;
+                case 11:
+                    handleFindUser(ledger);
+                    break;
+                case 12:
+                    Utils::clearScreen();
+                    Utils::showText(ledger.memoryText());
+                    Utils::pauseScreen();
+                    break;
+                case 13:
+                    handleDeleteExpense(ledger);
+                    break;
+                case 14:
+                    ledger.logout();
+                    cout << "\n✓ Logged out successfully!" << endl;
+                    Utils::pauseScreen();
+                    break;
+                case 15:
                     cout << "\nThank you for using Expense Sharing App! Goodbye!" << endl;
                     running = false;
                     break;
@@ -1020,7 +672,7 @@ int main() {
                     Utils::pauseScreen();
             }
         }
-        
+
         if (running) {
             Utils::clearScreen();
         }
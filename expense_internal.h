@@ -0,0 +1,2654 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - ENGINE INTERNALS
+
+    The classes behind expense.h: storage, indexes, balances, the change
+    feed, ExpenseManager and the sharded engine. Declarations only, apart
+    from templates and one-line accessors; the definitions are in the
+    library sources (expense_support.cpp, expense_model.cpp,
+    expense_analytics.cpp, expense_storage.cpp, expense_manager.cpp,
+    expense_shards.cpp). Included by the library, the command-line tools
+    (expense_tools.cpp) and the tests. Not installed and not a stable API;
+    everything here is in expense::detail.
+===============================================================================
+*/
+
+#ifndef EXPENSE_INTERNAL_H
+#define EXPENSE_INTERNAL_H
+
+#include "expense.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <ctime>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <queue>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string_view>
+#include <charconv>
+#include <stdexcept>
+#include <functional>
+#include <utility>
+#include <type_traits>
+#include <chrono>
+#include <random>
+
+namespace expense {
+namespace detail {
+
+using namespace std;
+
+// ============================================================================
+// UTILITY FUNCTIONS
+// ============================================================================
+
+namespace Utils {
+    // Get current date and time as string
+    string getCurrentDateTime();
+
+    // Validate email format (basic check)
+    bool isValidEmail(const string& email);
+
+    // Validate phone number (basic check - digits only)
+    bool isValidPhone(const string& phone);
+
+    // True if text can be stored as one field of a '|'-separated line
+    // record: no separator, no newline or other control characters
+    bool isRecordSafe(const string& text);
+
+    // Format currency with 2 decimal places
+    string formatCurrency(double amount);
+
+    // Split string by delimiter
+    vector<string> split(const string& str, char delimiter);
+
+    // Parse the whole of text as a number; false on anything else, including
+    // trailing characters and values out of range. Never throws.
+    bool parseInt(const string& text, int& out);
+
+    bool parseDouble(const string& text, double& out);
+
+    // Trim whitespace from string
+    string trim(const string& str);
+
+    // Convert string to lowercase
+    string toLower(const string& str);
+
+    // Turn "YYYY-MM-DD HH:MM:SS" (or just "YYYY-MM-DD") into a sortable
+    // number like 20240415093000. Returns -1 if the text is not a date.
+    long long dateTimeKey(const string& str);
+
+    // 64-bit mixing hash (splitmix64 finalizer)
+    inline uint64_t hash64(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    // Inverse of dateTimeKey: 20240415093000 -> "2024-04-15 09:30:00"
+    string formatDateTimeKey(long long key);
+
+    // Unix seconds of a dateTimeKey, which is in local time
+    long long dateTimeKeyToUnix(long long key);
+
+    // Wall-clock time in Unix milliseconds
+    long long unixMillis();
+
+    // Escape text for use inside a JSON string literal
+    string jsonEscape(const string& str);
+
+    // Create directory if it doesn't exist
+    void createDirectory(const string& path);
+}
+
+// ============================================================================
+// JSON READER
+// ============================================================================
+
+// Minimal pull reader for the JSON this app writes itself (change feed
+// records). object() and array() call back once per field or element with
+// the cursor on the value; the callback must consume it with one of the
+// read*/skip methods. All methods return false on malformed input.
+class JsonReader {
+private:
+    const char* cursor;
+    const char* end;
+
+    void skipSpace();
+
+    bool expect(char c);
+
+public:
+    explicit JsonReader(string_view text) : cursor(text.data()), end(text.data() + text.size()) {}
+
+    bool object(const function<bool(const string& key)>& onField);
+
+    bool array(const function<bool()>& onItem);
+
+    bool readString(string& out);
+
+    bool readNumber(double& out);
+
+    bool readInteger(long long& out);
+
+    bool skip();
+};
+
+// ============================================================================
+// JSON REQUEST PARSER
+// ============================================================================
+
+// Parser for one-line JSON requests: a flat object whose values are
+// strings, numbers, booleans, null or arrays of numbers. It works in place
+// on the caller's buffer: keys and string values are views into it,
+// unescaped where they stand (an escape never decodes to more bytes than
+// it occupies). Array elements go to a pool that keeps its capacity, so
+// after warm-up parsing does not touch the heap.
+class JsonRequestParser {
+public:
+    enum class Kind : uint8_t { STRING, NUMBER, BOOLEAN, NULL_VALUE, ARRAY };
+
+    struct Field {
+        string_view key;
+        Kind kind;
+        string_view text;     // STRING: contents; NUMBER, BOOLEAN, NULL_VALUE: the token
+        double number;        // NUMBER; BOOLEAN as 1 or 0
+        uint32_t first;       // ARRAY: elements [first, first + count) of the pool
+        uint32_t count;
+    };
+
+    static constexpr size_t MAX_FIELDS = 24;
+
+private:
+    Field fields[MAX_FIELDS];
+    size_t fieldCount = 0;
+    vector<double> pool;
+    const char* failure = nullptr;
+    char* cursor = nullptr;
+    char* end = nullptr;
+
+    bool fail(const char* why);
+
+    void skipSpace();
+
+    bool readHex4(unsigned& code);
+
+    // Cursor on the opening quote
+    bool parseString(string_view& out);
+
+    bool parseNumber(double& out, string_view& token);
+
+    bool parseLiteral(Field& field);
+
+    bool parseArray(Field& field);
+
+    bool parseValue(Field& field);
+
+public:
+    JsonRequestParser() { pool.reserve(64); }
+
+    // Parse one request. The text is modified in place and must outlive
+    // every view taken from this parser.
+    bool parse(char* text, size_t length);
+
+    const char* error() const { return failure ? failure : ""; }
+
+    // First field with the given name, or nullptr
+    const Field* field(string_view key) const;
+
+    string_view text(string_view key, string_view fallback = string_view()) const;
+
+    double number(string_view key, double fallback = 0.0) const;
+
+    // Elements of an array field; empty if the field is missing or not an array
+    pair<const double*, size_t> numbers(string_view key) const;
+};
+
+// Appends JSON to a caller-owned string that is reused between messages.
+// Commas between members and elements are inserted automatically.
+class JsonWriter {
+private:
+    string& out;
+    bool needComma = false;
+
+    void separate();
+
+    template <typename... Format>
+    JsonWriter& format(Format... format) {
+        separate();
+        char buffer[64];
+        out.append(buffer, to_chars(buffer, buffer + sizeof(buffer), format...).ptr);
+        return *this;
+    }
+
+public:
+    explicit JsonWriter(string& out) : out(out) {}
+
+    JsonWriter& beginObject() { separate(); out += '{'; needComma = false; return *this; }
+    JsonWriter& endObject() { out += '}'; needComma = true; return *this; }
+    JsonWriter& beginArray() { separate(); out += '['; needComma = false; return *this; }
+    JsonWriter& endArray() { out += ']'; needComma = true; return *this; }
+
+    JsonWriter& key(string_view name);
+
+    JsonWriter& text(string_view value);
+
+    JsonWriter& number(long long value) { return format(value); }
+    JsonWriter& number(double value) { return format(value); }
+    JsonWriter& money(double value) { return format(value, chars_format::fixed, 2); }
+
+    JsonWriter& boolean(bool value);
+
+    // Already-serialized JSON, e.g. Expense::toJson()
+    JsonWriter& raw(string_view json);
+};
+
+// ============================================================================
+// MEMORY ACCOUNTING
+// ============================================================================
+
+enum class MemoryCategory : uint8_t {
+    USERS,
+    EXPENSES,
+    PARTICIPANTS,
+    STRINGS,
+    INDEXES,
+    LEDGER,
+    ROLLUPS,
+    SKETCHES,
+    COUNT
+};
+
+// Process-wide byte and allocation counters per category. Containers opt in
+// through TrackedAllocator; other owners call recordAllocation/recordFree.
+class MemoryTracker {
+private:
+    struct Counters {
+        atomic<int64_t> liveBytes{0};
+        atomic<int64_t> peakBytes{0};
+        atomic<uint64_t> allocations{0};
+        atomic<uint64_t> frees{0};
+    };
+
+    static Counters& counters(MemoryCategory category);
+
+public:
+    struct Usage {
+        MemoryCategory category;
+        int64_t liveBytes;
+        int64_t peakBytes;
+        uint64_t allocations;
+        uint64_t liveAllocations;
+    };
+
+    static const char* categoryName(MemoryCategory category);
+
+    static void recordAllocation(MemoryCategory category, size_t bytes);
+
+    static void recordFree(MemoryCategory category, size_t bytes);
+
+    static void* allocate(MemoryCategory category, size_t bytes);
+
+    static void deallocate(MemoryCategory category, void* p, size_t bytes) noexcept;
+
+    static Usage usage(MemoryCategory category);
+
+    static int64_t totalLiveBytes();
+
+    static void report(ostream& out);
+};
+
+// Stateless allocator that charges every allocation to a category
+template <typename T, MemoryCategory Category>
+struct TrackedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = TrackedAllocator<U, Category>; };
+
+    TrackedAllocator() noexcept = default;
+
+    template <typename U>
+    TrackedAllocator(const TrackedAllocator<U, Category>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(MemoryTracker::allocate(Category, n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        MemoryTracker::deallocate(Category, p, n * sizeof(T));
+    }
+
+    bool operator==(const TrackedAllocator&) const noexcept { return true; }
+    bool operator!=(const TrackedAllocator&) const noexcept { return false; }
+};
+
+template <typename T, MemoryCategory Category>
+using TrackedVector = vector<T, TrackedAllocator<T, Category>>;
+
+template <typename K, typename V, MemoryCategory Category, typename Hash = hash<K>>
+using TrackedHashMap = unordered_map<K, V, Hash, equal_to<K>, TrackedAllocator<pair<const K, V>, Category>>;
+
+// ============================================================================
+// STRING POOL
+// ============================================================================
+
+// Interning pool: every distinct string is stored once and referred to by a
+// 32-bit handle, so equal strings compare by handle. Handle 0 is "".
+// Handles live only for the process; the data files keep the text itself.
+// Storage is chunked and never moves, so get() needs no lock; intern()
+// is serialized by a mutex.
+class StringPool {
+private:
+    static constexpr size_t CHUNK_BITS = 16;
+    static constexpr size_t CHUNK_SIZE = (size_t)1 << CHUNK_BITS;
+    static constexpr size_t MAX_CHUNKS = 4096;
+
+    string* chunks[MAX_CHUNKS] = {};
+    atomic<uint32_t> count;
+    TrackedHashMap<string_view, uint32_t, MemoryCategory::STRINGS> ids;
+    size_t textBytes = 0;
+    size_t limit = 0;   // cap on memoryBytes(), 0 = only MAX_CHUNKS
+    mutable mutex writeLock;
+
+    static bool usesHeap(const string& text);
+
+    size_t bytesLocked() const;
+
+public:
+    StringPool();
+
+    ~StringPool();
+
+    static StringPool& global();
+
+    // Throws length_error ("string pool is full") for a new string once
+    // the pool is out of handles or at its memory limit
+    uint32_t intern(string_view text);
+
+    const string& get(uint32_t id) const;
+
+    uint32_t size() const { return count.load(memory_order_acquire); }
+
+    size_t memoryBytes() const;
+
+    // Refuse new strings once memoryBytes() reaches bytes. Strings are
+    // never freed, so this is the only bound on the pool; it only ever
+    // lowers the limit, so every caller's cap holds.
+    void limitMemory(size_t bytes);
+    size_t memoryLimit() const;
+};
+
+// ============================================================================
+// TASK SCHEDULER
+// ============================================================================
+
+// Urgency of scheduled work. Workers always take interactive tasks before
+// batch ones, so a report requested from the menu overtakes a bulk job at
+// the next task boundary.
+enum class TaskPriority { INTERACTIVE = 0, BATCH = 1 };
+
+// Shared flag for cooperative cancellation. Queued tasks whose token is
+// cancelled are dropped; running tasks may poll cancelled() and stop early.
+class CancellationToken {
+private:
+    shared_ptr<atomic<bool>> flag;
+
+public:
+    CancellationToken() : flag(make_shared<atomic<bool>>(false)) {}
+
+    void cancel() const { flag->store(true, memory_order_relaxed); }
+    bool cancelled() const { return flag->load(memory_order_relaxed); }
+};
+
+// One pool of worker threads for every parallel job in the process. Each
+// worker owns a deque per priority: it pushes and pops its own work at the
+// back, and idle workers steal from the front of the others. Work
+// submitted from outside the pool goes to a shared queue. A thread waiting
+// on a TaskGroup runs queued tasks meanwhile, so nested waits never block
+// a worker.
+class TaskScheduler {
+public:
+    // Tracks a set of tasks so their submitter can wait for them. The
+    // first exception thrown by a task is rethrown by wait().
+    class TaskGroup {
+    private:
+        friend class TaskScheduler;
+        TaskPriority priority;
+        atomic<size_t> pending{0};
+        mutex lock;
+        condition_variable done;
+        exception_ptr error;
+
+        void finishOne();
+
+    public:
+        explicit TaskGroup(TaskPriority priority = TaskPriority::INTERACTIVE) : priority(priority) {}
+    };
+
+private:
+    static constexpr size_t PRIORITIES = 2;
+    static constexpr size_t NO_WORKER = (size_t)-1;
+
+    struct Task {
+        function<void()> run;
+        TaskGroup* group = nullptr;
+        CancellationToken token;
+    };
+
+    struct Worker {
+        mutex lock;
+        deque<Task> queues[PRIORITIES];
+        thread handle;
+        atomic<uint64_t> busyNanos{0};
+        atomic<uint64_t> tasksRun{0};
+        atomic<uint64_t> steals{0};
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    mutex injectLock;
+    deque<Task> injected[PRIORITIES];
+    mutex idleLock;
+    condition_variable idle;
+    atomic<size_t> queued{0};
+    bool stopping = false;
+    chrono::steady_clock::time_point started;
+    atomic<uint64_t> submitted[PRIORITIES] = {};
+    atomic<uint64_t> completed[PRIORITIES] = {};
+    atomic<uint64_t> dropped[PRIORITIES] = {};
+    atomic<uint64_t> helperTasks{0};
+
+    static inline thread_local TaskScheduler* currentScheduler = nullptr;
+    static inline thread_local size_t currentWorker = NO_WORKER;
+
+    size_t selfIndex() const { return currentScheduler == this ? currentWorker : NO_WORKER; }
+
+    // Most urgent task available to this thread: own deque (newest first),
+    // then the shared queue, then the oldest task of another worker
+    bool takeTask(size_t self, size_t maxPriority, Task& task, size_t& priority);
+
+    void execute(Task& task, size_t priority, size_t self);
+
+    void workerLoop(size_t self);
+
+public:
+    explicit TaskScheduler(size_t workerCount);
+
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // The process-wide scheduler, one worker per hardware thread
+    static TaskScheduler& global();
+
+    size_t workerCount() const { return workers.size(); }
+
+    void submit(function<void()> run, TaskPriority priority = TaskPriority::BATCH, TaskGroup* group = nullptr,
+                CancellationToken token = CancellationToken());
+
+    // Wait for every task of the group, running queued tasks at least as
+    // urgent as the group's in the meantime
+    void wait(TaskGroup& group);
+
+    // Run fn(chunkBegin, chunkEnd) over [begin, end) in chunks of `grain`
+    // and return when all chunks are done. The caller runs the first chunk.
+    void parallelFor(size_t begin, size_t end, size_t grain, const function<void(size_t, size_t)>& fn,
+                     TaskPriority priority = TaskPriority::BATCH, CancellationToken token = CancellationToken());
+
+    // Busy time of the workers since the scheduler started, per task counts
+    // by priority and steals
+    void report(ostream& out) const;
+};
+
+// ============================================================================
+// ENUMS
+// ============================================================================
+
+// SplitMethod and ExportOrder themselves are part of expense.h
+
+string splitMethodToString(SplitMethod method);
+
+SplitMethod stringToSplitMethod(const string& str);
+
+// ============================================================================
+// USER CLASS
+// ============================================================================
+
+class User {
+private:
+    int id;
+    uint32_t name;      // handles into StringPool::global()
+    uint32_t email;
+    string phone;
+    string password;
+
+public:
+    // Constructors
+    User() : id(0), name(0), email(0), phone(""), password("") {}
+    
+    User(int id, const string& name, const string& email, string phone, string password);
+
+    // Getters
+    int getId() const { return id; }
+    const string& getName() const { return StringPool::global().get(name); }
+    const string& getEmail() const { return StringPool::global().get(email); }
+    string getPhone() const { return phone; }
+    
+    // Password verification
+    bool verifyPassword(const string& pwd) const;
+
+    // Display user information
+    void display(ostream& out) const;
+
+    // Serialize to string for file storage
+    string serialize() const;
+
+    // JSON object for the change feed; the password is never included
+    string toJson() const;
+
+    // Inverse of toJson; the user comes back without a password
+    static User fromJson(JsonReader& reader);
+
+    // The same user under another ID
+    User withId(int newId) const;
+
+    // Deserialize from string; a malformed line gives a user with ID 0
+    static User deserialize(const string& data);
+};
+
+// ============================================================================
+// EXPENSE PARTICIPANT CLASS
+// ============================================================================
+
+// Packed to 8 bytes: 32-bit user id and the share in whole cents
+class ExpenseParticipant {
+private:
+    uint32_t userId;
+    int32_t shareCents;
+
+public:
+    ExpenseParticipant() : userId(0), shareCents(0) {}
+    
+    // Largest share (either sign) the cents field holds; addExpense rejects
+    // more, and records read from disk saturate instead of wrapping
+    static constexpr double MAX_SHARE = INT32_MAX / 100.0;
+
+    ExpenseParticipant(int userId, double share);
+
+    // Getters
+    int getUserId() const { return (int)userId; }
+    double getShare() const { return shareCents / 100.0; }
+    int32_t getShareCents() const { return shareCents; }
+
+    // Serialization
+    string serialize() const;
+
+    // A malformed entry gives user ID 0
+    static ExpenseParticipant deserialize(const string& data);
+};
+
+// Participant list that keeps up to three participants inside the expense
+// record itself and only allocates for larger groups (32 bytes in total,
+// versus a 24-byte vector header plus a separate heap block).
+class ParticipantList {
+private:
+    static constexpr uint32_t INLINE_CAPACITY = 3;
+
+    uint32_t count;
+    uint32_t capacity;
+    union {
+        ExpenseParticipant* heapItems;
+        alignas(ExpenseParticipant) unsigned char inlineBytes[INLINE_CAPACITY * sizeof(ExpenseParticipant)];
+    };
+
+    bool isInline() const { return capacity == INLINE_CAPACITY; }
+
+    ExpenseParticipant* items();
+
+    const ExpenseParticipant* items() const;
+
+    void copyFrom(const ParticipantList& other);
+
+    static ExpenseParticipant* allocateItems(uint32_t n);
+
+    static void freeItems(ExpenseParticipant* items, uint32_t n);
+
+    void release();
+
+public:
+    ParticipantList() : count(0), capacity(INLINE_CAPACITY) {}
+    ParticipantList(const ParticipantList& other) { copyFrom(other); }
+
+    ParticipantList(ParticipantList&& other) noexcept;
+
+    ParticipantList& operator=(const ParticipantList& other);
+
+    ParticipantList& operator=(ParticipantList&& other) noexcept;
+
+    ~ParticipantList() { release(); }
+
+    void push_back(const ExpenseParticipant& participant);
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const ExpenseParticipant& operator[](size_t i) const { return items()[i]; }
+    const ExpenseParticipant* begin() const { return items(); }
+    const ExpenseParticipant* end() const { return items() + count; }
+
+    // Heap bytes owned by this list (0 while the participants fit inline)
+    size_t heapBytes() const { return isInline() ? 0 : capacity * sizeof(ExpenseParticipant); }
+};
+
+// ============================================================================
+// EXPENSE CLASS
+// ============================================================================
+
+class Expense {
+private:
+    int id;
+    uint32_t description;   // handle into StringPool::global()
+    double amount;
+    SplitMethod splitMethod;
+    int createdBy;
+    long long createdAt;    // packed date, see Utils::dateTimeKey
+    ParticipantList participants;
+
+public:
+    // Constructors
+    Expense();
+    
+    Expense(int id, const string& desc, double amt, SplitMethod method, int creator);
+
+    // Getters
+    int getId() const { return id; }
+    const string& getDescription() const { return StringPool::global().get(description); }
+    uint32_t getDescriptionId() const { return description; }
+    double getAmount() const { return amount; }
+    SplitMethod getSplitMethod() const { return splitMethod; }
+    int getCreatedBy() const { return createdBy; }
+    string getCreatedAt() const { return Utils::formatDateTimeKey(createdAt); }
+    long long getCreatedAtKey() const { return createdAt; }
+    const ParticipantList& getParticipants() const { return participants; }
+
+    // Add participant
+    void addParticipant(const ExpenseParticipant& participant);
+
+    // Display expense details; nameOf maps a user ID to a display name
+    void display(const function<const string&(int)>& nameOf, ostream& out) const;
+
+    // Serialization
+    string serialize() const;
+
+    // JSON object for the change feed; globalId is added as "gid" when given
+    string toJson(const string& globalId = "") const;
+
+    // Inverse of toJson; returns an expense with ID 0 on malformed input
+    static Expense fromJson(JsonReader& reader, string* globalId = nullptr);
+
+    // The same expense under another ID, with every user ID passed through
+    // mapUser (used when merging records from another replica)
+    Expense remapped(int newId, const function<int(int)>& mapUser) const;
+
+    // A malformed line, including any malformed participant, gives an
+    // expense with ID 0 so loaders skip it
+    static Expense deserialize(const string& data);
+};
+
+// All expenses, charged to the EXPENSES memory category
+using ExpenseList = TrackedVector<Expense, MemoryCategory::EXPENSES>;
+
+// Identity of an expense across replicas. Expense IDs are only unique
+// within one data directory; the pair (replica that created it, its ID
+// there) is unique everywhere. Written as "<origin hex>-<counter>" after
+// the participants field of expenses.txt.
+struct GlobalExpenseId {
+    uint64_t origin = 0;    // replica ID; 0 for records written before replica IDs
+    uint64_t counter = 0;   // expense ID at the origin, or a content hash for old records
+
+    bool operator==(const GlobalExpenseId& other) const {
+        return origin == other.origin && counter == other.counter;
+    }
+
+    bool valid() const { return origin != 0 || counter != 0; }
+
+    string toString() const;
+
+    static GlobalExpenseId parse(const string& text);
+
+    // Identity of an expenses.txt line. Lines from before replica IDs get a
+    // hash of their text, so copies of the same data directory agree on it.
+    static GlobalExpenseId ofRecord(const string& line);
+
+    struct Hash {
+        size_t operator()(const GlobalExpenseId& gid) const {
+            return (size_t)Utils::hash64(gid.origin ^ Utils::hash64(gid.counter));
+        }
+    };
+};
+
+// ============================================================================
+// EXPENSE STORE
+// ============================================================================
+
+// Expenses in fixed-size pages with an optional memory cap. When resident
+// pages exceed the cap, the least recently used full pages are written to
+// an on-disk spill segment and dropped from memory; reading a spilled
+// expense faults its page back in. References returned by operator[] stay
+// valid until another page is faulted in.
+class ExpenseStore {
+private:
+    static constexpr size_t PAGE_SIZE = 256;   // expenses per page
+
+    struct Page {
+        ExpenseList rows;
+        bool resident = true;
+        int64_t spillOffset = -1;     // position in the spill file, -1 if never written
+        uint32_t spillLength = 0;
+        size_t bytes = 0;             // estimated footprint while resident
+        list<size_t>::iterator lruPosition;
+    };
+
+    mutable TrackedVector<Page, MemoryCategory::EXPENSES> pages;
+    mutable list<size_t> lru;                 // resident full pages, most recent first
+    mutable size_t residentBytes = 0;
+    mutable uint64_t faults = 0;
+    mutable uint64_t evictions = 0;
+    mutable fstream spill;
+    mutable uint64_t spillEnd = 0;            // bytes of the spill file in use
+    mutable bool spillWriteFailed = false;
+    size_t count = 0;
+    mutable size_t budget = 0;                // 0 means unlimited
+    string spillPath;                         // empty once the file is unlinked
+
+    // Create a spill file no other store uses, next to pathPrefix
+    bool openSpill(const string& pathPrefix);
+
+    static size_t footprint(const Expense& expense);
+
+    void touch(size_t pageNumber) const;
+
+    // A page whose spill write fails stays resident and the budget is
+    // turned off (see spillFailed())
+    void evict(size_t pageNumber) const;
+
+    // Evict least recently used pages until under budget, always keeping
+    // the two most recently used pages resident.
+    void enforceBudget() const;
+
+    // The page's lines; throws runtime_error if they cannot all be read back
+    string readSpilled(const Page& page) const;
+
+    void faultIn(size_t pageNumber) const;
+
+public:
+    class const_iterator {
+    private:
+        const ExpenseStore* store;
+        size_t index;
+
+    public:
+        const_iterator(const ExpenseStore* store, size_t index) : store(store), index(index) {}
+        const Expense& operator*() const { return (*store)[index]; }
+        const_iterator& operator++() { index++; return *this; }
+        bool operator!=(const const_iterator& other) const { return index != other.index; }
+        bool operator==(const const_iterator& other) const { return index == other.index; }
+    };
+
+    ~ExpenseStore();
+
+    // Cap resident expense memory at `bytes` (0 = unlimited), spilling to a
+    // file of this store's own named `pathPrefix`.XXXXXX (unlinked at once
+    // where the OS allows). False if it cannot be created; the budget is
+    // then off. Reading a spilled page back throws runtime_error if the
+    // file lost it.
+    bool setMemoryBudget(size_t bytes, const string& pathPrefix);
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+
+    const Expense& operator[](size_t index) const {
+        size_t pageNumber = index / PAGE_SIZE;
+        if (!pages[pageNumber].resident) {
+            faultIn(pageNumber);
+        } else {
+            touch(pageNumber);
+        }
+        return pages[pageNumber].rows[index % PAGE_SIZE];
+    }
+
+    void push_back(const Expense& expense);
+
+    void clear();
+
+    // Write every expense as text lines, each followed by suffix(ordinal)
+    // when given; suffix must be safe to call from several threads.
+    // Resident pages are rendered on the task scheduler a window at a time;
+    // spilled pages are copied straight from the spill file by the calling
+    // thread instead of being faulted back in. Throws runtime_error, having
+    // written only part of the rows, if a spilled page cannot be read back.
+    void writeAll(ostream& out, const function<string(size_t)>& suffix = nullptr) const;
+
+    size_t memoryBudget() const { return budget; }
+    size_t residentMemory() const { return residentBytes; }
+    size_t pageCount() const { return pages.size(); }
+    size_t residentPages() const { return lru.size() + (pages.empty() ? 0 : 1); }
+    uint64_t pageFaults() const { return faults; }
+    uint64_t pageEvictions() const { return evictions; }
+    // A spill write failed and the budget was turned off
+    bool spillFailed() const { return spillWriteFailed; }
+};
+
+// ============================================================================
+// COMPRESSED BITMAPS
+// ============================================================================
+
+// Roaring-style compressed bitmap of 32-bit values. Values are grouped by
+// their high 16 bits; each group is a sorted array of low halves while it
+// holds at most 4096 values, and a 65536-bit bitset once it grows larger.
+class RoaringBitmap {
+private:
+    static constexpr size_t ARRAY_LIMIT = 4096;
+    static constexpr size_t BITSET_WORDS = 65536 / 64;
+
+    using Values = TrackedVector<uint16_t, MemoryCategory::INDEXES>;
+    using Words = TrackedVector<uint64_t, MemoryCategory::INDEXES>;
+
+    struct Container {
+        uint16_t key = 0;
+        uint32_t cardinality = 0;
+        Values values;   // used while cardinality <= ARRAY_LIMIT
+        Words bits;      // used above ARRAY_LIMIT
+
+        bool isBitset() const { return !bits.empty(); }
+
+        bool contains(uint16_t low) const;
+
+        void toBitset();
+
+        // Pick the cheaper representation after a bulk operation
+        void normalize();
+
+        void add(uint16_t low);
+
+        // Expand to a bitset view without changing this container
+        Words asBits() const;
+    };
+
+    TrackedVector<Container, MemoryCategory::INDEXES> containers;   // sorted by key
+
+    static uint32_t popcount(const Words& words);
+
+    static Container intersect(const Container& a, const Container& b);
+
+    static Container unite(const Container& a, const Container& b);
+
+    static Container subtract(const Container& a, const Container& b);
+
+public:
+    void add(uint32_t value);
+
+    bool contains(uint32_t value) const;
+
+    uint64_t cardinality() const;
+
+    bool empty() const { return containers.empty(); }
+
+    // Values in ascending order
+    vector<uint32_t> toVector() const;
+
+    size_t memoryBytes() const;
+
+    // a AND b
+    static RoaringBitmap intersectionOf(const RoaringBitmap& a, const RoaringBitmap& b);
+
+    // a OR b
+    static RoaringBitmap unionOf(const RoaringBitmap& a, const RoaringBitmap& b);
+
+    // a AND NOT b
+    static RoaringBitmap differenceOf(const RoaringBitmap& a, const RoaringBitmap& b);
+};
+
+// ============================================================================
+// EXPENSE QUERY ENGINE
+// ============================================================================
+
+// A parsed search such as: payer=3 amount>500 quarter=2024-Q2 participant=7
+// Every filter is optional; an empty query matches every expense.
+struct ExpenseQuery {
+    int payerId = 0;                     // 0 means any payer
+    vector<int> participantIds;          // all of these must be involved
+    vector<int> anyParticipantIds;       // at least one of these must be involved
+    vector<int> excludedParticipantIds;  // none of these may be involved
+    double minAmount = 0.0;              // inclusive bounds
+    double maxAmount = numeric_limits<double>::max();
+    long long fromTime = 0;              // inclusive, see Utils::dateTimeKey
+    long long toTime = numeric_limits<long long>::max();
+    bool hasMethod = false;
+    SplitMethod method = SplitMethod::EQUAL;
+    string descriptionEquals;            // lowercase, exact match
+    string descriptionContains;          // lowercase, substring match
+
+    bool hasAmountFilter() const;
+
+    bool hasTimeFilter() const;
+
+    // Split the query text into tokens, keeping "quoted values" together
+    static vector<string> tokenize(const string& text);
+
+    // Parse the query language. Supported filters:
+    //   payer=ID  participant=ID[,ID...]  anyof=ID,ID,...  without=ID[,ID...]
+    //   amount>N amount>=N amount<N amount<=N
+    //   from=YYYY-MM-DD  to=YYYY-MM-DD  month=YYYY-MM  quarter=YYYY-QN
+    //   method=EQUAL|EXACT|PERCENTAGE  desc=text  desc~text
+    static bool parse(const string& text, ExpenseQuery& query, string& error);
+};
+
+// Secondary indexes and a columnar copy of the hot expense fields.
+// Rows are addressed by ordinal (position in the expense list).
+class ExpenseIndex {
+private:
+    static constexpr size_t BATCH_SIZE = 1024;
+
+    template <typename T>
+    using Column = TrackedVector<T, MemoryCategory::INDEXES>;
+    using PostingList = Column<uint32_t>;
+
+    Column<int> payerColumn;
+    Column<double> amountColumn;
+    Column<long long> timeColumn;
+    Column<uint8_t> methodColumn;
+    Column<uint32_t> descriptionColumn;   // StringPool handles
+    bool timeSorted = true;
+
+    TrackedHashMap<int, PostingList, MemoryCategory::INDEXES> byPayer;
+    TrackedHashMap<int, RoaringBitmap, MemoryCategory::INDEXES> byParticipant;
+    RoaringBitmap deleted;   // tombstoned ordinals, hidden from every query
+
+    // Lowercased text of each distinct description, keyed by pool handle,
+    // so description filters never touch names, emails or other pooled strings
+    TrackedHashMap<uint32_t, string, MemoryCategory::INDEXES> loweredDescriptions;
+    uint32_t descriptionLimit = 0;   // one past the largest description handle
+
+    static const PostingList& emptyList();
+
+    const RoaringBitmap& bitmapFor(int userId) const;
+
+    static const PostingList& lookup(const TrackedHashMap<int, PostingList, MemoryCategory::INDEXES>& index, int key);
+
+public:
+    void clear();
+
+    size_t size() const { return payerColumn.size(); }
+
+    void markDeleted(uint32_t ordinal) { deleted.add(ordinal); }
+    bool isDeleted(uint32_t ordinal) const { return deleted.contains(ordinal); }
+
+    // Index the expense stored at the given ordinal (ordinals only grow)
+    void add(uint32_t ordinal, const Expense& expense);
+
+    // Run a query and return matching ordinals in storage order.
+    // The planner drives from the participant bitmaps or payer postings (or
+    // a time range when the time column is sorted) and evaluates the
+    // remaining predicates over the columns in fixed-size batches.
+    vector<uint32_t> run(const ExpenseQuery& query, string* plan = nullptr) const;
+};
+
+// ============================================================================
+// ROLLUP TABLES
+// ============================================================================
+
+// Month keys are YYYYMM numbers, e.g. 202404 for April 2024
+int monthKeyOf(long long dateTimeKey);
+
+struct UserMonthTotals {
+    double paid = 0.0;      // bills this user paid for
+    double spent = 0.0;     // this user's own shares
+    int expenseCount = 0;   // expenses this user took part in
+
+    void merge(const UserMonthTotals& other);
+};
+
+// Money that moved between two users: what each one paid for the other
+struct PairFlow {
+    double firstPaidForSecond = 0.0;
+    double secondPaidForFirst = 0.0;
+
+    void merge(const PairFlow& other);
+
+    PairFlow swapped() const;
+};
+
+// Pre-aggregated per-month totals keyed by (user, month) and (user pair, month).
+// Pairs are stored with the smaller user id first.
+class RollupTables {
+private:
+    struct PairMonthKey {
+        int first;
+        int second;
+        int month;
+
+        bool operator==(const PairMonthKey& other) const {
+            return first == other.first && second == other.second && month == other.month;
+        }
+    };
+
+    struct PairMonthKeyHash {
+        size_t operator()(const PairMonthKey& key) const {
+            uint64_t h = (uint64_t)(uint32_t)key.first * 0x9E3779B97F4A7C15ULL;
+            h ^= (uint64_t)(uint32_t)key.second + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+            h ^= (uint64_t)(uint32_t)key.month + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+            return (size_t)h;
+        }
+    };
+
+    TrackedHashMap<uint64_t, UserMonthTotals, MemoryCategory::ROLLUPS> byUserMonth;
+    TrackedHashMap<PairMonthKey, PairFlow, MemoryCategory::ROLLUPS, PairMonthKeyHash> byPairMonth;
+
+    static uint64_t userMonthKey(int userId, int month);
+
+public:
+    void clear();
+
+    // sign = -1 backs out an expense that was deleted
+    void add(const Expense& expense, int sign = 1);
+
+    void merge(const RollupTables& other);
+
+    UserMonthTotals userMonth(int userId, int month) const;
+
+    // Flow between the two users, oriented so that "first" is userA
+    PairFlow pairMonth(int userA, int userB, int month) const;
+
+    // Build from scratch, one slice per scheduler worker, then merge the partial tables
+    static RollupTables build(const ExpenseList& expenses);
+};
+
+// ============================================================================
+// BALANCE LEDGER
+// ============================================================================
+
+// Running balances kept up to date as expenses are added, so balance
+// questions never need to rescan the expense history.
+class BalanceLedger {
+private:
+    static constexpr double EPSILON = 0.005;
+
+    using Row = TrackedHashMap<int, double, MemoryCategory::LEDGER>;
+
+    // owedTo[a][b] = how much b owes a (negative when a owes b)
+    TrackedHashMap<int, Row, MemoryCategory::LEDGER> owedTo;
+    Row netBalance;   // positive = others owe this user
+    set<pair<double, int>, less<pair<double, int>>,
+        TrackedAllocator<pair<double, int>, MemoryCategory::LEDGER>> ranking;   // (net balance, user id), ascending
+
+    void setNet(int userId, double value);
+
+public:
+    struct Entry {
+        int userId;
+        int counterpartyId;   // 0 for per-user net entries
+        double amount;
+    };
+
+    void clear();
+
+    // Record that the payer covered `share` on behalf of the participant
+    void apply(int payerId, int participantId, double share);
+
+    // One side of a debt: the counterparty owes the user `amount` more. A
+    // sharded ledger applies the two sides on the shards owning each user.
+    void credit(int userId, int counterpartyId, double amount);
+
+    void apply(const Expense& expense);
+
+    // Undo apply() for an expense that was deleted
+    void revert(const Expense& expense);
+
+    double net(int userId) const;
+
+    // Everyone the user has an open balance with; positive amount = they owe the user
+    vector<Entry> balancesFor(int userId) const;
+
+    // Users with the most negative net balance, largest debt first
+    vector<Entry> topDebtors(size_t k) const;
+
+    // Users with the most positive net balance, largest credit first
+    vector<Entry> topCreditors(size_t k) const;
+
+    // Every outstanding debt once: userId owes counterpartyId `amount`
+    vector<Entry> allDebts() const;
+
+    // Largest outstanding pairwise debts: userId owes counterpartyId `amount`.
+    // One pass over the pairs with a size-k min-heap.
+    vector<Entry> topPairs(size_t k) const;
+};
+
+// ============================================================================
+// DEBT GRAPH ANALYTICS
+// ============================================================================
+
+// Analytics over the "who owes whom" graph: connected components via
+// union-find, cancellation of debt cycles (A owes B owes C owes A) and a
+// settlement plan per component. Components are processed in parallel.
+class DebtGraph {
+public:
+    struct Transfer {
+        int fromUser;    // pays
+        int toUser;      // receives
+        double amount;
+    };
+
+    struct Component {
+        vector<int> userIds;
+        size_t edgesBefore = 0;
+        size_t edgesAfterCancellation = 0;
+        size_t cyclesCancelled = 0;
+        double amountCancelled = 0.0;
+        vector<Transfer> remainingDebts;   // debts left after cycle cancellation
+        vector<Transfer> settlement;       // transfers that settle the component
+    };
+
+    // debts: userId owes counterpartyId `amount` (as produced by BalanceLedger::allDebts)
+    static vector<Component> analyze(const vector<BalanceLedger::Entry>& debts);
+
+private:
+    static constexpr double EPSILON = 0.005;
+
+    struct Edge {
+        int from;
+        int to;
+        double amount;
+        bool alive;
+    };
+
+    static Component solveComponent(const vector<int>& nodes, const vector<size_t>& edgeIds,
+                                    const vector<BalanceLedger::Entry>& debts, const vector<int>& userOf);
+
+    // Depth-first search that cancels every cycle it closes. Cancelling
+    // subtracts the smallest debt on the cycle from each edge, which kills at
+    // least one edge, and the search resumes from the tail of that edge.
+    static void cancelCycles(int nodeCount, vector<Edge>& edges, Component& component);
+
+    // Greedy settlement: repeatedly match the largest debtor with the largest
+    // creditor. Produces at most (users - 1) transfers.
+    static vector<Transfer> settle(const vector<double>& net, const vector<int>& userIds);
+};
+
+// ============================================================================
+// APPROXIMATE ANALYTICS (SKETCHES)
+// ============================================================================
+
+// HyperLogLog distinct counter with 2^10 one-byte registers (1 KB).
+// Standard error is about 1.04 / sqrt(1024) = 3.25%.
+class HyperLogLog {
+private:
+    static constexpr int PRECISION = 10;
+    static constexpr size_t REGISTERS = (size_t)1 << PRECISION;
+    TrackedVector<uint8_t, MemoryCategory::SKETCHES> registers;
+
+public:
+    HyperLogLog() : registers(REGISTERS, 0) {}
+
+    void add(uint64_t hash);
+
+    void merge(const HyperLogLog& other);
+
+    double estimate() const;
+
+    static double relativeError() { return 1.04 / sqrt((double)REGISTERS); }
+    static size_t bytes() { return REGISTERS; }
+};
+
+// Count-min sketch with 4 rows of 2048 counters (32 KB).
+// Estimates never undercount and overcount by at most e/2048 (~0.13%) of
+// the total count with probability 1 - e^-4 (~98%).
+class CountMinSketch {
+private:
+    static constexpr size_t DEPTH = 4;
+    static constexpr size_t WIDTH = 2048;
+    TrackedVector<uint32_t, MemoryCategory::SKETCHES> counters;
+    uint64_t total = 0;
+
+    static size_t column(uint64_t key, size_t row);
+
+public:
+    CountMinSketch() : counters(DEPTH * WIDTH, 0) {}
+
+    void add(uint64_t key, uint32_t count = 1);
+
+    uint32_t estimate(uint64_t key) const;
+
+    void merge(const CountMinSketch& other);
+
+    uint64_t totalCount() const { return total; }
+    double errorBound() const { return exp(1.0) / WIDTH * total; }
+    static size_t bytes() { return DEPTH * WIDTH * sizeof(uint32_t); }
+};
+
+// Streaming sketches maintained on every expense: distinct co-participants
+// per user (HyperLogLog) and co-participation counts per user pair
+// (count-min with a bounded set of heavy-hitter candidates). All parts are
+// mergeable, so per-thread or per-shard sketches can be combined.
+// At most MAX_PARTNER_SKETCHES users keep a HyperLogLog; past that the
+// least recently updated ones are dropped and start over if seen again.
+class ExpenseSketches {
+public:
+    struct HeavyPair {
+        int firstUser;
+        int secondUser;
+        uint32_t estimatedCount;
+    };
+
+private:
+    static constexpr size_t MAX_CANDIDATES = 64;
+    static constexpr size_t MAX_PARTNER_SKETCHES = 16384;   // ~16 MB
+
+    struct PartnerSketch {
+        HyperLogLog distinct;
+        uint64_t lastUsed = 0;
+    };
+
+    TrackedHashMap<int, PartnerSketch, MemoryCategory::SKETCHES> partners;
+    uint64_t clock = 0;
+    size_t evicted = 0;
+    CountMinSketch pairCounts;
+    TrackedHashMap<uint64_t, uint32_t, MemoryCategory::SKETCHES> candidates;   // pair key -> estimated count
+
+    static uint64_t pairKey(int a, int b);
+
+    void offerCandidate(uint64_t key);
+
+    HyperLogLog& partnerSketch(int userId);
+
+    // Drop the least recently updated eighth at once, so trimming is
+    // amortized over many additions
+    void trimPartners();
+
+public:
+    void clear();
+
+    void add(const Expense& expense);
+
+    // `other` is taken to be newer: its updates rank after all of ours
+    void merge(const ExpenseSketches& other);
+
+    double distinctPartners(int userId) const;
+
+    size_t evictedPartners() const { return evicted; }
+
+    vector<HeavyPair> heavyPairs(size_t k) const;
+
+    double pairErrorBound() const { return pairCounts.errorBound(); }
+
+    size_t memoryBytes() const;
+
+    // Build per-worker sketches over slices of the expenses and merge them
+    static ExpenseSketches build(const ExpenseList& expenses);
+};
+
+// ============================================================================
+// PREFIX INDEX
+// ============================================================================
+
+// Sorted array of (lowercase key, user id) for prefix lookups with binary
+// search. Each name is indexed in full and from the start of every word,
+// so "smi" finds "John Smith". Single inserts go to a small sorted delta
+// (about sqrt(n) entries) that is merged into the main array when it
+// fills, so an insert costs O(sqrt n) amortized instead of O(n); lookups
+// search both arrays.
+class PrefixIndex {
+private:
+    static constexpr size_t MIN_DELTA = 64;
+
+    using Entry = pair<string, int>;
+    using Entries = TrackedVector<Entry, MemoryCategory::INDEXES>;
+
+    Entries entries;
+    Entries delta;
+
+    static vector<string> keysFor(const string& text, bool everyWord);
+
+    static Entries::const_iterator firstAtLeast(const Entries& list, const string& key);
+
+    void mergeDelta();
+
+public:
+    bool wordPrefixes = false;
+
+    void clear();
+
+    // Append during bulk loading; call build() once afterwards
+    void append(const string& text, int userId);
+
+    void build();
+
+    // Insert one user into the delta, folding it into the main array once
+    // it outgrows sqrt(n)
+    void insert(const string& text, int userId);
+
+    // User ids whose key starts with the prefix, in key order, without duplicates
+    vector<int> search(const string& prefix, size_t limit) const;
+
+    // User ids whose key equals the text exactly (case-insensitive)
+    vector<int> exact(const string& text) const;
+};
+
+// ============================================================================
+// EXTERNAL MERGE SORT
+// ============================================================================
+
+// Sorts an unbounded stream of fixed-size records with bounded memory.
+// Records are buffered up to the memory limit, sorted and written as runs
+// to temporary files, then k-way merged. If a combine function is given,
+// records with equal keys are folded together while writing runs and while
+// merging, so each key comes out once. Large buffers are sorted on the
+// task scheduler at batch priority.
+template <typename Record, typename Less = less<Record>>
+class ExternalMergeSorter {
+    static_assert(is_trivially_copyable<Record>::value, "records are written to disk as raw bytes");
+
+public:
+    using Combine = function<void(Record& into, const Record& from)>;
+    using Sink = function<void(const Record&)>;
+
+private:
+    static constexpr size_t IO_BUFFER_RECORDS = (1 << 16) / sizeof(Record) + 1;   // ~64 KB per open run
+    static constexpr size_t PARALLEL_SORT_SLICE = 1 << 15;                         // records per sorted slice at least
+
+    string tempPrefix;
+    size_t bufferLimit;
+    size_t maxFanIn;
+    Less less;
+    Combine combine;
+    vector<Record> buffer;
+    vector<string> runs;
+    int nextRunNumber = 0;
+    uint64_t recordsAdded = 0;
+    uint64_t runBytes = 0;
+    int passes = 0;
+
+    bool sameKey(const Record& a, const Record& b) const {
+        return !less(a, b) && !less(b, a);
+    }
+
+    // Folds equal keys into one record before passing it on
+    class Folder {
+    private:
+        const ExternalMergeSorter& sorter;
+        const Sink& sink;
+        Record pending;
+        bool hasPending = false;
+
+    public:
+        Folder(const ExternalMergeSorter& sorter, const Sink& sink) : sorter(sorter), sink(sink) {}
+
+        void operator()(const Record& record) {
+            if (hasPending && sorter.combine && sorter.sameKey(pending, record)) {
+                sorter.combine(pending, record);
+                return;
+            }
+            if (hasPending) sink(pending);
+            pending = record;
+            hasPending = true;
+        }
+
+        void finish() {
+            if (hasPending) sink(pending);
+            hasPending = false;
+        }
+    };
+
+    class RunWriter {
+    private:
+        ofstream out;
+        vector<Record> block;
+        uint64_t bytes = 0;
+
+    public:
+        explicit RunWriter(const string& path) : out(path, ios::binary | ios::trunc) {
+            if (!out.is_open()) throw runtime_error("cannot create sort run " + path);
+            block.reserve(IO_BUFFER_RECORDS);
+        }
+
+        void write(const Record& record) {
+            block.push_back(record);
+            if (block.size() == IO_BUFFER_RECORDS) flush();
+        }
+
+        void flush() {
+            out.write(reinterpret_cast<const char*>(block.data()), (streamsize)(block.size() * sizeof(Record)));
+            bytes += block.size() * sizeof(Record);
+            block.clear();
+        }
+
+        uint64_t close() {
+            flush();
+            out.close();
+            if (out.fail()) throw runtime_error("write failed on sort run");
+            return bytes;
+        }
+    };
+
+    class RunReader {
+    private:
+        ifstream in;
+        vector<Record> block;
+        size_t position = 0;
+
+    public:
+        explicit RunReader(const string& path) : in(path, ios::binary) {
+            if (!in.is_open()) throw runtime_error("cannot open sort run " + path);
+        }
+
+        bool next(Record& record) {
+            if (position == block.size()) {
+                block.resize(IO_BUFFER_RECORDS);
+                in.read(reinterpret_cast<char*>(block.data()), (streamsize)(block.size() * sizeof(Record)));
+                block.resize((size_t)in.gcount() / sizeof(Record));
+                position = 0;
+                if (block.empty()) return false;
+            }
+            record = block[position++];
+            return true;
+        }
+    };
+
+    string newRunPath() {
+        return tempPrefix + ".run" + to_string(nextRunNumber++);
+    }
+
+    // Sort slices of the buffer in parallel, then merge neighbours in
+    // rounds. Merges borrow up to half the buffer as scratch space.
+    void sortBuffer() {
+        TaskScheduler& scheduler = TaskScheduler::global();
+        size_t slices = min(scheduler.workerCount(), buffer.size() / PARALLEL_SORT_SLICE);
+        if (slices < 2) {
+            sort(buffer.begin(), buffer.end(), less);
+            return;
+        }
+        vector<size_t> bounds(slices + 1);
+        for (size_t i = 0; i <= slices; i++) bounds[i] = buffer.size() * i / slices;
+        auto at = [&](size_t slice) { return buffer.begin() + bounds[min(slice, slices)]; };
+
+        scheduler.parallelFor(0, slices, 1, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) sort(at(i), at(i + 1), less);
+        });
+        for (size_t width = 1; width < slices; width *= 2) {
+            scheduler.parallelFor(0, (slices + 2 * width - 1) / (2 * width), 1, [&](size_t first, size_t last) {
+                for (size_t pair = first; pair < last; pair++) {
+                    size_t left = pair * 2 * width;
+                    if (left + width < slices) inplace_merge(at(left), at(left + width), at(left + 2 * width), less);
+                }
+            });
+        }
+    }
+
+    void spillBuffer() {
+        if (buffer.empty()) return;
+        sortBuffer();
+        string path = newRunPath();
+        RunWriter writer(path);
+        Sink write = [&writer](const Record& record) { writer.write(record); };
+        Folder folder(*this, write);
+        for (const auto& record : buffer) folder(record);
+        folder.finish();
+        runBytes += writer.close();
+        runs.push_back(path);
+        buffer.clear();
+    }
+
+    // k-way merge of the given runs into sink, deleting them afterwards
+    void mergeRuns(const vector<string>& inputs, const Sink& sink) {
+        vector<unique_ptr<RunReader>> readers;
+        for (const auto& path : inputs) readers.emplace_back(new RunReader(path));
+
+        using Head = pair<Record, size_t>;
+        auto greater = [this](const Head& a, const Head& b) { return less(b.first, a.first); };
+        priority_queue<Head, vector<Head>, decltype(greater)> heads(greater);
+        for (size_t i = 0; i < readers.size(); i++) {
+            Record record;
+            if (readers[i]->next(record)) heads.push({record, i});
+        }
+
+        Folder folder(*this, sink);
+        while (!heads.empty()) {
+            Head head = heads.top();
+            heads.pop();
+            folder(head.first);
+            Record record;
+            if (readers[head.second]->next(record)) heads.push({record, head.second});
+        }
+        folder.finish();
+
+        readers.clear();
+        for (const auto& path : inputs) remove(path.c_str());
+    }
+
+public:
+    ExternalMergeSorter(const string& tempPrefix, size_t memoryBytes, Less less = Less(), Combine combine = nullptr)
+        : tempPrefix(tempPrefix), less(less), combine(combine) {
+        // Two thirds for records, the rest for the merge scratch of sortBuffer()
+        bufferLimit = max<size_t>(memoryBytes / sizeof(Record) / 3 * 2, 1024);
+        maxFanIn = max<size_t>(memoryBytes / (IO_BUFFER_RECORDS * sizeof(Record)), 2);
+    }
+
+    ~ExternalMergeSorter() {
+        for (const auto& path : runs) remove(path.c_str());
+    }
+
+    void add(const Record& record) {
+        buffer.push_back(record);
+        recordsAdded++;
+        if (buffer.size() >= bufferLimit) spillBuffer();
+    }
+
+    // Emit every record in sorted order. Small inputs never touch disk.
+    void finish(const Sink& sink) {
+        if (runs.empty()) {
+            sortBuffer();
+            Folder folder(*this, sink);
+            for (const auto& record : buffer) folder(record);
+            folder.finish();
+            vector<Record>().swap(buffer);
+            passes = 1;
+            return;
+        }
+
+        spillBuffer();
+        vector<Record>().swap(buffer);
+        passes = 1;
+
+        // Intermediate passes while there are more runs than we can open at once
+        while (runs.size() > maxFanIn) {
+            vector<string> merged;
+            for (size_t start = 0; start < runs.size(); start += maxFanIn) {
+                vector<string> group(runs.begin() + start, runs.begin() + min(runs.size(), start + maxFanIn));
+                if (group.size() == 1) {
+                    merged.push_back(group[0]);
+                    continue;
+                }
+                string path = newRunPath();
+                RunWriter writer(path);
+                mergeRuns(group, [&writer](const Record& record) { writer.write(record); });
+                runBytes += writer.close();
+                merged.push_back(path);
+            }
+            runs = merged;
+            passes++;
+        }
+
+        vector<string> finalRuns;
+        finalRuns.swap(runs);
+        mergeRuns(finalRuns, sink);
+        passes++;
+    }
+
+    uint64_t recordCount() const { return recordsAdded; }
+    int runCount() const { return nextRunNumber; }
+    uint64_t bytesSpilled() const { return runBytes; }
+    int mergePasses() const { return passes; }
+};
+
+// ============================================================================
+// FILE LOCKING
+// ============================================================================
+
+// Advisory lock on a lock file, shared between processes (flock). Many
+// readers may hold it shared; a writer holds it exclusive. Locks are tied
+// to this object's descriptor, so each thread that locks needs its own
+// FileLock. On Windows locking is a no-op.
+class FileLock {
+private:
+    string path;
+    int fd = -1;
+
+public:
+    explicit FileLock(const string& path) : path(path) {}
+
+    ~FileLock();
+
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+    void lock(bool exclusive);
+
+    // lock() without waiting: false if another holder has it
+    bool tryLock(bool exclusive);
+
+    void unlock();
+
+    // Holds the lock for one scope
+    class Guard {
+    private:
+        FileLock& fileLock;
+
+    public:
+        Guard(FileLock& fileLock, bool exclusive) : fileLock(fileLock) { fileLock.lock(exclusive); }
+        ~Guard() { fileLock.unlock(); }
+    };
+};
+
+// ============================================================================
+// CHANGE FEED
+// ============================================================================
+
+// Ordered log of every mutation as JSON lines, one record per line:
+//   {"seq":42,"ts":"2024-04-15 09:30:00","ms":1713173400123,"type":"expense.added","data":{...}}
+// ("ms" is the publish time in Unix milliseconds.)
+// Sequence numbers are dense and continue across runs and across every
+// process sharing the log. ExpenseManager publishes while it still holds
+// the exclusive data lock, right after appending the data line, and a
+// file log is appended to there and then: a record is in the log as soon
+// as its data line is in the data file, and in the same order. Appends
+// take <log>.lock, number the records after the last one in the log and
+// remember where the log ended, so the next append does not read it back.
+// A record that cannot be appended stays queued, ahead of anything
+// published later, and is retried by a background thread and on the next
+// publish; failedAppends() counts the attempts.
+// The log may also be a named pipe. A pipe blocks until a reader opens
+// it, so its records are only queued and the background thread writes
+// them in batches. That thread is shared by every feed in the process, so
+// many ledgers (tenants) cost one writer, not one each.
+class ChangeFeed {
+private:
+    static constexpr size_t MAX_BATCH_BYTES = 64 * 1024;
+    static constexpr streamoff READ_BLOCK = 64 * 1024;
+    static constexpr int FLUSH_INTERVAL_MS = 50;
+
+    // The one background thread that flushes every registered feed. It
+    // flushes a copy of the feed list without holding the lock, so add(),
+    // remove() and nudge() never wait on disk; remove() only waits while
+    // that one feed is being flushed.
+    class Writer {
+    private:
+        mutex lock;                  // guards feeds, urgent, stopping and each feed's flushing flag
+        condition_variable wake;
+        condition_variable idle;     // a feed finished flushing
+        unordered_set<ChangeFeed*> feeds;
+        bool urgent = false;
+        bool stopping = false;
+        thread worker;
+
+        void run();
+
+    public:
+        Writer() { worker = thread(&Writer::run, this); }
+
+        ~Writer();
+
+        static Writer& global();
+
+        void add(ChangeFeed* feed);
+
+        // After this returns the writer no longer touches the feed
+        void remove(ChangeFeed* feed);
+
+        // Flush without waiting for the next interval
+        void nudge();
+    };
+
+    string path;
+    FileLock appendLock;
+    mutex lock;                    // guards pending and pendingBytes
+    vector<string> pending;        // records without their "seq" prefix
+    size_t pendingBytes = 0;
+    mutex flushLock;               // one flush at a time, so batches stay in order
+    // Used only under flushLock
+    ofstream output;
+    bool pipe;
+    uint64_t pipeSequence = 0;     // a pipe cannot be read back, so count locally
+    uint64_t knownInode = 0;       // where the log ended after our last append
+    uint64_t knownSize = 0;
+    uint64_t knownSequence = 0;
+    uint64_t outputInode = 0;      // the file `output` has open
+    bool flushing = false;         // guarded by Writer::lock
+    atomic<uint64_t> writtenSequence{0};
+    atomic<uint64_t> batches{0};
+    atomic<uint64_t> appendFailures{0};
+    atomic<uint64_t> queuedRecords{0};
+
+    static bool isPipe(const string& file);
+
+    // Inode and size of the log, zero if it does not exist
+    static pair<uint64_t, uint64_t> identity(const string& file);
+
+public:
+    // Sequence number of the last complete record in the log, 0 if none
+    static uint64_t lastSequence(const string& file);
+
+private:
+    // Number and append one batch; false if it did not reach the log
+    bool append(const vector<string>& batch);
+
+    // Append everything queued so far as one batch. A batch that fails goes
+    // back to the front of the queue for the next flush.
+    void flush();
+
+public:
+    explicit ChangeFeed(const string& path);
+
+    // A last try for anything still queued
+    ~ChangeFeed();
+
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+    // Append one record; `data` must be a JSON value. Its sequence number is
+    // assigned when it is appended. Callers hold the lock that orders their
+    // data file appends, so the log follows the same order.
+    void publish(const string& type, const string& data);
+
+    const string& logPath() const { return path; }
+    uint64_t lastWritten() const { return writtenSequence; }
+    uint64_t batchesWritten() const { return batches; }
+    uint64_t failedAppends() const { return appendFailures; }
+    uint64_t queued() const { return queuedRecords; }   // published but not in the log yet
+
+    // Drop all but the last keepRecords records (at least one, so the
+    // numbering carries on). The log is replaced by rename: writers in
+    // other processes see the new inode and followers seek back to where
+    // they were with offsetAfter(). Callers hold the data lock.
+    Status trim(size_t keepRecords);
+
+    // "seq" of one record line, 0 if the line is not a record
+    static uint64_t sequenceOf(const string& line);
+
+    // Byte offset of the first record with seq > sequence; if there is
+    // none, the end of the last complete line. Records are in sequence
+    // order, so this is a binary search over byte offsets that reads a
+    // line or two per probe.
+    static uint64_t offsetAfter(const string& file, uint64_t sequence);
+
+    // Print records with seq > afterSequence. With follow, keep polling
+    // for new records until interrupted, reopening the log when it is
+    // trimmed.
+    static Status tail(const string& file, uint64_t afterSequence, bool follow, ostream& out);
+};
+
+// ============================================================================
+// DATA DIRECTORY WATCHER
+// ============================================================================
+
+// Calls onChange shortly after any of the named files in a directory is
+// written, created, replaced or deleted. On Linux this uses inotify on the
+// directory, so renames by compaction are seen too; elsewhere it polls.
+// Bursts of events are coalesced into one call.
+class DataWatcher {
+private:
+    static constexpr int POLL_INTERVAL_MS = 200;
+    static constexpr int COALESCE_MS = 10;
+
+    string directory;
+    vector<string> fileNames;
+    function<bool()> onChange;   // false if the reload failed and should be retried
+    atomic<bool> stopping{false};
+    thread worker;
+
+    bool watched(const char* name) const;
+
+    void run();
+
+    // Fallback: let onChange decide; refresh() is two stat() calls when idle
+    void pollLoop();
+
+public:
+    DataWatcher(const string& directory, vector<string> fileNames, function<bool()> onChange);
+
+    ~DataWatcher();
+
+    DataWatcher(const DataWatcher&) = delete;
+    DataWatcher& operator=(const DataWatcher&) = delete;
+};
+
+// ============================================================================
+// IDEMPOTENCY KEYS
+// ============================================================================
+
+// Recent client idempotency keys and the expense each one created, so a
+// retried submission gets the original ID back instead of a duplicate.
+// Keys are per user. The table is bounded twice: keys older than the
+// window are forgotten, and past capacity the oldest key goes first.
+// Arrivals are kept in a FIFO next to the hash map, so lookups, inserts
+// and evictions are all O(1) amortized.
+class IdempotencyKeys {
+public:
+    static constexpr size_t MAX_KEY_LENGTH = 128;
+    static constexpr size_t DEFAULT_CAPACITY = 100000;
+    static constexpr long long DEFAULT_WINDOW_SECONDS = 24 * 60 * 60;
+
+private:
+    struct Entry {
+        int expenseId;
+        long long createdAt;   // Unix seconds
+        uint64_t serial;       // which arrival put it here
+    };
+    struct Arrival {
+        uint64_t serial;
+        long long createdAt;
+        string slot;
+    };
+
+    TrackedHashMap<string, Entry, MemoryCategory::INDEXES> entries;   // "<user>:<key>" -> entry
+    deque<Arrival, TrackedAllocator<Arrival, MemoryCategory::INDEXES>> arrivals;   // oldest first
+    uint64_t nextSerial = 0;
+    size_t capacity = DEFAULT_CAPACITY;
+    long long windowSeconds = DEFAULT_WINDOW_SECONDS;
+
+    static string slotOf(int userId, const string& key);
+
+    // A key used again after it expired leaves a stale arrival behind;
+    // only the arrival that matches the entry removes it. Stale arrivals
+    // are rare, but they are capped too.
+    void evict(long long now);
+
+public:
+    // Keys end up as a field of expenses.txt
+    static bool validKey(const string& key);
+
+    void setLimits(size_t maxKeys, long long window);
+
+    // The expense created under this key, or 0 if it is unknown or expired
+    int find(int userId, const string& key, long long now) const;
+
+    void add(int userId, const string& key, int expenseId, long long createdAt);
+
+    // Every live key as (user, key, expense ID)
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (const auto& [slot, entry] : entries) {
+            size_t colon = slot.find(':');
+            visit(atoi(slot.c_str()), slot.substr(colon + 1), entry.expenseId);
+        }
+    }
+
+    size_t size() const { return entries.size(); }
+
+    void clear();
+};
+
+// ============================================================================
+// EXPENSE MANAGER CLASS
+// ============================================================================
+
+class ExpenseManager {
+private: 
+    TrackedVector<User, MemoryCategory::USERS> users;
+    ExpenseStore expenses;
+    ExpenseIndex expenseIndex;
+    RollupTables rollups;
+    BalanceLedger ledger;
+    ExpenseSketches sketches;
+    bool sketchesEnabled;
+    bool readOnly;
+    bool spillUnavailable = false;   // a memory budget was asked for but cannot be kept
+    TrackedHashMap<int, size_t, MemoryCategory::INDEXES> userPositionById;
+    TrackedHashMap<int, uint32_t, MemoryCategory::INDEXES> expenseOrdinalById;
+
+    // Expense IDs are local to this data directory. Every expense also has a
+    // global ID (this replica's ID plus the local ID), which is what merges
+    // and deletions go by. A tombstone may arrive before its expense.
+    uint64_t replicaId;
+    TrackedVector<GlobalExpenseId, MemoryCategory::INDEXES> globalIds;   // by ordinal
+    TrackedHashMap<GlobalExpenseId, uint32_t, MemoryCategory::INDEXES, GlobalExpenseId::Hash> ordinalByGlobalId;
+    TrackedHashMap<GlobalExpenseId, long long, MemoryCategory::INDEXES, GlobalExpenseId::Hash> tombstones;   // -> deletion time
+
+    // Client idempotency keys are stored as an optional field after the
+    // global ID in expenses.txt; the table is rebuilt from there on load
+    IdempotencyKeys idempotencyKeys;
+
+    PrefixIndex nameIndex;
+    PrefixIndex emailIndex;
+    unique_ptr<ChangeFeed> changes;
+    User* currentUser;
+    int nextUserId;
+    int nextExpenseId;
+    
+    const string DATA_DIR;
+    const string USERS_FILE;
+    const string EXPENSES_FILE;
+    const string CHANGES_FILE;
+    const string TOMBSTONES_FILE;
+    const string REPLICA_ID_FILE;
+    const string SYNC_DIR;
+
+    // Other processes may append to the data files at any time. Every write
+    // happens under the exclusive data directory lock, right after reading
+    // whatever was appended since we last looked; the cursors remember how
+    // far each file has been read.
+    struct FileCursor {
+        uint64_t inode = 0;
+        uint64_t offset = 0;     // bytes read so far (always at a line start)
+        uint64_t seenSize = 0;   // size and mtime at the last look
+        int64_t seenMtime = 0;
+        uint64_t anchor = 0;     // hash of the bytes just before offset
+        bool stale = false;      // an append of ours was not where expected
+    };
+    FileLock dataLock;
+    FileCursor usersCursor;
+    FileCursor expensesCursor;
+    FileCursor tombstonesCursor;
+    uint64_t malformedLines = 0;   // data file lines skipped because they do not parse
+    uint64_t loadedSequence = 0;   // last change feed record the loaded data files include
+
+    static inline const Status NOT_LOGGED_IN_ERROR{ErrorCode::NOT_LOGGED_IN, "Please login first!"};
+    static inline const Status READ_ONLY_ERROR{ErrorCode::READ_ONLY, "This replica is read-only!"};
+
+public:
+    // Approximate sketches cost about 1 KB per user (at most ~16 MB) plus 32 KB;
+    // they are off unless enableSketches is set.
+    // A non-zero memoryBudgetBytes caps resident expense records, spilling cold
+    // pages to a private <dataDir>/spill.seg.XXXXXX. A read-only manager (a replica) never
+    // writes to the data directory and changes only through applyChange().
+    ExpenseManager(const string& dataDir = "data", bool enableSketches = false, size_t memoryBudgetBytes = 0,
+                   bool readOnlyReplica = false);
+
+    // Every change is already on disk, so there is nothing to save here
+    ~ExpenseManager() {}
+
+    // ========================================================================
+    // USER OPERATIONS
+    // ========================================================================
+
+    // The new user's ID
+    Result<int> registerUser(string name, string email, string phone, string password);
+
+    size_t userCount() const { return users.size(); }
+    size_t expenseCount() const { return expenses.size(); }
+    uint64_t malformedLineCount() const { return malformedLines; }
+
+    // Sequence of the last change feed record that the loaded data files
+    // include; a replica follows the log from the record after it
+    uint64_t snapshotSequence() const { return loadedSequence; }
+
+    // For a replica that fell behind a trimmed log: load the data files
+    // again and return the new snapshot's sequence
+    uint64_t reloadSnapshot();
+
+    // How many addExpense idempotency keys to remember, and for how long
+    void setIdempotencyLimits(size_t maxKeys, long long windowSeconds);
+
+    // Act as a user without a password. Only replicas allow this, since
+    // they hold no passwords and serve read-only views.
+    Status viewAs(int userId);
+
+    Status login(string email, string password);
+
+    void logout();
+
+    // Switch to a user who already logged in, e.g. on another connection
+    // to the request server, which keeps one session per connection. An
+    // unknown ID (0 included) leaves nobody logged in.
+    bool resumeSession(int userId);
+
+    void displayAllUsers(ostream& out) const;
+
+    User* getCurrentUser();
+
+    vector<const User*> allUsers() const;
+
+    // Users whose name (any word) or email starts with the prefix
+    vector<const User*> findUsers(const string& prefix, size_t limit = 10) const;
+
+    void displayUserSearch(const string& prefix, ostream& out) const;
+
+    // ========================================================================
+    // EXPENSE OPERATIONS
+    // ========================================================================
+
+    // The new expense's ID. With an idempotency key, a retry of a
+    // submission that already went through returns the original expense's
+    // ID and adds nothing.
+    Result<int> addExpense(string description, double amount, SplitMethod method, 
+                           vector<int> participantIds, vector<double> shares = {},
+                           const string& idempotencyKey = "");
+
+    // Delete one of the current user's expenses. The record stays in
+    // expenses.txt; a tombstone naming its global ID is appended instead, so
+    // the deletion survives merges in either direction.
+    Status deleteExpense(int expenseId);
+
+    Status displayUserExpenses(ostream& out) const;
+
+    Status displayAllExpenses(ostream& out) const;
+
+    // Copies of the live expenses matching a query, in storage order
+    vector<Expense> findExpenses(const ExpenseQuery& query) const;
+
+    Status searchExpenses(const string& queryText, ostream& out) const;
+
+    // ========================================================================
+    // REPORTS
+    // ========================================================================
+
+    // Parse a report range. Accepts YYYY-MM or YYYY-MM-DD for both ends.
+    static bool parseReportRange(const string& fromText, const string& toText,
+                                 long long& fromTime, long long& toTime);
+
+    static long long monthStart(int month);
+
+    static long long monthEnd(int month);
+
+    static int nextMonth(int month);
+
+    // Totals for one user over [fromTime, toTime] computed from raw expenses.
+    // Only used for partial months at the edges of a report range.
+    UserMonthTotals rawUserTotals(int userId, long long fromTime, long long toTime) const;
+
+    // Flow between two users over [fromTime, toTime] from raw expenses
+    PairFlow rawPairFlow(int userA, int userB, long long fromTime, long long toTime) const;
+
+    // Per-month spending for the current user. Whole months come from the
+    // rollup tables; partial months at the edges are summed from raw expenses.
+    Status displayMonthlySpending(const string& fromText, const string& toText, ostream& out) const;
+
+    // Per-quarter money exchanged between the current user and another user
+    Status displayPairReport(int otherUserId, const string& fromText, const string& toText,
+                             ostream& out) const;
+
+    // ========================================================================
+    // BALANCE OPERATIONS
+    // ========================================================================
+
+    Status displayBalance(ostream& out) const;
+
+    // Read-only view of every balance, for callers that format their own output
+    const BalanceLedger& balances() const { return ledger; }
+
+    // Top-K net debtors, creditors and pairwise debts across all users
+    Status displayTopBalances(size_t k, ostream& out) const;
+
+    // Connected components, cycle cancellation and settlement over all debts
+    Status displayDebtSimplification(ostream& out) const;
+
+    // Approximate answers from the streaming sketches
+    Status displaySharingInsights(ostream& out) const;
+
+    // Bytes and allocation counts per subsystem
+    void displayMemoryUsage(ostream& out) const;
+
+    // One exported CSV row, self-contained so sorted output never has to
+    // revisit (possibly spilled) expense pages
+    struct ExportRow {
+        int64_t key;
+        uint32_t ordinal;
+        uint32_t slot;
+        double amount;
+        long long createdAt;
+        int expenseId;
+        uint32_t description;
+        int payerId;
+        int userId;
+        int32_t shareCents;
+    };
+
+    struct ExportRowLess {
+        bool operator()(const ExportRow& a, const ExportRow& b) const {
+            if (a.key != b.key) return a.key < b.key;
+            return a.ordinal != b.ordinal ? a.ordinal < b.ordinal : a.slot < b.slot;
+        }
+    };
+
+    static constexpr size_t DEFAULT_EXPORT_MEMORY = 64 * 1024 * 1024;
+
+    // Rank of every user by display name, for counterparty ordering
+    unordered_map<int, uint32_t> userNameRanks() const;
+
+    // Export the current user's rows, optionally sorted and cut to the first
+    // `limit` rows (0 = all). A limit that fits in memory is served by a
+    // bounded heap; otherwise rows go through an external merge sort that
+    // stays within the expense memory budget (64 MB when none is set).
+    Result<expense::ExportInfo> exportBalanceToCSV(const string& filename, ExportOrder order = ExportOrder::STORAGE,
+                                                   bool descending = false, size_t limit = 0) const;
+
+    // ========================================================================
+    // DATA PERSISTENCE
+    // ========================================================================
+
+    void loadData();
+
+    // New records picked up by one refresh
+    struct RefreshStats {
+        size_t users = 0;
+        size_t expenses = 0;
+        size_t deletions = 0;
+        size_t malformed = 0;   // lines skipped
+        bool reloaded = false;
+    };
+
+    // Load whatever was appended to the data files since the cursors. On the
+    // first call that is everything.
+    RefreshStats readNewRecords();
+
+    struct FileInfo {
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0;   // nanoseconds
+    };
+
+    // Identity of a file; all zero if it does not exist
+    static FileInfo fileInfo(const string& path);
+
+    // Hash of the first 64 bytes and the 64 bytes before offset. If they
+    // change, the file was rewritten in place and our offset no longer
+    // means anything. (Edits confined to the middle go unnoticed.)
+    static uint64_t anchorAt(const string& path, uint64_t offset);
+
+    // True if the file holds exactly these bytes at offset
+    static bool bytesAt(const string& path, uint64_t offset, const string& bytes);
+
+    // Call onLines with the complete lines after cursor.offset, up to
+    // batchSize at a time. The cursor moves past a batch only once onLines
+    // has applied it; if onLines throws, the cursor stays at the start of
+    // that batch and the next refresh reads it again. A last line without
+    // a newline is still being written.
+    static void readCompleteLines(const string& path, FileCursor& cursor, size_t batchSize,
+                                  const function<void(vector<string>&)>& onLines);
+
+    // One line at a time; the cursor moves past each line once onLine returns
+    static void readCompleteLines(const string& path, FileCursor& cursor,
+                                  const function<void(const string&)>& onLine);
+
+    // True if the file changed at all since the cursor last looked
+    static bool fileTouched(const string& path, const FileCursor& cursor);
+
+    // True if the file was replaced, truncated or rewritten before the
+    // cursor, or the cursor is stale
+    static bool fileReplaced(const string& path, const FileCursor& cursor);
+
+    // Append one record under the exclusive lock. The cursor moves past it
+    // only if it landed right at the cursor; if a writer that ignores the
+    // lock got in first, the cursor is marked stale and the next refresh
+    // reloads everything.
+    bool appendRecord(const string& path, FileCursor& cursor, const string& record);
+
+    void addLoadedUser(const User& user, bool bulk);
+
+    // Drop everything and load the data files again, keeping the login
+    void reloadAll();
+
+    // Pick up changes made by other processes; caller holds the data lock
+    RefreshStats refreshLocked();
+
+    // Cheap when nothing changed: three stat() calls and no lock
+    RefreshStats refresh();
+
+    static constexpr size_t LOAD_BATCH = 16384;
+
+    // The idempotency key field of an expenses.txt line, after the global ID
+    static string idempotencyKeyOf(const string& line);
+
+    // Add one new expense to the store, index, rollups, ledger and sketches
+    void recordExpense(const Expense& expense, const GlobalExpenseId& globalId);
+
+    // Register the global ID of a just-added expense; hide it at once if a
+    // tombstone for it came first
+    void addGlobalId(uint32_t ordinal, const GlobalExpenseId& globalId);
+
+    // Take a deleted expense out of queries, balances and rollups. The
+    // sketches cannot subtract, so insights may still count it.
+    void hideExpense(uint32_t ordinal);
+
+    // Record a deletion; false if it was already known
+    bool applyTombstone(const GlobalExpenseId& globalId, long long deletedAt);
+
+    static string tombstoneJson(int expenseId, const GlobalExpenseId& globalId, const string& deletedAt);
+
+    // Header of one change feed record
+    struct ChangeRecord {
+        uint64_t sequence = 0;
+        long long publishedMillis = 0;
+        string type;
+    };
+
+    // Apply one change feed line. Records already present (by ID) are
+    // skipped, so a replica can replay the log over a newer snapshot.
+    bool applyChange(const string& line, ChangeRecord& record);
+
+    void addLoadedBatch(const ExpenseList& batch, const vector<GlobalExpenseId>& batchIds);
+
+    // Change feed records left in the log by compaction. Followers further
+    // behind than this reload the data files instead.
+    static constexpr size_t CHANGE_LOG_KEEP = 100000;
+
+    // Rewrite the data files from memory and trim the change log. Files are
+    // replaced by rename, so other processes notice the new inode and
+    // reload instead of reading from a stale offset.
+    Status compactData(size_t keepChanges = CHANGE_LOG_KEEP);
+
+    // ========================================================================
+    // OFFLINE SYNC
+    // ========================================================================
+
+    // The replica ID stored in a data directory, 0 if it has none yet
+    static uint64_t readReplicaId(const string& dataDir);
+
+    // Pick a random ID for a new data directory; caller holds the data lock.
+    // A copied directory keeps the original's ID, so delete replica.id in
+    // the copy before using it on its own.
+    uint64_t createReplicaId();
+
+    // How far a merge has read a peer: a cursor per peer file, the local
+    // ID each peer user was matched to, and expense records that named a
+    // user we had not seen yet (retried by the next merge)
+    struct PeerState {
+        FileCursor users;
+        FileCursor expenses;
+        FileCursor tombstones;
+        unordered_map<int, int> localUserIds;
+        vector<string> pendingExpenses;
+    };
+
+    static bool loadPeerState(const string& path, PeerState& state);
+
+    static bool savePeerState(const string& path, const PeerState& state);
+
+    // Pull in everything another data directory has that this one lacks:
+    // users (matched by email), expenses (by global ID, under fresh local
+    // IDs) and tombstones. Both sets only grow and deletions always win, so
+    // merging in any order and any number of times converges. Progress
+    // through the peer's files is kept in sync/<peer>.state, so each merge
+    // reads only what the peer appended since the last one. Merging is one
+    // way; run it in both directories for a full sync.
+    Result<expense::MergeInfo> mergeFrom(const string& peerDir);
+
+    // Get user by ID (helper function)
+    User* getUserById(int id);
+
+    // Display name for a user ID, "Unknown" if there is no such user
+    const string& nameOf(int id) const;
+
+    function<const string&(int)> nameLookup() const;
+};
+
+// ============================================================================
+// TENANT POOL
+// ============================================================================
+
+// Many independent ledgers in one process, one per tenant under
+// <baseDir>/tenants/<id>. A tenant is loaded on first access and the least
+// recently used ones are dropped when the tracked memory charged to
+// resident tenants exceeds the budget; their data is already on disk, so
+// eviction only costs a reload later. A caller still holding an evicted
+// tenant keeps a working copy, freed when the last holder lets go; until
+// then acquire() hands that same instance back instead of loading a
+// second one on the same data directory.
+//
+// Interned strings go to the process-wide StringPool, which never shrinks
+// and is shared by every tenant, so no tenant is charged for them and they
+// are not counted against the budget: evicting tenants could never bring
+// them down. sharedBytes() reports them apart, and a separate shared
+// budget caps them (StringPool::limitMemory, for the whole process); past
+// it, loads and writes that need new strings fail with length_error.
+// A tenant is charged what its load allocated, plus tracked memory that
+// grows between two acquire() calls (charged to the tenant the first one
+// handed out, since the caller worked on it in between). With several
+// threads using tenants at once that attribution is approximate.
+//
+// T is ExpenseManager for the tools and Ledger for expense::LedgerPool;
+// the loader opens one from a data directory. Safe to call from any
+// thread; loads happen under the pool's lock.
+template <typename T>
+class TenantPool {
+public:
+    using Loader = function<Result<shared_ptr<T>>(const string& dataDir)>;
+
+    struct Stats {
+        size_t residentTenants = 0;
+        size_t residentBytes = 0;
+        size_t sharedBytes = 0;
+        size_t sharedBudget = 0;   // the string pool's limit, 0 = none
+        size_t memoryBudget = 0;
+        uint64_t hits = 0;       // including evicted tenants still held by a caller
+        uint64_t loads = 0;
+        uint64_t evictions = 0;
+    };
+
+private:
+    struct Tenant {
+        shared_ptr<T> value;
+        size_t bytes = 0;   // tracked memory charged to this tenant
+        list<string>::iterator lruPosition;
+    };
+
+    // An evicted tenant that a caller may still hold
+    struct Released {
+        weak_ptr<T> value;
+        size_t bytes = 0;
+    };
+
+    string tenantsDir;
+    size_t budget;                          // 0 means unlimited
+    Loader load;
+    mutable mutex lock;
+    unordered_map<string, Tenant> tenants;
+    unordered_map<string, Released> released;
+    list<string> lru;                       // most recent first
+    size_t totalBytes = 0;
+    uint64_t hitCount = 0;
+    uint64_t loadCount = 0;
+    uint64_t evictionCount = 0;
+    string lastTenant;
+    int64_t liveAtHandout = 0;
+
+    // Tracked memory outside the string pool, which no tenant owns
+    static int64_t tenantLiveBytes() {
+        return MemoryTracker::totalLiveBytes() - MemoryTracker::usage(MemoryCategory::STRINGS).liveBytes;
+    }
+
+    void chargeLastTenant() {
+        auto it = tenants.find(lastTenant);
+        if (it == tenants.end()) return;
+        int64_t delta = tenantLiveBytes() - liveAtHandout;
+        size_t bytes = (size_t)max<int64_t>(0, (int64_t)it->second.bytes + delta);
+        totalBytes = totalBytes - it->second.bytes + bytes;
+        it->second.bytes = bytes;
+    }
+
+    void drop(typename unordered_map<string, Tenant>::iterator it) {
+        if (it->first == lastTenant) {
+            chargeLastTenant();
+            lastTenant.clear();
+        }
+        totalBytes -= it->second.bytes;
+        lru.erase(it->second.lruPosition);
+        for (auto old = released.begin(); old != released.end();) {
+            old = old->second.value.expired() ? released.erase(old) : next(old);
+        }
+        released[it->first] = Released{it->second.value, it->second.bytes};
+        tenants.erase(it);
+        evictionCount++;
+    }
+
+    // Evict from the cold end until the budget holds. The most recent
+    // tenant always stays, even if it alone is over budget.
+    void evictToBudget() {
+        while (budget > 0 && totalBytes > budget && lru.size() > 1) drop(tenants.find(lru.back()));
+    }
+
+public:
+    // sharedBudgetBytes (0 = none) caps the string pool for the whole process
+    TenantPool(const string& baseDir, size_t memoryBudgetBytes, Loader loader, size_t sharedBudgetBytes = 0)
+        : tenantsDir(baseDir + "/tenants"), budget(memoryBudgetBytes), load(move(loader)) {
+        Utils::createDirectory(baseDir);
+        Utils::createDirectory(tenantsDir);
+        StringPool::global().limitMemory(sharedBudgetBytes);
+    }
+
+    TenantPool(const TenantPool&) = delete;
+    TenantPool& operator=(const TenantPool&) = delete;
+
+    // Letters, digits, '-' and '_', at most 64 characters, so the ID is
+    // always a plain directory name
+    static bool isValidTenantId(string_view tenantId) {
+        if (tenantId.empty() || tenantId.size() > 64) return false;
+        for (char c : tenantId) {
+            if (!isalnum((unsigned char)c) && c != '-' && c != '_') return false;
+        }
+        return true;
+    }
+
+    // The tenant's ledger, loading it if needed
+    Result<shared_ptr<T>> acquire(const string& tenantId) {
+        if (!isValidTenantId(tenantId)) {
+            return Status(ErrorCode::INVALID_ARGUMENT, "Invalid tenant ID '" + tenantId + "'");
+        }
+        lock_guard<mutex> guard(lock);
+        chargeLastTenant();
+
+        auto it = tenants.find(tenantId);
+        if (it != tenants.end()) {
+            hitCount++;
+            lru.splice(lru.begin(), lru, it->second.lruPosition);
+        } else {
+            Tenant tenant;
+            auto held = released.find(tenantId);
+            if (held != released.end()) {
+                // Still in use since its eviction: two instances on one data
+                // directory would each miss the other's changes
+                tenant.value = held->second.value.lock();
+                tenant.bytes = held->second.bytes;
+                released.erase(held);
+            }
+            if (tenant.value) {
+                hitCount++;
+            } else {
+                int64_t before = tenantLiveBytes();
+                Result<shared_ptr<T>> loaded = load(tenantsDir + "/" + tenantId);
+                if (!loaded) return loaded;
+                tenant.value = move(loaded.value());
+                tenant.bytes = (size_t)max<int64_t>(0, tenantLiveBytes() - before);
+                loadCount++;
+            }
+            lru.push_front(tenantId);
+            tenant.lruPosition = lru.begin();
+            totalBytes += tenant.bytes;
+            it = tenants.emplace(tenantId, move(tenant)).first;
+        }
+        shared_ptr<T> value = it->second.value;
+        evictToBudget();
+
+        lastTenant = tenantId;
+        liveAtHandout = tenantLiveBytes();
+        return value;
+    }
+
+    // Drop a resident tenant; false if it was not loaded
+    bool evict(const string& tenantId) {
+        lock_guard<mutex> guard(lock);
+        auto it = tenants.find(tenantId);
+        if (it == tenants.end()) return false;
+        drop(it);
+        return true;
+    }
+
+    bool isResident(const string& tenantId) const {
+        lock_guard<mutex> guard(lock);
+        return tenants.count(tenantId) > 0;
+    }
+
+    Stats stats() const {
+        lock_guard<mutex> guard(lock);
+        return Stats{tenants.size(), totalBytes, sharedBytes(), StringPool::global().memoryLimit(), budget,
+                     hitCount, loadCount, evictionCount};
+    }
+
+    // The shared string pool, outside every tenant and the budget
+    static size_t sharedBytes() { return StringPool::global().memoryBytes(); }
+};
+
+// ============================================================================
+// SHARDED ENGINE
+// ============================================================================
+
+// Expenses and pairwise balances split across shards by user hash, each
+// shard with its own thread, balance ledger and log file, so writes scale
+// past the one lock of ExpenseManager. Only expenses and balances: no
+// users, sessions, deletions or reports (expense::ShardedLedger). Expenses
+// live only in the logs; memory holds the balances, which grow with user
+// pairs, not with expenses.
+//
+// Users belong to the shard their ID hashes to; an expense is stored on
+// its payer's shard. Balances are kept one side per shard: the payer's
+// shard credits the payer and sends the matching debit to each
+// participant's shard, batched per destination after every mailbox
+// drain. Per-user queries go to one shard; rankings fan out to all shards
+// and are merged. Reads see everything applied so far; call drain() first
+// for an exact view of everything submitted.
+//
+// Shard N appends its expenses to <dir>/shard-N.txt in the expenses.txt
+// line format and syncs them to disk before they are acknowledged; one
+// sync covers everything a mailbox drain took. One engine at a time holds
+// <dir>/.lock. Opening the directory again replays every log in parallel,
+// on the shards' own threads, rebuilding both sides of every balance; a
+// torn last line is cut off. IDs interleave across shards (shard N issues
+// N+1, N+1+shards, ...), so the shard count is fixed when the directory is
+// created and kept in <dir>/shards.txt.
+class ShardedEngine {
+public:
+    struct Stats {
+        size_t expenses = 0;
+        uint64_t localDeltas = 0;      // both sides of a debt on one shard
+        uint64_t remoteDeltas = 0;     // debits sent to another shard
+        uint64_t batchesSent = 0;
+        size_t recovered = 0;          // expenses replayed from the logs on open
+        uint64_t malformedLines = 0;   // log lines skipped on open
+        uint64_t failedWrites = 0;     // expenses dropped: log append failed or IDs ran out
+    };
+
+private:
+    struct Delta {
+        int userId;
+        int counterpartyId;
+        double amount;
+    };
+
+    // IDs for the expenses of one add() call, filled in by their shards
+    struct Ticket {
+        mutex lock;
+        condition_variable done;
+        vector<int> ids;
+        size_t remaining = 0;
+    };
+
+    struct Submission {
+        Expense expense;
+        shared_ptr<Ticket> ticket;   // null for submit()
+        size_t position = 0;         // in the ticket's ids
+    };
+
+    struct Shard {
+        size_t index = 0;
+
+        // Mailbox, filled by submitters and other shards
+        mutex lock;
+        condition_variable wake;
+        vector<Submission> submissions;
+        vector<Delta> deltas;
+        vector<function<void()>> tasks;
+        bool stopping = false;
+
+        // Owned by the shard thread
+        size_t expenseCount = 0;
+        BalanceLedger ledger;
+        string logPath;
+        int logFd = -1;
+        uint64_t logBytes = 0;   // length of the complete lines in the log
+        string openError;        // set if recovery could not open the log
+        uint32_t nextLocalId = 0;
+        vector<vector<Delta>> outbox;   // per destination shard
+        uint64_t localDeltas = 0;
+        uint64_t remoteDeltas = 0;
+        uint64_t batchesSent = 0;
+        size_t recovered = 0;
+        uint64_t malformedLines = 0;
+        uint64_t failedWrites = 0;
+
+        thread worker;
+    };
+
+    string directory;
+    FileLock directoryLock;   // held exclusive for the engine's lifetime
+    vector<unique_ptr<Shard>> shards;
+
+    size_t shardOf(int userId) const {
+        return (size_t)(Utils::hash64((uint64_t)(uint32_t)userId) % shards.size());
+    }
+
+    static void post(Shard& shard, function<void()> task);
+
+    // Count an expense on its payer's shard and split its balance updates
+    void apply(Shard& shard, const Expense& expense);
+
+    // Assign IDs, append to the log and sync it; on failure the log is cut
+    // back, nothing is applied and the IDs are 0 (-1 if IDs ran out)
+    void commit(Shard& shard, vector<Submission>& batch);
+
+    void flushOutbox(Shard& shard);
+
+    // Replay the shard's log, then open it for appending
+    void recover(Shard& shard);
+
+    void run(Shard& shard);
+
+    void stop();
+
+    void enqueue(vector<Submission>& batch);
+
+    // Run fn on every shard's own thread and wait for all of them
+    void onEveryShard(const function<void(Shard&)>& fn);
+
+    // Fan a ranking query out and keep the best k of the merged answers
+    vector<BalanceLedger::Entry> mergeTop(size_t k, const function<vector<BalanceLedger::Entry>(const BalanceLedger&)>& query,
+                                          const function<bool(const BalanceLedger::Entry&, const BalanceLedger::Entry&)>& better);
+
+public:
+    // shardCount 0 means the count the directory was created with, or one
+    // shard per hardware thread for a new directory. Throws runtime_error
+    // if another engine has the directory open, it was created with
+    // another count, or a log cannot be opened. Returns once every log has
+    // been replayed.
+    explicit ShardedEngine(const string& dir, size_t shardCount = 0);
+
+    ~ShardedEngine();
+
+    ShardedEngine(const ShardedEngine&) = delete;
+    ShardedEngine& operator=(const ShardedEngine&) = delete;
+
+    size_t shardCount() const { return shards.size(); }
+
+    // The shard count recorded in dir, 0 if there is none
+    static size_t storedShardCount(const string& dir);
+
+    // Queue expenses on their payers' shards without waiting. The expense
+    // IDs given are replaced by the shards' own. Safe to call from several
+    // threads.
+    void submit(const vector<Expense>& batch);
+
+    // Like submit(), then wait until the expenses are in their shards'
+    // logs; their IDs in order, 0 where the log append failed
+    vector<int> add(const vector<Expense>& batch);
+
+    // Wait until every expense submitted so far and every delta it caused
+    // has been applied. The first round commits the expenses and sends
+    // their deltas; the second makes sure the deltas were received.
+    void drain();
+
+    // Everyone the user has an open balance with, from the user's shard
+    vector<BalanceLedger::Entry> balancesFor(int userId);
+
+    vector<BalanceLedger::Entry> topDebtors(size_t k);
+
+    vector<BalanceLedger::Entry> topCreditors(size_t k);
+
+    // Each debt is only counted on the creditor's shard, so nothing repeats
+    vector<BalanceLedger::Entry> topPairs(size_t k);
+
+    Stats stats();
+};
+
+}  // namespace detail
+}  // namespace expense
+
+#endif
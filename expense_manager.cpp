@@ -0,0 +1,1571 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - EXPENSE MANAGER
+
+    ExpenseManager, the engine behind Ledger: loading and refreshing
+    the data files, every operation and report, compaction and merges.
+===============================================================================
+*/
+
+#include "expense_internal.h"
+
+#include <sys/stat.h>
+
+namespace expense {
+namespace detail {
+
+// ============================================================================
+// EXPENSE MANAGER CLASS
+// ============================================================================
+
+ExpenseManager::ExpenseManager(const string& dataDir, bool enableSketches, size_t memoryBudgetBytes,
+               bool readOnlyReplica)
+    : sketchesEnabled(enableSketches), readOnly(readOnlyReplica), replicaId(0),
+      currentUser(nullptr), nextUserId(1), nextExpenseId(1),
+      DATA_DIR(dataDir), USERS_FILE(dataDir + "/users.txt"),
+      EXPENSES_FILE(dataDir + "/expenses.txt"),
+      CHANGES_FILE(dataDir + "/changes.jsonl"), TOMBSTONES_FILE(dataDir + "/tombstones.txt"),
+      REPLICA_ID_FILE(dataDir + "/replica.id"), SYNC_DIR(dataDir + "/sync"), dataLock(dataDir + "/.lock") {
+    nameIndex.wordPrefixes = true;
+    Utils::createDirectory(DATA_DIR);
+    spillUnavailable = !expenses.setMemoryBudget(memoryBudgetBytes,
+                                                 DATA_DIR + (readOnly ? "/spill.replica.seg" : "/spill.seg"));
+    if (!readOnly) {
+        FileLock::Guard exclusive(dataLock, true);
+        replicaId = readReplicaId(DATA_DIR);
+        if (replicaId == 0) replicaId = createReplicaId();
+    }
+    {
+        FileLock::Guard shared(dataLock, false);
+        loadData();
+        // Records are appended under the exclusive data lock together
+        // with their data lines, so the log's last record is this snapshot
+        loadedSequence = ChangeFeed::lastSequence(CHANGES_FILE);
+    }
+    if (!readOnly) changes.reset(new ChangeFeed(CHANGES_FILE));
+}
+
+// ============================================================================
+// USER OPERATIONS
+// ============================================================================
+
+Result<int> ExpenseManager::registerUser(string name, string email, string phone, string password) {
+    if (readOnly) return READ_ONLY_ERROR;
+
+    // Every field is stored in a '|'-separated line of users.txt
+    if (!Utils::isRecordSafe(name) || !Utils::isRecordSafe(password)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, "Name and password may not contain '|' or control characters!");
+    }
+
+    // Validate email
+    if (!Utils::isValidEmail(email) || !Utils::isRecordSafe(email)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, "Invalid email format!");
+    }
+
+    // Validate phone
+    if (!Utils:: isValidPhone(phone)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, "Invalid phone number!  (must be 10+ digits)");
+    }
+
+    // Catch up with other processes before checking and assigning the ID
+    FileLock::Guard exclusive(dataLock, true);
+    refreshLocked();
+
+    // Check if email already exists
+    for (int id : emailIndex.exact(email)) {
+        if (users[userPositionById.at(id)].getEmail() == email) {
+            return Status(ErrorCode::ALREADY_EXISTS, "Email already registered!");
+        }
+    }
+
+    // Create new user
+    User newUser(nextUserId, name, email, phone, password);
+    if (!appendRecord(USERS_FILE, usersCursor, newUser.serialize())) {
+        return Status(ErrorCode::IO_ERROR, "Could not save user!");
+    }
+    nextUserId++;
+    addLoadedUser(newUser, false);
+    changes->publish("user.registered", newUser.toJson());
+    return newUser.getId();
+}
+
+uint64_t ExpenseManager::reloadSnapshot() {
+    FileLock::Guard shared(dataLock, false);
+    reloadAll();
+    loadedSequence = ChangeFeed::lastSequence(CHANGES_FILE);
+    return loadedSequence;
+}
+
+void ExpenseManager::setIdempotencyLimits(size_t maxKeys, long long windowSeconds) {
+    idempotencyKeys.setLimits(maxKeys, windowSeconds);
+}
+
+Status ExpenseManager::viewAs(int userId) {
+    if (!readOnly) {
+        return Status(ErrorCode::PERMISSION_DENIED, "Password login is required on the primary!");
+    }
+    User* user = getUserById(userId);
+    if (user == nullptr) {
+        return Status(ErrorCode::NOT_FOUND, "User ID " + to_string(userId) + " not found!");
+    }
+    currentUser = user;
+    return Status();
+}
+
+Status ExpenseManager::login(string email, string password) {
+    for (int id : emailIndex.exact(email)) {
+        User& user = users[userPositionById.at(id)];
+        if (user.getEmail() == email && user.verifyPassword(password)) {
+            currentUser = &user;
+            return Status();
+        }
+    }
+    return Status(ErrorCode::AUTHENTICATION_FAILED, "Invalid email or password!");
+}
+
+void ExpenseManager::logout() {
+    currentUser = nullptr;
+}
+
+bool ExpenseManager::resumeSession(int userId) {
+    currentUser = getUserById(userId);
+    return currentUser != nullptr;
+}
+
+void ExpenseManager::displayAllUsers(ostream& out) const {
+    if (users.empty()) {
+        out << "\nNo users registered yet." << endl;
+        return;
+    }
+
+    out << "\n========================================" << endl;
+    out << "         REGISTERED USERS" << endl;
+    out << "========================================" << endl;
+    for (const auto& user : users) {
+        user.display(out);
+    }
+    out << "========================================" << endl;
+}
+
+User* ExpenseManager::getCurrentUser() {
+    return currentUser;
+}
+
+vector<const User*> ExpenseManager::allUsers() const {
+    vector<const User*> result;
+    result.reserve(users.size());
+    for (const auto& user : users) result.push_back(&user);
+    return result;
+}
+
+vector<const User*> ExpenseManager::findUsers(const string& prefix, size_t limit) const {
+    vector<const User*> result;
+    if (Utils::trim(prefix).empty()) return result;
+
+    vector<int> ids = nameIndex.search(prefix, limit);
+    for (int id : emailIndex.search(prefix, limit)) {
+        if (find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(id);
+    }
+    for (int id : ids) {
+        if (result.size() == limit) break;
+        result.push_back(&users[userPositionById.at(id)]);
+    }
+    return result;
+}
+
+void ExpenseManager::displayUserSearch(const string& prefix, ostream& out) const {
+    vector<const User*> matches = findUsers(prefix, 20);
+    out << "\n========================================" << endl;
+    out << "         MATCHING USERS" << endl;
+    out << "========================================" << endl;
+    for (const User* user : matches) {
+        out << "ID: " << user->getId() << " | Name: " << user->getName()
+             << " | Email: " << user->getEmail() << endl;
+    }
+    if (matches.empty()) {
+        out << "No users match '" << prefix << "'." << endl;
+    }
+    out << "========================================" << endl;
+}
+
+// ============================================================================
+// EXPENSE OPERATIONS
+// ============================================================================
+
+Result<int> ExpenseManager::addExpense(string description, double amount, SplitMethod method, 
+                       vector<int> participantIds, vector<double> shares,
+                       const string& idempotencyKey) {
+    
+    if (readOnly) return READ_ONLY_ERROR;
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+    if (!Utils::isRecordSafe(description)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, "Description may not contain '|' or control characters!");
+    }
+    if (!idempotencyKey.empty() && !IdempotencyKeys::validKey(idempotencyKey)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, "Idempotency key must be 1-" +
+                      to_string(IdempotencyKeys::MAX_KEY_LENGTH) + " characters without '|'!");
+    }
+
+    // Catch up with other processes so participants, the ID and keys
+    // they recorded are current
+    FileLock::Guard exclusive(dataLock, true);
+    refreshLocked();
+
+    if (!idempotencyKey.empty()) {
+        int original = idempotencyKeys.find(currentUser->getId(), idempotencyKey, time(nullptr));
+        if (original != 0) return original;
+    }
+
+    if (amount <= 0) {
+        return Status(ErrorCode::INVALID_ARGUMENT, "Amount must be greater than 0!");
+    }
+    const Status shareTooLarge(ErrorCode::INVALID_ARGUMENT, "Amounts and shares may not exceed " +
+                               Utils::formatCurrency(ExpenseParticipant::MAX_SHARE) + "!");
+    if (amount > ExpenseParticipant::MAX_SHARE) return shareTooLarge;
+
+    // Ensure creator is in participants
+    bool creatorIncluded = false;
+    for (int id : participantIds) {
+        if (id == currentUser->getId()) {
+            creatorIncluded = true;
+            break;
+        }
+    }
+    if (!creatorIncluded) {
+        participantIds.push_back(currentUser->getId());
+    }
+
+    // Validate participants exist
+    for (int id : participantIds) {
+        bool found = false;
+        for (const auto& user : users) {
+            if (user.getId() == id) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return Status(ErrorCode::NOT_FOUND, "User with ID " + to_string(id) + " not found!");
+        }
+    }
+
+    // Create expense
+    Expense newExpense(nextExpenseId++, description, amount, method, currentUser->getId());
+
+    // Calculate shares based on split method
+    if (method == SplitMethod:: EQUAL) {
+        double shareAmount = amount / participantIds.size();
+        for (int userId : participantIds) {
+            newExpense.addParticipant(ExpenseParticipant(userId, shareAmount));
+        }
+    }
+    else if (method == SplitMethod::EXACT) {
+        if (shares.size() != participantIds.size()) {
+            return Status(ErrorCode::INVALID_ARGUMENT, "Number of shares doesn't match participants!");
+        }
+
+        double total = 0;
+        for (double share : shares) {
+            if (abs(share) > ExpenseParticipant::MAX_SHARE) return shareTooLarge;
+            total += share;
+        }
+
+        if (abs(total - amount) > 0.01) {
+            return Status(ErrorCode::INVALID_ARGUMENT, "Sum of shares (" + Utils::formatCurrency(total) +
+                          ") doesn't match total amount (" + Utils::formatCurrency(amount) + ")!");
+        }
+
+        for (size_t i = 0; i < participantIds.size(); i++) {
+            newExpense. addParticipant(ExpenseParticipant(participantIds[i], shares[i]));
+        }
+    }
+    else if (method == SplitMethod::PERCENTAGE) {
+        if (shares.size() != participantIds.size()) {
+            return Status(ErrorCode::INVALID_ARGUMENT, "Number of percentages doesn't match participants!");
+        }
+
+        double totalPercentage = 0;
+        for (double percentage : shares) {
+            if (abs(amount * (percentage / 100.0)) > ExpenseParticipant::MAX_SHARE) return shareTooLarge;
+            totalPercentage += percentage;
+        }
+
+        if (abs(totalPercentage - 100.0) > 0.01) {
+            stringstream message;
+            message << "Percentages must add up to 100%!  (Current: " << totalPercentage << "%)";
+            return Status(ErrorCode::INVALID_ARGUMENT, message.str());
+        }
+
+        for (size_t i = 0; i < participantIds.size(); i++) {
+            double shareAmount = amount * (shares[i] / 100.0);
+            newExpense. addParticipant(ExpenseParticipant(participantIds[i], shareAmount));
+        }
+    }
+
+    GlobalExpenseId globalId{replicaId, (uint64_t)newExpense.getId()};
+    string record = newExpense.serialize() + "|" + globalId.toString();
+    if (!idempotencyKey.empty()) record += "|" + idempotencyKey;
+    if (!appendRecord(EXPENSES_FILE, expensesCursor, record)) {
+        return Status(ErrorCode::IO_ERROR, "Could not save expense!");
+    }
+    recordExpense(newExpense, globalId);
+    if (!idempotencyKey.empty()) {
+        idempotencyKeys.add(currentUser->getId(), idempotencyKey, newExpense.getId(), time(nullptr));
+    }
+    changes->publish("expense.added", newExpense.toJson(globalId.toString()));
+    return newExpense.getId();
+}
+
+Status ExpenseManager::deleteExpense(int expenseId) {
+    if (readOnly) return READ_ONLY_ERROR;
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    FileLock::Guard exclusive(dataLock, true);
+    refreshLocked();
+
+    auto it = expenseOrdinalById.find(expenseId);
+    if (it == expenseOrdinalById.end() || expenseIndex.isDeleted(it->second)) {
+        return Status(ErrorCode::NOT_FOUND, "Expense ID " + to_string(expenseId) + " not found!");
+    }
+    if (expenses[it->second].getCreatedBy() != currentUser->getId()) {
+        return Status(ErrorCode::PERMISSION_DENIED, "Only the payer can delete an expense!");
+    }
+
+    GlobalExpenseId globalId = globalIds[it->second];
+    string deletedAt = Utils::getCurrentDateTime();
+    if (!appendRecord(TOMBSTONES_FILE, tombstonesCursor, globalId.toString() + "|" + deletedAt)) {
+        return Status(ErrorCode::IO_ERROR, "Could not save the deletion!");
+    }
+    applyTombstone(globalId, Utils::dateTimeKey(deletedAt));
+    changes->publish("expense.deleted", tombstoneJson(expenseId, globalId, deletedAt));
+    return Status();
+}
+
+Status ExpenseManager::displayUserExpenses(ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    bool found = false;
+    out << "\n========================================" << endl;
+    out << "      YOUR EXPENSES" << endl;
+    out << "========================================" << endl;
+
+    ExpenseQuery query;
+    query.participantIds.push_back(currentUser->getId());
+    for (uint32_t ordinal : expenseIndex.run(query)) {
+        const Expense& expense = expenses[ordinal];
+        for (const auto& participant : expense.getParticipants()) {
+            if (participant.getUserId() == currentUser->getId()) {
+                expense.display(nameLookup(), out);
+                out << "Your share: " << Utils::formatCurrency(participant.getShare()) << endl;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    if (!found) {
+        out << "No expenses found for you." << endl;
+    }
+    return Status();
+}
+
+Status ExpenseManager::displayAllExpenses(ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    if (expenses.empty()) {
+        out << "\nNo expenses recorded yet." << endl;
+        return Status();
+    }
+
+    out << "\n========================================" << endl;
+    out << "         ALL EXPENSES" << endl;
+    out << "========================================" << endl;
+
+    for (size_t ordinal = 0; ordinal < expenses.size(); ordinal++) {
+        if (expenseIndex.isDeleted((uint32_t)ordinal)) continue;
+        expenses[ordinal].display(nameLookup(), out);
+    }
+    return Status();
+}
+
+vector<Expense> ExpenseManager::findExpenses(const ExpenseQuery& query) const {
+    vector<Expense> result;
+    for (uint32_t ordinal : expenseIndex.run(query)) result.push_back(expenses[ordinal]);
+    return result;
+}
+
+Status ExpenseManager::searchExpenses(const string& queryText, ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    ExpenseQuery query;
+    string error;
+    if (!ExpenseQuery::parse(queryText, query, error)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, error);
+    }
+
+    string plan;
+    vector<uint32_t> matches = expenseIndex.run(query, &plan);
+
+    out << "\n========================================" << endl;
+    out << "         SEARCH RESULTS" << endl;
+    out << "========================================" << endl;
+    out << "Plan: " << plan << endl;
+
+    double total = 0;
+    for (uint32_t ordinal : matches) {
+        expenses[ordinal].display(nameLookup(), out);
+        total += expenses[ordinal].getAmount();
+    }
+
+    out << "\n" << matches.size() << " matching expense(s), total "
+         << Utils::formatCurrency(total) << endl;
+    return Status();
+}
+
+// ============================================================================
+// REPORTS
+// ============================================================================
+
+bool ExpenseManager::parseReportRange(const string& fromText, const string& toText,
+                             long long& fromTime, long long& toTime) {
+    fromTime = Utils::dateTimeKey(fromText.size() == 7 ? fromText + "-01" : fromText);
+    if (toText.size() == 7) {
+        long long first = Utils::dateTimeKey(toText + "-01");
+        toTime = first < 0 ? -1 : monthEnd(monthKeyOf(first));
+    } else {
+        long long day = Utils::dateTimeKey(toText);
+        toTime = day < 0 ? -1 : day + 235959;
+    }
+    return fromTime >= 0 && toTime >= 0 && fromTime <= toTime;
+}
+
+long long ExpenseManager::monthStart(int month) {
+    return (month * 100LL + 1) * 1000000LL;
+}
+
+long long ExpenseManager::monthEnd(int month) {
+    static const int DAYS[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int year = month / 100, mon = month % 100;
+    int days = DAYS[mon - 1];
+    if (mon == 2 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)) days = 29;
+    return (month * 100LL + days) * 1000000LL + 235959;
+}
+
+int ExpenseManager::nextMonth(int month) {
+    return month % 100 == 12 ? (month / 100 + 1) * 100 + 1 : month + 1;
+}
+
+UserMonthTotals ExpenseManager::rawUserTotals(int userId, long long fromTime, long long toTime) const {
+    ExpenseQuery query;
+    query.fromTime = fromTime;
+    query.toTime = toTime;
+    query.participantIds.push_back(userId);
+    vector<uint32_t> involved = expenseIndex.run(query);
+
+    query.participantIds.clear();
+    query.payerId = userId;
+    vector<uint32_t> paid = expenseIndex.run(query);
+
+    UserMonthTotals totals;
+    for (uint32_t ordinal : paid) {
+        totals.paid += expenses[ordinal].getAmount();
+    }
+    for (uint32_t ordinal : involved) {
+        for (const auto& participant : expenses[ordinal].getParticipants()) {
+            if (participant.getUserId() == userId) {
+                totals.spent += participant.getShare();
+                totals.expenseCount++;
+            }
+        }
+    }
+    for (uint32_t ordinal : paid) {
+        if (!binary_search(involved.begin(), involved.end(), ordinal)) {
+            totals.expenseCount++;
+        }
+    }
+    return totals;
+}
+
+PairFlow ExpenseManager::rawPairFlow(int userA, int userB, long long fromTime, long long toTime) const {
+    ExpenseQuery query;
+    query.fromTime = fromTime;
+    query.toTime = toTime;
+    query.participantIds = {userA, userB};
+
+    PairFlow flow;
+    for (uint32_t ordinal : expenseIndex.run(query)) {
+        const Expense& expense = expenses[ordinal];
+        int payer = expense.getCreatedBy();
+        if (payer != userA && payer != userB) continue;
+        for (const auto& participant : expense.getParticipants()) {
+            if (payer == userA && participant.getUserId() == userB) {
+                flow.firstPaidForSecond += participant.getShare();
+            } else if (payer == userB && participant.getUserId() == userA) {
+                flow.secondPaidForFirst += participant.getShare();
+            }
+        }
+    }
+    return flow;
+}
+
+Status ExpenseManager::displayMonthlySpending(const string& fromText, const string& toText, ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    long long fromTime, toTime;
+    if (!parseReportRange(fromText, toText, fromTime, toTime)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, "Invalid date range!");
+    }
+
+    out << "\n========================================" << endl;
+    out << "       MONTHLY SPENDING" << endl;
+    out << "========================================" << endl;
+    out << left << setw(10) << "Month" << setw(14) << "Paid" << setw(14) << "Your share"
+         << setw(10) << "Count" << "Source" << endl;
+
+    UserMonthTotals overall;
+    int userId = currentUser->getId();
+    for (int month = monthKeyOf(fromTime); month <= monthKeyOf(toTime); month = nextMonth(month)) {
+        bool wholeMonth = fromTime <= monthStart(month) && toTime >= monthEnd(month);
+        UserMonthTotals totals = wholeMonth
+            ? rollups.userMonth(userId, month)
+            : rawUserTotals(userId, max(fromTime, monthStart(month)), min(toTime, monthEnd(month)));
+        overall.merge(totals);
+
+        stringstream label;
+        label << month / 100 << "-" << setw(2) << setfill('0') << month % 100;
+        out << left << setw(10) << label.str()
+             << setw(14) << Utils::formatCurrency(totals.paid)
+             << setw(14) << Utils::formatCurrency(totals.spent)
+             << setw(10) << totals.expenseCount
+             << (wholeMonth ? "rollup" : "partial") << endl;
+    }
+
+    out << "----------------------------------------" << endl;
+    out << "Total paid: " << Utils::formatCurrency(overall.paid)
+         << " | Your share: " << Utils::formatCurrency(overall.spent) << endl;
+    out << right << "========================================" << endl;
+    return Status();
+}
+
+Status ExpenseManager::displayPairReport(int otherUserId, const string& fromText, const string& toText,
+                         ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    long long fromTime, toTime;
+    if (!parseReportRange(fromText, toText, fromTime, toTime)) {
+        return Status(ErrorCode::INVALID_ARGUMENT, "Invalid date range!");
+    }
+
+    const string& otherName = nameOf(otherUserId);
+
+    out << "\n========================================" << endl;
+    out << "   EXCHANGE WITH " << otherName << endl;
+    out << "========================================" << endl;
+    out << left << setw(10) << "Quarter" << setw(16) << "You paid" << setw(16) << "They paid"
+         << "Net" << endl;
+
+    int userId = currentUser->getId();
+    map<string, PairFlow> quarters;
+    for (int month = monthKeyOf(fromTime); month <= monthKeyOf(toTime); month = nextMonth(month)) {
+        bool wholeMonth = fromTime <= monthStart(month) && toTime >= monthEnd(month);
+        PairFlow flow = wholeMonth
+            ? rollups.pairMonth(userId, otherUserId, month)
+            : rawPairFlow(userId, otherUserId, max(fromTime, monthStart(month)), min(toTime, monthEnd(month)));
+        string quarter = to_string(month / 100) + "-Q" + to_string((month % 100 - 1) / 3 + 1);
+        quarters[quarter].merge(flow);
+    }
+
+    for (const auto& [quarter, flow] : quarters) {
+        double net = flow.firstPaidForSecond - flow.secondPaidForFirst;
+        out << left << setw(10) << quarter
+             << setw(16) << Utils::formatCurrency(flow.firstPaidForSecond)
+             << setw(16) << Utils::formatCurrency(flow.secondPaidForFirst)
+             << (net >= 0 ? "+" : "-") << Utils::formatCurrency(abs(net)) << endl;
+    }
+    out << right << "========================================" << endl;
+    return Status();
+}
+
+// ============================================================================
+// BALANCE OPERATIONS
+// ============================================================================
+
+Status ExpenseManager::displayBalance(ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    // Balances are maintained incrementally by the ledger
+    vector<BalanceLedger::Entry> balance = ledger.balancesFor(currentUser->getId());
+
+    out << "\n========================================" << endl;
+    out << "         YOUR BALANCE" << endl;
+    out << "========================================" << endl;
+
+    if (balance.empty()) {
+        out << "No balances to show." << endl;
+        return Status();
+    }
+
+    bool hasBalance = false;
+    for (const auto& entry : balance) {
+        double amount = entry.amount;
+        if (abs(amount) > 0.01) {
+            hasBalance = true;
+            string userName = nameOf(entry.counterpartyId);
+
+            if (amount > 0) {
+                out << userName << " owes you: " << Utils::formatCurrency(amount) << endl;
+            } else {
+                out << "You owe " << userName << ": " << Utils::formatCurrency(-amount) << endl;
+            }
+        }
+    }
+
+    if (!hasBalance) {
+        out << "All settled up!" << endl;
+    }
+    out << "========================================" << endl;
+    return Status();
+}
+
+Status ExpenseManager::displayTopBalances(size_t k, ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    out << "\n========================================" << endl;
+    out << "       TOP " << k << " DEBTORS" << endl;
+    out << "========================================" << endl;
+    vector<BalanceLedger::Entry> debtors = ledger.topDebtors(k);
+    for (size_t i = 0; i < debtors.size(); i++) {
+        out << setw(4) << (i + 1) << ". " << nameOf(debtors[i].userId) << " (ID: " << debtors[i].userId
+             << ") owes " << Utils::formatCurrency(-debtors[i].amount) << endl;
+    }
+    if (debtors.empty()) out << "Nobody owes anything." << endl;
+
+    out << "\n========================================" << endl;
+    out << "       TOP " << k << " CREDITORS" << endl;
+    out << "========================================" << endl;
+    vector<BalanceLedger::Entry> creditors = ledger.topCreditors(k);
+    for (size_t i = 0; i < creditors.size(); i++) {
+        out << setw(4) << (i + 1) << ". " << nameOf(creditors[i].userId) << " (ID: " << creditors[i].userId
+             << ") is owed " << Utils::formatCurrency(creditors[i].amount) << endl;
+    }
+    if (creditors.empty()) out << "Nobody is owed anything." << endl;
+
+    out << "\n========================================" << endl;
+    out << "    TOP " << k << " OUTSTANDING DEBTS" << endl;
+    out << "========================================" << endl;
+    vector<BalanceLedger::Entry> pairs = ledger.topPairs(k);
+    for (size_t i = 0; i < pairs.size(); i++) {
+        out << setw(4) << (i + 1) << ". " << nameOf(pairs[i].userId) << " owes "
+             << nameOf(pairs[i].counterpartyId) << ": " << Utils::formatCurrency(pairs[i].amount) << endl;
+    }
+    if (pairs.empty()) out << "No outstanding debts." << endl;
+    out << "========================================" << endl;
+    return Status();
+}
+
+Status ExpenseManager::displayDebtSimplification(ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    vector<DebtGraph::Component> components = DebtGraph::analyze(ledger.allDebts());
+
+    size_t edgesBefore = 0, edgesAfter = 0, transfers = 0, cycles = 0;
+    const DebtGraph::Component* mine = nullptr;
+    for (const auto& component : components) {
+        edgesBefore += component.edgesBefore;
+        edgesAfter += component.edgesAfterCancellation;
+        transfers += component.settlement.size();
+        cycles += component.cyclesCancelled;
+        if (find(component.userIds.begin(), component.userIds.end(), currentUser->getId()) != component.userIds.end()) {
+            mine = &component;
+        }
+    }
+
+    out << "\n========================================" << endl;
+    out << "       DEBT SIMPLIFICATION" << endl;
+    out << "========================================" << endl;
+    out << "Groups of connected users: " << components.size() << endl;
+    out << "Outstanding debts:         " << edgesBefore << endl;
+    out << "Cycles cancelled:          " << cycles << endl;
+    out << "Debts after cancellation:  " << edgesAfter << endl;
+    out << "Transfers to settle all:   " << transfers << endl;
+
+    if (mine == nullptr) {
+        out << "\nYou have no outstanding debts. All settled up!" << endl;
+        out << "========================================" << endl;
+        return Status();
+    }
+
+    out << "\nYour group: " << mine->userIds.size() << " users, "
+         << mine->cyclesCancelled << " cycle(s) cancelled ("
+         << Utils::formatCurrency(mine->amountCancelled) << " of circular debt removed)" << endl;
+    out << "Settlement plan:" << endl;
+    const size_t MAX_LINES = 50;
+    for (size_t i = 0; i < mine->settlement.size() && i < MAX_LINES; i++) {
+        const auto& transfer = mine->settlement[i];
+        bool involvesMe = transfer.fromUser == currentUser->getId() || transfer.toUser == currentUser->getId();
+        out << (involvesMe ? " * " : "   ") << nameOf(transfer.fromUser) << " pays "
+             << nameOf(transfer.toUser) << ": " << Utils::formatCurrency(transfer.amount) << endl;
+    }
+    if (mine->settlement.size() > MAX_LINES) {
+        out << "   ... and " << (mine->settlement.size() - MAX_LINES) << " more" << endl;
+    }
+    out << "========================================" << endl;
+    return Status();
+}
+
+Status ExpenseManager::displaySharingInsights(ostream& out) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+    if (!sketchesEnabled) {
+        out << "Sharing insights are disabled for this session." << endl;
+        return Status();
+    }
+
+    out << "\n========================================" << endl;
+    out << "   SHARING INSIGHTS (APPROXIMATE)" << endl;
+    out << "========================================" << endl;
+    out << fixed << setprecision(0);
+    out << "People you have split with: ~" << sketches.distinctPartners(currentUser->getId())
+         << " (+/- " << setprecision(1) << HyperLogLog::relativeError() * 100 << "%)" << endl;
+    if (sketches.evictedPartners() > 0) {
+        out << "(Counts restart for the least active users past the sketch cap; "
+             << sketches.evictedPartners() << " dropped so far.)" << endl;
+    }
+
+    out << "\nMost frequent co-participants:" << endl;
+    vector<ExpenseSketches::HeavyPair> pairs = sketches.heavyPairs(10);
+    for (size_t i = 0; i < pairs.size(); i++) {
+        out << setw(4) << (i + 1) << ". " << nameOf(pairs[i].firstUser) << " & "
+             << nameOf(pairs[i].secondUser) << ": ~" << pairs[i].estimatedCount << " shared expenses" << endl;
+    }
+    if (pairs.empty()) out << "No shared expenses yet." << endl;
+    out << setprecision(0) << "Counts may be high by up to " << sketches.pairErrorBound()
+         << " (98% confidence)." << endl;
+    out << "Sketch memory: " << sketches.memoryBytes() / 1024 << " KB" << endl;
+    out.unsetf(ios::fixed);
+    out << setprecision(6) << "========================================" << endl;
+    return Status();
+}
+
+void ExpenseManager::displayMemoryUsage(ostream& out) const {
+    out << "\n========================================" << endl;
+    out << "          MEMORY USAGE" << endl;
+    out << "========================================" << endl;
+    out << "Users: " << users.size() << " | Expenses: " << expenses.size()
+         << " | Interned strings: " << StringPool::global().size() << endl;
+    out << "Idempotency keys: " << idempotencyKeys.size() << endl;
+    if (malformedLines > 0) {
+        out << "Malformed data lines skipped: " << malformedLines << endl;
+    }
+    if (changes) {
+        out << "Change feed: last seq " << changes->lastWritten() << " | batches "
+             << changes->batchesWritten() << " | queued " << changes->queued()
+             << " | failed appends " << changes->failedAppends() << endl;
+    }
+    out << "Bytes per expense record: " << sizeof(Expense)
+         << " | per participant: " << sizeof(ExpenseParticipant) << endl << endl;
+    if (spillUnavailable) {
+        out << "Expense budget: off (could not open the spill file)" << endl << endl;
+    } else if (expenses.spillFailed()) {
+        out << "Expense budget: off (a write to the spill file failed)" << endl << endl;
+    }
+    if (expenses.memoryBudget() > 0) {
+        out << "Expense budget: " << expenses.memoryBudget() / 1024 << " KB | resident "
+             << expenses.residentMemory() / 1024 << " KB in " << expenses.residentPages()
+             << "/" << expenses.pageCount() << " pages" << endl;
+        out << "Page faults: " << expenses.pageFaults()
+             << " | Evictions: " << expenses.pageEvictions() << endl << endl;
+    }
+    MemoryTracker::report(out);
+    out << "\nTask scheduler:" << endl;
+    TaskScheduler::global().report(out);
+    out << "========================================" << endl;
+}
+
+unordered_map<int, uint32_t> ExpenseManager::userNameRanks() const {
+    vector<pair<string, int>> byName;
+    byName.reserve(users.size());
+    for (const auto& user : users) {
+        byName.emplace_back(Utils::toLower(user.getName()), user.getId());
+    }
+    sort(byName.begin(), byName.end());
+    unordered_map<int, uint32_t> ranks;
+    for (size_t i = 0; i < byName.size(); i++) {
+        ranks[byName[i].second] = (uint32_t)i;
+    }
+    return ranks;
+}
+
+Result<expense::ExportInfo> ExpenseManager::exportBalanceToCSV(const string& filename, ExportOrder order,
+                                               bool descending, size_t limit) const {
+    if (currentUser == nullptr) return NOT_LOGGED_IN_ERROR;
+
+    ofstream file(filename);
+    if (!file.is_open()) {
+        return Status(ErrorCode::IO_ERROR, "Could not create file!");
+    }
+
+    // Write CSV header
+    file << "Expense ID,Description,Total Amount,Payer,Payer Name,User ID,User Name,Share,Created At\n";
+
+    // Expenses the current user paid for or takes part in, in ledger order
+    ExpenseQuery paidQuery, sharedQuery;
+    paidQuery.payerId = currentUser->getId();
+    sharedQuery.participantIds.push_back(currentUser->getId());
+    vector<uint32_t> paid = expenseIndex.run(paidQuery);
+    vector<uint32_t> shared = expenseIndex.run(sharedQuery);
+    vector<uint32_t> relevant;
+    set_union(paid.begin(), paid.end(), shared.begin(), shared.end(), back_inserter(relevant));
+
+    size_t written = 0;
+    auto writeRow = [&](const ExportRow& row) {
+        file << row.expenseId << ","
+             << StringPool::global().get(row.description) << ","
+             << fixed << setprecision(2) << row.amount << ","
+             << row.payerId << ","
+             << nameOf(row.payerId) << ","
+             << row.userId << ","
+             << nameOf(row.userId) << ","
+             << row.shareCents / 100.0 << ","
+             << Utils::formatDateTimeKey(row.createdAt) << "\n";
+        written++;
+    };
+    auto makeRow = [](const Expense& expense, uint32_t ordinal, uint32_t slot, int64_t key) {
+        const ExpenseParticipant& participant = expense.getParticipants()[slot];
+        return ExportRow{key, ordinal, slot, expense.getAmount(), expense.getCreatedAtKey(),
+                         expense.getId(), expense.getDescriptionId(), expense.getCreatedBy(),
+                         (int)participant.getUserId(), participant.getShareCents()};
+    };
+
+    if (order == ExportOrder::STORAGE && !descending) {
+        for (uint32_t ordinal : relevant) {
+            const Expense& expense = expenses[ordinal];
+            uint32_t slots = (uint32_t)expense.getParticipants().size();
+            for (uint32_t slot = 0; slot < slots && (limit == 0 || written < limit); slot++) {
+                writeRow(makeRow(expense, ordinal, slot, 0));
+            }
+            if (limit != 0 && written >= limit) break;
+        }
+        file.close();
+        return expense::ExportInfo{filename, written, 0};
+    }
+
+    unordered_map<int, uint32_t> nameRanks;
+    if (order == ExportOrder::COUNTERPARTY) nameRanks = userNameRanks();
+    auto keyOf = [&](const Expense& expense, const ExpenseParticipant& participant, uint32_t ordinal) -> int64_t {
+        int64_t key = ordinal;
+        if (order == ExportOrder::DATE) {
+            key = expense.getCreatedAtKey();
+        } else if (order == ExportOrder::AMOUNT) {
+            key = llround(expense.getAmount() * 100.0);
+        } else if (order == ExportOrder::COUNTERPARTY) {
+            // The other side of the row from the current user's point of view
+            int other = (int)participant.getUserId() == currentUser->getId()
+                            ? expense.getCreatedBy() : (int)participant.getUserId();
+            auto it = nameRanks.find(other);
+            key = it == nameRanks.end() ? numeric_limits<uint32_t>::max() : it->second;
+        }
+        return descending ? -key : key;
+    };
+
+    size_t memoryBytes = expenses.memoryBudget() > 0 ? expenses.memoryBudget() : DEFAULT_EXPORT_MEMORY;
+    ExportRowLess less;
+    bool useHeap = limit > 0 && limit * sizeof(ExportRow) <= memoryBytes;
+
+    // Top-N: keep the `limit` smallest rows in a max-heap
+    vector<ExportRow> heap;
+    ExternalMergeSorter<ExportRow, ExportRowLess> sorter(filename + ".sort", memoryBytes, less);
+    try {
+        for (uint32_t ordinal : relevant) {
+            const Expense& expense = expenses[ordinal];
+            const auto& participants = expense.getParticipants();
+            for (uint32_t slot = 0; slot < participants.size(); slot++) {
+                ExportRow row = makeRow(expense, ordinal, slot, keyOf(expense, participants[slot], ordinal));
+                if (!useHeap) {
+                    sorter.add(row);
+                } else if (heap.size() < limit) {
+                    heap.push_back(row);
+                    push_heap(heap.begin(), heap.end(), less);
+                } else if (less(row, heap.front())) {
+                    pop_heap(heap.begin(), heap.end(), less);
+                    heap.back() = row;
+                    push_heap(heap.begin(), heap.end(), less);
+                }
+            }
+        }
+
+        if (useHeap) {
+            sort_heap(heap.begin(), heap.end(), less);
+            for (const auto& row : heap) writeRow(row);
+        } else {
+            sorter.finish([&](const ExportRow& row) {
+                if (limit == 0 || written < limit) writeRow(row);
+            });
+        }
+    } catch (const exception& e) {
+        return Status(ErrorCode::IO_ERROR, string("Export failed: ") + e.what());
+    }
+
+    file.close();
+    return expense::ExportInfo{filename, written, (size_t)sorter.runCount()};
+}
+
+// ============================================================================
+// DATA PERSISTENCE
+// ============================================================================
+
+void ExpenseManager::loadData() {
+    Utils::createDirectory(DATA_DIR);
+
+    readNewRecords();
+}
+
+ExpenseManager::RefreshStats ExpenseManager::readNewRecords() {
+    RefreshStats stats;
+
+    // Users; bulk loads append to the prefix indexes and sort once
+    bool bulk = usersCursor.offset == 0;
+    readCompleteLines(USERS_FILE, usersCursor, [&](const string& line) {
+        User user = User::deserialize(line);
+        if (user.getId() <= 0) {
+            stats.malformed++;
+        } else if (getUserById(user.getId()) == nullptr) {
+            addLoadedUser(user, bulk);
+            stats.users++;
+        }
+    });
+    if (bulk) {
+        nameIndex.build();
+        emailIndex.build();
+    }
+
+    // Expenses in batches so rollups and sketches are built without
+    // holding every record at once when a memory budget is set. Each
+    // batch of lines is parsed in parallel on the task scheduler.
+    auto loadLines = [&](vector<string>& lines) {
+        ExpenseList parsed(lines.size());
+        vector<GlobalExpenseId> parsedIds(lines.size());
+        vector<string> parsedKeys(lines.size());
+        TaskScheduler::global().parallelFor(0, lines.size(), 1024, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                parsed[i] = Expense::deserialize(lines[i]);
+                parsedIds[i] = GlobalExpenseId::ofRecord(lines[i]);
+                parsedKeys[i] = idempotencyKeyOf(lines[i]);
+            }
+        });
+
+        ExpenseList batch;
+        vector<GlobalExpenseId> batchIds;
+        for (size_t i = 0; i < parsed.size(); i++) {
+            Expense& expense = parsed[i];
+            if (expense.getId() <= 0) stats.malformed++;
+            if (expense.getId() > 0 && expenseOrdinalById.find(expense.getId()) == expenseOrdinalById.end()) {
+                if (expense.getId() >= nextExpenseId) {
+                    nextExpenseId = expense.getId() + 1;
+                }
+                if (!parsedKeys[i].empty()) {
+                    idempotencyKeys.add(expense.getCreatedBy(), parsedKeys[i], expense.getId(),
+                                        Utils::dateTimeKeyToUnix(expense.getCreatedAtKey()));
+                }
+                batch.push_back(move(expense));
+                batchIds.push_back(parsedIds[i]);
+                stats.expenses++;
+            }
+        }
+        if (!batch.empty()) addLoadedBatch(batch, batchIds);
+    };
+    readCompleteLines(EXPENSES_FILE, expensesCursor, LOAD_BATCH, loadLines);
+
+    // Tombstones: "<global id>|<deleted at>"
+    readCompleteLines(TOMBSTONES_FILE, tombstonesCursor, [&](const string& line) {
+        size_t separator = line.find('|');
+        GlobalExpenseId globalId = GlobalExpenseId::parse(line.substr(0, separator));
+        long long deletedAt = separator == string::npos ? 0 : Utils::dateTimeKey(line.substr(separator + 1));
+        if (!globalId.valid()) stats.malformed++;
+        else if (applyTombstone(globalId, deletedAt)) stats.deletions++;
+    });
+    malformedLines += stats.malformed;
+    return stats;
+}
+
+ExpenseManager::FileInfo ExpenseManager::fileInfo(const string& path) {
+    FileInfo info;
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) return info;
+    info.inode = (uint64_t)status.st_ino;
+    info.size = (uint64_t)status.st_size;
+    #if defined(__linux__)
+        info.mtime = (int64_t)status.st_mtim.tv_sec * 1000000000LL + status.st_mtim.tv_nsec;
+    #else
+        info.mtime = (int64_t)status.st_mtime * 1000000000LL;
+    #endif
+    return info;
+}
+
+uint64_t ExpenseManager::anchorAt(const string& path, uint64_t offset) {
+    static constexpr uint64_t SAMPLE = 64;
+    ifstream file(path, ios::binary);
+    if (!file.is_open() || offset == 0) return 0;
+    uint64_t hash = offset;
+    for (uint64_t start : {(uint64_t)0, offset > SAMPLE ? offset - SAMPLE : 0}) {
+        char bytes[SAMPLE];
+        file.clear();
+        file.seekg((streamoff)start);
+        file.read(bytes, (streamsize)min(SAMPLE, offset - start));
+        for (streamsize i = 0; i < file.gcount(); i++) hash = Utils::hash64(hash ^ (unsigned char)bytes[i]);
+    }
+    return hash;
+}
+
+bool ExpenseManager::bytesAt(const string& path, uint64_t offset, const string& bytes) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) return false;
+    file.seekg((streamoff)offset);
+    string found(bytes.size(), '\0');
+    file.read(&found[0], (streamsize)found.size());
+    return file.gcount() == (streamsize)found.size() && found == bytes;
+}
+
+void ExpenseManager::readCompleteLines(const string& path, FileCursor& cursor, size_t batchSize,
+                              const function<void(vector<string>&)>& onLines) {
+    FileInfo info = fileInfo(path);
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) return;
+    cursor.inode = info.inode;
+    file.seekg((streamoff)cursor.offset);
+    vector<string> lines;
+    uint64_t end = cursor.offset;
+    auto apply = [&]() {
+        if (!lines.empty()) onLines(lines);
+        lines.clear();
+        cursor.offset = end;
+    };
+    try {
+        string line;
+        while (getline(file, line) && !file.eof()) {
+            end += line.size() + 1;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) lines.push_back(move(line));
+            if (lines.size() >= batchSize) apply();
+        }
+        apply();
+    } catch (...) {
+        // The old size and mtime stay, so fileTouched() still reports the
+        // unread lines
+        cursor.anchor = anchorAt(path, cursor.offset);
+        throw;
+    }
+    cursor.seenSize = info.size;
+    cursor.seenMtime = info.mtime;
+    cursor.anchor = anchorAt(path, cursor.offset);
+}
+
+void ExpenseManager::readCompleteLines(const string& path, FileCursor& cursor,
+                              const function<void(const string&)>& onLine) {
+    readCompleteLines(path, cursor, 1, [&](vector<string>& lines) { onLine(lines[0]); });
+}
+
+bool ExpenseManager::fileTouched(const string& path, const FileCursor& cursor) {
+    if (cursor.stale) return true;
+    FileInfo info = fileInfo(path);
+    return info.inode != cursor.inode || info.size != cursor.seenSize || info.mtime != cursor.seenMtime;
+}
+
+bool ExpenseManager::fileReplaced(const string& path, const FileCursor& cursor) {
+    if (cursor.stale) return true;
+    if (cursor.offset == 0) return false;
+    FileInfo info = fileInfo(path);
+    return info.inode != cursor.inode || info.size < cursor.offset ||
+           anchorAt(path, cursor.offset) != cursor.anchor;
+}
+
+bool ExpenseManager::appendRecord(const string& path, FileCursor& cursor, const string& record) {
+    ofstream file(path, ios::app | ios::binary);
+    if (!file.is_open()) return false;
+    file << record << "\n";
+    file.close();
+    if (file.fail()) return false;
+
+    // Writers that ignore the lock (external tools) may have appended too,
+    // so only skip bytes that are known to be this record
+    FileInfo info = fileInfo(path);
+    if ((cursor.offset > 0 && info.inode != cursor.inode) || !bytesAt(path, cursor.offset, record + "\n")) {
+        cursor.stale = true;
+        return true;
+    }
+    cursor.inode = info.inode;
+    cursor.offset += record.size() + 1;
+    cursor.seenSize = cursor.offset;   // anything beyond us was appended without the lock
+    cursor.seenMtime = info.mtime;
+    cursor.anchor = anchorAt(path, cursor.offset);
+    return true;
+}
+
+void ExpenseManager::addLoadedUser(const User& user, bool bulk) {
+    int viewingId = currentUser ? currentUser->getId() : 0;
+    userPositionById[user.getId()] = users.size();
+    users.push_back(user);
+    if (bulk) {
+        nameIndex.append(user.getName(), user.getId());
+        emailIndex.append(user.getEmail(), user.getId());
+    } else {
+        nameIndex.insert(user.getName(), user.getId());
+        emailIndex.insert(user.getEmail(), user.getId());
+    }
+    if (user.getId() >= nextUserId) {
+        nextUserId = user.getId() + 1;
+    }
+    if (viewingId) currentUser = getUserById(viewingId);   // users may have moved
+}
+
+void ExpenseManager::reloadAll() {
+    int viewingId = currentUser ? currentUser->getId() : 0;
+    currentUser = nullptr;
+    users.clear();
+    userPositionById.clear();
+    expenseOrdinalById.clear();
+    globalIds.clear();
+    ordinalByGlobalId.clear();
+    tombstones.clear();
+    idempotencyKeys.clear();
+    nameIndex.clear();
+    emailIndex.clear();
+    expenses.clear();
+    expenseIndex.clear();
+    rollups = RollupTables();
+    ledger = BalanceLedger();
+    sketches = ExpenseSketches();
+    nextUserId = 1;
+    nextExpenseId = 1;
+    usersCursor = FileCursor();
+    expensesCursor = FileCursor();
+    tombstonesCursor = FileCursor();
+    malformedLines = 0;
+    loadData();
+    if (viewingId) currentUser = getUserById(viewingId);
+}
+
+ExpenseManager::RefreshStats ExpenseManager::refreshLocked() {
+    bool usersTouched = fileTouched(USERS_FILE, usersCursor);
+    bool expensesTouched = fileTouched(EXPENSES_FILE, expensesCursor);
+    bool tombstonesTouched = fileTouched(TOMBSTONES_FILE, tombstonesCursor);
+    if (!usersTouched && !expensesTouched && !tombstonesTouched) return RefreshStats();
+    if ((usersTouched && fileReplaced(USERS_FILE, usersCursor)) ||
+        (expensesTouched && fileReplaced(EXPENSES_FILE, expensesCursor)) ||
+        (tombstonesTouched && fileReplaced(TOMBSTONES_FILE, tombstonesCursor))) {
+        reloadAll();
+        RefreshStats stats;
+        stats.users = users.size();
+        stats.expenses = expenses.size();
+        stats.reloaded = true;
+        return stats;
+    }
+    return readNewRecords();
+}
+
+ExpenseManager::RefreshStats ExpenseManager::refresh() {
+    if (readOnly) return RefreshStats();   // replicas follow the change feed instead
+    if (!fileTouched(USERS_FILE, usersCursor) && !fileTouched(EXPENSES_FILE, expensesCursor) &&
+        !fileTouched(TOMBSTONES_FILE, tombstonesCursor)) {
+        return RefreshStats();
+    }
+    FileLock::Guard shared(dataLock, false);
+    return refreshLocked();
+}
+
+string ExpenseManager::idempotencyKeyOf(const string& line) {
+    size_t separator = 0;
+    for (int field = 0; field < 8 && separator != string::npos; field++) {
+        separator = line.find('|', field == 0 ? 0 : separator + 1);
+    }
+    return separator == string::npos ? string() : line.substr(separator + 1);
+}
+
+void ExpenseManager::recordExpense(const Expense& expense, const GlobalExpenseId& globalId) {
+    expenseOrdinalById[expense.getId()] = (uint32_t)expenses.size();
+    expenses.push_back(expense);
+    expenseIndex.add((uint32_t)(expenses.size() - 1), expense);
+    rollups.add(expense);
+    ledger.apply(expense);
+    if (sketchesEnabled) sketches.add(expense);
+    addGlobalId((uint32_t)(expenses.size() - 1), globalId);
+}
+
+void ExpenseManager::addGlobalId(uint32_t ordinal, const GlobalExpenseId& globalId) {
+    globalIds.push_back(globalId);
+    ordinalByGlobalId[globalId] = ordinal;
+    if (tombstones.find(globalId) != tombstones.end()) hideExpense(ordinal);
+}
+
+void ExpenseManager::hideExpense(uint32_t ordinal) {
+    expenseIndex.markDeleted(ordinal);
+    const Expense& expense = expenses[ordinal];
+    ledger.revert(expense);
+    rollups.add(expense, -1);
+}
+
+bool ExpenseManager::applyTombstone(const GlobalExpenseId& globalId, long long deletedAt) {
+    if (tombstones.find(globalId) != tombstones.end()) return false;
+    tombstones[globalId] = deletedAt;
+    auto it = ordinalByGlobalId.find(globalId);
+    if (it != ordinalByGlobalId.end()) hideExpense(it->second);
+    return true;
+}
+
+string ExpenseManager::tombstoneJson(int expenseId, const GlobalExpenseId& globalId, const string& deletedAt) {
+    return "{\"id\":" + to_string(expenseId) + ",\"gid\":\"" + globalId.toString() +
+           "\",\"deletedAt\":\"" + deletedAt + "\"}";
+}
+
+bool ExpenseManager::applyChange(const string& line, ChangeRecord& record) {
+    JsonReader reader(line);
+    bool ok = reader.object([&](const string& key) {
+        long long number = 0;
+        if (key == "seq") {
+            if (!reader.readInteger(number)) return false;
+            record.sequence = (uint64_t)number;
+            return true;
+        }
+        if (key == "ms") return reader.readInteger(record.publishedMillis);
+        if (key == "type") return reader.readString(record.type);
+        if (key != "data") return reader.skip();
+
+        if (record.type == "user.registered") {
+            User user = User::fromJson(reader);
+            if (user.getId() <= 0) return false;
+            if (getUserById(user.getId()) == nullptr) {
+                addLoadedUser(user, false);
+            }
+            return true;
+        }
+        if (record.type == "expense.added") {
+            string globalId;
+            Expense expense = Expense::fromJson(reader, &globalId);
+            if (expense.getId() <= 0) return false;
+            if (expenseOrdinalById.find(expense.getId()) == expenseOrdinalById.end()) {
+                // Records from before global IDs get the same content hash as their line
+                recordExpense(expense, globalId.empty() ? GlobalExpenseId::ofRecord(expense.serialize())
+                                                        : GlobalExpenseId::parse(globalId));
+                nextExpenseId = max(nextExpenseId, expense.getId() + 1);
+            }
+            return true;
+        }
+        if (record.type == "expense.deleted") {
+            string globalId, deletedAt;
+            bool deletionOk = reader.object([&](const string& field) {
+                if (field == "gid") return reader.readString(globalId);
+                if (field == "deletedAt") return reader.readString(deletedAt);
+                return reader.skip();
+            });
+            GlobalExpenseId parsed = GlobalExpenseId::parse(globalId);
+            if (!deletionOk || !parsed.valid()) return false;
+            applyTombstone(parsed, Utils::dateTimeKey(deletedAt));
+            return true;
+        }
+        return reader.skip();   // record types this build does not know
+    });
+    return ok && record.sequence > 0;
+}
+
+void ExpenseManager::addLoadedBatch(const ExpenseList& batch, const vector<GlobalExpenseId>& batchIds) {
+    rollups.merge(RollupTables::build(batch));
+    if (sketchesEnabled) {
+        sketches.merge(ExpenseSketches::build(batch));
+    }
+    for (size_t i = 0; i < batch.size(); i++) {
+        const Expense& expense = batch[i];
+        expenseOrdinalById[expense.getId()] = (uint32_t)expenses.size();
+        expenses.push_back(expense);
+        expenseIndex.add((uint32_t)(expenses.size() - 1), expense);
+        ledger.apply(expense);
+        addGlobalId((uint32_t)(expenses.size() - 1), batchIds[i]);
+    }
+}
+
+Status ExpenseManager::compactData(size_t keepChanges) {
+    if (readOnly) return READ_ONLY_ERROR;
+    FileLock::Guard exclusive(dataLock, true);
+    refreshLocked();
+
+    const string usersTemp = USERS_FILE + ".tmp";
+    const string expensesTemp = EXPENSES_FILE + ".tmp";
+    ofstream usersFile(usersTemp, ios::trunc | ios::binary);
+    for (const auto& user : users) {
+        usersFile << user.serialize() << "\n";
+    }
+    usersFile.close();
+
+    // Deleted expenses stay: their tombstones must keep winning over
+    // copies that a later merge brings back. Idempotency keys still in
+    // the window are kept; expired ones are dropped.
+    unordered_map<uint32_t, string> keyByOrdinal;
+    idempotencyKeys.forEach([&](int, const string& key, int expenseId) {
+        auto it = expenseOrdinalById.find(expenseId);
+        if (it != expenseOrdinalById.end()) keyByOrdinal[it->second] = key;
+    });
+    ofstream expensesFile(expensesTemp, ios::trunc | ios::binary);
+    try {
+        expenses.writeAll(expensesFile, [&](size_t ordinal) {
+            auto key = keyByOrdinal.find((uint32_t)ordinal);
+            return "|" + globalIds[ordinal].toString() + (key == keyByOrdinal.end() ? "" : "|" + key->second);
+        });
+    } catch (const runtime_error& error) {
+        // Partial output must never replace the data files
+        expensesFile.close();
+        remove(usersTemp.c_str());
+        remove(expensesTemp.c_str());
+        return Status(ErrorCode::IO_ERROR, string("Could not rewrite the data files: ") + error.what());
+    }
+    expensesFile.close();
+
+    if (usersFile.fail() || expensesFile.fail() ||
+        rename(usersTemp.c_str(), USERS_FILE.c_str()) != 0 ||
+        rename(expensesTemp.c_str(), EXPENSES_FILE.c_str()) != 0) {
+        return Status(ErrorCode::IO_ERROR, "Could not rewrite the data files!");
+    }
+    FileInfo usersInfo = fileInfo(USERS_FILE);
+    FileInfo expensesInfo = fileInfo(EXPENSES_FILE);
+    usersCursor = {usersInfo.inode, usersInfo.size, usersInfo.size, usersInfo.mtime, anchorAt(USERS_FILE, usersInfo.size)};
+    expensesCursor = {expensesInfo.inode, expensesInfo.size, expensesInfo.size, expensesInfo.mtime,
+                      anchorAt(EXPENSES_FILE, expensesInfo.size)};
+    return changes->trim(keepChanges);
+}
+
+// ============================================================================
+// OFFLINE SYNC
+// ============================================================================
+
+uint64_t ExpenseManager::readReplicaId(const string& dataDir) {
+    ifstream file(dataDir + "/replica.id");
+    string text;
+    if (!(file >> text)) return 0;
+    return strtoull(text.c_str(), nullptr, 16);
+}
+
+uint64_t ExpenseManager::createReplicaId() {
+    random_device device;
+    uint64_t id = 0;
+    while (id == 0) {
+        id = ((uint64_t)device() << 32 | device()) ^ Utils::hash64((uint64_t)Utils::unixMillis());
+    }
+    ofstream file(REPLICA_ID_FILE, ios::trunc);
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)id);
+    file << buffer << "\n";
+    return id;
+}
+
+bool ExpenseManager::loadPeerState(const string& path, PeerState& state) {
+    ifstream file(path);
+    if (!file.is_open()) return false;
+    string line;
+    while (getline(file, line)) {
+        istringstream fields(line);
+        string kind;
+        fields >> kind;
+        FileCursor* cursor = kind == "users" ? &state.users
+                           : kind == "expenses" ? &state.expenses
+                           : kind == "tombstones" ? &state.tombstones : nullptr;
+        if (cursor != nullptr) {
+            fields >> cursor->inode >> cursor->offset >> cursor->anchor;
+        } else if (kind == "user") {
+            int peerId = 0, localId = 0;
+            if (fields >> peerId >> localId) state.localUserIds[peerId] = localId;
+        } else if (kind == "pending" && line.size() > 8) {
+            state.pendingExpenses.push_back(line.substr(8));
+        }
+    }
+    return true;
+}
+
+bool ExpenseManager::savePeerState(const string& path, const PeerState& state) {
+    const string temp = path + ".tmp";
+    ofstream file(temp, ios::trunc);
+    auto writeCursor = [&](const char* kind, const FileCursor& cursor) {
+        file << kind << " " << cursor.inode << " " << cursor.offset << " " << cursor.anchor << "\n";
+    };
+    writeCursor("users", state.users);
+    writeCursor("expenses", state.expenses);
+    writeCursor("tombstones", state.tombstones);
+    for (const auto& [peerId, localId] : state.localUserIds) {
+        file << "user " << peerId << " " << localId << "\n";
+    }
+    for (const string& line : state.pendingExpenses) {
+        file << "pending " << line << "\n";
+    }
+    file.close();
+    return !file.fail() && rename(temp.c_str(), path.c_str()) == 0;
+}
+
+Result<expense::MergeInfo> ExpenseManager::mergeFrom(const string& peerDir) {
+    if (readOnly) return READ_ONLY_ERROR;
+
+    uint64_t peerId = readReplicaId(peerDir);
+    if (peerId == 0) {
+        return Status(ErrorCode::INVALID_ARGUMENT,
+                      peerDir + " has no replica.id; open it once with this version first!");
+    }
+    if (peerId == replicaId) {
+        return Status(ErrorCode::INVALID_ARGUMENT, peerDir + " has this directory's replica ID (a copy?); "
+                      "delete its replica.id and open it once to give it its own.");
+    }
+
+    // Shared lock on the peer, exclusive here; taken in replica ID order
+    // so two directories merging into each other cannot deadlock
+    FileLock peerLock(peerDir + "/.lock");
+    if (peerId < replicaId) peerLock.lock(false);
+    FileLock::Guard exclusive(dataLock, true);
+    if (peerId > replicaId) peerLock.lock(false);
+    refreshLocked();
+
+    char peerName[24];
+    snprintf(peerName, sizeof(peerName), "%016llx", (unsigned long long)peerId);
+    const string statePath = SYNC_DIR + "/" + peerName + ".state";
+    const string peerUsersFile = peerDir + "/users.txt";
+    const string peerExpensesFile = peerDir + "/expenses.txt";
+    const string peerTombstonesFile = peerDir + "/tombstones.txt";
+
+    PeerState state;
+    loadPeerState(statePath, state);
+    // A peer file that was compacted or replaced is read again from the start
+    uint64_t rescanned = 0;
+    for (auto [path, cursor] : {make_pair(&peerUsersFile, &state.users), make_pair(&peerExpensesFile, &state.expenses),
+                                make_pair(&peerTombstonesFile, &state.tombstones)}) {
+        if (fileReplaced(*path, *cursor)) {
+            *cursor = FileCursor();
+            rescanned++;
+        }
+    }
+    // Rereading the expenses from the start finds the pending ones again
+    if (state.expenses.offset == 0) state.pendingExpenses.clear();
+    for (auto it = state.localUserIds.begin(); it != state.localUserIds.end();) {
+        it = getUserById(it->second) == nullptr ? state.localUserIds.erase(it) : next(it);
+    }
+    uint64_t bytesBefore = state.users.offset + state.expenses.offset + state.tombstones.offset;
+
+    // 1. Users
+    vector<User> newUsers;
+    string userLines;
+    readCompleteLines(peerUsersFile, state.users, [&](const string& line) {
+        User peerUser = User::deserialize(line);
+        if (peerUser.getId() <= 0 || state.localUserIds.count(peerUser.getId())) return;
+        for (int id : emailIndex.exact(peerUser.getEmail())) {
+            if (users[userPositionById.at(id)].getEmail() == peerUser.getEmail()) {
+                state.localUserIds[peerUser.getId()] = id;
+                return;
+            }
+        }
+        for (const auto& pending : newUsers) {
+            if (pending.getEmail() == peerUser.getEmail()) {
+                state.localUserIds[peerUser.getId()] = pending.getId();
+                return;
+            }
+        }
+        newUsers.push_back(peerUser.withId(nextUserId++));
+        state.localUserIds[peerUser.getId()] = newUsers.back().getId();
+        userLines += (userLines.empty() ? "" : "\n") + newUsers.back().serialize();
+    });
+    if (!newUsers.empty() && !appendRecord(USERS_FILE, usersCursor, userLines)) {
+        return Status(ErrorCode::IO_ERROR, "Could not save merged users!");
+    }
+    for (const auto& user : newUsers) {
+        addLoadedUser(user, false);
+        changes->publish("user.registered", user.toJson());
+    }
+
+    // 2. Expenses the peer has and we do not. Ones whose users are still
+    // unknown stay pending instead of being passed over for good.
+    vector<pair<Expense, GlobalExpenseId>> newExpenses;
+    unordered_set<GlobalExpenseId, GlobalExpenseId::Hash> staged;
+    string expenseLines;
+    size_t duplicates = 0, unmapped = 0;
+    vector<string> retried;
+    retried.swap(state.pendingExpenses);
+    auto mergeExpense = [&](const string& line) {
+        Expense peerExpense = Expense::deserialize(line);
+        if (peerExpense.getId() <= 0) return;
+        GlobalExpenseId globalId = GlobalExpenseId::ofRecord(line);
+        if (ordinalByGlobalId.find(globalId) != ordinalByGlobalId.end() || !staged.insert(globalId).second) {
+            duplicates++;
+            return;
+        }
+        bool mapped = true;
+        Expense local = peerExpense.remapped(nextExpenseId, [&](int peerUserId) {
+            auto it = state.localUserIds.find(peerUserId);
+            if (it == state.localUserIds.end()) {
+                mapped = false;
+                return 0;
+            }
+            return it->second;
+        });
+        if (!mapped) {
+            unmapped++;
+            state.pendingExpenses.push_back(line);
+            return;
+        }
+        nextExpenseId++;
+        expenseLines += (expenseLines.empty() ? "" : "\n") + local.serialize() + "|" + globalId.toString();
+        newExpenses.emplace_back(local, globalId);
+    };
+    for (const string& line : retried) mergeExpense(line);
+    readCompleteLines(peerExpensesFile, state.expenses, mergeExpense);
+    if (!newExpenses.empty() && !appendRecord(EXPENSES_FILE, expensesCursor, expenseLines)) {
+        return Status(ErrorCode::IO_ERROR, "Could not save merged expenses!");
+    }
+    for (const auto& [expense, globalId] : newExpenses) {
+        recordExpense(expense, globalId);
+        changes->publish("expense.added", expense.toJson(globalId.toString()));
+    }
+
+    // 3. Deletions
+    staged.clear();
+    vector<pair<GlobalExpenseId, string>> newTombstones;
+    string tombstoneLines;
+    readCompleteLines(peerTombstonesFile, state.tombstones, [&](const string& line) {
+        size_t separator = line.find('|');
+        GlobalExpenseId globalId = GlobalExpenseId::parse(line.substr(0, separator));
+        if (!globalId.valid() || tombstones.find(globalId) != tombstones.end()) return;
+        if (!staged.insert(globalId).second) return;
+        newTombstones.emplace_back(globalId, separator == string::npos ? "" : line.substr(separator + 1));
+        tombstoneLines += (tombstoneLines.empty() ? "" : "\n") + line;
+    });
+    if (!newTombstones.empty() && !appendRecord(TOMBSTONES_FILE, tombstonesCursor, tombstoneLines)) {
+        return Status(ErrorCode::IO_ERROR, "Could not save merged deletions!");
+    }
+    for (const auto& [globalId, deletedAt] : newTombstones) {
+        applyTombstone(globalId, Utils::dateTimeKey(deletedAt));
+        auto it = ordinalByGlobalId.find(globalId);
+        int expenseId = it == ordinalByGlobalId.end() ? 0 : expenses[it->second].getId();
+        changes->publish("expense.deleted", tombstoneJson(expenseId, globalId, deletedAt));
+    }
+
+    Utils::createDirectory(SYNC_DIR);
+    expense::MergeInfo merged;
+    merged.progressSaved = savePeerState(statePath, state);
+    merged.peerReplica = peerName;
+    merged.newUsers = newUsers.size();
+    merged.newExpenses = newExpenses.size();
+    merged.newDeletions = newTombstones.size();
+    merged.alreadyPresent = duplicates;
+    merged.skippedUnknownUser = unmapped;
+    merged.peerBytesRead = state.users.offset + state.expenses.offset + state.tombstones.offset - bytesBefore;
+    merged.filesReadFromStart = rescanned;
+    return merged;
+}
+
+User* ExpenseManager::getUserById(int id) {
+    auto it = userPositionById.find(id);
+    return it == userPositionById.end() ? nullptr : &users[it->second];
+}
+
+const string& ExpenseManager::nameOf(int id) const {
+    static const string unknown = "Unknown";
+    auto it = userPositionById.find(id);
+    return it == userPositionById.end() ? unknown : users[it->second].getName();
+}
+
+function<const string&(int)> ExpenseManager::nameLookup() const {
+    return [this](int id) -> const string& { return nameOf(id); };
+}
+
+}  // namespace detail
+}  // namespace expense
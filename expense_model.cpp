@@ -0,0 +1,565 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - RECORDS AND STORAGE
+
+    Users, expense participants, expenses, global expense IDs and the
+    paged expense store declared in expense_internal.h.
+===============================================================================
+*/
+
+#include "expense_internal.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace expense {
+namespace detail {
+
+// ============================================================================
+// ENUMS
+// ============================================================================
+
+string splitMethodToString(SplitMethod method) {
+    switch(method) {
+        case SplitMethod::EQUAL:  return "EQUAL";
+        case SplitMethod::EXACT:  return "EXACT";
+        case SplitMethod::PERCENTAGE:  return "PERCENTAGE";
+        default: return "UNKNOWN";
+    }
+}
+
+SplitMethod stringToSplitMethod(const string& str) {
+    if (str == "EQUAL") return SplitMethod::EQUAL;
+    if (str == "EXACT") return SplitMethod:: EXACT;
+    if (str == "PERCENTAGE") return SplitMethod::PERCENTAGE;
+    return SplitMethod::EQUAL;
+}
+
+// ============================================================================
+// USER CLASS
+// ============================================================================
+
+User::User(int id, const string& name, const string& email, string phone, string password)
+    : id(id), name(StringPool::global().intern(name)), email(StringPool::global().intern(email)),
+      phone(phone), password(password) {}
+
+bool User::verifyPassword(const string& pwd) const {
+    return password == pwd;
+}
+
+void User::display(ostream& out) const {
+    out << "ID: " << id << " | Name: " << getName() 
+         << " | Email: " << getEmail() << " | Phone: " << phone << endl;
+}
+
+string User::serialize() const {
+    return to_string(id) + "|" + getName() + "|" + getEmail() + "|" + phone + "|" + password;
+}
+
+string User::toJson() const {
+    return "{\"id\":" + to_string(id) + ",\"name\":\"" + Utils::jsonEscape(getName()) +
+           "\",\"email\":\"" + Utils::jsonEscape(getEmail()) + "\",\"phone\":\"" + Utils::jsonEscape(phone) + "\"}";
+}
+
+User User::fromJson(JsonReader& reader) {
+    long long id = 0;
+    string name, email, phone, ignored;
+    bool ok = reader.object([&](const string& key) {
+        if (key == "id") return reader.readInteger(id);
+        if (key == "name") return reader.readString(name);
+        if (key == "email") return reader.readString(email);
+        if (key == "phone") return reader.readString(phone);
+        return reader.skip();
+    });
+    if (!ok || id <= 0) return User();
+    return User((int)id, name, email, phone, "");
+}
+
+User User::withId(int newId) const {
+    User copy = *this;
+    copy.id = newId;
+    return copy;
+}
+
+User User::deserialize(const string& data) {
+    vector<string> parts = Utils::split(data, '|');
+    int id = 0;
+    if (parts.size() >= 5 && Utils::parseInt(parts[0], id)) {
+        return User(id, parts[1], parts[2], parts[3], parts[4]);
+    }
+    return User();
+}
+
+// ============================================================================
+// EXPENSE PARTICIPANT CLASS
+// ============================================================================
+
+ExpenseParticipant::ExpenseParticipant(int userId, double share)
+    : userId((uint32_t)userId),
+      shareCents((int32_t)llround(clamp(share, -MAX_SHARE, MAX_SHARE) * 100.0)) {}
+
+string ExpenseParticipant::serialize() const {
+    stringstream ss;
+    ss << userId << ":" << fixed << setprecision(2) << getShare();
+    return ss. str();
+}
+
+ExpenseParticipant ExpenseParticipant::deserialize(const string& data) {
+    vector<string> parts = Utils::split(data, ':');
+    int userId = 0;
+    double share = 0.0;
+    if (parts.size() >= 2 && Utils::parseInt(parts[0], userId) && Utils::parseDouble(parts[1], share)) {
+        return ExpenseParticipant(userId, share);
+    }
+    return ExpenseParticipant();
+}
+
+ExpenseParticipant* ParticipantList::items() {
+    return isInline() ? reinterpret_cast<ExpenseParticipant*>(inlineBytes) : heapItems;
+}
+
+const ExpenseParticipant* ParticipantList::items() const {
+    return isInline() ? reinterpret_cast<const ExpenseParticipant*>(inlineBytes) : heapItems;
+}
+
+void ParticipantList::copyFrom(const ParticipantList& other) {
+    count = other.count;
+    capacity = count <= INLINE_CAPACITY ? INLINE_CAPACITY : count;
+    if (!isInline()) heapItems = allocateItems(capacity);
+    memcpy(items(), other.items(), count * sizeof(ExpenseParticipant));
+}
+
+ExpenseParticipant* ParticipantList::allocateItems(uint32_t n) {
+    return static_cast<ExpenseParticipant*>(
+        MemoryTracker::allocate(MemoryCategory::PARTICIPANTS, n * sizeof(ExpenseParticipant)));
+}
+
+void ParticipantList::freeItems(ExpenseParticipant* items, uint32_t n) {
+    MemoryTracker::deallocate(MemoryCategory::PARTICIPANTS, items, n * sizeof(ExpenseParticipant));
+}
+
+void ParticipantList::release() {
+    if (!isInline()) freeItems(heapItems, capacity);
+    count = 0;
+    capacity = INLINE_CAPACITY;
+}
+
+ParticipantList::ParticipantList(ParticipantList&& other) noexcept : count(other.count), capacity(other.capacity) {
+    memcpy(inlineBytes, other.inlineBytes, sizeof(inlineBytes));
+    other.count = 0;
+    other.capacity = INLINE_CAPACITY;
+}
+
+ParticipantList& ParticipantList::operator=(const ParticipantList& other) {
+    if (this != &other) {
+        release();
+        copyFrom(other);
+    }
+    return *this;
+}
+
+ParticipantList& ParticipantList::operator=(ParticipantList&& other) noexcept {
+    if (this != &other) {
+        release();
+        count = other.count;
+        capacity = other.capacity;
+        memcpy(inlineBytes, other.inlineBytes, sizeof(inlineBytes));
+        other.count = 0;
+        other.capacity = INLINE_CAPACITY;
+    }
+    return *this;
+}
+
+void ParticipantList::push_back(const ExpenseParticipant& participant) {
+    if (count == capacity) {
+        uint32_t newCapacity = capacity * 2;
+        ExpenseParticipant* grown = allocateItems(newCapacity);
+        memcpy(grown, items(), count * sizeof(ExpenseParticipant));
+        if (!isInline()) freeItems(heapItems, capacity);
+        heapItems = grown;
+        capacity = newCapacity;
+    }
+    items()[count++] = participant;
+}
+
+// ============================================================================
+// EXPENSE CLASS
+// ============================================================================
+
+Expense::Expense() : id(0), description(0), amount(0.0), 
+            splitMethod(SplitMethod::EQUAL), createdBy(0), createdAt(0) {}
+
+Expense::Expense(int id, const string& desc, double amt, SplitMethod method, int creator)
+    : id(id), description(StringPool::global().intern(desc)), amount(amt), 
+      splitMethod(method), createdBy(creator) {
+    createdAt = Utils::dateTimeKey(Utils::getCurrentDateTime());
+}
+
+void Expense::addParticipant(const ExpenseParticipant& participant) {
+    participants.push_back(participant);
+}
+
+void Expense::display(const function<const string&(int)>& nameOf, ostream& out) const {
+    out << "\n----------------------------------------" << endl;
+    out << "Expense ID: " << id << endl;
+    out << "Description: " << getDescription() << endl;
+    out << "Amount: " << Utils::formatCurrency(amount) << endl;
+    out << "Split Method: " << splitMethodToString(splitMethod) << endl;
+    out << "Created At: " << getCreatedAt() << endl;
+    out << "Participants:" << endl;
+    
+    for (const auto& p : participants) {
+        out << "  - " << nameOf(p.getUserId()) << " (ID:  " << p.getUserId() << "): " 
+             << Utils:: formatCurrency(p.getShare()) << endl;
+    }
+    out << "----------------------------------------" << endl;
+}
+
+string Expense::serialize() const {
+    stringstream ss;
+    ss << id << "|" << getDescription() << "|" << fixed << setprecision(2) << amount 
+       << "|" << splitMethodToString(splitMethod) << "|" << createdBy 
+       << "|" << getCreatedAt() << "|";
+    
+    // Serialize participants
+    for (size_t i = 0; i < participants.size(); i++) {
+        ss << participants[i]. serialize();
+        if (i < participants.size() - 1) ss << ",";
+    }
+    
+    return ss.str();
+}
+
+string Expense::toJson(const string& globalId) const {
+    stringstream ss;
+    ss << "{\"id\":" << id;
+    if (!globalId.empty()) ss << ",\"gid\":\"" << globalId << "\"";
+    ss << ",\"description\":\"" << Utils::jsonEscape(getDescription())
+       << "\",\"amount\":" << fixed << setprecision(2) << amount
+       << ",\"method\":\"" << splitMethodToString(splitMethod) << "\",\"payer\":" << createdBy
+       << ",\"createdAt\":\"" << getCreatedAt() << "\",\"participants\":[";
+    for (size_t i = 0; i < participants.size(); i++) {
+        if (i > 0) ss << ",";
+        ss << "{\"user\":" << participants[i].getUserId() << ",\"share\":" << participants[i].getShare() << "}";
+    }
+    ss << "]}";
+    return ss.str();
+}
+
+Expense Expense::fromJson(JsonReader& reader, string* globalId) {
+    Expense exp;
+    long long id = 0, payer = 0;
+    string text;
+    bool ok = reader.object([&](const string& key) {
+        if (key == "id") return reader.readInteger(id);
+        if (key == "gid" && globalId != nullptr) return reader.readString(*globalId);
+        if (key == "amount") return reader.readNumber(exp.amount);
+        if (key == "payer") return reader.readInteger(payer);
+        if (key == "description") {
+            if (!reader.readString(text)) return false;
+            exp.description = StringPool::global().intern(text);
+            return true;
+        }
+        if (key == "method") {
+            if (!reader.readString(text)) return false;
+            exp.splitMethod = stringToSplitMethod(text);
+            return true;
+        }
+        if (key == "createdAt") {
+            if (!reader.readString(text)) return false;
+            exp.createdAt = max(0LL, Utils::dateTimeKey(text));
+            return true;
+        }
+        if (key == "participants") {
+            return reader.array([&]() {
+                long long userId = 0;
+                double share = 0.0;
+                bool itemOk = reader.object([&](const string& field) {
+                    if (field == "user") return reader.readInteger(userId);
+                    if (field == "share") return reader.readNumber(share);
+                    return reader.skip();
+                });
+                exp.participants.push_back(ExpenseParticipant((int)userId, share));
+                return itemOk;
+            });
+        }
+        return reader.skip();
+    });
+    if (!ok || id <= 0) return Expense();
+    exp.id = (int)id;
+    exp.createdBy = (int)payer;
+    return exp;
+}
+
+Expense Expense::remapped(int newId, const function<int(int)>& mapUser) const {
+    Expense exp;
+    exp.id = newId;
+    exp.description = description;
+    exp.amount = amount;
+    exp.splitMethod = splitMethod;
+    exp.createdBy = mapUser(createdBy);
+    exp.createdAt = createdAt;
+    for (const auto& participant : participants) {
+        exp.participants.push_back(ExpenseParticipant(mapUser(participant.getUserId()), participant.getShare()));
+    }
+    return exp;
+}
+
+Expense Expense::deserialize(const string& data) {
+    vector<string> parts = Utils::split(data, '|');
+    if (parts. size() >= 7) {
+        Expense exp;
+        if (!Utils::parseInt(parts[0], exp.id) || !Utils::parseDouble(parts[2], exp.amount) ||
+            !Utils::parseInt(parts[4], exp.createdBy)) {
+            return Expense();
+        }
+        exp.description = StringPool::global().intern(parts[1]);
+        exp.splitMethod = stringToSplitMethod(parts[3]);
+        exp.createdAt = max(0LL, Utils::dateTimeKey(parts[5]));
+        
+        // Deserialize participants
+        if (! parts[6].empty()) {
+            vector<string> participantStrings = Utils::split(parts[6], ',');
+            for (const auto& pStr : participantStrings) {
+                ExpenseParticipant participant = ExpenseParticipant::deserialize(pStr);
+                if (participant.getUserId() <= 0) return Expense();
+                exp.participants.push_back(participant);
+            }
+        }
+        
+        return exp;
+    }
+    return Expense();
+}
+
+string GlobalExpenseId::toString() const {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%016llx-%llu", (unsigned long long)origin, (unsigned long long)counter);
+    return string(buffer);
+}
+
+GlobalExpenseId GlobalExpenseId::parse(const string& text) {
+    GlobalExpenseId gid;
+    size_t dash = text.find('-');
+    if (dash == string::npos) return gid;
+    gid.origin = strtoull(text.substr(0, dash).c_str(), nullptr, 16);
+    gid.counter = strtoull(text.c_str() + dash + 1, nullptr, 10);
+    return gid;
+}
+
+GlobalExpenseId GlobalExpenseId::ofRecord(const string& line) {
+    size_t separator = 0;
+    for (int field = 0; field < 7 && separator != string::npos; field++) {
+        separator = line.find('|', field == 0 ? 0 : separator + 1);
+    }
+    if (separator != string::npos) return parse(line.substr(separator + 1));
+
+    GlobalExpenseId gid;
+    uint64_t hash = line.size();
+    for (unsigned char c : line) hash = Utils::hash64(hash ^ c);
+    gid.counter = hash;
+    return gid;
+}
+
+// ============================================================================
+// EXPENSE STORE
+// ============================================================================
+
+size_t ExpenseStore::footprint(const Expense& expense) {
+    return sizeof(Expense) + expense.getParticipants().heapBytes();
+}
+
+void ExpenseStore::touch(size_t pageNumber) const {
+    Page& page = pages[pageNumber];
+    if (pageNumber + 1 == pages.size()) return;   // the tail page is never evicted
+    lru.erase(page.lruPosition);
+    lru.push_front(pageNumber);
+    page.lruPosition = lru.begin();
+}
+
+void ExpenseStore::evict(size_t pageNumber) const {
+    Page& page = pages[pageNumber];
+    if (page.spillOffset < 0) {
+        // Full pages never change, so each one is written at most once
+        string text;
+        for (const auto& expense : page.rows) {
+            text += expense.serialize();
+            text += '\n';
+        }
+        spill.clear();
+        spill.seekp((streamoff)spillEnd);
+        spill.write(text.data(), (streamsize)text.size());
+        spill.flush();
+        if (!spill) {
+            // The rows exist nowhere else: keep them and stop evicting
+            spill.clear();
+            spillWriteFailed = true;
+            budget = 0;
+            return;
+        }
+        page.spillOffset = (int64_t)spillEnd;
+        page.spillLength = (uint32_t)text.size();
+        spillEnd += text.size();
+    }
+    ExpenseList().swap(page.rows);
+    page.resident = false;
+    residentBytes -= page.bytes;
+    lru.erase(page.lruPosition);
+    evictions++;
+}
+
+void ExpenseStore::enforceBudget() const {
+    while (budget > 0 && residentBytes > budget && lru.size() > 2) {
+        evict(lru.back());
+    }
+}
+
+string ExpenseStore::readSpilled(const Page& page) const {
+    string text(page.spillLength, '\0');
+    spill.clear();
+    spill.seekg(page.spillOffset);
+    spill.read(&text[0], (streamsize)text.size());
+    if (!spill || spill.gcount() != (streamsize)text.size() ||
+        std::count(text.begin(), text.end(), '\n') != (ptrdiff_t)PAGE_SIZE) {
+        spill.clear();
+        throw runtime_error("cannot read spilled expenses back from the spill file");
+    }
+    return text;
+}
+
+void ExpenseStore::faultIn(size_t pageNumber) const {
+    Page& page = pages[pageNumber];
+    stringstream lines(readSpilled(page));
+    string line;
+    page.rows.reserve(PAGE_SIZE);
+    while (getline(lines, line)) {
+        page.rows.push_back(Expense::deserialize(line));
+        if (page.rows.back().getId() <= 0) {
+            ExpenseList().swap(page.rows);
+            throw runtime_error("damaged expense in the spill file");
+        }
+    }
+    page.resident = true;
+    residentBytes += page.bytes;
+    lru.push_front(pageNumber);
+    page.lruPosition = lru.begin();
+    faults++;
+    enforceBudget();
+}
+
+ExpenseStore::~ExpenseStore() {
+    if (spill.is_open()) {
+        spill.close();
+        if (!spillPath.empty()) remove(spillPath.c_str());
+    }
+}
+
+bool ExpenseStore::openSpill(const string& pathPrefix) {
+    // Other stores (other Ledgers, other processes) may spill into the same
+    // directory, so the name is unique and the file is never reused
+    #ifndef _WIN32
+        string path = pathPrefix + ".XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0) return false;
+        spill.open(path, ios::in | ios::out | ios::binary);
+        close(fd);
+        // Nobody else needs the name, and an unlinked file cannot outlive a crash
+        unlink(path.c_str());
+    #else
+        random_device device;
+        for (int attempt = 0; attempt < 16 && !spill.is_open(); attempt++) {
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), ".%08x", (unsigned)device());
+            string path = pathPrefix + suffix;
+            if (ifstream(path).is_open()) continue;
+            spill.open(path, ios::in | ios::out | ios::binary | ios::trunc);
+            if (spill.is_open()) spillPath = path;
+        }
+    #endif
+    return spill.is_open();
+}
+
+bool ExpenseStore::setMemoryBudget(size_t bytes, const string& pathPrefix) {
+    budget = bytes;
+    if (budget > 0 && !spill.is_open()) {
+        if (!openSpill(pathPrefix)) {
+            budget = 0;
+            return false;
+        }
+    }
+    enforceBudget();
+    return true;
+}
+
+void ExpenseStore::push_back(const Expense& expense) {
+    if (count % PAGE_SIZE == 0) {
+        // The previous tail page is full now and becomes evictable
+        if (!pages.empty()) {
+            lru.push_front(pages.size() - 1);
+            pages.back().lruPosition = lru.begin();
+        }
+        pages.emplace_back();
+        pages.back().rows.reserve(PAGE_SIZE);
+        pages.back().bytes = PAGE_SIZE * sizeof(Expense);
+        residentBytes += pages.back().bytes;
+    }
+    Page& tail = pages.back();
+    tail.rows.push_back(expense);
+    size_t extra = expense.getParticipants().heapBytes();
+    tail.bytes += extra;
+    residentBytes += extra;
+    count++;
+    enforceBudget();
+}
+
+void ExpenseStore::clear() {
+    pages.clear();
+    lru.clear();
+    residentBytes = 0;
+    count = 0;
+    spillEnd = 0;   // every page is gone, so the file is free to overwrite
+}
+
+void ExpenseStore::writeAll(ostream& out, const function<string(size_t)>& suffix) const {
+    size_t window = TaskScheduler::global().workerCount() * 4;
+    vector<string> texts(window);
+    for (size_t first = 0; first < pages.size(); first += window) {
+        size_t last = min(pages.size(), first + window);
+        TaskScheduler::global().parallelFor(first, last, 1, [&](size_t begin, size_t end) {
+            for (size_t pageNumber = begin; pageNumber < end; pageNumber++) {
+                const Page& page = pages[pageNumber];
+                string& text = texts[pageNumber - first];
+                text.clear();
+                if (!page.resident) continue;
+                size_t ordinal = pageNumber * PAGE_SIZE;
+                for (const auto& expense : page.rows) {
+                    text += expense.serialize();
+                    if (suffix) text += suffix(ordinal++);
+                    text += '\n';
+                }
+            }
+        });
+
+        for (size_t pageNumber = first; pageNumber < last; pageNumber++) {
+            const Page& page = pages[pageNumber];
+            size_t ordinal = pageNumber * PAGE_SIZE;
+            if (page.resident) {
+                out << texts[pageNumber - first];
+            } else if (!suffix) {
+                out << readSpilled(page);
+            } else {
+                string text = readSpilled(page);
+                size_t start = 0, end;
+                while ((end = text.find('\n', start)) != string::npos) {
+                    out.write(text.data() + start, (streamsize)(end - start));
+                    out << suffix(ordinal++) << "\n";
+                    start = end + 1;
+                }
+            }
+        }
+    }
+}
+
+}  // namespace detail
+}  // namespace expense
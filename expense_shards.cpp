@@ -0,0 +1,427 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - SHARDED ENGINE
+
+    ShardedEngine, declared in expense_internal.h: per-shard threads,
+    ledgers and logs, log replay on open, and the fan-out queries
+    behind expense::ShardedLedger.
+===============================================================================
+*/
+
+#include "expense_internal.h"
+
+#include <filesystem>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace expense {
+namespace detail {
+
+namespace {
+
+// Logs are written through plain descriptors so that an append can be
+// synced to disk before it is acknowledged
+int openLog(const string& path) {
+    #ifndef _WIN32
+        return open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    #else
+        return _open(path.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+    #endif
+}
+
+void closeLog(int fd) {
+    if (fd < 0) return;
+    #ifndef _WIN32
+        close(fd);
+    #else
+        _close(fd);
+    #endif
+}
+
+// Write all of data and sync it; false if any of it may be missing
+bool appendSynced(int fd, const string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        #ifndef _WIN32
+            ssize_t chunk = write(fd, data.data() + written, data.size() - written);
+            if (chunk < 0 && errno == EINTR) continue;
+        #else
+            int chunk = _write(fd, data.data() + written, (unsigned)min(data.size() - written, (size_t)1 << 30));
+        #endif
+        if (chunk <= 0) return false;
+        written += (size_t)chunk;
+    }
+    #ifndef _WIN32
+        return fsync(fd) == 0;
+    #else
+        return _commit(fd) == 0;
+    #endif
+}
+
+// A new file survives a crash only once its directory entry is synced too
+void syncDirectory(const string& dir) {
+    #ifndef _WIN32
+        int fd = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        fsync(fd);
+        close(fd);
+    #else
+        (void)dir;
+    #endif
+}
+
+}  // namespace
+
+// ============================================================================
+// SHARDED ENGINE
+// ============================================================================
+
+void ShardedEngine::post(Shard& shard, function<void()> task) {
+    {
+        lock_guard<mutex> guard(shard.lock);
+        shard.tasks.push_back(move(task));
+    }
+    shard.wake.notify_one();
+}
+
+void ShardedEngine::apply(Shard& shard, const Expense& expense) {
+    shard.expenseCount++;
+    int payer = expense.getCreatedBy();
+    for (const auto& participant : expense.getParticipants()) {
+        int userId = participant.getUserId();
+        double share = participant.getShare();
+        if (userId == payer || share == 0.0) continue;
+        shard.ledger.credit(payer, userId, share);
+        size_t owner = shardOf(userId);
+        if (owner == shard.index) {
+            shard.ledger.credit(userId, payer, -share);
+            shard.localDeltas++;
+        } else {
+            shard.outbox[owner].push_back({userId, payer, -share});
+            shard.remoteDeltas++;
+        }
+    }
+}
+
+void ShardedEngine::commit(Shard& shard, vector<Submission>& batch) {
+    // IDs interleave across shards, so they are unique without coordination
+    uint64_t lastId = ((uint64_t)shard.nextLocalId + batch.size() - 1) * shards.size() + shard.index + 1;
+    if (lastId > (uint64_t)numeric_limits<int>::max()) {
+        shard.failedWrites += batch.size();
+        for (auto& submission : batch) submission.expense = submission.expense.remapped(-1, [](int userId) { return userId; });
+        return;
+    }
+    uint32_t firstLocalId = shard.nextLocalId;
+    string lines;
+    for (auto& submission : batch) {
+        int id = (int)(shard.nextLocalId++ * shards.size() + shard.index + 1);
+        submission.expense = submission.expense.remapped(id, [](int userId) { return userId; });
+        lines += submission.expense.serialize();
+        lines += '\n';
+    }
+
+    if (appendSynced(shard.logFd, lines)) {
+        shard.logBytes += lines.size();
+        for (const auto& submission : batch) apply(shard, submission.expense);
+    } else {
+        // Cut off whatever part of the batch reached the file, so a replay
+        // never brings back expenses reported as failed
+        closeLog(shard.logFd);
+        error_code ignored;
+        filesystem::resize_file(shard.logPath, shard.logBytes, ignored);
+        shard.logFd = openLog(shard.logPath);
+        shard.nextLocalId = firstLocalId;
+        shard.failedWrites += batch.size();
+        for (auto& submission : batch) submission.expense = submission.expense.remapped(0, [](int userId) { return userId; });
+    }
+}
+
+void ShardedEngine::flushOutbox(Shard& shard) {
+    for (size_t destination = 0; destination < shard.outbox.size(); destination++) {
+        vector<Delta>& pending = shard.outbox[destination];
+        if (pending.empty()) continue;
+        Shard& target = *shards[destination];
+        {
+            lock_guard<mutex> guard(target.lock);
+            target.deltas.insert(target.deltas.end(), pending.begin(), pending.end());
+        }
+        target.wake.notify_one();
+        pending.clear();
+        shard.batchesSent++;
+    }
+}
+
+void ShardedEngine::recover(Shard& shard) {
+    {
+        ifstream in(shard.logPath, ios::binary);
+        string line;
+        while (getline(in, line)) {
+            if (in.eof()) break;   // no newline: the last append was torn
+            shard.logBytes += line.size() + 1;
+            if (line.empty()) continue;
+            Expense expense = Expense::deserialize(line);
+            int id = expense.getId();
+            if (id <= 0 || (size_t)(id - 1) % shards.size() != shard.index) {
+                shard.malformedLines++;
+                continue;
+            }
+            shard.nextLocalId = max(shard.nextLocalId, (uint32_t)((size_t)(id - 1) / shards.size() + 1));
+            apply(shard, expense);
+            shard.recovered++;
+        }
+    }
+
+    error_code error;
+    bool existed = filesystem::exists(shard.logPath, error);
+    if (existed && filesystem::file_size(shard.logPath, error) > shard.logBytes) {
+        filesystem::resize_file(shard.logPath, shard.logBytes, error);
+    }
+    shard.logFd = openLog(shard.logPath);
+    if (shard.logFd < 0) shard.openError = "cannot open " + shard.logPath;
+    else if (!existed) syncDirectory(directory);
+    flushOutbox(shard);
+}
+
+// Each pass takes the whole mailbox: expenses first, then incoming
+// deltas, then the outbox is sent before any task runs or any add() is
+// answered. A task therefore sees every expense queued before it
+// committed and its deltas already in the destination mailboxes.
+void ShardedEngine::run(Shard& shard) {
+    recover(shard);
+    vector<Submission> submissions;
+    vector<Delta> deltas;
+    vector<function<void()>> tasks;
+    while (true) {
+        {
+            unique_lock<mutex> guard(shard.lock);
+            shard.wake.wait(guard, [&]() {
+                return shard.stopping || !shard.submissions.empty() || !shard.deltas.empty() || !shard.tasks.empty();
+            });
+            if (shard.stopping && shard.submissions.empty() && shard.deltas.empty() && shard.tasks.empty()) return;
+            submissions.swap(shard.submissions);
+            deltas.swap(shard.deltas);
+            tasks.swap(shard.tasks);
+        }
+        if (!submissions.empty()) commit(shard, submissions);
+        for (const auto& delta : deltas) shard.ledger.credit(delta.userId, delta.counterpartyId, delta.amount);
+        flushOutbox(shard);
+        for (const auto& submission : submissions) {
+            if (!submission.ticket) continue;
+            Ticket& ticket = *submission.ticket;
+            lock_guard<mutex> guard(ticket.lock);
+            ticket.ids[submission.position] = submission.expense.getId();
+            if (--ticket.remaining == 0) ticket.done.notify_all();
+        }
+        for (auto& task : tasks) task();
+        submissions.clear();
+        deltas.clear();
+        tasks.clear();
+    }
+}
+
+void ShardedEngine::stop() {
+    for (auto& shard : shards) {
+        {
+            lock_guard<mutex> guard(shard->lock);
+            shard->stopping = true;
+        }
+        shard->wake.notify_one();
+    }
+    for (auto& shard : shards) {
+        if (shard->worker.joinable()) shard->worker.join();
+        closeLog(shard->logFd);
+        shard->logFd = -1;
+    }
+}
+
+void ShardedEngine::onEveryShard(const function<void(Shard&)>& fn) {
+    mutex doneLock;
+    condition_variable done;
+    size_t remaining = shards.size();
+    for (auto& shard : shards) {
+        Shard* target = shard.get();
+        post(*target, [&, target]() {
+            fn(*target);
+            lock_guard<mutex> guard(doneLock);
+            if (--remaining == 0) done.notify_one();
+        });
+    }
+    unique_lock<mutex> guard(doneLock);
+    done.wait(guard, [&]() { return remaining == 0; });
+}
+
+vector<BalanceLedger::Entry> ShardedEngine::mergeTop(size_t k, const function<vector<BalanceLedger::Entry>(const BalanceLedger&)>& query,
+                                                     const function<bool(const BalanceLedger::Entry&, const BalanceLedger::Entry&)>& better) {
+    vector<vector<BalanceLedger::Entry>> partial(shards.size());
+    onEveryShard([&](Shard& shard) { partial[shard.index] = query(shard.ledger); });
+    vector<BalanceLedger::Entry> merged;
+    for (const auto& entries : partial) merged.insert(merged.end(), entries.begin(), entries.end());
+    size_t keep = min(k, merged.size());
+    partial_sort(merged.begin(), merged.begin() + keep, merged.end(), better);
+    merged.resize(keep);
+    return merged;
+}
+
+ShardedEngine::ShardedEngine(const string& dir, size_t shardCount) : directory(dir), directoryLock(dir + "/.lock") {
+    error_code ignored;
+    filesystem::create_directories(directory, ignored);
+    // A second engine would hand out the same IDs and interleave appends
+    if (!directoryLock.tryLock(true)) throw runtime_error(directory + " is open in another sharded ledger");
+    size_t stored = storedShardCount(directory);
+    if (stored != 0 && shardCount != 0 && stored != shardCount) {
+        throw runtime_error(directory + " was created with " + to_string(stored) + " shards, not " +
+                            to_string(shardCount));
+    }
+    shardCount = stored != 0 ? stored : shardCount != 0 ? shardCount : max(1u, thread::hardware_concurrency());
+    if (stored == 0) {
+        // Synced like the logs: replaying them with another count would
+        // route users to the wrong shards
+        const string countPath = directory + "/shards.txt";
+        filesystem::remove(countPath, ignored);
+        int fd = openLog(countPath);
+        bool written = fd >= 0 && appendSynced(fd, to_string(shardCount) + "\n");
+        closeLog(fd);
+        if (!written) throw runtime_error("cannot write " + countPath);
+        syncDirectory(directory);
+    }
+
+    for (size_t i = 0; i < shardCount; i++) {
+        shards.emplace_back(new Shard());
+        Shard& shard = *shards.back();
+        shard.index = i;
+        shard.outbox.resize(shardCount);
+        shard.logPath = directory + "/shard-" + to_string(i) + ".txt";
+    }
+    for (auto& shard : shards) {
+        Shard* target = shard.get();
+        target->worker = thread([this, target]() { run(*target); });
+    }
+
+    // Wait for the replay, including the deltas it sent between shards
+    drain();
+    for (auto& shard : shards) {
+        if (shard->openError.empty()) continue;
+        string error = shard->openError;
+        stop();
+        throw runtime_error(error);
+    }
+}
+
+ShardedEngine::~ShardedEngine() {
+    drain();
+    stop();
+}
+
+size_t ShardedEngine::storedShardCount(const string& dir) {
+    ifstream countFile(dir + "/shards.txt");
+    string line;
+    int count = 0;
+    if (!getline(countFile, line) || !Utils::parseInt(line, count) || count <= 0) return 0;
+    return (size_t)count;
+}
+
+void ShardedEngine::enqueue(vector<Submission>& batch) {
+    vector<vector<Submission>> routed(shards.size());
+    for (auto& submission : batch) routed[shardOf(submission.expense.getCreatedBy())].push_back(move(submission));
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (routed[i].empty()) continue;
+        {
+            lock_guard<mutex> guard(shards[i]->lock);
+            auto& queue = shards[i]->submissions;
+            if (queue.empty()) {
+                queue.swap(routed[i]);
+            } else {
+                queue.insert(queue.end(), make_move_iterator(routed[i].begin()), make_move_iterator(routed[i].end()));
+            }
+        }
+        shards[i]->wake.notify_one();
+    }
+}
+
+void ShardedEngine::submit(const vector<Expense>& batch) {
+    vector<Submission> submissions;
+    submissions.reserve(batch.size());
+    for (const auto& expense : batch) submissions.push_back({expense, nullptr, 0});
+    enqueue(submissions);
+}
+
+vector<int> ShardedEngine::add(const vector<Expense>& batch) {
+    if (batch.empty()) return {};
+    auto ticket = make_shared<Ticket>();
+    ticket->ids.assign(batch.size(), 0);
+    ticket->remaining = batch.size();
+    vector<Submission> submissions;
+    submissions.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) submissions.push_back({batch[i], ticket, i});
+    enqueue(submissions);
+
+    unique_lock<mutex> guard(ticket->lock);
+    ticket->done.wait(guard, [&]() { return ticket->remaining == 0; });
+    return ticket->ids;
+}
+
+void ShardedEngine::drain() {
+    onEveryShard([](Shard&) {});
+    onEveryShard([](Shard&) {});
+}
+
+vector<BalanceLedger::Entry> ShardedEngine::balancesFor(int userId) {
+    vector<BalanceLedger::Entry> result;
+    mutex doneLock;
+    condition_variable done;
+    bool finished = false;
+    Shard& owner = *shards[shardOf(userId)];
+    post(owner, [&]() {
+        result = owner.ledger.balancesFor(userId);
+        lock_guard<mutex> guard(doneLock);
+        finished = true;
+        done.notify_one();
+    });
+    unique_lock<mutex> guard(doneLock);
+    done.wait(guard, [&]() { return finished; });
+    return result;
+}
+
+vector<BalanceLedger::Entry> ShardedEngine::topDebtors(size_t k) {
+    return mergeTop(k, [k](const BalanceLedger& ledger) { return ledger.topDebtors(k); },
+                    [](const BalanceLedger::Entry& a, const BalanceLedger::Entry& b) { return a.amount < b.amount; });
+}
+
+vector<BalanceLedger::Entry> ShardedEngine::topCreditors(size_t k) {
+    return mergeTop(k, [k](const BalanceLedger& ledger) { return ledger.topCreditors(k); },
+                    [](const BalanceLedger::Entry& a, const BalanceLedger::Entry& b) { return a.amount > b.amount; });
+}
+
+vector<BalanceLedger::Entry> ShardedEngine::topPairs(size_t k) {
+    return mergeTop(k, [k](const BalanceLedger& ledger) { return ledger.topPairs(k); },
+                    [](const BalanceLedger::Entry& a, const BalanceLedger::Entry& b) { return a.amount > b.amount; });
+}
+
+ShardedEngine::Stats ShardedEngine::stats() {
+    vector<Stats> partial(shards.size());
+    onEveryShard([&](Shard& shard) {
+        partial[shard.index] = {shard.expenseCount, shard.localDeltas, shard.remoteDeltas, shard.batchesSent,
+                                shard.recovered, shard.malformedLines, shard.failedWrites};
+    });
+    Stats total;
+    for (const auto& part : partial) {
+        total.expenses += part.expenses;
+        total.localDeltas += part.localDeltas;
+        total.remoteDeltas += part.remoteDeltas;
+        total.batchesSent += part.batchesSent;
+        total.recovered += part.recovered;
+        total.malformedLines += part.malformedLines;
+        total.failedWrites += part.failedWrites;
+    }
+    return total;
+}
+
+}  // namespace detail
+}  // namespace expense
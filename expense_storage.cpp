@@ -0,0 +1,485 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - FILES AND LOGS
+
+    File locks, the change feed, the data directory watcher and the
+    idempotency key table declared in expense_internal.h.
+===============================================================================
+*/
+
+#include "expense_internal.h"
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+
+namespace expense {
+namespace detail {
+
+// ============================================================================
+// FILE LOCKING
+// ============================================================================
+
+FileLock::~FileLock() {
+    #ifndef _WIN32
+        if (fd >= 0) close(fd);
+    #endif
+}
+
+void FileLock::lock(bool exclusive) {
+    #ifndef _WIN32
+        if (fd < 0) fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (fd < 0) throw runtime_error("cannot open lock file " + path);
+        while (flock(fd, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+            if (errno != EINTR) throw runtime_error("cannot lock " + path);
+        }
+    #else
+        (void)exclusive;
+    #endif
+}
+
+bool FileLock::tryLock(bool exclusive) {
+    #ifndef _WIN32
+        if (fd < 0) fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (fd < 0) throw runtime_error("cannot open lock file " + path);
+        while (flock(fd, (exclusive ? LOCK_EX : LOCK_SH) | LOCK_NB) != 0) {
+            if (errno == EWOULDBLOCK) return false;
+            if (errno != EINTR) throw runtime_error("cannot lock " + path);
+        }
+    #else
+        (void)exclusive;
+    #endif
+    return true;
+}
+
+void FileLock::unlock() {
+    #ifndef _WIN32
+        if (fd >= 0) flock(fd, LOCK_UN);
+    #endif
+}
+
+// ============================================================================
+// CHANGE FEED
+// ============================================================================
+
+void ChangeFeed::Writer::run() {
+    unique_lock<mutex> guard(lock);
+    while (!stopping) {
+        wake.wait_for(guard, chrono::milliseconds(FLUSH_INTERVAL_MS),
+                      [this]() { return stopping || urgent; });
+        urgent = false;
+        vector<ChangeFeed*> snapshot(feeds.begin(), feeds.end());
+        for (ChangeFeed* feed : snapshot) {
+            if (feeds.count(feed) == 0) continue;   // removed meanwhile
+            feed->flushing = true;
+            guard.unlock();
+            feed->flush();
+            guard.lock();
+            feed->flushing = false;
+            idle.notify_all();
+        }
+    }
+}
+
+ChangeFeed::Writer::~Writer() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+ChangeFeed::Writer& ChangeFeed::Writer::global() {
+    static Writer writer;
+    return writer;
+}
+
+void ChangeFeed::Writer::add(ChangeFeed* feed) {
+    lock_guard<mutex> guard(lock);
+    feeds.insert(feed);
+}
+
+void ChangeFeed::Writer::remove(ChangeFeed* feed) {
+    unique_lock<mutex> guard(lock);
+    feeds.erase(feed);
+    idle.wait(guard, [feed]() { return !feed->flushing; });
+}
+
+void ChangeFeed::Writer::nudge() {
+    {
+        lock_guard<mutex> guard(lock);
+        urgent = true;
+    }
+    wake.notify_one();
+}
+
+bool ChangeFeed::isPipe(const string& file) {
+    #ifdef _WIN32
+        (void)file;
+        return false;
+    #else
+        struct stat info;
+        return stat(file.c_str(), &info) == 0 && S_ISFIFO(info.st_mode);
+    #endif
+}
+
+pair<uint64_t, uint64_t> ChangeFeed::identity(const string& file) {
+    struct stat info;
+    if (stat(file.c_str(), &info) != 0) return {0, 0};
+    return {(uint64_t)info.st_ino, (uint64_t)info.st_size};
+}
+
+uint64_t ChangeFeed::lastSequence(const string& file) {
+    if (isPipe(file)) return 0;
+    ifstream input(file, ios::binary);
+    if (!input.is_open()) return 0;
+    input.seekg(0, ios::end);
+    streamoff start = input.tellg();
+
+    // Read backwards a block at a time until a complete record turns
+    // up. `tail` keeps only the bytes whose line start is not read yet.
+    string tail;
+    while (start > 0) {
+        streamoff from = max<streamoff>(0, start - READ_BLOCK);
+        string block((size_t)(start - from), '\0');
+        input.seekg(from);
+        input.read(&block[0], (streamsize)block.size());
+        tail.insert(0, block);
+        start = from;
+
+        size_t end = tail.rfind('\n');
+        while (end != string::npos) {
+            size_t newline = end == 0 ? string::npos : tail.rfind('\n', end - 1);
+            if (newline == string::npos && start > 0) break;   // starts in an earlier block
+            size_t begin = newline == string::npos ? 0 : newline + 1;
+            uint64_t sequence = sequenceOf(tail.substr(begin, end - begin));
+            if (sequence > 0) return sequence;
+            end = newline;
+        }
+        tail.resize(end == string::npos ? 0 : end + 1);
+    }
+    return 0;
+}
+
+bool ChangeFeed::append(const vector<string>& batch) {
+    try {
+        FileLock::Guard exclusive(appendLock, true);
+        uint64_t sequence = pipeSequence;
+        if (!pipe) {
+            // Replaced by trim() since we opened it: write to the new file
+            pair<uint64_t, uint64_t> now = identity(path);
+            if (output.is_open() && now.first != outputInode) output.close();
+            // Unchanged since our last append: nobody else wrote to it
+            bool known = now.first == knownInode && now.second == knownSize && knownInode != 0;
+            sequence = known ? knownSequence : lastSequence(path);
+        }
+        string text;
+        for (const auto& record : batch) {
+            text += "{\"seq\":" + to_string(++sequence) + record;
+        }
+        if (!output.is_open()) {
+            output.open(path, ios::app);
+            outputInode = identity(path).first;
+        }
+        output << text;
+        output.flush();
+        if (!output) {
+            // Reopen for the retry
+            output.close();
+            output.clear();
+            return false;
+        }
+        pipeSequence = sequence;
+        writtenSequence = sequence;
+        if (!pipe) {
+            pair<uint64_t, uint64_t> now = identity(path);
+            knownInode = now.first;
+            knownSize = now.second;
+            knownSequence = sequence;
+        }
+        batches++;
+        return true;
+    } catch (const runtime_error&) {
+        return false;   // the lock file could not be opened or locked
+    }
+}
+
+void ChangeFeed::flush() {
+    lock_guard<mutex> writing(flushLock);
+    vector<string> batch;
+    size_t batchBytes;
+    {
+        lock_guard<mutex> guard(lock);
+        if (pending.empty()) return;
+        batch.swap(pending);
+        batchBytes = pendingBytes;
+        pendingBytes = 0;
+    }
+    if (append(batch)) {
+        queuedRecords -= batch.size();
+        return;
+    }
+    appendFailures++;
+    lock_guard<mutex> guard(lock);
+    pending.insert(pending.begin(), make_move_iterator(batch.begin()), make_move_iterator(batch.end()));
+    pendingBytes += batchBytes;
+}
+
+ChangeFeed::ChangeFeed(const string& path) : path(path), appendLock(path + ".lock"), pipe(isPipe(path)) {
+    Writer::global().add(this);
+}
+
+ChangeFeed::~ChangeFeed() {
+    Writer::global().remove(this);
+    flush();
+}
+
+void ChangeFeed::publish(const string& type, const string& data) {
+    string record = ",\"ts\":\"" + Utils::getCurrentDateTime() + "\",\"ms\":" + to_string(Utils::unixMillis()) +
+                    ",\"type\":\"" + type + "\",\"data\":" + data + "}\n";
+    bool full;
+    {
+        lock_guard<mutex> guard(lock);
+        pendingBytes += record.size();
+        pending.push_back(move(record));
+        queuedRecords++;
+        full = pendingBytes >= MAX_BATCH_BYTES;
+    }
+    if (!pipe) flush();
+    else if (full) Writer::global().nudge();
+}
+
+Status ChangeFeed::trim(size_t keepRecords) {
+    if (pipe) return Status();
+    lock_guard<mutex> writing(flushLock);
+    FileLock::Guard exclusive(appendLock, true);
+    uint64_t last = lastSequence(path);
+    keepRecords = max<size_t>(keepRecords, 1);
+    if (last <= keepRecords) return Status();
+    uint64_t from = offsetAfter(path, last - keepRecords);
+    if (from == 0) return Status();
+
+    const string temp = path + ".tmp";
+    {
+        ifstream input(path, ios::binary);
+        ofstream trimmed(temp, ios::trunc | ios::binary);
+        input.seekg((streamoff)from);
+        trimmed << input.rdbuf();
+        trimmed.close();
+        if (!input.good() && !input.eof()) trimmed.setstate(ios::failbit);
+        if (trimmed.fail() || rename(temp.c_str(), path.c_str()) != 0) {
+            remove(temp.c_str());
+            return Status(ErrorCode::IO_ERROR, "Could not trim the change log " + path + "!");
+        }
+    }
+    output.close();
+    knownInode = 0;
+    return Status();
+}
+
+uint64_t ChangeFeed::sequenceOf(const string& line) {
+    static const string KEY = "{\"seq\":";
+    if (line.compare(0, KEY.size(), KEY) != 0) return 0;
+    return strtoull(line.c_str() + KEY.size(), nullptr, 10);
+}
+
+uint64_t ChangeFeed::offsetAfter(const string& file, uint64_t sequence) {
+    ifstream input(file, ios::binary);
+    if (!input.is_open() || sequence == 0) return 0;
+    input.seekg(0, ios::end);
+    const uint64_t size = (uint64_t)input.tellg();
+
+    // Start and seq of the first record whose line starts at or after
+    // `at`; seq 0 if there is none
+    auto recordFrom = [&](uint64_t at) -> pair<uint64_t, uint64_t> {
+        string line;
+        input.clear();
+        input.seekg((streamoff)(at > 0 ? at - 1 : 0));
+        if (at > 0 && (!getline(input, line) || input.eof())) return {size, 0};
+        uint64_t start = at > 0 ? (uint64_t)input.tellg() : 0;
+        while (getline(input, line) && !input.eof()) {
+            uint64_t found = sequenceOf(line);
+            if (found > 0) return {start, found};
+            start += line.size() + 1;
+        }
+        return {start, 0};
+    };
+
+    uint64_t low = 0, high = size;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        pair<uint64_t, uint64_t> record = recordFrom(middle);
+        if (record.second == 0 || record.second > sequence) high = middle;
+        else low = record.first + 1;
+    }
+    return recordFrom(low).first;
+}
+
+Status ChangeFeed::tail(const string& file, uint64_t afterSequence, bool follow, ostream& out) {
+    ifstream input(file, ios::binary);
+    while (!input.is_open() && follow) {
+        this_thread::sleep_for(chrono::milliseconds(200));
+        input.open(file, ios::binary);
+    }
+    if (!input.is_open()) {
+        return Status(ErrorCode::IO_ERROR, "Could not open change log " + file + "!");
+    }
+    input.seekg((streamoff)offsetAfter(file, afterSequence));
+    uint64_t inode = identity(file).first;
+
+    string line, partial;
+    while (true) {
+        while (getline(input, line)) {
+            if (input.eof()) {
+                // Last line without a newline: the writer is mid-record
+                partial += line;
+                break;
+            }
+            line = partial + line;
+            partial.clear();
+            uint64_t sequence = sequenceOf(line);
+            if (sequence > afterSequence) {
+                out << line << "\n";
+                afterSequence = sequence;
+            }
+        }
+        out.flush();
+        if (!follow) return Status();
+        input.clear();
+        this_thread::sleep_for(chrono::milliseconds(200));
+
+        uint64_t now = identity(file).first;
+        if (now != 0 && now != inode) {
+            input.close();
+            input.open(file, ios::binary);
+            input.seekg((streamoff)offsetAfter(file, afterSequence));
+            inode = now;
+            partial.clear();
+        }
+    }
+}
+
+// ============================================================================
+// DATA DIRECTORY WATCHER
+// ============================================================================
+
+bool DataWatcher::watched(const char* name) const {
+    return find(fileNames.begin(), fileNames.end(), name) != fileNames.end();
+}
+
+void DataWatcher::run() {
+    #ifdef __linux__
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0 || inotify_add_watch(fd, directory.c_str(),
+                                        IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE) < 0) {
+            if (fd >= 0) close(fd);
+            pollLoop();
+            return;
+        }
+        alignas(inotify_event) char buffer[4096];
+        bool retry = false;
+        while (!stopping) {
+            pollfd ready{fd, POLLIN, 0};
+            if (poll(&ready, 1, POLL_INTERVAL_MS) <= 0) {
+                // A failed reload is tried again every interval until it works
+                if (retry && !stopping) retry = !onChange();
+                continue;
+            }
+
+            bool relevant = false;
+            do {
+                ssize_t length;
+                while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                    for (char* at = buffer; at < buffer + length;) {
+                        auto* event = reinterpret_cast<inotify_event*>(at);
+                        if (event->len > 0 && watched(event->name)) relevant = true;
+                        at += sizeof(inotify_event) + event->len;
+                    }
+                }
+                // Let a burst of appends settle before reloading
+                this_thread::sleep_for(chrono::milliseconds(COALESCE_MS));
+            } while (poll(&ready, 1, 0) > 0 && !stopping);
+
+            if ((relevant || retry) && !stopping) retry = !onChange();
+        }
+        close(fd);
+    #else
+        pollLoop();
+    #endif
+}
+
+void DataWatcher::pollLoop() {
+    while (!stopping) {
+        this_thread::sleep_for(chrono::milliseconds(POLL_INTERVAL_MS));
+        if (!stopping) onChange();
+    }
+}
+
+DataWatcher::DataWatcher(const string& directory, vector<string> fileNames, function<bool()> onChange)
+    : directory(directory), fileNames(move(fileNames)), onChange(move(onChange)) {
+    worker = thread(&DataWatcher::run, this);
+}
+
+DataWatcher::~DataWatcher() {
+    stopping = true;
+    worker.join();
+}
+
+// ============================================================================
+// IDEMPOTENCY KEYS
+// ============================================================================
+
+string IdempotencyKeys::slotOf(int userId, const string& key) {
+    return to_string(userId) + ":" + key;
+}
+
+void IdempotencyKeys::evict(long long now) {
+    while (!arrivals.empty() &&
+           (entries.size() > capacity || arrivals.size() > 2 * capacity ||
+            arrivals.front().createdAt < now - windowSeconds)) {
+        auto it = entries.find(arrivals.front().slot);
+        if (it != entries.end() && it->second.serial == arrivals.front().serial) entries.erase(it);
+        arrivals.pop_front();
+    }
+}
+
+bool IdempotencyKeys::validKey(const string& key) {
+    return !key.empty() && key.size() <= MAX_KEY_LENGTH && Utils::isRecordSafe(key);
+}
+
+void IdempotencyKeys::setLimits(size_t maxKeys, long long window) {
+    capacity = max<size_t>(maxKeys, 1);
+    windowSeconds = max(window, 1LL);
+    evict(time(nullptr));
+}
+
+int IdempotencyKeys::find(int userId, const string& key, long long now) const {
+    auto it = entries.find(slotOf(userId, key));
+    if (it == entries.end() || it->second.createdAt < now - windowSeconds) return 0;
+    return it->second.expenseId;
+}
+
+void IdempotencyKeys::add(int userId, const string& key, int expenseId, long long createdAt) {
+    string slot = slotOf(userId, key);
+    uint64_t serial = nextSerial++;
+    entries[slot] = {expenseId, createdAt, serial};
+    arrivals.push_back({serial, createdAt, move(slot)});
+    evict(max(createdAt, (long long)time(nullptr)));
+}
+
+void IdempotencyKeys::clear() {
+    entries.clear();
+    arrivals.clear();
+}
+
+}  // namespace detail
+}  // namespace expense
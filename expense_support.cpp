@@ -0,0 +1,918 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - SUPPORT CODE
+
+    Utilities, the JSON reader, request parser and writer, memory
+    accounting, the string pool and the task scheduler declared in
+    expense_internal.h.
+===============================================================================
+*/
+
+#include "expense_internal.h"
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+namespace expense {
+namespace detail {
+
+// ============================================================================
+// UTILITY FUNCTIONS
+// ============================================================================
+
+namespace Utils {
+
+    string getCurrentDateTime() {
+        time_t now = time(0);
+        char buffer[80];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime(&now));
+        return string(buffer);
+    }
+
+    bool isValidEmail(const string& email) {
+        return email.find('@') != string::npos && email.find('.') != string::npos;
+    }
+
+    bool isValidPhone(const string& phone) {
+        if (phone.empty() || phone.length() < 10) return false;
+        for (char c : phone) {
+            if (!isdigit(c)) return false;
+        }
+        return true;
+    }
+
+    bool isRecordSafe(const string& text) {
+        for (char c : text) {
+            if (c == '|' || (unsigned char)c < 0x20 || c == 0x7F) return false;
+        }
+        return true;
+    }
+
+    string formatCurrency(double amount) {
+        stringstream ss;
+        ss << fixed << setprecision(2) << "$" << amount;
+        return ss.str();
+    }
+
+    vector<string> split(const string& str, char delimiter) {
+        vector<string> tokens;
+        stringstream ss(str);
+        string token;
+        while (getline(ss, token, delimiter)) {
+            tokens.push_back(token);
+        }
+        return tokens;
+    }
+
+    bool parseInt(const string& text, int& out) {
+        const char* end = text.data() + text.size();
+        auto [stop, status] = from_chars(text.data(), end, out);
+        return !text.empty() && status == errc() && stop == end;
+    }
+
+    bool parseDouble(const string& text, double& out) {
+        const char* end = text.data() + text.size();
+        auto [stop, status] = from_chars(text.data(), end, out);
+        return !text.empty() && status == errc() && stop == end && isfinite(out);
+    }
+
+    string trim(const string& str) {
+        size_t first = str.find_first_not_of(" \t\n\r");
+        if (first == string::npos) return "";
+        size_t last = str.find_last_not_of(" \t\n\r");
+        return str.substr(first, (last - first + 1));
+    }
+
+    string toLower(const string& str) {
+        string result = str;
+        for (char& c : result) {
+            c = (char)tolower((unsigned char)c);
+        }
+        return result;
+    }
+
+    long long dateTimeKey(const string& str) {
+        int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+        int fields = sscanf(str.c_str(), "%d-%d-%d %d:%d:%d",
+                            &year, &month, &day, &hour, &minute, &second);
+        if (fields != 3 && fields != 6) return -1;
+        if (month < 1 || month > 12 || day < 1 || day > 31) return -1;
+        return ((((year * 100LL + month) * 100 + day) * 100 + hour) * 100 + minute) * 100 + second;
+    }
+
+    string formatDateTimeKey(long long key) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%04lld-%02lld-%02lld %02lld:%02lld:%02lld",
+                 key / 10000000000LL, key / 100000000LL % 100, key / 1000000LL % 100,
+                 key / 10000LL % 100, key / 100LL % 100, key % 100);
+        return string(buffer);
+    }
+
+    long long dateTimeKeyToUnix(long long key) {
+        tm fields{};
+        fields.tm_year = (int)(key / 10000000000LL) - 1900;
+        fields.tm_mon = (int)(key / 100000000LL % 100) - 1;
+        fields.tm_mday = (int)(key / 1000000LL % 100);
+        fields.tm_hour = (int)(key / 10000LL % 100);
+        fields.tm_min = (int)(key / 100LL % 100);
+        fields.tm_sec = (int)(key % 100);
+        fields.tm_isdst = -1;
+        return (long long)mktime(&fields);
+    }
+
+    long long unixMillis() {
+        return chrono::duration_cast<chrono::milliseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    string jsonEscape(const string& str) {
+        string result;
+        result.reserve(str.size() + 2);
+        for (char c : str) {
+            switch (c) {
+                case '"':  result += "\\\""; break;
+                case '\\': result += "\\\\"; break;
+                case '\n': result += "\\n"; break;
+                case '\r': result += "\\r"; break;
+                case '\t': result += "\\t"; break;
+                default:
+                    if ((unsigned char)c < 0x20) {
+                        char buffer[8];
+                        snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char)c);
+                        result += buffer;
+                    } else {
+                        result += c;
+                    }
+            }
+        }
+        return result;
+    }
+
+    void createDirectory(const string& path) {
+        #ifdef _WIN32
+            _mkdir(path.c_str());
+        #else
+            mkdir(path.c_str(), 0777);
+        #endif
+    }
+}
+
+// ============================================================================
+// JSON READER
+// ============================================================================
+
+void JsonReader::skipSpace() {
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r')) cursor++;
+}
+
+bool JsonReader::expect(char c) {
+    skipSpace();
+    if (cursor >= end || *cursor != c) return false;
+    cursor++;
+    return true;
+}
+
+bool JsonReader::object(const function<bool(const string& key)>& onField) {
+    if (!expect('{')) return false;
+    skipSpace();
+    if (cursor < end && *cursor == '}') { cursor++; return true; }
+    string key;
+    while (true) {
+        if (!readString(key) || !expect(':') || !onField(key)) return false;
+        skipSpace();
+        if (cursor < end && *cursor == ',') { cursor++; continue; }
+        return expect('}');
+    }
+}
+
+bool JsonReader::array(const function<bool()>& onItem) {
+    if (!expect('[')) return false;
+    skipSpace();
+    if (cursor < end && *cursor == ']') { cursor++; return true; }
+    while (true) {
+        if (!onItem()) return false;
+        skipSpace();
+        if (cursor < end && *cursor == ',') { cursor++; continue; }
+        return expect(']');
+    }
+}
+
+bool JsonReader::readString(string& out) {
+    if (!expect('"')) return false;
+    out.clear();
+    while (cursor < end && *cursor != '"') {
+        char c = *cursor++;
+        if (c != '\\') { out += c; continue; }
+        if (cursor >= end) return false;
+        char escaped = *cursor++;
+        switch (escaped) {
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': {
+                if (end - cursor < 4) return false;
+                unsigned code = (unsigned)strtoul(string(cursor, 4).c_str(), nullptr, 16);
+                cursor += 4;
+                // UTF-8 encode (the writer only escapes control characters)
+                if (code < 0x80) {
+                    out += (char)code;
+                } else if (code < 0x800) {
+                    out += (char)(0xC0 | (code >> 6));
+                    out += (char)(0x80 | (code & 0x3F));
+                } else {
+                    out += (char)(0xE0 | (code >> 12));
+                    out += (char)(0x80 | ((code >> 6) & 0x3F));
+                    out += (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default: out += escaped;   // \" \\ \/
+        }
+    }
+    return expect('"');
+}
+
+bool JsonReader::readNumber(double& out) {
+    skipSpace();
+    char* numberEnd;
+    string text(cursor, (size_t)min<ptrdiff_t>(end - cursor, 64));
+    out = strtod(text.c_str(), &numberEnd);
+    if (numberEnd == text.c_str()) return false;
+    cursor += numberEnd - text.c_str();
+    return true;
+}
+
+bool JsonReader::readInteger(long long& out) {
+    double value;
+    if (!readNumber(value)) return false;
+    out = llround(value);
+    return true;
+}
+
+bool JsonReader::skip() {
+    skipSpace();
+    if (cursor >= end) return false;
+    string ignored;
+    double number;
+    switch (*cursor) {
+        case '{': return object([this](const string&) { return skip(); });
+        case '[': return array([this]() { return skip(); });
+        case '"': return readString(ignored);
+        case 't': case 'f': case 'n':
+            while (cursor < end && isalpha((unsigned char)*cursor)) cursor++;
+            return true;
+        default: return readNumber(number);
+    }
+}
+
+// ============================================================================
+// JSON REQUEST PARSER
+// ============================================================================
+
+bool JsonRequestParser::fail(const char* why) {
+    failure = why;
+    return false;
+}
+
+void JsonRequestParser::skipSpace() {
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')) cursor++;
+}
+
+bool JsonRequestParser::readHex4(unsigned& code) {
+    if (end - cursor < 4) return false;
+    code = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *cursor++;
+        code <<= 4;
+        if (c >= '0' && c <= '9') code |= (unsigned)(c - '0');
+        else if (c >= 'a' && c <= 'f') code |= (unsigned)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') code |= (unsigned)(c - 'A' + 10);
+        else return false;
+    }
+    return true;
+}
+
+bool JsonRequestParser::parseString(string_view& out) {
+    char* begin = ++cursor;
+    while (cursor < end && *cursor != '"' && *cursor != '\\' && (unsigned char)*cursor >= 0x20) cursor++;
+    if (cursor < end && *cursor == '"') {
+        out = string_view(begin, (size_t)(cursor++ - begin));
+        return true;
+    }
+
+    // Escapes: decode in place behind the read cursor
+    char* write = cursor;
+    while (true) {
+        if (cursor >= end) return fail("unterminated string");
+        char c = *cursor++;
+        if (c == '"') break;
+        if ((unsigned char)c < 0x20) return fail("control character in string");
+        if (c != '\\') {
+            *write++ = c;
+            continue;
+        }
+        if (cursor >= end) return fail("unterminated string");
+        char escaped = *cursor++;
+        switch (escaped) {
+            case '"': case '\\': case '/': *write++ = escaped; break;
+            case 'n': *write++ = '\n'; break;
+            case 'r': *write++ = '\r'; break;
+            case 't': *write++ = '\t'; break;
+            case 'b': *write++ = '\b'; break;
+            case 'f': *write++ = '\f'; break;
+            case 'u': {
+                unsigned code;
+                if (!readHex4(code)) return fail("bad \\u escape");
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    unsigned low;
+                    if (end - cursor < 6 || cursor[0] != '\\' || cursor[1] != 'u') return fail("unpaired surrogate");
+                    cursor += 2;
+                    if (!readHex4(low) || low < 0xDC00 || low > 0xDFFF) return fail("unpaired surrogate");
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                if (code < 0x80) {
+                    *write++ = (char)code;
+                } else if (code < 0x800) {
+                    *write++ = (char)(0xC0 | (code >> 6));
+                    *write++ = (char)(0x80 | (code & 0x3F));
+                } else if (code < 0x10000) {
+                    *write++ = (char)(0xE0 | (code >> 12));
+                    *write++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                    *write++ = (char)(0x80 | (code & 0x3F));
+                } else {
+                    *write++ = (char)(0xF0 | (code >> 18));
+                    *write++ = (char)(0x80 | ((code >> 12) & 0x3F));
+                    *write++ = (char)(0x80 | ((code >> 6) & 0x3F));
+                    *write++ = (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default: return fail("bad escape");
+        }
+    }
+    out = string_view(begin, (size_t)(write - begin));
+    return true;
+}
+
+bool JsonRequestParser::parseNumber(double& out, string_view& token) {
+    char* begin = cursor;
+    while (cursor < end && (isdigit((unsigned char)*cursor) || *cursor == '-' || *cursor == '+' ||
+                            *cursor == '.' || *cursor == 'e' || *cursor == 'E')) {
+        cursor++;
+    }
+    auto [stop, status] = from_chars(begin, cursor, out);
+    if (begin == cursor || status != errc() || stop != cursor) return fail("bad number");
+    token = string_view(begin, (size_t)(cursor - begin));
+    return true;
+}
+
+bool JsonRequestParser::parseLiteral(Field& field) {
+    static const struct { const char* word; Kind kind; double number; } LITERALS[] = {
+        {"true", Kind::BOOLEAN, 1.0}, {"false", Kind::BOOLEAN, 0.0}, {"null", Kind::NULL_VALUE, 0.0}
+    };
+    for (const auto& literal : LITERALS) {
+        size_t length = strlen(literal.word);
+        if ((size_t)(end - cursor) >= length && memcmp(cursor, literal.word, length) == 0) {
+            field.kind = literal.kind;
+            field.number = literal.number;
+            field.text = string_view(cursor, length);
+            cursor += length;
+            return true;
+        }
+    }
+    return fail("unexpected character");
+}
+
+bool JsonRequestParser::parseArray(Field& field) {
+    cursor++;
+    field.kind = Kind::ARRAY;
+    field.first = (uint32_t)pool.size();
+    skipSpace();
+    if (cursor < end && *cursor == ']') {
+        cursor++;
+        field.count = 0;
+        return true;
+    }
+    while (true) {
+        skipSpace();
+        double value;
+        string_view token;
+        if (cursor >= end || !(isdigit((unsigned char)*cursor) || *cursor == '-')) {
+            return fail("arrays may only hold numbers");
+        }
+        if (!parseNumber(value, token)) return false;
+        pool.push_back(value);
+        skipSpace();
+        if (cursor < end && *cursor == ',') {
+            cursor++;
+            continue;
+        }
+        if (cursor < end && *cursor == ']') break;
+        return fail("expected , or ] in array");
+    }
+    cursor++;
+    field.count = (uint32_t)pool.size() - field.first;
+    return true;
+}
+
+bool JsonRequestParser::parseValue(Field& field) {
+    skipSpace();
+    if (cursor >= end) return fail("missing value");
+    char c = *cursor;
+    if (c == '"') {
+        field.kind = Kind::STRING;
+        return parseString(field.text);
+    }
+    if (c == '[') return parseArray(field);
+    if (c == '{') return fail("nested objects are not supported");
+    if (c == '-' || isdigit((unsigned char)c)) {
+        field.kind = Kind::NUMBER;
+        return parseNumber(field.number, field.text);
+    }
+    return parseLiteral(field);
+}
+
+bool JsonRequestParser::parse(char* text, size_t length) {
+    cursor = text;
+    end = text + length;
+    fieldCount = 0;
+    pool.clear();
+    failure = nullptr;
+
+    skipSpace();
+    if (cursor >= end || *cursor != '{') return fail("request must be a JSON object");
+    cursor++;
+    skipSpace();
+    if (cursor < end && *cursor == '}') {
+        cursor++;
+    } else {
+        while (true) {
+            skipSpace();
+            if (cursor >= end || *cursor != '"') return fail("expected a field name");
+            if (fieldCount == MAX_FIELDS) return fail("too many fields");
+            Field& field = fields[fieldCount];
+            field.number = 0.0;
+            field.first = field.count = 0;
+            if (!parseString(field.key)) return false;
+            skipSpace();
+            if (cursor >= end || *cursor != ':') return fail("expected :");
+            cursor++;
+            if (!parseValue(field)) return false;
+            fieldCount++;
+            skipSpace();
+            if (cursor < end && *cursor == ',') {
+                cursor++;
+                continue;
+            }
+            if (cursor < end && *cursor == '}') {
+                cursor++;
+                break;
+            }
+            return fail("expected , or }");
+        }
+    }
+    skipSpace();
+    return cursor == end || fail("text after the object");
+}
+
+const JsonRequestParser::Field* JsonRequestParser::field(string_view key) const {
+    for (size_t i = 0; i < fieldCount; i++) {
+        if (fields[i].key == key) return &fields[i];
+    }
+    return nullptr;
+}
+
+string_view JsonRequestParser::text(string_view key, string_view fallback) const {
+    const Field* found = field(key);
+    return found && found->kind == Kind::STRING ? found->text : fallback;
+}
+
+double JsonRequestParser::number(string_view key, double fallback) const {
+    const Field* found = field(key);
+    return found && (found->kind == Kind::NUMBER || found->kind == Kind::BOOLEAN) ? found->number : fallback;
+}
+
+pair<const double*, size_t> JsonRequestParser::numbers(string_view key) const {
+    const Field* found = field(key);
+    if (!found || found->kind != Kind::ARRAY) return {nullptr, 0};
+    return {pool.data() + found->first, found->count};
+}
+
+void JsonWriter::separate() {
+    if (needComma) out += ',';
+    needComma = true;
+}
+
+JsonWriter& JsonWriter::key(string_view name) {
+    text(name);
+    out += ':';
+    needComma = false;
+    return *this;
+}
+
+JsonWriter& JsonWriter::text(string_view value) {
+    separate();
+    out += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    static const char HEX[] = "0123456789abcdef";
+                    out += "\\u00";
+                    out += HEX[(unsigned char)c >> 4];
+                    out += HEX[c & 0xF];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+    return *this;
+}
+
+JsonWriter& JsonWriter::boolean(bool value) {
+    separate();
+    out += value ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::raw(string_view json) {
+    separate();
+    out += json;
+    return *this;
+}
+
+// ============================================================================
+// MEMORY ACCOUNTING
+// ============================================================================
+
+MemoryTracker::Counters& MemoryTracker::counters(MemoryCategory category) {
+    static Counters all[(size_t)MemoryCategory::COUNT];
+    return all[(size_t)category];
+}
+
+const char* MemoryTracker::categoryName(MemoryCategory category) {
+    switch (category) {
+        case MemoryCategory::USERS:        return "Users";
+        case MemoryCategory::EXPENSES:     return "Expenses";
+        case MemoryCategory::PARTICIPANTS: return "Participants";
+        case MemoryCategory::STRINGS:      return "Strings";
+        case MemoryCategory::INDEXES:      return "Indexes";
+        case MemoryCategory::LEDGER:       return "Ledger";
+        case MemoryCategory::ROLLUPS:      return "Rollups";
+        case MemoryCategory::SKETCHES:     return "Sketches";
+        default:                           return "Other";
+    }
+}
+
+void MemoryTracker::recordAllocation(MemoryCategory category, size_t bytes) {
+    Counters& c = counters(category);
+    int64_t live = c.liveBytes.fetch_add((int64_t)bytes, memory_order_relaxed) + (int64_t)bytes;
+    c.allocations.fetch_add(1, memory_order_relaxed);
+    int64_t peak = c.peakBytes.load(memory_order_relaxed);
+    while (live > peak && !c.peakBytes.compare_exchange_weak(peak, live, memory_order_relaxed)) {}
+}
+
+void MemoryTracker::recordFree(MemoryCategory category, size_t bytes) {
+    Counters& c = counters(category);
+    c.liveBytes.fetch_sub((int64_t)bytes, memory_order_relaxed);
+    c.frees.fetch_add(1, memory_order_relaxed);
+}
+
+void* MemoryTracker::allocate(MemoryCategory category, size_t bytes) {
+    void* p = ::operator new(bytes);
+    recordAllocation(category, bytes);
+    return p;
+}
+
+void MemoryTracker::deallocate(MemoryCategory category, void* p, size_t bytes) noexcept {
+    recordFree(category, bytes);
+    ::operator delete(p);
+}
+
+MemoryTracker::Usage MemoryTracker::usage(MemoryCategory category) {
+    Counters& c = counters(category);
+    uint64_t allocations = c.allocations.load(memory_order_relaxed);
+    return {category, c.liveBytes.load(memory_order_relaxed), c.peakBytes.load(memory_order_relaxed),
+            allocations, allocations - c.frees.load(memory_order_relaxed)};
+}
+
+int64_t MemoryTracker::totalLiveBytes() {
+    int64_t total = 0;
+    for (size_t i = 0; i < (size_t)MemoryCategory::COUNT; i++) {
+        total += usage((MemoryCategory)i).liveBytes;
+    }
+    return total;
+}
+
+void MemoryTracker::report(ostream& out) {
+    auto megabytes = [](int64_t bytes) {
+        stringstream ss;
+        ss << fixed << setprecision(2) << bytes / (1024.0 * 1024.0) << " MB";
+        return ss.str();
+    };
+
+    out << left << setw(14) << "Category" << right << setw(12) << "Live" << setw(12) << "Peak"
+        << setw(14) << "Allocations" << setw(12) << "Live allocs" << endl;
+    int64_t live = 0, peak = 0;
+    uint64_t allocations = 0, liveAllocations = 0;
+    for (size_t i = 0; i < (size_t)MemoryCategory::COUNT; i++) {
+        Usage u = usage((MemoryCategory)i);
+        out << left << setw(14) << categoryName(u.category) << right << setw(12) << megabytes(u.liveBytes)
+            << setw(12) << megabytes(u.peakBytes) << setw(14) << u.allocations
+            << setw(12) << u.liveAllocations << endl;
+        live += u.liveBytes;
+        peak += u.peakBytes;
+        allocations += u.allocations;
+        liveAllocations += u.liveAllocations;
+    }
+    out << left << setw(14) << "Total" << right << setw(12) << megabytes(live) << setw(12) << megabytes(peak)
+        << setw(14) << allocations << setw(12) << liveAllocations << endl;
+}
+
+// ============================================================================
+// STRING POOL
+// ============================================================================
+
+bool StringPool::usesHeap(const string& text) {
+    const char* data = text.data();
+    return data < (const char*)&text || data >= (const char*)(&text + 1);
+}
+
+StringPool::StringPool() : count(0) {
+    intern("");
+}
+
+StringPool::~StringPool() {
+    uint32_t total = count.load();
+    for (uint32_t id = 0; id < total; id++) {
+        string& slot = chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+        if (usesHeap(slot)) MemoryTracker::recordFree(MemoryCategory::STRINGS, slot.capacity() + 1);
+        slot.~string();
+    }
+    for (string* chunk : chunks) {
+        if (chunk) MemoryTracker::deallocate(MemoryCategory::STRINGS, chunk, CHUNK_SIZE * sizeof(string));
+    }
+}
+
+StringPool& StringPool::global() {
+    static StringPool pool;
+    return pool;
+}
+
+uint32_t StringPool::intern(string_view text) {
+    lock_guard<mutex> guard(writeLock);
+    auto it = ids.find(text);
+    if (it != ids.end()) return it->second;
+
+    uint32_t id = count.load(memory_order_relaxed);
+    size_t chunk = id >> CHUNK_BITS;
+    if (chunk >= MAX_CHUNKS || (limit > 0 && bytesLocked() >= limit)) {
+        throw length_error("string pool is full");
+    }
+    if (!chunks[chunk]) {
+        chunks[chunk] = static_cast<string*>(
+            MemoryTracker::allocate(MemoryCategory::STRINGS, CHUNK_SIZE * sizeof(string)));
+    }
+    string& slot = *new (&chunks[chunk][id & (CHUNK_SIZE - 1)]) string(text.data(), text.size());
+    ids.emplace(string_view(slot), id);
+    textBytes += slot.capacity() + 1;
+    if (usesHeap(slot)) MemoryTracker::recordAllocation(MemoryCategory::STRINGS, slot.capacity() + 1);
+    count.store(id + 1, memory_order_release);
+    return id;
+}
+
+const string& StringPool::get(uint32_t id) const {
+    return chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+}
+
+size_t StringPool::memoryBytes() const {
+    lock_guard<mutex> guard(writeLock);
+    return bytesLocked();
+}
+
+void StringPool::limitMemory(size_t bytes) {
+    lock_guard<mutex> guard(writeLock);
+    if (bytes > 0 && (limit == 0 || bytes < limit)) limit = bytes;
+}
+
+size_t StringPool::memoryLimit() const {
+    lock_guard<mutex> guard(writeLock);
+    return limit;
+}
+
+size_t StringPool::bytesLocked() const {
+    size_t allocatedChunks = (count.load() + CHUNK_SIZE - 1) >> CHUNK_BITS;
+    return textBytes + allocatedChunks * CHUNK_SIZE * sizeof(string)
+         + ids.size() * (sizeof(string_view) + sizeof(uint32_t) + 2 * sizeof(void*));
+}
+
+// ============================================================================
+// TASK SCHEDULER
+// ============================================================================
+
+void TaskScheduler::TaskGroup::finishOne() {
+    if (pending.fetch_sub(1) == 1) {
+        lock_guard<mutex> guard(lock);
+        done.notify_all();
+    }
+}
+
+bool TaskScheduler::takeTask(size_t self, size_t maxPriority, Task& task, size_t& priority) {
+    for (priority = 0; priority <= maxPriority; priority++) {
+        if (self != NO_WORKER) {
+            Worker& own = *workers[self];
+            lock_guard<mutex> guard(own.lock);
+            if (!own.queues[priority].empty()) {
+                task = move(own.queues[priority].back());
+                own.queues[priority].pop_back();
+                queued--;
+                return true;
+            }
+        }
+        {
+            lock_guard<mutex> guard(injectLock);
+            if (!injected[priority].empty()) {
+                task = move(injected[priority].front());
+                injected[priority].pop_front();
+                queued--;
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset <= workers.size(); offset++) {
+            size_t victim = ((self == NO_WORKER ? 0 : self) + offset) % workers.size();
+            if (victim == self) continue;
+            Worker& other = *workers[victim];
+            lock_guard<mutex> guard(other.lock);
+            if (!other.queues[priority].empty()) {
+                task = move(other.queues[priority].front());
+                other.queues[priority].pop_front();
+                queued--;
+                if (self != NO_WORKER) workers[self]->steals++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::execute(Task& task, size_t priority, size_t self) {
+    if (task.token.cancelled()) {
+        dropped[priority]++;
+    } else {
+        auto start = chrono::steady_clock::now();
+        try {
+            task.run();
+        } catch (...) {
+            if (task.group != nullptr) {
+                lock_guard<mutex> guard(task.group->lock);
+                if (!task.group->error) task.group->error = current_exception();
+            }
+        }
+        if (self != NO_WORKER) {
+            workers[self]->busyNanos += (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count();
+            workers[self]->tasksRun++;
+        } else {
+            helperTasks++;
+        }
+    }
+    completed[priority]++;
+    if (task.group != nullptr) task.group->finishOne();
+}
+
+void TaskScheduler::workerLoop(size_t self) {
+    currentScheduler = this;
+    currentWorker = self;
+    Task task;
+    size_t priority;
+    while (true) {
+        if (takeTask(self, PRIORITIES - 1, task, priority)) {
+            execute(task, priority, self);
+            task = Task();
+            continue;
+        }
+        unique_lock<mutex> guard(idleLock);
+        idle.wait(guard, [&]() { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0) return;
+    }
+}
+
+TaskScheduler::TaskScheduler(size_t workerCount) : started(chrono::steady_clock::now()) {
+    workerCount = max((size_t)1, workerCount);
+    for (size_t i = 0; i < workerCount; i++) workers.emplace_back(new Worker());
+    for (size_t i = 0; i < workerCount; i++) {
+        workers[i]->handle = thread(&TaskScheduler::workerLoop, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        lock_guard<mutex> guard(idleLock);
+        stopping = true;
+    }
+    idle.notify_all();
+    for (auto& worker : workers) worker->handle.join();
+}
+
+TaskScheduler& TaskScheduler::global() {
+    static TaskScheduler scheduler(max(1u, thread::hardware_concurrency()));
+    return scheduler;
+}
+
+void TaskScheduler::submit(function<void()> run, TaskPriority priority, TaskGroup* group,
+            CancellationToken token) {
+    size_t level = (size_t)priority;
+    if (group != nullptr) group->pending++;
+    Task task{move(run), group, move(token)};
+    size_t self = selfIndex();
+    if (self != NO_WORKER) {
+        lock_guard<mutex> guard(workers[self]->lock);
+        workers[self]->queues[level].push_back(move(task));
+    } else {
+        lock_guard<mutex> guard(injectLock);
+        injected[level].push_back(move(task));
+    }
+    submitted[level]++;
+    queued++;
+    { lock_guard<mutex> guard(idleLock); }
+    idle.notify_one();
+}
+
+void TaskScheduler::wait(TaskGroup& group) {
+    size_t self = selfIndex();
+    Task task;
+    size_t priority;
+    while (group.pending.load() > 0) {
+        if (takeTask(self, (size_t)group.priority, task, priority)) {
+            execute(task, priority, self);
+            task = Task();
+            continue;
+        }
+        unique_lock<mutex> guard(group.lock);
+        group.done.wait_for(guard, chrono::milliseconds(1), [&]() { return group.pending.load() == 0; });
+    }
+    lock_guard<mutex> guard(group.lock);
+    if (group.error) {
+        exception_ptr error = group.error;
+        group.error = nullptr;
+        rethrow_exception(error);
+    }
+}
+
+void TaskScheduler::parallelFor(size_t begin, size_t end, size_t grain, const function<void(size_t, size_t)>& fn,
+                 TaskPriority priority, CancellationToken token) {
+    if (end <= begin) return;
+    grain = max((size_t)1, grain);
+    if (end - begin <= grain) {
+        if (!token.cancelled()) fn(begin, end);
+        return;
+    }
+    TaskGroup group(priority);
+    for (size_t start = begin + grain; start < end; start += grain) {
+        size_t stop = min(end, start + grain);
+        submit([&fn, start, stop]() { fn(start, stop); }, priority, &group, token);
+    }
+    try {
+        if (!token.cancelled()) fn(begin, min(end, begin + grain));
+    } catch (...) {
+        lock_guard<mutex> guard(group.lock);
+        if (!group.error) group.error = current_exception();
+    }
+    wait(group);
+}
+
+void TaskScheduler::report(ostream& out) const {
+    double uptimeNanos = (double)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - started).count();
+    uint64_t busy = 0, run = 0, steals = 0;
+    for (const auto& worker : workers) {
+        busy += worker->busyNanos.load();
+        run += worker->tasksRun.load();
+        steals += worker->steals.load();
+    }
+    out << fixed << setprecision(1);
+    out << "Workers: " << workers.size() << " | Utilization: "
+        << (uptimeNanos > 0 ? 100.0 * busy / (uptimeNanos * workers.size()) : 0.0) << "%"
+        << " | Tasks on workers: " << run << " | Run by waiting callers: " << helperTasks.load()
+        << " | Steals: " << steals << endl;
+    const char* names[PRIORITIES] = {"Interactive", "Batch"};
+    for (size_t p = 0; p < PRIORITIES; p++) {
+        out << left << setw(12) << names[p] << right << " submitted " << submitted[p].load()
+            << ", completed " << completed[p].load() << ", cancelled " << dropped[p].load() << endl;
+    }
+    out.unsetf(ios::fixed);
+    out << setprecision(6);
+}
+
+}  // namespace detail
+}  // namespace expense
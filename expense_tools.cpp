@@ -0,0 +1,2375 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - COMMAND-LINE TOOLS
+
+    The modes declared in expense_tools.h: benchmarks (including the tenant
+    pool and the sharded engine), the balance audit, the read replica, the
+    JSON-lines protocol and the request server. These print reports to
+    stdout; the library does not.
+
+    Build with the library (libexpense.a, see expense.cpp):
+      g++ -std=c++20 -pthread -O2 expense_tools.cpp expense_app.cpp -L. -lexpense -o expense_app
+===============================================================================
+*/
+
+#include "expense_internal.h"
+#include "expense_tools.h"
+
+#include <coroutine>
+#include <filesystem>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <csignal>
+#include <sched.h>
+#endif
+
+using namespace std;
+using namespace expense::detail;
+using expense::ErrorCode;
+using expense::Status;
+using expense::Result;
+using expense::SplitMethod;
+using expense::ExportOrder;
+
+namespace {
+
+// ============================================================================
+// TENANTS
+// ============================================================================
+
+// Tenant ledgers of the benchmark, the JSON stream and the server: one
+// ExpenseManager per tenant under <dataDir>/tenants/<id> (see TenantPool)
+using ManagerPool = TenantPool<ExpenseManager>;
+
+ManagerPool::Loader managerLoader(bool enableSketches) {
+    return [enableSketches](const string& dataDir) -> Result<shared_ptr<ExpenseManager>> {
+        try {
+            return make_shared<ExpenseManager>(dataDir, enableSketches);
+        } catch (const bad_alloc&) {
+            return Status(ErrorCode::RESOURCE_EXHAUSTED, "Out of memory!");
+        } catch (const exception& error) {
+            return Status(ErrorCode::IO_ERROR, error.what());
+        }
+    };
+}
+
+// The ledger a request is for: the tenant it names, or the main ledger for
+// no tenant. tenants may be null when the caller serves no tenants.
+Result<shared_ptr<ExpenseManager>> ledgerFor(ExpenseManager& main, ManagerPool* tenants, const string& tenant) {
+    if (tenant.empty()) return shared_ptr<ExpenseManager>(shared_ptr<ExpenseManager>(), &main);
+    if (tenants == nullptr) return Status(ErrorCode::INVALID_ARGUMENT, "Tenants are not enabled here");
+    return tenants->acquire(tenant);
+}
+
+// Tenants' exports go to a subdirectory each, so user IDs never collide
+string exportDirFor(const string& exportDir, const string& tenant) {
+    return tenant.empty() ? exportDir : exportDir + "/" + tenant;
+}
+
+// ============================================================================
+// BENCHMARK
+// ============================================================================
+
+// Time a block in milliseconds
+template <typename Fn>
+double timeMs(Fn fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Write a synthetic users.txt and expenses.txt into dir. User N logs in as
+// userN@bench.test with password "pw"; expenses span 2023-01 to 2024-12.
+void generateBenchData(const string& dir, int userCount, int expenseCount) {
+    Utils::createDirectory(dir);
+
+    static const char* DESCRIPTIONS[] = {
+        "Groceries", "Uber", "Dinner", "Rent", "Coffee", "Movie tickets", "Fuel", "Internet bill",
+        "Electricity", "Lunch", "Snacks", "Hotel", "Flight", "Gym", "Pharmacy", "Team outing"
+    };
+    uint64_t seed = 42;
+    auto nextRandom = [&seed]() { seed = Utils::hash64(seed); return seed; };
+
+    ofstream usersFile(dir + "/users.txt");
+    for (int id = 1; id <= userCount; id++) {
+        usersFile << id << "|User " << id << "|user" << id << "@bench.test|" << (5550000000LL + id) << "|pw\n";
+    }
+
+    ofstream expensesFile(dir + "/expenses.txt");
+    for (int id = 1; id <= expenseCount; id++) {
+        int payer = (int)(nextRandom() % userCount) + 1;
+        int people = 2 + (int)(nextRandom() % 4);
+        double amount = (double)(100 + nextRandom() % 50000) / 100.0;
+        int month = 1 + (int)((long long)id * 24 / (expenseCount + 1));
+        expensesFile << id << "|" << DESCRIPTIONS[nextRandom() % 16] << "|" << fixed << setprecision(2)
+                     << amount << "|EQUAL|" << payer << "|" << (2023 + (month - 1) / 12) << "-"
+                     << setw(2) << setfill('0') << ((month - 1) % 12 + 1) << "-15 12:00:00" << setfill(' ') << "|";
+        expensesFile << payer << ":" << amount / people;
+        for (int p = 1; p < people; p++) {
+            expensesFile << "," << (int)(nextRandom() % userCount) + 1 << ":" << amount / people;
+        }
+        expensesFile << "\n";
+    }
+}
+
+// Generate a synthetic data set, load it and time the main read paths.
+// Usage: ./expense_app --bench [users] [expenses] [expense budget MB]
+int runBenchmark(int userCount, int expenseCount, size_t budgetBytes) {
+    const string dir = "bench_data";
+    double generateMs = timeMs([&]() { generateBenchData(dir, userCount, expenseCount); });
+
+    unique_ptr<ExpenseManager> manager;
+    double loadMs = timeMs([&]() { manager.reset(new ExpenseManager(dir, true, budgetBytes)); });
+
+    vector<pair<string, double>> timings;
+    {
+        ostream discard(nullptr);   // reports are rendered, then dropped
+        manager->login("user1@bench.test", "pw");
+        timings.push_back({"search amount>100 participant=1", timeMs([&]() { manager->searchExpenses("amount>100 participant=1", discard); })});
+        timings.push_back({"search participant=1,2", timeMs([&]() { manager->searchExpenses("participant=1,2", discard); })});
+        timings.push_back({"search desc=Rent quarter=2024-Q2", timeMs([&]() { manager->searchExpenses("desc=Rent quarter=2024-Q2", discard); })});
+        timings.push_back({"balance (user 1)", timeMs([&]() { manager->displayBalance(discard); })});
+        timings.push_back({"top 100 debtors/creditors/pairs", timeMs([&]() { manager->displayTopBalances(100, discard); })});
+        timings.push_back({"monthly report 2023-01..2024-12", timeMs([&]() { manager->displayMonthlySpending("2023-01", "2024-12", discard); })});
+        timings.push_back({"debt simplification", timeMs([&]() { manager->displayDebtSimplification(discard); })});
+        timings.push_back({"user prefix search 'user12'", timeMs([&]() { manager->findUsers("user12", 10); })});
+        timings.push_back({"my expenses (user 1)", timeMs([&]() { manager->displayUserExpenses(discard); })});
+        timings.push_back({"export CSV (user 1)", timeMs([&]() { manager->exportBalanceToCSV(dir + "/export.csv"); })});
+
+        // A long batch job keeps the workers busy while an interactive job
+        // runs; the batch job is then cancelled
+        TaskScheduler& scheduler = TaskScheduler::global();
+        auto spin = [](double ms, const CancellationToken& token) {
+            auto until = chrono::steady_clock::now() + chrono::duration<double, milli>(ms);
+            while (chrono::steady_clock::now() < until && !token.cancelled()) {}
+        };
+        CancellationToken batchToken;
+        TaskScheduler::TaskGroup batchJob(TaskPriority::BATCH);
+        for (int i = 0; i < 256; i++) {
+            scheduler.submit([&]() { spin(2.0, batchToken); }, TaskPriority::BATCH, &batchJob, batchToken);
+        }
+        CancellationToken none;
+        timings.push_back({"64 x 0.1 ms interactive under batch", timeMs([&]() {
+            scheduler.parallelFor(0, 64, 1, [&](size_t, size_t) { spin(0.1, none); }, TaskPriority::INTERACTIVE);
+        })});
+        timings.push_back({"cancel 256 x 2 ms batch job", timeMs([&]() {
+            batchToken.cancel();
+            scheduler.wait(batchJob);
+        })});
+    }
+
+    cout << "========================================" << endl;
+    cout << "   BENCHMARK: " << userCount << " users, " << expenseCount << " expenses" << endl;
+    cout << "========================================" << endl;
+    cout << fixed << setprecision(2);
+    cout << left << setw(40) << "generate data files" << right << setw(12) << generateMs << " ms" << endl;
+    cout << left << setw(40) << "load + build indexes" << right << setw(12) << loadMs << " ms" << endl;
+    for (const auto& [name, ms] : timings) {
+        cout << left << setw(40) << name << right << setw(12) << ms << " ms" << endl;
+    }
+    manager->displayMemoryUsage(cout);
+    return 0;
+}
+
+// Many small ledgers behind one tenant pool: cost of the first load, of
+// switching between resident tenants, and of random access under a budget.
+// Usage: ./expense_app --bench-tenants [tenants] [expenses per tenant] [budget MB] [accesses]
+int runTenantBenchmark(int tenantCount, int expensesPerTenant, size_t budgetBytes, int accesses) {
+    const string dir = "bench_tenants";
+    const int USERS_PER_TENANT = 8;
+    uint64_t seed = 7;
+    auto nextRandom = [&seed]() { seed = Utils::hash64(seed); return seed; };
+    auto tenantName = [](int index) {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "t%05d", index);
+        return string(buffer);
+    };
+
+    Utils::createDirectory(dir);
+    Utils::createDirectory(dir + "/tenants");
+    double generateMs = timeMs([&]() {
+        for (int t = 0; t < tenantCount; t++) {
+            string tenantDir = dir + "/tenants/" + tenantName(t);
+            Utils::createDirectory(tenantDir);
+            ofstream usersFile(tenantDir + "/users.txt");
+            for (int id = 1; id <= USERS_PER_TENANT; id++) {
+                usersFile << id << "|User " << id << "|user" << id << "@" << tenantName(t) << ".test|"
+                          << (5550000000LL + id) << "|pw\n";
+            }
+            ofstream expensesFile(tenantDir + "/expenses.txt");
+            for (int id = 1; id <= expensesPerTenant; id++) {
+                int payer = (int)(nextRandom() % USERS_PER_TENANT) + 1;
+                int other = (int)(nextRandom() % USERS_PER_TENANT) + 1;
+                double amount = (double)(100 + nextRandom() % 20000) / 100.0;
+                expensesFile << id << "|Expense " << id % 50 << "|" << fixed << setprecision(2) << amount
+                             << "|EQUAL|" << payer << "|2024-0" << (1 + id % 9) << "-15 12:00:00|"
+                             << payer << ":" << amount / 2 << "," << other << ":" << amount / 2 << "\n";
+            }
+            // Drop any state a previous run left behind
+            remove((tenantDir + "/changes.jsonl").c_str());
+            remove((tenantDir + "/tombstones.txt").c_str());
+        }
+    });
+
+    ManagerPool tenants(dir, budgetBytes, managerLoader(false));
+    size_t checksum = 0, failures = 0;
+    auto touch = [&](int index) {
+        Result<shared_ptr<ExpenseManager>> manager = tenants.acquire(tenantName(index));
+        if (manager) checksum += manager.value()->expenseCount();
+        else failures++;
+    };
+
+    // 1. Every tenant once, all cold
+    double firstTouchMs = timeMs([&]() {
+        for (int t = 0; t < tenantCount; t++) touch(t);
+    });
+    size_t residentAfterFirst = tenants.stats().residentTenants;
+
+    // 2. Round robin over the last few tenants touched, which are resident
+    int working = min(8, (int)residentAfterFirst);
+    int switches = max(accesses, 1);
+    uint64_t loadsBefore = tenants.stats().loads;
+    double hotMs = timeMs([&]() {
+        for (int i = 0; i < switches; i++) touch(tenantCount - 1 - i % working);
+    });
+    uint64_t hotLoads = tenants.stats().loads - loadsBefore;
+
+    // 3. Uniform random access over every tenant
+    vector<double> hitMicros, loadMicros;
+    for (int i = 0; i < accesses; i++) {
+        int index = (int)(nextRandom() % tenantCount);
+        bool resident = tenants.isResident(tenantName(index));
+        double ms = timeMs([&]() { touch(index); });
+        (resident ? hitMicros : loadMicros).push_back(ms * 1000.0);
+    }
+    auto summarize = [](vector<double>& micros) {
+        if (micros.empty()) return string("-");
+        sort(micros.begin(), micros.end());
+        double total = 0;
+        for (double value : micros) total += value;
+        stringstream ss;
+        ss << fixed << setprecision(2) << total / micros.size() << " us avg, "
+           << micros[micros.size() / 2] << " p50, " << micros[min(micros.size() - 1, micros.size() * 99 / 100)] << " p99";
+        return ss.str();
+    };
+
+    ManagerPool::Stats stats = tenants.stats();
+    cout << "========================================" << endl;
+    cout << "   TENANT BENCHMARK: " << tenantCount << " tenants x " << expensesPerTenant << " expenses" << endl;
+    cout << "========================================" << endl;
+    cout << fixed << setprecision(2);
+    cout << left << setw(32) << "generate data files" << right << setw(12) << generateMs << " ms" << endl;
+    cout << left << setw(32) << "first touch (cold load)" << right << setw(12) << firstTouchMs * 1000.0 / tenantCount
+         << " us/tenant" << endl;
+    cout << left << setw(32) << ("switch among " + to_string(working) + " resident") << right << setw(12)
+         << hotMs * 1000.0 / switches << " us/switch (" << hotLoads << " reloads)" << endl;
+    cout << left << setw(32) << "random access: hits" << right << "  " << hitMicros.size() << " | "
+         << summarize(hitMicros) << endl;
+    cout << left << setw(32) << "random access: loads" << right << "  " << loadMicros.size() << " | "
+         << summarize(loadMicros) << endl;
+    cout << "Budget: " << (budgetBytes ? to_string(budgetBytes / 1024) + " KB" : string("none"))
+         << " | Resident: " << stats.residentTenants << " tenants, " << stats.residentBytes / 1024 << " KB"
+         << " (" << (stats.residentTenants ? stats.residentBytes / stats.residentTenants / 1024 : 0)
+         << " KB/tenant)" << endl;
+    cout << "Shared strings (all tenants, outside the budget): " << stats.sharedBytes / 1024 << " KB" << endl;
+    cout << "Loads: " << stats.loads << " | Hits: " << stats.hits << " | Evictions: " << stats.evictions
+         << " | Failed: " << failures << " | Checksum: " << checksum << endl;
+    cout << "========================================" << endl;
+    return failures == 0 ? 0 : 1;
+}
+
+// Write throughput of the sharded engine from 1 shard up to maxShards,
+// checked against a single ledger, then reopened from its logs and checked
+// again. Efficiency is throughput relative to perfect scaling of the 1-shard
+// run.
+// Usage: ./expense_app --bench-shards [users] [expenses] [max shards]
+int runShardBenchmark(int userCount, int expenseCount, int maxShards) {
+    const string baseDir = "bench_shards";
+    uint64_t seed = 11;
+    auto nextRandom = [&seed]() { seed = Utils::hash64(seed); return seed; };
+
+    vector<Expense> generated;
+    generated.reserve(expenseCount);
+    BalanceLedger reference;
+    double generateMs = timeMs([&]() {
+        for (int id = 1; id <= expenseCount; id++) {
+            int payer = (int)(nextRandom() % userCount) + 1;
+            int people = 2 + (int)(nextRandom() % 4);
+            double amount = (double)(100 + nextRandom() % 50000) / 100.0;
+            Expense expense(id, "Expense " + to_string(id % 64), amount, SplitMethod::EQUAL, payer);
+            expense.addParticipant(ExpenseParticipant(payer, amount / people));
+            for (int p = 1; p < people; p++) {
+                expense.addParticipant(ExpenseParticipant((int)(nextRandom() % userCount) + 1, amount / people));
+            }
+            reference.apply(expense);
+            generated.push_back(expense);
+        }
+    });
+    vector<BalanceLedger::Entry> expectedDebtors = reference.topDebtors(10);
+    vector<BalanceLedger::Entry> expectedCreditors = reference.topCreditors(10);
+    auto sameAmounts = [](const vector<BalanceLedger::Entry>& a, const vector<BalanceLedger::Entry>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if (abs(a[i].amount - b[i].amount) > 0.01) return false;
+        }
+        return true;
+    };
+
+    cout << "========================================" << endl;
+    cout << "   SHARD BENCHMARK: " << userCount << " users, " << expenseCount << " expenses" << endl;
+    cout << "========================================" << endl;
+    cout << "Hardware threads: " << thread::hardware_concurrency()
+         << " | generate: " << fixed << setprecision(2) << generateMs << " ms" << endl;
+    cout << left << setw(8) << "Shards" << right << setw(12) << "Write ms" << setw(14) << "Expenses/s"
+         << setw(12) << "Efficiency" << setw(12) << "Remote %" << setw(12) << "Query ms" << setw(12) << "Reopen ms"
+         << "  Check" << endl;
+
+    double baseline = 0.0;
+    const size_t CHUNK = 4096;
+    for (int shardCount = 1; shardCount <= maxShards; shardCount *= 2) {
+        // Fresh logs per run; a directory keeps the shard count it was made with
+        const string dir = baseDir + "/" + to_string(shardCount);
+        error_code ignored;
+        filesystem::remove_all(dir, ignored);
+        auto engine = make_unique<ShardedEngine>(dir, (size_t)shardCount);
+        size_t clients = max((size_t)1, min((size_t)shardCount, (size_t)thread::hardware_concurrency()));
+        double writeMs = timeMs([&]() {
+            vector<thread> submitters;
+            for (size_t c = 0; c < clients; c++) {
+                submitters.emplace_back([&, c]() {
+                    vector<Expense> chunk;
+                    for (size_t start = c * CHUNK; start < generated.size(); start += clients * CHUNK) {
+                        size_t end = min(generated.size(), start + CHUNK);
+                        chunk.assign(generated.begin() + start, generated.begin() + end);
+                        engine->submit(chunk);
+                    }
+                });
+            }
+            for (auto& submitter : submitters) submitter.join();
+            engine->drain();
+        });
+
+        vector<BalanceLedger::Entry> debtors, creditors;
+        double queryMs = timeMs([&]() {
+            debtors = engine->topDebtors(10);
+            creditors = engine->topCreditors(10);
+        });
+        ShardedEngine::Stats stats = engine->stats();
+        bool ok = stats.expenses == generated.size() && stats.failedWrites == 0 &&
+                  sameAmounts(debtors, expectedDebtors) && sameAmounts(creditors, expectedCreditors);
+
+        // Recovery: the same balances come back from the shard logs
+        engine.reset();
+        double reopenMs = timeMs([&]() { engine = make_unique<ShardedEngine>(dir, (size_t)shardCount); });
+        ShardedEngine::Stats reopened = engine->stats();
+        ok = ok && reopened.recovered == generated.size() && reopened.malformedLines == 0 &&
+             sameAmounts(engine->topDebtors(10), expectedDebtors) &&
+             sameAmounts(engine->topCreditors(10), expectedCreditors);
+
+        double throughput = generated.size() / (writeMs / 1000.0);
+        if (shardCount == 1) baseline = throughput;
+        uint64_t deltas = stats.localDeltas + stats.remoteDeltas;
+        cout << left << setw(8) << shardCount << right << setw(12) << writeMs << setw(14) << setprecision(0) << throughput
+             << setw(11) << setprecision(1) << throughput / (baseline * shardCount) * 100.0 << "%"
+             << setw(11) << (deltas ? 100.0 * stats.remoteDeltas / deltas : 0.0) << "%"
+             << setw(12) << setprecision(2) << queryMs << setw(12) << reopenMs << "  " << (ok ? "ok" : "MISMATCH")
+             << endl;
+        if (!ok) return 1;
+    }
+    cout << "========================================" << endl;
+    return 0;
+}
+
+// ============================================================================
+// BALANCE AUDIT
+// ============================================================================
+
+// One pairwise delta; low < high and positive cents mean low owes high
+struct PairDelta {
+    uint32_t low;
+    uint32_t high;
+    int64_t cents;
+};
+
+struct PairDeltaLess {
+    bool operator()(const PairDelta& a, const PairDelta& b) const {
+        return a.low != b.low ? a.low < b.low : a.high < b.high;
+    }
+};
+
+// Amount in cents, matching llround(stod(text) * 100). Plain amounts with at
+// most two decimals are parsed exactly; anything else falls back to strtod.
+int64_t parseCents(const char* text, char** end) {
+    const char* cursor = text;
+    bool negative = *cursor == '-';
+    if (negative) cursor++;
+    int64_t whole = 0;
+    const char* digitsStart = cursor;
+    while (*cursor >= '0' && *cursor <= '9' && cursor - digitsStart < 15) whole = whole * 10 + (*cursor++ - '0');
+    int64_t fraction = 0;
+    int fractionDigits = 0;
+    if (*cursor == '.') {
+        cursor++;
+        while (*cursor >= '0' && *cursor <= '9' && fractionDigits < 3) {
+            fraction = fraction * 10 + (*cursor++ - '0');
+            fractionDigits++;
+        }
+    }
+    bool plain = cursor > digitsStart && fractionDigits <= 2 &&
+                 !(*cursor >= '0' && *cursor <= '9') && *cursor != 'e' && *cursor != 'E';
+    if (!plain) {
+        return llround(strtod(text, end) * 100.0);
+    }
+    *end = (char*)cursor;
+    int64_t cents = whole * 100 + (fractionDigits == 1 ? fraction * 10 : fraction);
+    return negative ? -cents : cents;
+}
+
+// Emit the deltas of one NUL-terminated expense line without building an
+// Expense. Fields are located from the end so descriptions never shift them.
+bool emitDeltas(const char* line, size_t length, ExternalMergeSorter<PairDelta, PairDeltaLess>& sorter) {
+    size_t separators[4];
+    int found = 0;
+    for (size_t i = length; i > 0 && found < 4; i--) {
+        if (line[i - 1] == '|') separators[found++] = i - 1;
+    }
+    if (found < 3) return false;
+
+    // Lines written since replica IDs end with a "|<global id>" field
+    int last = memchr(line + separators[0], '-', length - separators[0]) != nullptr ? 1 : 0;
+    if (found < 3 + last) return false;
+
+    long payer = strtol(line + separators[2 + last] + 1, nullptr, 10);
+    if (payer <= 0) return false;
+
+    const char* cursor = line + separators[last] + 1;
+    while (*cursor && *cursor != '\r' && *cursor != '|') {
+        char* end;
+        long participant = strtol(cursor, &end, 10);
+        if (*end != ':') return false;
+        int64_t cents = parseCents(end + 1, &end);
+        if (participant > 0 && participant != payer) {
+            // The participant owes the payer
+            if (participant < payer) {
+                sorter.add({(uint32_t)participant, (uint32_t)payer, cents});
+            } else {
+                sorter.add({(uint32_t)payer, (uint32_t)participant, -cents});
+            }
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end && *end != '\r' && *end != '|') {
+            return false;
+        }
+        cursor = end;
+    }
+    return true;
+}
+
+// Append a non-negative cent amount as "D.CC"
+void appendCents(string& out, int64_t cents) {
+    char digits[24];
+    auto result = to_chars(digits, digits + sizeof(digits), cents / 100);
+    out.append(digits, result.ptr);
+    out += '.';
+    out += (char)('0' + cents % 100 / 10);
+    out += (char)('0' + cents % 10);
+}
+
+void appendNumber(string& out, uint32_t value) {
+    char digits[12];
+    auto result = to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+// Global IDs of expenses deleted in the data directory holding the given file
+unordered_set<GlobalExpenseId, GlobalExpenseId::Hash> loadDeletedIds(const string& expensesPath) {
+    unordered_set<GlobalExpenseId, GlobalExpenseId::Hash> deleted;
+    size_t slash = expensesPath.rfind('/');
+    ifstream file((slash == string::npos ? string(".") : expensesPath.substr(0, slash)) + "/tombstones.txt");
+    string line;
+    while (getline(file, line)) {
+        GlobalExpenseId gid = GlobalExpenseId::parse(line.substr(0, line.find('|')));
+        if (gid.valid()) deleted.insert(gid);
+    }
+    return deleted;
+}
+
+// Recompute pairwise balances from expense files without loading them.
+// Lines are streamed, turned into (user, counterparty, delta) tuples and
+// externally sorted within memoryBytes, so history larger than RAM works.
+// Expenses with a tombstone next to their file are left out.
+// Usage: ./expense_app --audit-balances out.csv [--mem=MB] [expense files...]
+int runBalanceAudit(const string& outputPath, const vector<string>& inputs, size_t memoryBytes) {
+    ofstream output(outputPath);
+    if (!output.is_open()) {
+        cout << "Error: Could not create " << outputPath << endl;
+        return 1;
+    }
+
+    ExternalMergeSorter<PairDelta, PairDeltaLess> sorter(
+        outputPath + ".sort", memoryBytes, PairDeltaLess(),
+        [](PairDelta& into, const PairDelta& from) { into.cents += from.cents; });
+
+    uint64_t bytesRead = 0, lines = 0, skipped = 0, deletedLines = 0, pairs = 0;
+    double scanMs = 0.0, mergeMs = 0.0;
+
+    try {
+        // Read large blocks and cut lines in place, so parsing never copies
+        scanMs = timeMs([&]() {
+            vector<char> block(1 << 20);
+            for (const auto& path : inputs) {
+                ifstream input(path, ios::binary);
+                if (!input.is_open()) {
+                    cout << "Warning: Could not open " << path << ", skipping." << endl;
+                    continue;
+                }
+                unordered_set<GlobalExpenseId, GlobalExpenseId::Hash> deleted = loadDeletedIds(path);
+                size_t carry = 0;
+                while (true) {
+                    if (carry + 1 >= block.size()) block.resize(block.size() * 2);   // line longer than a block
+                    input.read(block.data() + carry, (streamsize)(block.size() - carry - 1));
+                    size_t filled = carry + (size_t)input.gcount();
+                    bool atEnd = input.gcount() == 0;
+                    bytesRead += (size_t)input.gcount();
+
+                    size_t start = 0;
+                    while (start < filled) {
+                        char* newline = (char*)memchr(block.data() + start, '\n', filled - start);
+                        if (newline == nullptr && !atEnd) break;
+                        size_t length = (newline ? (size_t)(newline - block.data()) : filled) - start;
+                        block[start + length] = '\0';
+                        if (length > 0) {
+                            lines++;
+                            if (!deleted.empty() &&
+                                deleted.count(GlobalExpenseId::ofRecord(string(block.data() + start, length)))) {
+                                deletedLines++;
+                            } else if (!emitDeltas(block.data() + start, length, sorter)) {
+                                skipped++;
+                            }
+                        }
+                        start += length + 1;
+                    }
+                    if (atEnd) break;
+                    carry = filled - start;
+                    memmove(block.data(), block.data() + start, carry);
+                }
+            }
+        });
+
+        mergeMs = timeMs([&]() {
+            string pending = "Debtor ID,Creditor ID,Amount\n";
+            sorter.finish([&](const PairDelta& delta) {
+                if (delta.cents == 0) return;
+                bool lowOwes = delta.cents > 0;
+                appendNumber(pending, lowOwes ? delta.low : delta.high);
+                pending += ',';
+                appendNumber(pending, lowOwes ? delta.high : delta.low);
+                pending += ',';
+                appendCents(pending, lowOwes ? delta.cents : -delta.cents);
+                pending += '\n';
+                pairs++;
+                if (pending.size() >= (1 << 20)) {
+                    output << pending;
+                    pending.clear();
+                }
+            });
+            output << pending;
+        });
+    } catch (const exception& e) {
+        cout << "Error: " << e.what() << endl;
+        return 1;
+    }
+    output.close();
+
+    double totalSeconds = (scanMs + mergeMs) / 1000.0;
+    cout << "========================================" << endl;
+    cout << "         BALANCE AUDIT" << endl;
+    cout << "========================================" << endl;
+    cout << fixed << setprecision(2);
+    cout << "Expense lines: " << lines << " (" << skipped << " malformed, " << deletedLines << " deleted)"
+         << " | Input: " << bytesRead / (1024.0 * 1024.0) << " MB" << endl;
+    cout << "Tuples: " << sorter.recordCount() << " | Sort runs: " << sorter.runCount()
+         << " | Spilled: " << sorter.bytesSpilled() / (1024.0 * 1024.0) << " MB"
+         << " | Passes: " << sorter.mergePasses() << endl;
+    cout << "Scan: " << scanMs << " ms | Merge: " << mergeMs << " ms | Throughput: "
+         << (totalSeconds > 0 ? bytesRead / (1024.0 * 1024.0) / totalSeconds : 0.0) << " MB/s" << endl;
+    cout << "✓ " << pairs << " pairwise balances written to " << outputPath << endl;
+    cout << "========================================" << endl;
+    return 0;
+}
+
+// ============================================================================
+// READ REPLICA
+// ============================================================================
+
+// Replication progress, written by the follower thread and read by `status`
+struct ReplicaStatus {
+    atomic<uint64_t> appliedSequence{0};
+    atomic<long long> appliedPublishedMillis{0};   // publish time of the last applied record
+    atomic<long long> lastApplyDelayMs{0};         // publish -> apply for that record
+    atomic<uint64_t> malformedRecords{0};
+    atomic<uint64_t> snapshotReloads{0};           // fell behind a trimmed log
+};
+
+// Tail the change log after the records the replica already has and apply
+// every complete record. Compaction trims the log by replacing it; the
+// follower then reopens it and seeks past what it applied. If the records
+// it needs were trimmed away, it reloads the data files instead.
+void followChangeLog(const string& logPath, ExpenseManager& manager, mutex& managerLock,
+                     ReplicaStatus& status, const atomic<bool>& stop) {
+    static constexpr size_t MAX_LINES_PER_APPLY = 4096;
+    ifstream log;
+    uint64_t logInode = 0;
+    string line, partial;
+    vector<string> lines;
+    uint64_t applied = status.appliedSequence;
+
+    auto logInodeNow = [&]() -> uint64_t {
+        struct stat info;
+        return stat(logPath.c_str(), &info) == 0 ? (uint64_t)info.st_ino : 0;
+    };
+
+    while (!stop) {
+        if (!log.is_open()) {
+            log.open(logPath, ios::binary);
+            if (!log.is_open()) {
+                this_thread::sleep_for(chrono::milliseconds(100));
+                continue;
+            }
+            log.seekg((streamoff)ChangeFeed::offsetAfter(logPath, applied));
+            logInode = logInodeNow();
+            partial.clear();
+        }
+
+        lines.clear();
+        while (lines.size() < MAX_LINES_PER_APPLY && getline(log, line)) {
+            if (log.eof()) {
+                partial += line;   // the primary is mid-write
+                break;
+            }
+            lines.push_back(partial + line);
+            partial.clear();
+        }
+        log.clear();
+
+        if (lines.empty()) {
+            uint64_t inode = logInodeNow();
+            if (inode != 0 && inode != logInode) {
+                log.close();   // trimmed: reopen the new log
+                continue;
+            }
+            this_thread::sleep_for(chrono::milliseconds(50));
+            continue;
+        }
+
+        // Apply a whole batch under one lock so readers see few pauses
+        lock_guard<mutex> guard(managerLock);
+        for (const auto& record : lines) {
+            uint64_t sequence = ChangeFeed::sequenceOf(record);
+            if (sequence == 0) {
+                if (!record.empty()) status.malformedRecords++;
+                continue;
+            }
+            if (sequence <= applied) continue;
+            if (sequence > applied + 1) {
+                // The records in between were trimmed before we read them
+                applied = manager.reloadSnapshot();
+                status.appliedSequence = applied;
+                status.snapshotReloads++;
+                log.close();
+                break;
+            }
+            applied = sequence;
+            status.appliedSequence = sequence;
+            ExpenseManager::ChangeRecord header;
+            if (!manager.applyChange(record, header)) {
+                status.malformedRecords++;
+                continue;
+            }
+            status.appliedPublishedMillis = header.publishedMillis;
+            status.lastApplyDelayMs = max(0LL, Utils::unixMillis() - header.publishedMillis);
+        }
+    }
+}
+
+// Print "Error: <message>" for a failed status; nothing on success
+void printError(const Status& status) {
+    if (!status) cout << "Error: " << status.message << endl;
+}
+
+void showReplicaHelp() {
+    cout << "Commands:" << endl;
+    cout << "  status                                   replication progress and lag" << endl;
+    cout << "  users                                    list users" << endl;
+    cout << "  as <user id>                             view data as a user" << endl;
+    cout << "  balance | expenses                       balance / expenses of that user" << endl;
+    cout << "  search <query>                           e.g. search amount>100 month=2024-04" << endl;
+    cout << "  export <file> [date|amount|counterparty] [desc] [N]" << endl;
+    cout << "  top [k]                                  top debtors, creditors and pairs" << endl;
+    cout << "  report <from YYYY-MM> <to YYYY-MM>       monthly spending" << endl;
+    cout << "  quit" << endl;
+}
+
+// Read-only follower: loads the snapshot in dataDir, then tails its change
+// log from the record after the snapshot and serves queries from stdin
+// while replication continues.
+// Usage: ./expense_app --replica [data dir]
+int runReplica(const string& dataDir) {
+    const string logPath = dataDir + "/changes.jsonl";
+    ExpenseManager manager(dataDir, true, 0, true);
+    mutex managerLock;
+    ReplicaStatus status;
+    status.appliedSequence = manager.snapshotSequence();
+    atomic<bool> stop{false};
+    thread follower(followChangeLog, logPath, ref(manager), ref(managerLock), ref(status), cref(stop));
+
+    cout << "Read replica of " << dataDir << " (type 'help' for commands)" << endl;
+    string line;
+    while (cout << "replica> " << flush, getline(cin, line)) {
+        stringstream words(line);
+        string command;
+        words >> command;
+        if (command.empty()) continue;
+        if (command == "quit" || command == "exit") break;
+        if (command == "help") {
+            showReplicaHelp();
+            continue;
+        }
+
+        lock_guard<mutex> guard(managerLock);
+        if (command == "status") {
+            uint64_t applied = status.appliedSequence;
+            uint64_t head = max(ChangeFeed::lastSequence(logPath), applied);
+            uint64_t behind = head - applied;
+            cout << "Applied seq: " << applied << " | Primary head: " << head
+                 << " | Behind: " << behind << " records | Lag: ";
+            if (behind == 0) {
+                cout << "0 ms" << endl;
+            } else if (status.appliedPublishedMillis == 0) {
+                cout << "catching up" << endl;
+            } else {
+                // While behind, lag is at least the age of the last applied record
+                cout << max(0LL, Utils::unixMillis() - status.appliedPublishedMillis) << " ms" << endl;
+            }
+            cout << "Last apply delay: " << status.lastApplyDelayMs << " ms | Malformed records: "
+                 << status.malformedRecords << " | Snapshot reloads: " << status.snapshotReloads
+                 << " | Users: " << manager.userCount()
+                 << " | Expenses: " << manager.expenseCount() << endl;
+        } else if (command == "users") {
+            manager.displayAllUsers(cout);
+        } else if (command == "as") {
+            int userId = 0;
+            words >> userId;
+            Status viewing = manager.viewAs(userId);
+            if (viewing) cout << "Viewing as " << manager.getCurrentUser()->getName() << endl;
+            else printError(viewing);
+        } else if (command == "balance") {
+            printError(manager.displayBalance(cout));
+        } else if (command == "expenses") {
+            printError(manager.displayUserExpenses(cout));
+        } else if (command == "search") {
+            string query;
+            getline(words, query);
+            printError(manager.searchExpenses(Utils::trim(query), cout));
+        } else if (command == "export") {
+            string file, word;
+            words >> file;
+            ExportOrder order = ExportOrder::STORAGE;
+            bool descending = false;
+            size_t limit = 0;
+            while (words >> word) {
+                if (word == "date") order = ExportOrder::DATE;
+                else if (word == "amount") order = ExportOrder::AMOUNT;
+                else if (word == "counterparty") order = ExportOrder::COUNTERPARTY;
+                else if (word == "desc") descending = true;
+                else limit = (size_t)max(0, atoi(word.c_str()));
+            }
+            if (file.empty()) {
+                cout << "Error: export needs a file name" << endl;
+                continue;
+            }
+            Result<expense::ExportInfo> exported = manager.exportBalanceToCSV(file, order, descending, limit);
+            if (exported) cout << "Exported " << exported->rows << " rows to " << exported->path << endl;
+            else printError(exported.status());
+        } else if (command == "top") {
+            size_t k = 10;
+            words >> k;
+            printError(manager.displayTopBalances(k, cout));
+        } else if (command == "report") {
+            string from, to;
+            words >> from >> to;
+            printError(manager.displayMonthlySpending(from, to, cout));
+        } else {
+            cout << "Unknown command '" << command << "'" << endl;
+            showReplicaHelp();
+        }
+    }
+
+    stop = true;
+    follower.join();
+    return 0;
+}
+
+// ============================================================================
+// JSON PROTOCOL
+// ============================================================================
+
+// Splits a byte stream into lines inside one reusable buffer. Callers read
+// into space(), then commit() what arrived; each complete line is handed
+// out as a mutable span and a partial line waits for the rest. The buffer
+// only grows for a line longer than itself.
+class LineBuffer {
+private:
+    vector<char> buffer;
+    size_t start = 0;    // first unconsumed byte
+    size_t filled = 0;
+
+public:
+    explicit LineBuffer(size_t capacity = 64 * 1024) : buffer(capacity) {}
+
+    // Free space after the buffered bytes, compacting or growing first
+    char* space(size_t& available) {
+        if (start > 0) {
+            memmove(buffer.data(), buffer.data() + start, filled - start);
+            filled -= start;
+            start = 0;
+        }
+        if (filled == buffer.size()) buffer.resize(buffer.size() * 2);
+        available = buffer.size() - filled;
+        return buffer.data() + filled;
+    }
+
+    void commit(size_t bytes) { filled += bytes; }
+
+    // Call onLine(char* line, size_t length) for each complete line; the
+    // newline (and a preceding \r) is not included
+    template <typename OnLine>
+    void lines(OnLine onLine) {
+        while (start < filled) {
+            char* begin = buffer.data() + start;
+            char* newline = (char*)memchr(begin, '\n', filled - start);
+            if (newline == nullptr) break;
+            start += (size_t)(newline - begin) + 1;
+            size_t length = (size_t)(newline - begin);
+            if (length > 0 && begin[length - 1] == '\r') length--;
+            onLine(begin, length);
+        }
+    }
+
+    // What is left once the input has ended: a last line without a newline
+    string_view rest() const { return string_view(buffer.data() + start, filled - start); }
+};
+
+// JSON-lines interface to an ExpenseManager: one request object per line
+// in, one response object per line out.
+//
+//   {"id":1,"op":"login","email":"a@x.com","password":"pw"}
+//   {"id":1,"ok":true,"result":{"userId":3,"name":"Asha"}}
+//   {"id":2,"op":"add","description":"Dinner","amount":60,"participants":[4,5]}
+//   {"id":2,"ok":false,"error":"Please login first!","code":"NOT_LOGGED_IN"}
+//
+// "id" is optional and echoed back as given. The session (who is logged
+// in) belongs to the caller, one per stream or connection. Operations that
+// only render a report return its text as result.text. "add" takes an
+// optional "idempotencyKey": resending an add with the same key returns
+// the first expenseId instead of adding again.
+//
+// "tenant" is optional too: with it, the request goes to that tenant's
+// ledger in the tenant pool instead of the main one. A login belongs to
+// the tenant it was made on; requests for another tenant run without it.
+class JsonApi {
+public:
+    struct Session {
+        int userId = 0;
+        string tenant;   // where userId logged in, empty for the main ledger
+    };
+
+private:
+    ExpenseManager& mainLedger;
+    ManagerPool* tenants;   // null: requests naming a tenant fail
+    bool trusted;           // local use: may name export files, compact and merge
+    bool refreshing;        // refresh the ledger before each request
+    string exportDir;       // where untrusted exports go
+    JsonRequestParser parser;
+    ostringstream output;   // rendered reports
+    string result;
+
+    static void writeUser(JsonWriter& json, const User& user) {
+        json.beginObject()
+            .key("id").number((long long)user.getId())
+            .key("name").text(user.getName())
+            .key("email").text(user.getEmail())
+            .endObject();
+    }
+
+    static void writeEntries(JsonWriter& json, const ExpenseManager& manager, string_view name,
+                             const vector<BalanceLedger::Entry>& entries, bool pairs) {
+        json.key(name).beginArray();
+        for (const auto& entry : entries) {
+            json.beginObject().key("userId").number((long long)entry.userId).key("name").text(manager.nameOf(entry.userId));
+            if (pairs) json.key("counterpartyId").number((long long)entry.counterpartyId);
+            json.key("amount").money(entry.amount).endObject();
+        }
+        json.endArray();
+    }
+
+    static void writeExpenses(JsonWriter& json, const ExpenseManager& manager, const ExpenseQuery& query) {
+        json.key("expenses").beginArray();
+        double total = 0.0;
+        for (const Expense& expense : manager.findExpenses(query)) {
+            json.raw(expense.toJson());
+            total += expense.getAmount();
+        }
+        json.endArray().key("total").money(total);
+    }
+
+    // A JSON number as an int; false for fractions and values outside int,
+    // which a plain cast would turn into undefined behaviour
+    static bool wholeInt(double value, int& out) {
+        if (!(value >= numeric_limits<int>::min() && value <= numeric_limits<int>::max()) || value != floor(value)) {
+            return false;
+        }
+        out = (int)value;
+        return true;
+    }
+
+    // An integer field, or fallback if it is missing
+    Status integer(string_view key, int& out, int fallback = 0) const {
+        if (wholeInt(parser.number(key, fallback), out)) return Status();
+        return Status(ErrorCode::INVALID_ARGUMENT, "'" + string(key) + "' must be a whole number in range");
+    }
+
+    // Run the parsed request against a tenant's (or the main) ledger,
+    // adding the members of the result object to result
+    Status run(ExpenseManager& manager, Session& session, const string& tenant, string_view op) {
+        JsonWriter json(result);
+        int me = session.userId;
+
+        if (op == "ping") {
+            json.key("pong").boolean(true);
+            return Status();
+        }
+        if (op == "login") {
+            Status loggedIn = manager.login(string(parser.text("email")), string(parser.text("password")));
+            if (!loggedIn) return loggedIn;
+            session.userId = manager.getCurrentUser()->getId();
+            session.tenant = tenant;
+            json.key("userId").number((long long)session.userId).key("name").text(manager.getCurrentUser()->getName());
+            return Status();
+        }
+        if (op == "logout") {
+            manager.logout();
+            session.userId = 0;
+            session.tenant.clear();
+            return Status();
+        }
+        if (op == "register") {
+            Result<int> registered = manager.registerUser(string(parser.text("name")), string(parser.text("email")),
+                                                          string(parser.text("phone")), string(parser.text("password")));
+            if (!registered) return registered.status();
+            json.key("userId").number((long long)*registered);
+            return Status();
+        }
+        if (op == "users" || op == "find") {
+            int limit = 0;
+            Status limitOk = integer("limit", limit, 10);
+            if (!limitOk) return limitOk;
+            vector<const User*> found = op == "users"
+                ? manager.allUsers()
+                : manager.findUsers(string(parser.text("prefix")), (size_t)max(1, limit));
+            json.key("users").beginArray();
+            for (const User* user : found) writeUser(json, *user);
+            json.endArray();
+            return Status();
+        }
+        if (op == "add") {
+            auto [ids, idCount] = parser.numbers("participants");
+            auto [shares, shareCount] = parser.numbers("shares");
+            vector<int> participantIds(idCount);
+            for (size_t i = 0; i < idCount; i++) {
+                if (!wholeInt(ids[i], participantIds[i])) {
+                    return Status(ErrorCode::INVALID_ARGUMENT, "'participants' must be user IDs");
+                }
+            }
+            Result<int> added = manager.addExpense(string(parser.text("description")), parser.number("amount"),
+                                                   stringToSplitMethod(string(parser.text("method", "EQUAL"))),
+                                                   participantIds, vector<double>(shares, shares + shareCount),
+                                                   string(parser.text("idempotencyKey")));
+            if (!added) return added.status();
+            json.key("expenseId").number((long long)*added);
+            return Status();
+        }
+        if (op == "delete") {
+            int expenseId = 0;
+            Status idOk = integer("expenseId", expenseId);
+            return idOk ? manager.deleteExpense(expenseId) : idOk;
+        }
+        if (op == "balance") {
+            json.key("balances").beginArray();
+            for (const auto& entry : manager.balances().balancesFor(me)) {
+                if (abs(entry.amount) <= 0.01) continue;
+                json.beginObject()
+                    .key("userId").number((long long)entry.counterpartyId)
+                    .key("name").text(manager.nameOf(entry.counterpartyId))
+                    .key("amount").money(entry.amount)   // positive: they owe you
+                    .endObject();
+            }
+            json.endArray();
+            return Status();
+        }
+        if (op == "expenses" || op == "search") {
+            ExpenseQuery query;
+            if (op == "expenses") {
+                query.participantIds.push_back(me);
+            } else {
+                string error;
+                if (!ExpenseQuery::parse(string(parser.text("query")), query, error)) {
+                    return Status(ErrorCode::INVALID_ARGUMENT, error);
+                }
+            }
+            writeExpenses(json, manager, query);
+            return Status();
+        }
+        if (op == "top") {
+            int k = 0;
+            Status kOk = integer("k", k, 10);
+            if (!kOk) return kOk;
+            k = max(1, k);
+            const BalanceLedger& ledger = manager.balances();
+            writeEntries(json, manager, "debtors", ledger.topDebtors(k), false);
+            writeEntries(json, manager, "creditors", ledger.topCreditors(k), false);
+            writeEntries(json, manager, "pairs", ledger.topPairs(k), true);
+            return Status();
+        }
+        if (op == "export") {
+            string_view orderName = parser.text("order");
+            ExportOrder order = orderName == "date" ? ExportOrder::DATE
+                              : orderName == "amount" ? ExportOrder::AMOUNT
+                              : orderName == "counterparty" ? ExportOrder::COUNTERPARTY
+                              : ExportOrder::STORAGE;
+            string path;
+            if (trusted && !parser.text("file").empty()) {
+                path = string(parser.text("file"));
+            } else {
+                string directory = exportDirFor(exportDir, tenant);
+                Utils::createDirectory(exportDir);
+                Utils::createDirectory(directory);
+                path = directory + "/user-" + to_string(me) + ".csv";
+            }
+            int limit = 0;
+            Status limitOk = integer("limit", limit);
+            if (!limitOk) return limitOk;
+            Result<expense::ExportInfo> exported = manager.exportBalanceToCSV(
+                path, order, parser.number("descending") != 0, (size_t)max(0, limit));
+            if (!exported) return exported.status();
+            json.key("file").text(path).key("rows").number((long long)exported->rows);
+            return Status();
+        }
+        if (trusted && op == "compact") {
+            return manager.compactData();
+        }
+        if (trusted && op == "merge") {
+            Result<expense::MergeInfo> merged = manager.mergeFrom(string(parser.text("peer")));
+            if (!merged) return merged.status();
+            json.key("peerReplica").text(merged->peerReplica)
+                .key("newUsers").number((long long)merged->newUsers)
+                .key("newExpenses").number((long long)merged->newExpenses)
+                .key("newDeletions").number((long long)merged->newDeletions)
+                .key("alreadyPresent").number((long long)merged->alreadyPresent)
+                .key("skippedUnknownUser").number((long long)merged->skippedUnknownUser);
+            return Status();
+        }
+
+        // Reports: the rendered text is the result
+        output.str("");
+        Status rendered;
+        if (op == "report") {
+            rendered = manager.displayMonthlySpending(string(parser.text("from")), string(parser.text("to")), output);
+        } else if (op == "pair") {
+            int userId = 0;
+            rendered = integer("userId", userId);
+            if (rendered) {
+                rendered = manager.displayPairReport(userId, string(parser.text("from")), string(parser.text("to")),
+                                                     output);
+            }
+        } else if (op == "simplify") {
+            rendered = manager.displayDebtSimplification(output);
+        } else if (op == "insights") {
+            rendered = manager.displaySharingInsights(output);
+        } else if (op == "memory") {
+            manager.displayMemoryUsage(output);
+        } else if (op == "all") {
+            rendered = manager.displayAllExpenses(output);
+        } else {
+            return Status(ErrorCode::INVALID_ARGUMENT, "Unknown op '" + string(op) + "'");
+        }
+        if (rendered) json.key("text").text(output.view());
+        return rendered;
+    }
+
+public:
+    JsonApi(ExpenseManager& mainLedger, ManagerPool* tenants, bool trusted, bool refreshing, const string& exportDir)
+        : mainLedger(mainLedger), tenants(tenants), trusted(trusted), refreshing(refreshing), exportDir(exportDir) {}
+
+    // Parse one request line in place. On failure the error response has
+    // already been appended to out.
+    bool parse(char* line, size_t length, string& out) {
+        if (parser.parse(line, length)) return true;
+        JsonWriter json(out);
+        json.beginObject().key("ok").boolean(false).key("error").text(string("bad request: ") + parser.error())
+            .key("code").text(expense::errorCodeName(ErrorCode::INVALID_ARGUMENT)).endObject();
+        out += '\n';
+        return false;
+    }
+
+    string_view op() const { return parser.text("op"); }
+
+    // Operations that write to the data directory or export a file
+    bool isSlow() const {
+        string_view name = op();
+        return name == "register" || name == "add" || name == "delete" || name == "export" ||
+               name == "compact" || name == "merge";
+    }
+
+    // Run the request parsed last and append its response line to out.
+    // The caller serializes access to the ledgers.
+    bool execute(Session& session, string& out) {
+        string_view name = op();
+        bool open = name == "ping" || name == "login" || name == "register" || name == "users" || name == "find";
+        string tenant(parser.text("tenant"));
+        result.assign(1, '{');
+        Status status(ErrorCode::NOT_LOGGED_IN, "Please login first!");
+        Result<shared_ptr<ExpenseManager>> ledger = ledgerFor(mainLedger, tenants, tenant);
+        if (!ledger) {
+            status = ledger.status();
+        } else {
+            ExpenseManager& manager = *ledger.value();
+            if (refreshing) manager.refresh();   // pick up records other processes appended
+            bool signedIn = session.userId != 0 && session.tenant == tenant;
+            if (open || signedIn) {
+                manager.resumeSession(signedIn ? session.userId : 0);
+                status = run(manager, session, tenant, name);
+            }
+        }
+        result += '}';
+        bool ok = status.ok();
+
+        JsonWriter json(out);
+        json.beginObject();
+        if (const JsonRequestParser::Field* id = parser.field("id")) {
+            json.key("id");
+            if (id->kind == JsonRequestParser::Kind::STRING) json.text(id->text);
+            else json.raw(id->text);
+        }
+        json.key("ok").boolean(ok);
+        if (ok) {
+            json.key("result").raw(result);
+        } else {
+            json.key("error").text(status.message).key("code").text(expense::errorCodeName(status.code));
+        }
+        json.endObject();
+        out += '\n';
+        return ok;
+    }
+
+    bool handle(char* line, size_t length, Session& session, string& out) {
+        return parse(line, length, out) && execute(session, out);
+    }
+};
+
+// JSON lines on stdin, responses on stdout, until end of input. Requests
+// naming a tenant go to <data dir>/tenants/<id>, with the tenants' tracked
+// memory kept under the budget.
+// Usage: ./expense_app --json [data dir] [tenant budget MB]
+int runJsonStream(const string& dataDir, size_t tenantBudgetBytes) {
+    ExpenseManager manager(dataDir, true);
+    ManagerPool tenants(dataDir, tenantBudgetBytes, managerLoader(true));
+    JsonApi api(manager, &tenants, true, true, dataDir + "/exports");
+    JsonApi::Session session;
+    LineBuffer input;
+    string out;
+    auto handleLine = [&](char* line, size_t length) {
+        if (length == 0) return;
+        api.handle(line, length, session, out);
+    };
+
+    while (true) {
+        size_t available;
+        char* space = input.space(available);
+        #ifdef _WIN32
+            int length = _read(0, space, (unsigned)available);
+        #else
+            ssize_t length = read(STDIN_FILENO, space, available);
+            if (length < 0 && errno == EINTR) continue;
+        #endif
+        if (length <= 0) break;
+        input.commit((size_t)length);
+        input.lines(handleLine);
+        // Answer everything received before waiting for more
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+        out.clear();
+    }
+    string last(input.rest());
+    handleLine(last.data(), last.size());
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+    return 0;
+}
+
+// Requests per second through the JSON protocol on one thread: parsing
+// alone, then parse + execute + serialize through the line buffer.
+// Usage: ./expense_app --bench-json [requests]
+int runJsonBenchmark(int requestCount) {
+    const string dir = "bench_json";
+    generateBenchData(dir, 1000, 20000);
+    ExpenseManager manager(dir, false);
+
+    #ifdef __linux__
+        cpu_set_t oneCore;
+        CPU_ZERO(&oneCore);
+        CPU_SET(sched_getcpu() < 0 ? 0 : sched_getcpu(), &oneCore);
+        sched_setaffinity(0, sizeof(oneCore), &oneCore);
+    #endif
+
+    // A login, then a mix that adds an expense with one of three friends
+    // every eighth request
+    string stream = "{\"id\":0,\"op\":\"login\",\"email\":\"user7@bench.test\",\"password\":\"pw\"}\n";
+    for (int i = 1; i < requestCount; i++) {
+        string id = "{\"id\":" + to_string(i);
+        switch (i % 8) {
+            case 0: case 4: stream += id + ",\"op\":\"balance\"}\n"; break;
+            case 1: stream += id + ",\"op\":\"ping\"}\n"; break;
+            case 2: case 6: stream += id + ",\"op\":\"search\",\"query\":\"amount>450 payer=7\"}\n"; break;
+            case 3: stream += id + ",\"op\":\"find\",\"prefix\":\"user1" + to_string(i % 100) + "\",\"limit\":5}\n"; break;
+            case 5:
+                stream += id + ",\"op\":\"add\",\"description\":\"Lunch \\\"at Joe\\u2019s\\\"\",\"amount\":12.5,"
+                          "\"method\":\"EXACT\",\"participants\":[" + to_string(8 + i / 8 % 3) +
+                          "],\"shares\":[6.25,6.25]}\n";
+                break;
+            default: stream += id + ",\"op\":\"find\",\"prefix\":\"User 2\",\"limit\":3}\n";
+        }
+    }
+
+    JsonRequestParser parser;
+    vector<char> copy(stream.begin(), stream.end());
+    size_t parsed = 0, fields = 0;
+    double parseMs = timeMs([&]() {
+        for (int pass = 0; pass < 10; pass++) {
+            memcpy(copy.data(), stream.data(), stream.size());
+            char* at = copy.data();
+            char* end = at + copy.size();
+            while (at < end) {
+                char* newline = (char*)memchr(at, '\n', (size_t)(end - at));
+                if (parser.parse(at, (size_t)(newline - at))) {
+                    parsed++;
+                    fields += parser.field("op") != nullptr;
+                }
+                at = newline + 1;
+            }
+        }
+    });
+
+    JsonApi api(manager, nullptr, false, false, dir + "/exports");
+    JsonApi::Session session;
+    LineBuffer input;
+    string out;
+    size_t responses = 0, failures = 0, outBytes = 0;
+    double endToEndMs = timeMs([&]() {
+        for (size_t offset = 0; offset < stream.size();) {
+            size_t available;
+            char* space = input.space(available);
+            size_t length = min(available, stream.size() - offset);
+            memcpy(space, stream.data() + offset, length);
+            offset += length;
+            input.commit(length);
+            input.lines([&](char* line, size_t lineLength) {
+                responses++;
+                if (!api.handle(line, lineLength, session, out)) failures++;
+            });
+            outBytes += out.size();
+            out.clear();
+        }
+    });
+
+    cout << "========================================" << endl;
+    cout << "   JSON PROTOCOL: " << requestCount << " requests, 1 thread" << endl;
+    cout << "========================================" << endl;
+    cout << fixed << setprecision(0);
+    cout << left << setw(40) << "parse only (10 passes)" << right << setw(12) << parsed / (parseMs / 1000.0)
+         << " req/s  (" << setprecision(1) << stream.size() * 10 / (parseMs * 1000.0) << " MB/s, "
+         << setprecision(0) << parseMs * 1e6 / max<size_t>(parsed, 1) << " ns/req)" << endl;
+    cout << left << setw(40) << "parse + execute + respond" << right << setw(12)
+         << responses / (endToEndMs / 1000.0) << " req/s  (" << setprecision(1)
+         << endToEndMs * 1000.0 / max<size_t>(responses, 1) << " us/req)" << endl;
+    cout << "Requests " << stream.size() / 1024 << " KB in, responses " << outBytes / 1024 << " KB out, "
+         << failures << " failed" << endl;
+    cout << "========================================" << endl;
+    return parsed == (size_t)requestCount * 10 && fields == parsed && failures == 0 ? 0 : 1;
+}
+
+// ============================================================================
+// REQUEST SERVER
+// ============================================================================
+
+#ifdef __linux__
+
+// Coroutine result handed back to the one coroutine that awaits it. The
+// body starts when awaited and resumes the awaiter when it finishes;
+// exceptions are rethrown at the co_await.
+template <typename T>
+class Async {
+public:
+    struct promise_type {
+        T value{};
+        exception_ptr error;
+        coroutine_handle<> awaiting;
+
+        Async get_return_object() { return Async(coroutine_handle<promise_type>::from_promise(*this)); }
+        suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept {
+            struct ResumeAwaiting {
+                bool await_ready() noexcept { return false; }
+                coroutine_handle<> await_suspend(coroutine_handle<promise_type> self) noexcept {
+                    return self.promise().awaiting;
+                }
+                void await_resume() noexcept {}
+            };
+            return ResumeAwaiting{};
+        }
+        void return_value(T result) { value = move(result); }
+        void unhandled_exception() { error = current_exception(); }
+    };
+
+    Async(Async&& other) noexcept : handle(exchange(other.handle, nullptr)) {}
+    ~Async() {
+        if (handle) handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    coroutine_handle<> await_suspend(coroutine_handle<> awaiting) noexcept {
+        handle.promise().awaiting = awaiting;
+        return handle;
+    }
+    T await_resume() {
+        if (handle.promise().error) rethrow_exception(handle.promise().error);
+        return move(handle.promise().value);
+    }
+
+private:
+    coroutine_handle<promise_type> handle;
+
+    explicit Async(coroutine_handle<promise_type> handle) : handle(handle) {}
+};
+
+// Coroutine that starts at once and frees itself when it returns
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+// Single-threaded epoll loop. Coroutines suspend here until a socket is
+// readable or writable, or until work handed to the task scheduler is
+// done; workers report back through an eventfd, so every coroutine
+// resumes on the loop thread.
+class EventLoop {
+public:
+    // The coroutines waiting on one file descriptor
+    struct Waiters {
+        coroutine_handle<> reader;
+        coroutine_handle<> writer;
+    };
+
+    struct FdAwaiter {
+        coroutine_handle<>& slot;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<> handle) noexcept { slot = handle; }
+        void await_resume() const noexcept {}
+    };
+
+    struct OffloadAwaiter {
+        EventLoop& loop;
+        function<void()> work;
+        exception_ptr error;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<> handle) {
+            TaskScheduler::global().submit([this, handle]() {
+                try {
+                    work();
+                } catch (...) {
+                    error = current_exception();
+                }
+                loop.finished(handle);
+            }, TaskPriority::INTERACTIVE);
+        }
+        void await_resume() {
+            if (error) rethrow_exception(error);
+        }
+    };
+
+private:
+    static constexpr int MAX_EVENTS = 256;
+
+    int epollFd;
+    int wakeFd;
+    deque<coroutine_handle<>> ready;        // loop thread only
+    mutex doneLock;
+    vector<coroutine_handle<>> done;        // offloaded work finished on a worker
+
+    // Called on a worker thread
+    void finished(coroutine_handle<> handle) {
+        {
+            lock_guard<mutex> guard(doneLock);
+            done.push_back(handle);
+        }
+        wake();
+    }
+
+public:
+    EventLoop() : epollFd(epoll_create1(EPOLL_CLOEXEC)), wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        if (epollFd < 0 || wakeFd < 0) throw runtime_error("could not create the event loop");
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;   // marks the wakeup eventfd
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    }
+
+    ~EventLoop() {
+        close(epollFd);
+        close(wakeFd);
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Edge-triggered, so callers read or write until EAGAIN before waiting
+    bool watch(int fd, Waiters& waiters) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = &waiters;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    void unwatch(int fd) { epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr); }
+
+    FdAwaiter readable(Waiters& waiters) { return {waiters.reader}; }
+    FdAwaiter writable(Waiters& waiters) { return {waiters.writer}; }
+
+    // Run work on the task scheduler; the awaiting coroutine resumes on the
+    // loop thread once it is done
+    OffloadAwaiter offload(function<void()> work) { return {*this, move(work), nullptr}; }
+
+    // Resume a coroutine on the next turn of the loop
+    void defer(coroutine_handle<> handle) { ready.push_back(handle); }
+
+    // Interrupt epoll_wait. Safe from any thread and from signal handlers.
+    void wake() {
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+
+    // Wait for events, then resume everything they made runnable. Handles
+    // are collected before any is resumed, since a resumed connection may
+    // close and free the Waiters a later event points at.
+    void runOnce() {
+        epoll_event events[MAX_EVENTS];
+        int count = epoll_wait(epollFd, events, MAX_EVENTS, ready.empty() ? -1 : 0);
+        for (int i = 0; i < count; i++) {
+            auto* waiters = static_cast<Waiters*>(events[i].data.ptr);
+            if (waiters == nullptr) {
+                uint64_t wakeups;
+                while (read(wakeFd, &wakeups, sizeof(wakeups)) > 0) {}
+                lock_guard<mutex> guard(doneLock);
+                ready.insert(ready.end(), done.begin(), done.end());
+                done.clear();
+                continue;
+            }
+            uint32_t flags = events[i].events;
+            if ((flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && waiters->reader) {
+                ready.push_back(exchange(waiters->reader, nullptr));
+            }
+            if ((flags & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && waiters->writer) {
+                ready.push_back(exchange(waiters->writer, nullptr));
+            }
+        }
+        while (!ready.empty()) {
+            coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            handle.resume();
+        }
+    }
+};
+
+// Lets one request at a time use the ExpenseManager, in arrival order.
+// Waiting requests are suspended rather than blocked, so the loop keeps
+// serving every other socket meanwhile. Loop thread only.
+class AsyncGate {
+private:
+    EventLoop& loop;
+    bool held = false;
+    deque<coroutine_handle<>> waiting;
+
+public:
+    struct Acquire {
+        AsyncGate& gate;
+
+        bool await_ready() noexcept {
+            if (gate.held) return false;
+            gate.held = true;
+            return true;
+        }
+        void await_suspend(coroutine_handle<> handle) { gate.waiting.push_back(handle); }
+        void await_resume() const noexcept {}
+    };
+
+    // Releases the gate when it goes out of scope
+    struct Guard {
+        AsyncGate& gate;
+        ~Guard() { gate.release(); }
+    };
+
+    explicit AsyncGate(EventLoop& loop) : loop(loop) {}
+
+    Acquire acquire() { return {*this}; }
+
+    // Hand the gate straight to the next waiter, if any
+    void release() {
+        if (waiting.empty()) {
+            held = false;
+            return;
+        }
+        loop.defer(waiting.front());
+        waiting.pop_front();
+    }
+
+    size_t queued() const { return waiting.size(); }
+};
+
+// Line-based request server over TCP. Each request is one line and goes
+// through the same pipeline: parse, authenticate against the connection's
+// session, execute against the ExpenseManager, serialize. A line starting
+// with '{' is a JsonApi request and gets one JSON line back. Any other line
+// is space-separated words, answered with "OK <bytes>\n" or
+// "ERR <bytes>\n" followed by exactly that many bytes of text.
+//
+// Besides the main ledger, the server answers for every tenant in its
+// tenant pool: JSON requests name one with "tenant", and "tenant <id>"
+// points a connection's word commands at one.
+//
+// Every connection is a coroutine on one epoll loop, so idle connections
+// cost a socket and a coroutine frame rather than a thread. Requests that
+// write to the data directory or export a file run on the task scheduler;
+// the request suspends until they are done and the loop carries on.
+class RequestServer {
+public:
+    struct Stats {
+        uint64_t accepted = 0;
+        size_t peakConnections = 0;
+        uint64_t requests = 0;
+        uint64_t offloaded = 0;
+        uint64_t failed = 0;
+        uint64_t acceptErrors = 0;
+    };
+
+private:
+    static constexpr size_t MAX_REQUEST_BYTES = 64 * 1024;
+
+    // One request line split into words; the views point into line
+    struct Request {
+        string line;
+        vector<string_view> words;
+
+        string_view verb() const { return words.empty() ? string_view() : words[0]; }
+        string arg(size_t i) const { return i < words.size() ? string(words[i]) : string(); }
+
+        // Everything from word i to the end of the line, spaces included
+        string rest(size_t i) const {
+            if (i >= words.size()) return string();
+            return string(words[i].data(), line.data() + line.size() - words[i].data());
+        }
+    };
+
+    struct Response {
+        bool ok = true;
+        string text;
+    };
+
+    struct Connection {
+        int fd = -1;
+        EventLoop::Waiters waiters;
+        string inbox;        // received bytes not yet parsed
+        string outbox;       // serialized responses not yet sent
+        Request request;     // reused for every request on the connection
+        JsonApi::Session session;
+        string tenant;       // for word commands; empty for the main ledger
+    };
+
+    ExpenseManager& manager;
+    ManagerPool* tenants;
+    string exportDir;
+    JsonApi json;
+    ostringstream output;
+    EventLoop loop;
+    AsyncGate gate;
+    int listenFd;
+    EventLoop::Waiters listenWaiters;
+    unordered_set<Connection*> connections;
+    atomic<bool> stopRequested{false};
+    bool accepting = false;
+    bool draining = false;
+    Stats counters;
+    char readBuffer[64 * 1024];   // shared by every connection; loop thread only
+
+    static bool parseRequest(Request& request) {
+        request.words.clear();
+        const string& line = request.line;
+        size_t at = 0;
+        while (at < line.size()) {
+            while (at < line.size() && isspace((unsigned char)line[at])) at++;
+            size_t start = at;
+            while (at < line.size() && !isspace((unsigned char)line[at])) at++;
+            if (at > start) request.words.emplace_back(line.data() + start, at - start);
+        }
+        return !request.words.empty();
+    }
+
+    static void serialize(const Response& response, string& out) {
+        out += response.ok ? "OK " : "ERR ";
+        out += to_string(response.text.size());
+        out += '\n';
+        out += response.text;
+    }
+
+    static vector<string> splitList(const string& text) {
+        vector<string> items;
+        stringstream stream(text);
+        string item;
+        while (getline(stream, item, ',')) {
+            if (!item.empty()) items.push_back(item);
+        }
+        return items;
+    }
+
+    // Verbs that need no session
+    static bool isPublic(string_view verb) {
+        return verb == "ping" || verb == "help" || verb == "stats" || verb == "tenant" || verb == "login" ||
+               verb == "register" || verb == "users" || verb == "find";
+    }
+
+    // Verbs that write to the data directory or export a file
+    static bool isSlow(string_view verb) {
+        return verb == "register" || verb == "add" || verb == "delete" || verb == "export";
+    }
+
+    static string helpText() {
+        return "Commands (one per line, words separated by spaces):\n"
+               "  login <email> <password>            logout\n"
+               "  register <email> <phone> <password> <name...>\n"
+               "  add <amount> <EQUAL|EXACT|PERCENTAGE> <id,id,...> <share,share,...|-> <description...>\n"
+               "  delete <expense id>\n"
+               "  balance | expenses | simplify | insights\n"
+               "  search <query>                      e.g. search amount>100 month=2024-04\n"
+               "  top [k]                             top debtors, creditors and pairs\n"
+               "  report <from YYYY-MM> <to YYYY-MM>  monthly spending\n"
+               "  pair <user id> <from> <to>          quarterly exchange with another user\n"
+               "  export [date|amount|counterparty] [desc] [N]\n"
+               "  tenant [id]                         use a tenant's ledger (no id: the main one)\n"
+               "  users | find <prefix> | stats | ping | help | quit\n"
+               "A line starting with '{' is a JSON request and gets a JSON line back.\n";
+    }
+
+    string statsText() const {
+        stringstream out;
+        out << "Connections: " << connections.size() << " open, " << counters.peakConnections << " peak, "
+            << counters.accepted << " accepted\n"
+            << "Requests: " << counters.requests << " (" << counters.offloaded << " offloaded, "
+            << counters.failed << " failed) | Waiting for the manager: " << gate.queued() << "\n";
+        return out.str();
+    }
+
+    // Read up to the next newline into conn.request.line; false once the
+    // peer has closed or sent an oversized line
+    Async<bool> readLine(Connection& conn) {
+        while (true) {
+            size_t end = conn.inbox.find('\n');
+            if (end != string::npos) {
+                conn.request.line.assign(conn.inbox, 0, end);
+                if (!conn.request.line.empty() && conn.request.line.back() == '\r') conn.request.line.pop_back();
+                conn.inbox.erase(0, end + 1);
+                co_return true;
+            }
+            if (conn.inbox.size() > MAX_REQUEST_BYTES) co_return false;
+
+            ssize_t length = recv(conn.fd, readBuffer, sizeof(readBuffer), 0);
+            if (length > 0) {
+                conn.inbox.append(readBuffer, (size_t)length);
+            } else if (length == 0) {
+                co_return false;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                co_await loop.readable(conn.waiters);
+            } else if (errno != EINTR) {
+                co_return false;
+            }
+        }
+    }
+
+    Async<bool> flush(Connection& conn) {
+        size_t sent = 0;
+        while (sent < conn.outbox.size()) {
+            ssize_t length = send(conn.fd, conn.outbox.data() + sent, conn.outbox.size() - sent, MSG_NOSIGNAL);
+            if (length > 0) {
+                sent += (size_t)length;
+            } else if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                co_await loop.writable(conn.waiters);
+            } else if (length == 0 || errno != EINTR) {
+                co_return false;
+            }
+        }
+        conn.outbox.clear();
+        co_return true;
+    }
+
+    // A login only counts on the ledger it was made on
+    static bool signedIn(const Connection& conn) {
+        return conn.session.userId != 0 && conn.session.tenant == conn.tenant;
+    }
+
+    bool authenticate(const Connection& conn, Response& response) const {
+        if (signedIn(conn) || isPublic(conn.request.verb())) return true;
+        response = {false, "Error: Please login first!\n"};
+        return false;
+    }
+
+    Response selectTenant(Connection& conn) const {
+        string tenant = conn.request.arg(1);
+        if (!tenant.empty() && tenants == nullptr) return {false, "Error: Tenants are not enabled here\n"};
+        if (!tenant.empty() && !ManagerPool::isValidTenantId(tenant)) {
+            return {false, "Error: Invalid tenant ID '" + tenant + "'\n"};
+        }
+        conn.tenant = tenant;
+        return {true, tenant.empty() ? "✓ Using the main ledger\n" : "✓ Using tenant " + tenant + "\n"};
+    }
+
+    // Run one request against the connection's ledger; the caller holds
+    // the gate
+    Response run(ExpenseManager& manager, Connection& conn) {
+        const Request& request = conn.request;
+        string_view verb = request.verb();
+        output.str("");
+        Status status;
+
+        if (verb == "login") {
+            status = manager.login(request.arg(1), request.arg(2));
+            if (status) {
+                conn.session.userId = manager.getCurrentUser()->getId();
+                conn.session.tenant = conn.tenant;
+                output << "✓ Login successful!  Welcome, " << manager.getCurrentUser()->getName() << "!" << endl;
+            }
+        } else if (verb == "logout") {
+            manager.logout();
+            conn.session.userId = 0;
+            conn.session.tenant.clear();
+            output << "✓ Logged out successfully!" << endl;
+        } else if (verb == "register") {
+            Result<int> registered = manager.registerUser(request.rest(4), request.arg(1), request.arg(2), request.arg(3));
+            status = registered.status();
+            if (registered) output << "✓ User registered successfully!  (ID: " << *registered << ")" << endl;
+        } else if (verb == "users") {
+            manager.displayAllUsers(output);
+        } else if (verb == "find") {
+            manager.displayUserSearch(request.rest(1), output);
+        } else if (verb == "add") {
+            vector<int> participantIds;
+            for (const string& id : splitList(request.arg(3))) participantIds.push_back(atoi(id.c_str()));
+            vector<double> shares;
+            for (const string& share : splitList(request.arg(4))) {
+                if (share != "-") shares.push_back(atof(share.c_str()));
+            }
+            Result<int> added = manager.addExpense(request.rest(5), atof(request.arg(1).c_str()),
+                                                   stringToSplitMethod(request.arg(2)), participantIds, shares);
+            status = added.status();
+            if (added) output << "✓ Expense added successfully!  (ID: " << *added << ")" << endl;
+        } else if (verb == "delete") {
+            int expenseId = atoi(request.arg(1).c_str());
+            status = manager.deleteExpense(expenseId);
+            if (status) output << "✓ Expense deleted successfully!  (ID: " << expenseId << ")" << endl;
+        } else if (verb == "balance") {
+            status = manager.displayBalance(output);
+        } else if (verb == "expenses") {
+            status = manager.displayUserExpenses(output);
+        } else if (verb == "search") {
+            status = manager.searchExpenses(request.rest(1), output);
+        } else if (verb == "top") {
+            int k = request.words.size() > 1 ? atoi(request.arg(1).c_str()) : 10;
+            status = manager.displayTopBalances((size_t)max(k, 1), output);
+        } else if (verb == "report") {
+            status = manager.displayMonthlySpending(request.arg(1), request.arg(2), output);
+        } else if (verb == "pair") {
+            status = manager.displayPairReport(atoi(request.arg(1).c_str()), request.arg(2), request.arg(3), output);
+        } else if (verb == "simplify") {
+            status = manager.displayDebtSimplification(output);
+        } else if (verb == "insights") {
+            status = manager.displaySharingInsights(output);
+        } else if (verb == "export") {
+            ExportOrder order = ExportOrder::STORAGE;
+            bool descending = false;
+            size_t limit = 0;
+            for (size_t i = 1; i < request.words.size(); i++) {
+                string word = request.arg(i);
+                if (word == "date") order = ExportOrder::DATE;
+                else if (word == "amount") order = ExportOrder::AMOUNT;
+                else if (word == "counterparty") order = ExportOrder::COUNTERPARTY;
+                else if (word == "desc") descending = true;
+                else limit = (size_t)max(0, atoi(word.c_str()));
+            }
+            // Clients name no paths; each user gets one file in the data directory
+            string directory = exportDirFor(exportDir, conn.tenant);
+            Utils::createDirectory(exportDir);
+            Utils::createDirectory(directory);
+            string path = directory + "/user-" + to_string(conn.session.userId) + ".csv";
+            Result<expense::ExportInfo> exported = manager.exportBalanceToCSV(path, order, descending, limit);
+            status = exported.status();
+            if (exported) {
+                output << "✓ Balance sheet exported to " << path << " successfully! (" << exported->rows << " rows)" << endl;
+                output << "File: " << path << endl;
+            }
+        } else {
+            status = Status(ErrorCode::INVALID_ARGUMENT, "Unknown command '" + string(verb) + "' (try 'help')");
+        }
+        if (!status) return {false, "Error: " + status.message + "\n"};
+        return {true, output.str()};
+    }
+
+    Async<Response> execute(Connection& conn) {
+        string_view verb = conn.request.verb();
+        if (verb == "ping") co_return Response{true, "pong\n"};
+        if (verb == "help") co_return Response{true, helpText()};
+        if (verb == "stats") co_return Response{true, statsText()};
+        if (verb == "tenant") co_return selectTenant(conn);
+
+        co_await gate.acquire();
+        AsyncGate::Guard guard{gate};
+        Result<shared_ptr<ExpenseManager>> ledger = ledgerFor(manager, tenants, conn.tenant);
+        if (!ledger) co_return Response{false, "Error: " + ledger.status().message + "\n"};
+        ExpenseManager& target = *ledger.value();
+        target.refresh();   // pick up records other processes appended
+        target.resumeSession(signedIn(conn) ? conn.session.userId : 0);
+        Response response;
+        if (isSlow(verb)) {
+            counters.offloaded++;
+            co_await loop.offload([&]() { response = run(target, conn); });
+        } else {
+            response = run(target, conn);
+        }
+        co_return response;
+    }
+
+    // JSON requests are parsed under the gate too, since the parser is shared
+    Async<bool> executeJson(Connection& conn) {
+        co_await gate.acquire();
+        AsyncGate::Guard guard{gate};
+        string& line = conn.request.line;
+        if (!json.parse(line.data(), line.size(), conn.outbox)) co_return false;
+        bool ok = false;
+        if (json.isSlow()) {
+            counters.offloaded++;
+            co_await loop.offload([&]() { ok = json.execute(conn.session, conn.outbox); });
+        } else {
+            ok = json.execute(conn.session, conn.outbox);
+        }
+        co_return ok;
+    }
+
+    Detached serveConnection(int fd) {
+        Connection conn;
+        conn.fd = fd;
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (!loop.watch(fd, conn.waiters)) {
+            close(fd);
+            co_return;
+        }
+        connections.insert(&conn);
+        counters.accepted++;
+        counters.peakConnections = max(counters.peakConnections, connections.size());
+
+        try {
+            while (co_await readLine(conn)) {
+                size_t first = conn.request.line.find_first_not_of(" \t");
+                if (first == string::npos) continue;
+                bool isJson = conn.request.line[first] == '{';
+                if (!isJson) {
+                    parseRequest(conn.request);
+                    if (conn.request.verb() == "quit") break;
+                }
+
+                counters.requests++;
+                bool ok;
+                if (isJson) {
+                    ok = co_await executeJson(conn);
+                } else {
+                    Response response;
+                    if (authenticate(conn, response)) response = co_await execute(conn);
+                    ok = response.ok;
+                    serialize(response, conn.outbox);
+                }
+                if (!ok) counters.failed++;
+
+                // Pipelined requests are answered with one send
+                if (conn.inbox.find('\n') != string::npos) continue;
+                if (!co_await flush(conn)) break;
+            }
+            if (!conn.outbox.empty()) co_await flush(conn);
+        } catch (const exception&) {
+            counters.failed++;
+        }
+
+        loop.unwatch(fd);
+        close(fd);
+        connections.erase(&conn);
+    }
+
+    // With edge triggering a failed accept (say, out of file descriptors)
+    // is retried when the next connection arrives
+    Detached acceptConnections() {
+        accepting = true;
+        while (!stopRequested) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd >= 0) {
+                serveConnection(fd);
+                continue;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) counters.acceptErrors++;
+            co_await loop.readable(listenWaiters);
+        }
+        accepting = false;
+    }
+
+    // Stop accepting and hang up on every client; connections finish the
+    // request they are running first
+    void beginDrain() {
+        draining = true;
+        for (Connection* conn : connections) shutdown(conn->fd, SHUT_RDWR);
+        if (listenWaiters.reader) loop.defer(exchange(listenWaiters.reader, nullptr));
+    }
+
+public:
+    // Takes ownership of a listening, non-blocking socket
+    // tenants may be null for a server without tenants
+    RequestServer(ExpenseManager& manager, ManagerPool* tenants, const string& dataDir, int listenFd)
+        : manager(manager), tenants(tenants), exportDir(dataDir + "/exports"),
+          json(manager, tenants, false, true, exportDir), gate(loop), listenFd(listenFd) {}
+
+    ~RequestServer() { close(listenFd); }
+
+    RequestServer(const RequestServer&) = delete;
+    RequestServer& operator=(const RequestServer&) = delete;
+
+    // Serve until stop() is called and every connection has closed
+    void serve() {
+        if (!loop.watch(listenFd, listenWaiters)) throw runtime_error("could not watch the listening socket");
+        acceptConnections();
+        while (accepting || !connections.empty()) {
+            if (stopRequested && !draining) beginDrain();
+            loop.runOnce();
+        }
+        loop.unwatch(listenFd);
+    }
+
+    // Safe from any thread and from signal handlers
+    void stop() {
+        stopRequested = true;
+        loop.wake();
+    }
+
+    const Stats& stats() const { return counters; }
+
+    void report(ostream& out) const {
+        out << "Server: " << counters.accepted << " connections (" << counters.peakConnections << " at once), "
+            << counters.requests << " requests (" << counters.offloaded << " offloaded, " << counters.failed
+            << " failed), " << counters.acceptErrors << " accept errors" << endl;
+    }
+};
+
+// Bind a non-blocking listening socket on 127.0.0.1; port 0 picks a free one.
+// Returns -1 on failure, otherwise the socket, with port set to the bound port.
+int openListener(int& port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    socklen_t length = sizeof(address);
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0 ||
+        getsockname(fd, (sockaddr*)&address, &length) != 0) {
+        close(fd);
+        return -1;
+    }
+    port = ntohs(address.sin_port);
+    return fd;
+}
+
+// Raise the soft open-file limit towards wanted (capped by the hard limit)
+// and return the limit now in force
+rlim_t raiseFileLimit(rlim_t wanted) {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return 0;
+    if (limit.rlim_cur < wanted) {
+        limit.rlim_cur = min(wanted, limit.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return limit.rlim_cur;
+}
+
+RequestServer* activeServer = nullptr;
+
+void stopActiveServer(int) {
+    if (activeServer != nullptr) activeServer->stop();
+}
+
+// Serve a data directory, and the tenants under <data dir>/tenants, on
+// 127.0.0.1 until interrupted.
+// Usage: ./expense_app --serve [port] [data dir] [tenant budget MB]
+int runServer(int port, const string& dataDir, size_t tenantBudgetBytes) {
+    int listenFd = openListener(port);
+    if (listenFd < 0) {
+        cout << "Error: Could not listen on port " << port << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    rlim_t fileLimit = raiseFileLimit(RLIM_INFINITY);
+
+    ExpenseManager manager(dataDir, true);
+    ManagerPool tenants(dataDir, tenantBudgetBytes, managerLoader(true));
+    RequestServer server(manager, &tenants, dataDir, listenFd);
+    activeServer = &server;
+    signal(SIGINT, stopActiveServer);
+    signal(SIGTERM, stopActiveServer);
+    cout << "Serving " << dataDir << " on 127.0.0.1:" << port << " (up to about " << fileLimit
+         << " connections; Ctrl+C to stop)" << endl;
+    server.serve();
+    activeServer = nullptr;
+    server.report(cout);
+    return 0;
+}
+
+// Client side of --bench-server. Opens every connection, logs each one in,
+// and only then starts the request phase, so all of them are open at once.
+// Each connection has one request in flight; one request in eight adds an
+// expense, which the server offloads.
+int driveServerLoad(int port, int connectionCount, int requestsEach, int userCount) {
+    struct Client {
+        int fd = -1;
+        bool connected = false;
+        bool loggedIn = false;
+        bool closed = false;
+        int answered = 0;
+        bool writing = false;   // the request in flight adds an expense
+        string inbox;
+        chrono::steady_clock::time_point sentAt;
+    };
+    static constexpr size_t CONNECT_WINDOW = 512;   // connects in flight at once
+    using Clock = chrono::steady_clock;
+
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    vector<Client> clients(connectionCount);
+    size_t opened = 0, loggedIn = 0, finished = 0;
+    uint64_t errors = 0;
+    vector<double> queryMs, writeMs;
+    Clock::time_point start = Clock::now(), requestsStart;
+    double connectMs = 0.0;
+
+    auto userOf = [&](size_t index) { return (int)(index % (size_t)userCount) + 1; };
+    auto sendLine = [&](Client& client, const string& line) {
+        if (send(client.fd, line.data(), line.size(), MSG_NOSIGNAL) != (ssize_t)line.size()) errors++;
+        client.sentAt = Clock::now();
+    };
+    auto sendRequest = [&](size_t index) {
+        Client& client = clients[index];
+        int me = userOf(index);
+        client.writing = false;
+        switch (client.answered % 8) {
+            case 0: case 3: case 6: sendLine(client, "balance\n"); break;
+            case 1: case 5: sendLine(client, "report 2024-01 2024-06\n"); break;
+            case 2: sendLine(client, "ping\n"); break;
+            case 4: sendLine(client, "search amount>400 payer=" + to_string(me) + "\n"); break;
+            default:
+                client.writing = true;
+                sendLine(client, "add 12.50 EQUAL " + to_string(me % userCount + 1) + " - Load test\n");
+        }
+    };
+    auto openMore = [&]() {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons((uint16_t)port);
+        while (opened < clients.size() && opened - loggedIn < CONNECT_WINDOW) {
+            Client& client = clients[opened];
+            client.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (client.fd < 0 ||
+                (connect(client.fd, (sockaddr*)&address, sizeof(address)) != 0 && errno != EINPROGRESS)) {
+                cout << "Error: Connection " << opened << " failed: " << strerror(errno) << endl;
+                return false;
+            }
+            int one = 1;
+            setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.u64 = opened;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, client.fd, &event);
+            opened++;
+        }
+        return true;
+    };
+    auto closeClient = [&](Client& client) {
+        if (client.closed) return;
+        client.closed = true;
+        finished++;
+        if (!client.loggedIn) loggedIn++;   // never blocks the request phase
+    };
+    // One complete response: advance the client to its next step
+    auto onResponse = [&](size_t index, bool ok) {
+        Client& client = clients[index];
+        if (!ok) errors++;
+        if (!client.loggedIn) {
+            client.loggedIn = true;
+            loggedIn++;
+            return;
+        }
+        double ms = chrono::duration<double, milli>(Clock::now() - client.sentAt).count();
+        (client.writing ? writeMs : queryMs).push_back(ms);
+        if (++client.answered < requestsEach) {
+            sendRequest(index);
+        } else {
+            closeClient(client);
+        }
+    };
+
+    if (epollFd < 0 || !openMore()) return 1;
+    bool requestPhase = false;
+    epoll_event events[256];
+    while (finished < clients.size()) {
+        if (chrono::duration<double>(Clock::now() - start).count() > 600) {
+            cout << "Error: Load test timed out with " << finished << " of " << clients.size()
+                 << " connections done" << endl;
+            return 1;
+        }
+        if (!requestPhase && loggedIn == clients.size()) {
+            requestPhase = true;
+            requestsStart = Clock::now();
+            connectMs = chrono::duration<double, milli>(requestsStart - start).count();
+            for (size_t i = 0; i < clients.size(); i++) {
+                if (!clients[i].closed) sendRequest(i);
+            }
+        }
+        int count = epoll_wait(epollFd, events, 256, 1000);
+        for (int e = 0; e < count; e++) {
+            size_t index = events[e].data.u64;
+            Client& client = clients[index];
+            if (client.closed) continue;
+            if ((events[e].events & EPOLLERR) || ((events[e].events & EPOLLHUP) && !client.connected)) {
+                errors++;
+                closeClient(client);
+                continue;
+            }
+            if (!client.connected && (events[e].events & EPOLLOUT)) {
+                client.connected = true;
+                sendLine(client, "login user" + to_string(userOf(index)) + "@bench.test pw\n");
+            }
+            char buffer[16384];
+            ssize_t length;
+            while ((length = recv(client.fd, buffer, sizeof(buffer), 0)) > 0) {
+                client.inbox.append(buffer, (size_t)length);
+            }
+            if (length == 0) {
+                errors++;
+                closeClient(client);
+                continue;
+            }
+            // Frames are "OK|ERR <bytes>\n<text>"
+            size_t newline;
+            while ((newline = client.inbox.find('\n')) != string::npos) {
+                size_t space = client.inbox.find(' ');
+                size_t bytes = space < newline ? strtoull(client.inbox.c_str() + space + 1, nullptr, 10) : 0;
+                if (client.inbox.size() < newline + 1 + bytes) break;
+                bool ok = client.inbox.compare(0, 3, "OK ") == 0;
+                client.inbox.erase(0, newline + 1 + bytes);
+                onResponse(index, ok);
+            }
+        }
+        if (!requestPhase && !openMore()) return 1;
+    }
+    double requestSeconds = chrono::duration<double>(Clock::now() - requestsStart).count();
+    for (Client& client : clients) close(client.fd);
+    close(epollFd);
+
+    auto percentile = [](vector<double>& values, double p) {
+        if (values.empty()) return 0.0;
+        size_t at = min(values.size() - 1, (size_t)(p * values.size()));
+        nth_element(values.begin(), values.begin() + at, values.end());
+        return values[at];
+    };
+    size_t requests = queryMs.size() + writeMs.size();
+    cout << fixed << setprecision(2);
+    cout << left << setw(40) << "connect + login all" << right << setw(12) << connectMs << " ms" << endl;
+    cout << left << setw(40) << "requests" << right << setw(12) << requests << "  ("
+         << setprecision(0) << requests / max(requestSeconds, 1e-9) << " /s)" << setprecision(2) << endl;
+    cout << left << setw(40) << "query latency p50 / p99" << right << setw(12) << percentile(queryMs, 0.5)
+         << " / " << percentile(queryMs, 0.99) << " ms" << endl;
+    cout << left << setw(40) << "add expense latency p50 / p99" << right << setw(12) << percentile(writeMs, 0.5)
+         << " / " << percentile(writeMs, 0.99) << " ms" << endl;
+    cout << left << setw(40) << "errors" << right << setw(12) << errors << endl;
+    return errors == 0 && requests == (size_t)connectionCount * requestsEach ? 0 : 1;
+}
+
+// Start a server on a synthetic data set and hold `connections` client
+// connections open at once from a child process, so that client and server
+// sockets each have a full open-file limit.
+// Usage: ./expense_app --bench-server [connections] [requests per connection]
+int runServerLoadTest(int connectionCount, int requestsEach) {
+    const string dir = "bench_server";
+    const int userCount = 1000;
+    rlim_t fileLimit = raiseFileLimit(RLIM_INFINITY);
+    if (fileLimit < (rlim_t)connectionCount + 64) {
+        cout << "Open file limit is " << fileLimit << "; testing " << fileLimit - 64 << " connections instead of "
+             << connectionCount << endl;
+        connectionCount = (int)fileLimit - 64;
+        if (connectionCount <= 0) return 1;
+    }
+
+    int port = 0;
+    int listenFd = openListener(port);
+    if (listenFd < 0) {
+        cout << "Error: Could not open a listening socket: " << strerror(errno) << endl;
+        return 1;
+    }
+
+    cout << "========================================" << endl;
+    cout << "   SERVER LOAD TEST: " << connectionCount << " connections x " << requestsEach << " requests" << endl;
+    cout << "========================================" << endl;
+    cout << "Open file limit: " << fileLimit << " per process" << endl;
+
+    // Fork before the parent starts any threads; the child waits until the
+    // server is ready
+    int ready[2];
+    if (pipe(ready) != 0) return 1;
+    cout.flush();
+    pid_t child = fork();
+    if (child == 0) {
+        close(listenFd);
+        close(ready[1]);
+        char go;
+        ssize_t got = read(ready[0], &go, 1);
+        int result = got == 1 ? driveServerLoad(port, connectionCount, requestsEach, userCount) : 1;
+        cout.flush();
+        _exit(result);
+    }
+    close(ready[0]);
+    if (child < 0) return 1;
+
+    generateBenchData(dir, userCount, 20000);
+    ExpenseManager manager(dir, false);
+    RequestServer server(manager, nullptr, dir, listenFd);
+    thread serving([&]() { server.serve(); });
+    ssize_t written = write(ready[1], "1", 1);
+    close(ready[1]);
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    server.stop();
+    serving.join();
+    server.report(cout);
+    cout << "Slow steps ran on " << TaskScheduler::global().workerCount() << " scheduler worker(s)" << endl;
+    cout << "========================================" << endl;
+    bool ok = written == 1 && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+              server.stats().peakConnections >= (size_t)connectionCount;
+    if (!ok) cout << "Load test FAILED" << endl;
+    return ok ? 0 : 1;
+}
+
+#endif
+
+}  // namespace
+
+// ============================================================================
+// COMMAND-LINE TOOLS (expense_tools.h)
+// ============================================================================
+
+namespace expense {
+namespace tools {
+
+int benchmark(int userCount, int expenseCount, size_t budgetBytes) {
+    return runBenchmark(userCount, expenseCount, budgetBytes);
+}
+
+int tenantBenchmark(int tenantCount, int expensesPerTenant, size_t budgetBytes, int accesses) {
+    return runTenantBenchmark(tenantCount, expensesPerTenant, budgetBytes, accesses);
+}
+
+int shardBenchmark(int userCount, int expenseCount, int maxShards) {
+    return runShardBenchmark(userCount, expenseCount, maxShards);
+}
+
+int jsonBenchmark(int requestCount) {
+    return runJsonBenchmark(requestCount);
+}
+
+int serverLoadTest(int connectionCount, int requestsEach) {
+    #ifdef __linux__
+        return runServerLoadTest(connectionCount, requestsEach);
+    #else
+        cout << "Error: Server mode needs Linux (epoll)" << endl;
+        return 1;
+    #endif
+}
+
+int balanceAudit(const string& outputPath, const vector<string>& inputs, size_t memoryBytes) {
+    return runBalanceAudit(outputPath, inputs, memoryBytes);
+}
+
+int tailChanges(const string& logPath, uint64_t afterSequence, bool follow) {
+    Status status = ChangeFeed::tail(logPath, afterSequence, follow, cout);
+    printError(status);
+    return status ? 0 : 1;
+}
+
+int replica(const string& dataDir) {
+    return runReplica(dataDir);
+}
+
+int jsonStream(const string& dataDir, size_t tenantBudgetBytes) {
+    return runJsonStream(dataDir, tenantBudgetBytes);
+}
+
+int serve(int port, const string& dataDir, size_t tenantBudgetBytes) {
+    #ifdef __linux__
+        return runServer(port, dataDir, tenantBudgetBytes);
+    #else
+        cout << "Error: Server mode needs Linux (epoll)" << endl;
+        return 1;
+    #endif
+}
+
+}  // namespace tools
+}  // namespace expense
@@ -0,0 +1,47 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - COMMAND-LINE TOOLS
+
+    Entry points for the app's non-interactive modes: benchmarks, the audit,
+    the change feed, the read replica, the JSON-lines stream and the request
+    server. Each one writes its report to stdout and returns a process exit
+    code. Implemented in expense_tools.cpp, which is not part of the
+    library; unlike expense.h this is not a stable embedding API.
+===============================================================================
+*/
+
+#ifndef EXPENSE_TOOLS_H
+#define EXPENSE_TOOLS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace expense {
+namespace tools {
+
+int benchmark(int userCount, int expenseCount, size_t budgetBytes);
+int tenantBenchmark(int tenantCount, int expensesPerTenant, size_t budgetBytes, int accesses);
+int shardBenchmark(int userCount, int expenseCount, int maxShards);
+int jsonBenchmark(int requestCount);
+int serverLoadTest(int connectionCount, int requestsEach);
+
+// Recompute pairwise balances from expense files without loading them
+int balanceAudit(const std::string& outputPath, const std::vector<std::string>& inputs, size_t memoryBytes);
+// Print change records after a sequence number; with follow, keep polling
+int tailChanges(const std::string& logPath, uint64_t afterSequence, bool follow);
+
+// Interactive read-only follower of a data directory's change feed
+int replica(const std::string& dataDir);
+// JSON request lines on stdin, one response line each on stdout. Both
+// also serve the tenants under <dataDir>/tenants, keeping the resident
+// ones' tracked memory under tenantBudgetBytes (0 = unlimited).
+int jsonStream(const std::string& dataDir, size_t tenantBudgetBytes);
+// Answer line requests over TCP on 127.0.0.1 until interrupted (Linux only)
+int serve(int port, const std::string& dataDir, size_t tenantBudgetBytes);
+
+}  // namespace tools
+}  // namespace expense
+
+#endif
@@ -0,0 +1,56 @@
+/*
+===============================================================================
+    EXPENSE SHARING LIBRARY - TEST CHECKS
+
+    Shared by the programs in tests/. CHECK and CHECK_EQ report a failure
+    with its line and keep going; a test's main() ends with
+    `return checks::result("<test name>");`, so the exit code is 0 only
+    when every check passed.
+===============================================================================
+*/
+
+#ifndef EXPENSE_TESTS_CHECK_H
+#define EXPENSE_TESTS_CHECK_H
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+namespace checks {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void fail(const char* file, int line, const std::string& what) {
+    std::cout << file << ":" << line << ": FAILED " << what << std::endl;
+    failures()++;
+}
+
+inline int result(const char* name) {
+    std::cout << name << ": " << (failures() == 0 ? "ok" : std::to_string(failures()) + " failed") << std::endl;
+    return failures() == 0 ? 0 : 1;
+}
+
+// An empty scratch directory under the system temp directory
+inline std::string scratchDir(const std::string& name) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / ("expense_test_" + name);
+    std::filesystem::remove_all(path);
+    std::filesystem::create_directories(path);
+    return path.string();
+}
+
+}  // namespace checks
+
+#define CHECK(condition) \
+    do { if (!(condition)) checks::fail(__FILE__, __LINE__, #condition); } while (0)
+
+#define CHECK_EQ(actual, expected)                                                            \
+    do {                                                                                      \
+        auto checkActual = (actual);                                                          \
+        auto checkExpected = (expected);                                                      \
+        if (!(checkActual == checkExpected)) checks::fail(__FILE__, __LINE__, #actual " == " #expected); \
+    } while (0)
+
+#endif
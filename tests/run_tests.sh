@@ -0,0 +1,28 @@
+#!/bin/sh
+# Build the library once, then build and run every tests/test_*.cpp
+# against it. Exits non-zero if any test fails to build or fails a check.
+#   sh tests/run_tests.sh
+set -u
+root=$(cd "$(dirname "$0")/.." && pwd)
+build=${TMPDIR:-/tmp}/expense_tests_build
+mkdir -p "$build"
+
+objects=""
+for library in expense expense_support expense_model expense_analytics expense_storage expense_manager expense_shards; do
+    g++ -std=c++20 -pthread -O1 -Wall -Wextra -c "$root/$library.cpp" -o "$build/$library.o" || exit 1
+    objects="$objects $build/$library.o"
+done
+rm -f "$build/libexpense.a"
+ar rcs "$build/libexpense.a" $objects || exit 1
+
+status=0
+for source in "$root"/tests/test_*.cpp; do
+    name=$(basename "$source" .cpp)
+    if ! g++ -std=c++20 -pthread -O1 -Wall -Wextra -I"$root" "$source" -L"$build" -lexpense -o "$build/$name"; then
+        echo "$name: build failed"
+        status=1
+        continue
+    fi
+    "$build/$name" || status=1
+done
+exit $status
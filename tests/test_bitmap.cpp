@@ -0,0 +1,143 @@
+/*
+===============================================================================
+    TESTS: ROARING BITMAP SET OPERATIONS
+
+    intersectionOf, unionOf and differenceOf against std::set, for every
+    pairing of array containers (up to 4096 values per 65536-value group)
+    and bitset containers (more than that), including results that cross
+    the limit in either direction and groups present on one side only.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_bitmap.cpp -L. -lexpense -o test_bitmap
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense_internal.h"
+#include "tests/check.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+using expense::detail::RoaringBitmap;
+
+namespace {
+
+// `count` distinct values from [base, base + span)
+set<uint32_t> randomSet(size_t count, uint32_t base, uint32_t span, mt19937& random) {
+    set<uint32_t> values;
+    while (values.size() < count) values.insert(base + (uint32_t)(random() % span));
+    return values;
+}
+
+RoaringBitmap bitmapOf(const set<uint32_t>& values, mt19937& random) {
+    // Out of order, so add() has to insert in the middle as well as append
+    vector<uint32_t> shuffled(values.begin(), values.end());
+    shuffle(shuffled.begin(), shuffled.end(), random);
+    RoaringBitmap bitmap;
+    for (uint32_t value : shuffled) bitmap.add(value);
+    return bitmap;
+}
+
+bool same(const RoaringBitmap& bitmap, const set<uint32_t>& expected) {
+    vector<uint32_t> values = bitmap.toVector();
+    return bitmap.cardinality() == expected.size() && values == vector<uint32_t>(expected.begin(), expected.end()) &&
+           bitmap.empty() == expected.empty();
+}
+
+void checkOperations(const set<uint32_t>& a, const set<uint32_t>& b, const string& label, mt19937& random) {
+    RoaringBitmap left = bitmapOf(a, random);
+    RoaringBitmap right = bitmapOf(b, random);
+    if (!same(left, a) || !same(right, b)) checks::fail(__FILE__, __LINE__, label + ": bitmap does not match its set");
+
+    set<uint32_t> both, either, onlyLeft;
+    set_intersection(a.begin(), a.end(), b.begin(), b.end(), inserter(both, both.end()));
+    set_union(a.begin(), a.end(), b.begin(), b.end(), inserter(either, either.end()));
+    set_difference(a.begin(), a.end(), b.begin(), b.end(), inserter(onlyLeft, onlyLeft.end()));
+
+    if (!same(RoaringBitmap::intersectionOf(left, right), both)) {
+        checks::fail(__FILE__, __LINE__, label + ": intersectionOf");
+    }
+    if (!same(RoaringBitmap::unionOf(left, right), either)) {
+        checks::fail(__FILE__, __LINE__, label + ": unionOf");
+    }
+    if (!same(RoaringBitmap::differenceOf(left, right), onlyLeft)) {
+        checks::fail(__FILE__, __LINE__, label + ": differenceOf");
+    }
+
+    // Results still answer contains() after a bulk operation
+    RoaringBitmap united = RoaringBitmap::unionOf(left, right);
+    for (uint32_t probe : {0u, 4095u, 4096u, 65535u, 65536u, 70000u, 200000u}) {
+        if (united.contains(probe) != (either.count(probe) > 0)) {
+            checks::fail(__FILE__, __LINE__, label + ": contains(" + to_string(probe) + ")");
+        }
+    }
+}
+
+void testOneGroup() {
+    // Sizes on both sides of the 4096-value array limit, in one group
+    mt19937 random(7);
+    const vector<size_t> sizes = {0, 1, 100, 4095, 4096, 4097, 6000, 30000};
+    for (size_t first : sizes) {
+        for (size_t second : sizes) {
+            set<uint32_t> a = randomSet(first, 0, 65536, random);
+            set<uint32_t> b = randomSet(second, 0, 65536, random);
+            checkOperations(a, b, to_string(first) + " vs " + to_string(second), random);
+        }
+    }
+}
+
+void testCrossingTheLimit() {
+    mt19937 random(11);
+
+    // Two bitsets sharing only 3000 values: the intersection is an array
+    set<uint32_t> low, high;
+    for (uint32_t v = 0; v < 8000; v++) low.insert(v);
+    for (uint32_t v = 5000; v < 13000; v++) high.insert(v);
+    checkOperations(low, high, "bitset overlap below the limit", random);
+
+    // Two arrays whose union is a bitset
+    set<uint32_t> evens, odds;
+    for (uint32_t v = 0; v < 8192; v += 2) evens.insert(v);
+    for (uint32_t v = 1; v < 8192; v += 2) odds.insert(v);
+    checkOperations(evens, odds, "arrays uniting above the limit", random);
+
+    // A bitset minus most of itself leaves an array, and minus all of
+    // itself leaves nothing
+    set<uint32_t> most(low.begin(), low.end());
+    for (uint32_t v = 0; v < 7000; v++) most.erase(v);
+    set<uint32_t> removed;
+    set_difference(low.begin(), low.end(), most.begin(), most.end(), inserter(removed, removed.end()));
+    checkOperations(low, removed, "bitset difference below the limit", random);
+    checkOperations(low, low, "bitset minus itself", random);
+}
+
+void testManyGroups() {
+    // Groups of both kinds, some on one side only
+    mt19937 random(13);
+    set<uint32_t> a, b;
+    for (uint32_t group : {0u, 1u, 3u, 4u, 7u}) {
+        set<uint32_t> part = randomSet(group % 2 ? 9000 : 500, group << 16, 65536, random);
+        a.insert(part.begin(), part.end());
+    }
+    for (uint32_t group : {1u, 2u, 3u, 4u, 9u}) {
+        set<uint32_t> part = randomSet(group % 2 ? 300 : 12000, group << 16, 65536, random);
+        b.insert(part.begin(), part.end());
+    }
+    checkOperations(a, b, "many groups", random);
+    checkOperations(b, a, "many groups reversed", random);
+}
+
+}  // namespace
+
+int main() {
+    testOneGroup();
+    testCrossingTheLimit();
+    testManyGroups();
+    return checks::result("test_bitmap");
+}
@@ -0,0 +1,208 @@
+/*
+===============================================================================
+    TESTS: CHANGE FEED
+
+    Finding the last sequence number behind records larger than one read
+    block, dense numbering across feeds that share a log and the shared
+    writer thread, records kept and retried in order when an append fails,
+    seeking to the record after a sequence number, trimming the log, and
+    tail() reporting a missing log as a Status.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_change_feed.cpp -L. -lexpense -o test_change_feed
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense_internal.h"
+#include "tests/check.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using expense::detail::ChangeFeed;
+
+namespace {
+
+vector<string> readLines(const string& path) {
+    ifstream file(path);
+    vector<string> lines;
+    string line;
+    while (getline(file, line)) lines.push_back(line);
+    return lines;
+}
+
+void testLastSequence() {
+    const string dir = checks::scratchDir("feed_last");
+
+    CHECK_EQ(ChangeFeed::lastSequence(dir + "/missing.jsonl"), (uint64_t)0);
+
+    // A record much larger than the 64 KB read block, then a partial line
+    const string big = dir + "/big.jsonl";
+    {
+        ofstream file(big);
+        file << "{\"seq\":7,\"data\":1}\n";
+        file << "{\"seq\":8,\"data\":\"" << string(300 * 1024, 'x') << "\"}\n";
+        file << "{\"seq\":9,\"da";
+    }
+    CHECK_EQ(ChangeFeed::lastSequence(big), (uint64_t)8);
+
+    // Non-record lines are skipped on the way back
+    const string noise = dir + "/noise.jsonl";
+    {
+        ofstream file(noise);
+        file << "{\"seq\":3,\"data\":1}\n" << string(200 * 1024, 'y') << "\n\n";
+    }
+    CHECK_EQ(ChangeFeed::lastSequence(noise), (uint64_t)3);
+
+    const string none = dir + "/none.jsonl";
+    {
+        ofstream file(none);
+        file << "not a record\n";
+    }
+    CHECK_EQ(ChangeFeed::lastSequence(none), (uint64_t)0);
+}
+
+void testSharedWriter() {
+    const string dir = checks::scratchDir("feed_shared");
+    const string log = dir + "/changes.jsonl";
+    const string other = dir + "/other.jsonl";
+    {
+        // Two feeds on one log and a third on its own; file logs are
+        // appended to on publish, interleaved but densely numbered
+        ChangeFeed first(log), second(log), third(other);
+        for (int i = 0; i < 50; i++) {
+            first.publish("test.first", to_string(i));
+            second.publish("test.second", to_string(i));
+            third.publish("test.third", to_string(i));
+        }
+    }
+
+    vector<string> lines = readLines(log);
+    CHECK_EQ(lines.size(), (size_t)100);
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (ChangeFeed::sequenceOf(lines[i]) != i + 1) {
+            checks::fail(__FILE__, __LINE__, "sequence " + to_string(i + 1) + " missing or out of order");
+            break;
+        }
+    }
+    CHECK_EQ(readLines(other).size(), (size_t)50);
+    CHECK_EQ(ChangeFeed::lastSequence(other), (uint64_t)50);
+
+    // A feed that reopens the log continues the numbering
+    {
+        ChangeFeed again(log);
+        again.publish("test.again", "{}");
+    }
+    CHECK_EQ(ChangeFeed::lastSequence(log), (uint64_t)101);
+}
+
+void testRetry() {
+    const string dir = checks::scratchDir("feed_retry");
+    const string log = dir + "/later/changes.jsonl";
+    {
+        // The directory is missing, so the append fails and the record stays
+        // queued; once it exists the next publish writes both, in order
+        ChangeFeed feed(log);
+        feed.publish("test.first", "1");
+        CHECK_EQ(feed.queued(), (uint64_t)1);
+        CHECK(feed.failedAppends() >= 1);
+
+        filesystem::create_directories(dir + "/later");
+        feed.publish("test.second", "2");
+        CHECK_EQ(feed.queued(), (uint64_t)0);
+        CHECK_EQ(feed.lastWritten(), (uint64_t)2);
+    }
+    vector<string> lines = readLines(log);
+    CHECK_EQ(lines.size(), (size_t)2);
+    CHECK(lines.size() == 2 && lines[0].find("test.first") != string::npos &&
+          lines[1].find("test.second") != string::npos);
+}
+
+void testOffsetAfter() {
+    const string dir = checks::scratchDir("feed_offset");
+    CHECK_EQ(ChangeFeed::offsetAfter(dir + "/missing.jsonl", 3), (uint64_t)0);
+
+    // Records 1..200 of varying length, a stray line and a partial record
+    const string log = dir + "/changes.jsonl";
+    vector<uint64_t> starts(202, 0);
+    uint64_t offset = 0;
+    {
+        ofstream file(log, ios::binary);
+        for (int i = 1; i <= 200; i++) {
+            starts[i] = offset;
+            string line = "{\"seq\":" + to_string(i) + ",\"data\":\"" + string((size_t)(i * 37 % 300), 'x') + "\"}\n";
+            if (i == 100) line += "not a record\n";
+            file << line;
+            offset += line.size();
+        }
+        starts[201] = offset;
+        file << "{\"seq\":201,\"da";
+    }
+    CHECK_EQ(ChangeFeed::offsetAfter(log, 0), (uint64_t)0);
+    bool all = true;
+    for (uint64_t sequence = 1; sequence <= 200; sequence++) {
+        all = all && ChangeFeed::offsetAfter(log, sequence) == starts[sequence + 1];
+    }
+    CHECK(all);
+    CHECK_EQ(ChangeFeed::offsetAfter(log, 500), starts[201]);
+}
+
+void testTrim() {
+    const string dir = checks::scratchDir("feed_trim");
+    const string log = dir + "/changes.jsonl";
+    ChangeFeed feed(log);
+    for (int i = 0; i < 30; i++) feed.publish("test.record", to_string(i));
+    CHECK(feed.trim(10).ok());
+
+    // The last ten records are left, and numbering carries on after them
+    vector<string> lines = readLines(log);
+    CHECK_EQ(lines.size(), (size_t)10);
+    CHECK(!lines.empty() && ChangeFeed::sequenceOf(lines.front()) == 21);
+    feed.publish("test.record", "30");
+    CHECK_EQ(ChangeFeed::lastSequence(log), (uint64_t)31);
+    CHECK_EQ(readLines(log).size(), (size_t)11);
+
+    // Another feed on the same log keeps appending to the new file
+    {
+        ChangeFeed other(log);
+        other.publish("test.other", "1");
+        CHECK(feed.trim(1).ok());
+        other.publish("test.other", "2");
+    }
+    lines = readLines(log);
+    CHECK_EQ(lines.size(), (size_t)2);
+    CHECK(lines.size() == 2 && ChangeFeed::sequenceOf(lines[0]) == 32 && ChangeFeed::sequenceOf(lines[1]) == 33);
+}
+
+void testTail() {
+    const string dir = checks::scratchDir("feed_tail");
+    ostringstream out;
+    expense::Status missing = ChangeFeed::tail(dir + "/missing.jsonl", 0, false, out);
+    CHECK(missing.code == expense::ErrorCode::IO_ERROR);
+    CHECK(out.str().empty());
+
+    const string log = dir + "/changes.jsonl";
+    {
+        ofstream file(log);
+        file << "{\"seq\":1,\"a\":1}\n{\"seq\":2,\"a\":2}\n{\"seq\":3,\"a\":3}\n{\"seq\":4";
+    }
+    expense::Status tailed = ChangeFeed::tail(log, 1, false, out);
+    CHECK(tailed.ok());
+    CHECK_EQ(out.str(), string("{\"seq\":2,\"a\":2}\n{\"seq\":3,\"a\":3}\n"));
+}
+
+}  // namespace
+
+int main() {
+    testLastSequence();
+    testSharedWriter();
+    testRetry();
+    testOffsetAfter();
+    testTrim();
+    testTail();
+    return checks::result("test_change_feed");
+}
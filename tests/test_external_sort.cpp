@@ -0,0 +1,138 @@
+/*
+===============================================================================
+    TESTS: EXTERNAL MERGE SORT
+
+    ExternalMergeSorter against std::sort: in memory, with a budget so small
+    that it spills many runs and needs intermediate merge passes, with
+    buffers large enough to be sorted in parallel slices, and with a combine
+    function folding equal keys. Spilled runs are deleted afterwards.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_external_sort.cpp -L. -lexpense -o test_external_sort
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense_internal.h"
+#include "tests/check.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using expense::detail::ExternalMergeSorter;
+
+namespace {
+
+struct Entry {
+    uint32_t key;
+    int64_t value;
+
+    bool operator==(const Entry& other) const { return key == other.key && value == other.value; }
+};
+
+// A total order, so the expected output is exact
+struct EntryLess {
+    bool operator()(const Entry& a, const Entry& b) const {
+        return a.key != b.key ? a.key < b.key : a.value < b.value;
+    }
+};
+
+struct KeyLess {
+    bool operator()(const Entry& a, const Entry& b) const { return a.key < b.key; }
+};
+
+vector<Entry> randomEntries(size_t count, uint32_t keys, unsigned seed) {
+    mt19937 random(seed);
+    vector<Entry> entries(count);
+    for (auto& entry : entries) entry = {(uint32_t)(random() % keys), (int64_t)(random() % 1000) - 500};
+    return entries;
+}
+
+bool emptyDirectory(const string& dir) {
+    return filesystem::is_empty(dir);
+}
+
+// Sort through the sorter and compare with std::sort; returns the run count
+int checkSorted(const string& name, const vector<Entry>& input, size_t memoryBytes) {
+    const string dir = checks::scratchDir("sort_" + name);
+    vector<Entry> output;
+    int runs = 0;
+    {
+        ExternalMergeSorter<Entry, EntryLess> sorter(dir + "/sort", memoryBytes);
+        for (const auto& entry : input) sorter.add(entry);
+        sorter.finish([&](const Entry& entry) { output.push_back(entry); });
+        CHECK_EQ(sorter.recordCount(), (uint64_t)input.size());
+        runs = sorter.runCount();
+    }
+    vector<Entry> expected = input;
+    sort(expected.begin(), expected.end(), EntryLess());
+    CHECK(output == expected);
+    CHECK(emptyDirectory(dir));
+    return runs;
+}
+
+void testInMemory() {
+    CHECK_EQ(checkSorted("memory", randomEntries(5000, 1000, 1), 1 << 20), 0);
+    CHECK_EQ(checkSorted("empty", {}, 1 << 20), 0);
+}
+
+void testSpilled() {
+    // The smallest budget: 1024-record buffers, two runs merged at a time
+    const string dir = checks::scratchDir("sort_passes");
+    vector<Entry> input = randomEntries(20000, 5000, 2);
+    vector<Entry> output;
+    {
+        ExternalMergeSorter<Entry, EntryLess> sorter(dir + "/sort", 1);
+        for (const auto& entry : input) sorter.add(entry);
+        sorter.finish([&](const Entry& entry) { output.push_back(entry); });
+        CHECK(sorter.runCount() > 20);
+        CHECK(sorter.mergePasses() > 2);
+        CHECK(sorter.bytesSpilled() >= input.size() * sizeof(Entry));
+    }
+    vector<Entry> expected = input;
+    sort(expected.begin(), expected.end(), EntryLess());
+    CHECK(output == expected);
+    CHECK(emptyDirectory(dir));
+
+    // Buffers of 131072 records, sorted in parallel slices when the
+    // scheduler has more than one worker
+    CHECK(checkSorted("parallel", randomEntries(300000, 1 << 30, 3), 3 << 20) >= 2);
+}
+
+void testCombine() {
+    const string dir = checks::scratchDir("sort_combine");
+    vector<Entry> input = randomEntries(30000, 700, 4);
+    vector<Entry> output;
+    {
+        ExternalMergeSorter<Entry, KeyLess> sorter(dir + "/sort", 1, KeyLess(),
+                                                   [](Entry& into, const Entry& from) { into.value += from.value; });
+        for (const auto& entry : input) sorter.add(entry);
+        sorter.finish([&](const Entry& entry) { output.push_back(entry); });
+        CHECK(sorter.runCount() > 2);
+    }
+
+    // Each key once, carrying the sum of its values
+    vector<Entry> expected = input;
+    sort(expected.begin(), expected.end(), KeyLess());
+    vector<Entry> folded;
+    for (const auto& entry : expected) {
+        if (!folded.empty() && folded.back().key == entry.key) folded.back().value += entry.value;
+        else folded.push_back(entry);
+    }
+    CHECK_EQ(output.size(), folded.size());
+    CHECK(output == folded);
+    CHECK(emptyDirectory(dir));
+}
+
+}  // namespace
+
+int main() {
+    testInMemory();
+    testSpilled();
+    testCombine();
+    return checks::result("test_external_sort");
+}
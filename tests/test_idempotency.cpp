@@ -0,0 +1,159 @@
+/*
+===============================================================================
+    TESTS: IDEMPOTENT addExpense
+
+    Replaying an idempotency key returns the original expense ID: in the
+    same session, from another process on the same data directory, after
+    a restart and after compaction. Keys are per user, malformed keys are
+    rejected, and a key is forgotten past the window or the capacity.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_idempotency.cpp -L. -lexpense -o test_idempotency
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense.h"
+#include "tests/check.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace std;
+using expense::ErrorCode;
+using expense::Ledger;
+using expense::LedgerOptions;
+using expense::Result;
+using expense::SplitMethod;
+
+namespace {
+
+unique_ptr<Ledger> openLedger(const string& dataDir, size_t maxKeys = 100000, long long windowSeconds = 24 * 60 * 60) {
+    LedgerOptions options;
+    options.dataDir = dataDir;
+    options.idempotencyKeys = maxKeys;
+    options.idempotencyWindowSeconds = windowSeconds;
+    Result<unique_ptr<Ledger>> opened = Ledger::open(options);
+    CHECK(opened.ok());
+    return opened.ok() ? move(opened.value()) : nullptr;
+}
+
+// Two users; Ann is logged in afterwards. Returns Bob's ID.
+int setUpUsers(Ledger& ledger) {
+    CHECK(ledger.registerUser("Ann", "ann@example.com", "9876543210", "secret1").ok());
+    auto bob = ledger.registerUser("Bob", "bob@example.com", "9876543211", "secret2");
+    CHECK(bob.ok());
+    CHECK(ledger.login("ann@example.com", "secret1").ok());
+    return bob.ok() ? bob.value() : 0;
+}
+
+int add(Ledger& ledger, int otherUser, const string& key, double amount = 25.0) {
+    Result<int> added = ledger.addExpense("Groceries", amount, SplitMethod::EQUAL, {otherUser}, {}, key);
+    CHECK(added.ok());
+    return added.ok() ? added.value() : 0;
+}
+
+size_t myExpenseCount(Ledger& ledger) {
+    auto mine = ledger.myExpenses();
+    return mine.ok() ? mine.value().size() : (size_t)-1;
+}
+
+void testReplay() {
+    const string dir = checks::scratchDir("idempotency_replay");
+    int bob = 0, original = 0;
+    {
+        auto ledger = openLedger(dir);
+        if (!ledger) return;
+        bob = setUpUsers(*ledger);
+        original = add(*ledger, bob, "order-1");
+        CHECK(original > 0);
+
+        // Same session; the retried amount does not matter, the key does
+        CHECK_EQ(add(*ledger, bob, "order-1", 99.0), original);
+        CHECK_EQ(myExpenseCount(*ledger), (size_t)1);
+
+        // Malformed keys never reach the data file
+        CHECK(ledger->addExpense("Bad", 5.0, SplitMethod::EQUAL, {bob}, {}, "a|b").status().code
+              == ErrorCode::INVALID_ARGUMENT);
+        CHECK(ledger->addExpense("Bad", 5.0, SplitMethod::EQUAL, {bob}, {}, string(129, 'k')).status().code
+              == ErrorCode::INVALID_ARGUMENT);
+        CHECK(ledger->addExpense("Bad", 5.0, SplitMethod::EQUAL, {bob}, {}, "line\nbreak").status().code
+              == ErrorCode::INVALID_ARGUMENT);
+        CHECK_EQ(myExpenseCount(*ledger), (size_t)1);
+
+        // Another process on the same directory sees the key
+        auto other = openLedger(dir);
+        CHECK(other->login("ann@example.com", "secret1").ok());
+        CHECK_EQ(add(*other, bob, "order-1"), original);
+
+        // Keys are per user: Bob's "order-1" is a new expense (shared
+        // with Ann, so she has two from here on)
+        CHECK(other->login("bob@example.com", "secret2").ok());
+        int bobs = add(*other, 1, "order-1");
+        CHECK(bobs != original && bobs > 0);
+    }
+
+    // Restart: the key is read back from expenses.txt
+    {
+        auto ledger = openLedger(dir);
+        CHECK(ledger->login("ann@example.com", "secret1").ok());
+        CHECK_EQ(add(*ledger, bob, "order-1"), original);
+        CHECK_EQ(myExpenseCount(*ledger), (size_t)2);
+        CHECK(ledger->compact().ok());
+    }
+
+    // Compaction keeps live keys
+    {
+        auto ledger = openLedger(dir);
+        CHECK(ledger->login("ann@example.com", "secret1").ok());
+        CHECK_EQ(add(*ledger, bob, "order-1"), original);
+        CHECK_EQ(myExpenseCount(*ledger), (size_t)2);
+    }
+}
+
+void testCapacity() {
+    const string dir = checks::scratchDir("idempotency_capacity");
+    auto ledger = openLedger(dir, 2);
+    if (!ledger) return;
+    int bob = setUpUsers(*ledger);
+    int first = add(*ledger, bob, "k1");
+    int second = add(*ledger, bob, "k2");
+    int third = add(*ledger, bob, "k3");
+
+    // Only the two newest keys are remembered
+    CHECK_EQ(add(*ledger, bob, "k3"), third);
+    CHECK_EQ(add(*ledger, bob, "k2"), second);
+    int again = add(*ledger, bob, "k1");
+    CHECK(again != first && again > third);
+}
+
+void testWindow() {
+    const string dir = checks::scratchDir("idempotency_window");
+    int bob = 0, original = 0;
+    {
+        auto ledger = openLedger(dir, 100, 1);
+        if (!ledger) return;
+        bob = setUpUsers(*ledger);
+        original = add(*ledger, bob, "late");
+        CHECK_EQ(add(*ledger, bob, "late"), original);
+    }
+
+    this_thread::sleep_for(chrono::milliseconds(2500));
+
+    // Expired: the key loaded back from disk is past the window
+    auto ledger = openLedger(dir, 100, 1);
+    CHECK(ledger->login("ann@example.com", "secret1").ok());
+    int retried = add(*ledger, bob, "late");
+    CHECK(retried != original && retried > 0);
+    CHECK_EQ(myExpenseCount(*ledger), (size_t)2);
+}
+
+}  // namespace
+
+int main() {
+    testReplay();
+    testCapacity();
+    testWindow();
+    return checks::result("test_idempotency");
+}
@@ -0,0 +1,177 @@
+/*
+===============================================================================
+    TESTS: JSON REQUEST PARSER AND STORED TEXT FIELDS
+
+    Escapes, surrogate pairs and malformed input for JsonRequestParser, and
+    the rejection of '|' and control characters before they reach a
+    '|'-separated data file.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_json.cpp -L. -lexpense -o test_json
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense.h"
+#include "expense_internal.h"
+#include "tests/check.h"
+
+#include <string>
+
+using namespace std;
+using expense::detail::JsonRequestParser;
+namespace Utils = expense::detail::Utils;
+
+namespace {
+
+// Parse a copy of the text; the parser works in place on its buffer
+struct Parsed {
+    string buffer;
+    JsonRequestParser parser;
+    bool ok;
+
+    explicit Parsed(const string& text) : buffer(text) {
+        ok = parser.parse(&buffer[0], buffer.size());
+    }
+};
+
+void testValues() {
+    Parsed parsed(R"( {"op":"add", "amount": 12.5, "ids":[1, -2 ,3], "flag":true, "none":null, "empty":[]} )");
+    CHECK(parsed.ok);
+    CHECK_EQ(parsed.parser.text("op"), string_view("add"));
+    CHECK_EQ(parsed.parser.number("amount"), 12.5);
+    CHECK_EQ(parsed.parser.number("flag"), 1.0);
+    CHECK(parsed.parser.field("none") != nullptr);
+    CHECK(parsed.parser.field("none")->kind == JsonRequestParser::Kind::NULL_VALUE);
+    CHECK(parsed.parser.field("missing") == nullptr);
+    CHECK_EQ(parsed.parser.number("missing", 7.0), 7.0);
+
+    auto [ids, count] = parsed.parser.numbers("ids");
+    CHECK_EQ(count, (size_t)3);
+    if (count == 3) {
+        CHECK_EQ(ids[0], 1.0);
+        CHECK_EQ(ids[1], -2.0);
+        CHECK_EQ(ids[2], 3.0);
+    }
+    CHECK_EQ(parsed.parser.numbers("empty").second, (size_t)0);
+
+    Parsed empty("{}");
+    CHECK(empty.ok);
+}
+
+void testEscapes() {
+    Parsed simple(R"({"s":"a\"b\\c\/d\ne\tf\rg\bh\fi"})");
+    CHECK(simple.ok);
+    CHECK_EQ(string(simple.parser.text("s")), string("a\"b\\c/d\ne\tf\rg\bh\fi"));
+
+    // One, two, three and four byte UTF-8, the last from a surrogate pair
+    Parsed unicode(R"({"s":"\u0041\u00e9\u20AC\ud83d\ude00"})");
+    CHECK(unicode.ok);
+    CHECK_EQ(string(unicode.parser.text("s")), string("A\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80"));
+
+    // Escaped keys are decoded too, and later fields still parse
+    Parsed key(R"({"o\u0070":"x","n":1})");
+    CHECK(key.ok);
+    CHECK_EQ(key.parser.text("op"), string_view("x"));
+    CHECK_EQ(key.parser.number("n"), 1.0);
+}
+
+void testErrors() {
+    struct Case {
+        const char* text;
+        const char* error;
+    };
+    const Case cases[] = {
+        {"", "request must be a JSON object"},
+        {"[1]", "request must be a JSON object"},
+        {R"({"a":"x)", "unterminated string"},
+        {"{\"a\":\"x\ny\"}", "control character in string"},
+        {R"({"a":"\x"})", "bad escape"},
+        {R"({"a":"\u12"})", "bad \\u escape"},
+        {R"({"a":"\ud83d"})", "unpaired surrogate"},
+        {R"({"a":"\ud83dA"})", "unpaired surrogate"},
+        {R"({"a":1.2.3})", "bad number"},
+        {R"({"a":["x"]})", "arrays may only hold numbers"},
+        {R"({"a":[1 2]})", "expected , or ] in array"},
+        {R"({"a":{"b":1}})", "nested objects are not supported"},
+        {R"({"a":nope})", "unexpected character"},
+        {R"({"a" 1})", "expected :"},
+        {R"({"a":1 "b":2})", "expected , or }"},
+        {R"({a:1})", "expected a field name"},
+        {R"({"a":})", "unexpected character"},
+        {R"({"a":1} x)", "text after the object"},
+    };
+    for (const auto& c : cases) {
+        Parsed parsed(c.text);
+        CHECK(!parsed.ok);
+        if (string(parsed.parser.error()) != c.error) {
+            checks::fail(__FILE__, __LINE__, string(c.text) + " -> " + parsed.parser.error() + ", expected " + c.error);
+        }
+    }
+
+    string many = "{";
+    for (size_t i = 0; i <= JsonRequestParser::MAX_FIELDS; i++) {
+        many += (i ? ",\"f" : "\"f") + to_string(i) + "\":1";
+    }
+    many += "}";
+    Parsed tooMany(many);
+    CHECK(!tooMany.ok);
+    CHECK_EQ(string(tooMany.parser.error()), string("too many fields"));
+
+    // A failed parse leaves nothing behind for the next one
+    JsonRequestParser reused;
+    string bad = R"({"a":[1,2],"b":)";
+    CHECK(!reused.parse(&bad[0], bad.size()));
+    string good = R"({"c":[4]})";
+    CHECK(reused.parse(&good[0], good.size()));
+    CHECK(reused.field("a") == nullptr);
+    CHECK_EQ(reused.numbers("c").second, (size_t)1);
+}
+
+void testRecordSafety() {
+    CHECK(Utils::isRecordSafe("Dinner at Luigi's"));
+    CHECK(Utils::isRecordSafe("caf\xC3\xA9"));
+    CHECK(!Utils::isRecordSafe("a|b"));
+    CHECK(!Utils::isRecordSafe("a\nb"));
+    CHECK(!Utils::isRecordSafe("a\tb"));
+    CHECK(!Utils::isRecordSafe(string("a\0b", 3)));
+    CHECK(!Utils::isRecordSafe("a\x7F"));
+
+    expense::LedgerOptions options;
+    options.dataDir = checks::scratchDir("json");
+    auto opened = expense::Ledger::open(options);
+    CHECK(opened.ok());
+    if (!opened.ok()) return;
+    expense::Ledger& ledger = *opened.value();
+
+    using expense::ErrorCode;
+    CHECK(ledger.registerUser("Ann|Admin", "ann@example.com", "9876543210", "secret1").status().code
+          == ErrorCode::INVALID_ARGUMENT);
+    CHECK(ledger.registerUser("Ann\nB", "ann@example.com", "9876543210", "secret1").status().code
+          == ErrorCode::INVALID_ARGUMENT);
+    CHECK(ledger.registerUser("Ann", "a|n@example.com", "9876543210", "secret1").status().code
+          == ErrorCode::INVALID_ARGUMENT);
+
+    auto ann = ledger.registerUser("Ann", "ann@example.com", "9876543210", "secret1");
+    auto bob = ledger.registerUser("Bob", "bob@example.com", "9876543211", "secret2");
+    CHECK(ann.ok() && bob.ok());
+    CHECK(ledger.login("ann@example.com", "secret1").ok());
+
+    auto bad = ledger.addExpense("Taxi|x", 20.0, expense::SplitMethod::EQUAL, {bob.value()});
+    CHECK(bad.status().code == ErrorCode::INVALID_ARGUMENT);
+    bad = ledger.addExpense("Taxi\r\n", 20.0, expense::SplitMethod::EQUAL, {bob.value()});
+    CHECK(bad.status().code == ErrorCode::INVALID_ARGUMENT);
+    CHECK(ledger.addExpense("Taxi", 20.0, expense::SplitMethod::EQUAL, {bob.value()}).ok());
+
+    auto mine = ledger.myExpenses();
+    CHECK(mine.ok() && mine.value().size() == 1);
+}
+
+}  // namespace
+
+int main() {
+    testValues();
+    testEscapes();
+    testErrors();
+    testRecordSafety();
+    return checks::result("test_json");
+}
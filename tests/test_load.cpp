@@ -0,0 +1,112 @@
+/*
+===============================================================================
+    TESTS: LOADING DATA FILES WITH MALFORMED LINES
+
+    A line that does not parse (bad number, bad participant, bad global ID)
+    is skipped and counted; it never fails Ledger::open or refresh, and
+    the good lines around it still load. A ledger whose own append landed
+    after someone else's partial line reloads rather than misreading.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_load.cpp -L. -lexpense -o test_load
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense.h"
+#include "tests/check.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+using namespace std;
+using expense::Ledger;
+using expense::LedgerOptions;
+using expense::Result;
+using expense::SplitMethod;
+
+namespace {
+
+unique_ptr<Ledger> openLedger(const string& dataDir) {
+    LedgerOptions options;
+    options.dataDir = dataDir;
+    Result<unique_ptr<Ledger>> opened = Ledger::open(options);
+    CHECK(opened.ok());
+    return opened.ok() ? move(opened.value()) : nullptr;
+}
+
+void append(const string& path, const string& line) {
+    ofstream file(path, ios::app | ios::binary);
+    file << line << "\n";
+}
+
+size_t myExpenseCount(Ledger& ledger) {
+    auto mine = ledger.myExpenses();
+    return mine.ok() ? mine.value().size() : (size_t)-1;
+}
+
+uint64_t malformed(Ledger& ledger) {
+    auto count = ledger.malformedLines();
+    CHECK(count.ok());
+    return count.ok() ? count.value() : 0;
+}
+
+}  // namespace
+
+int main() {
+    const string dir = checks::scratchDir("load_malformed");
+    int bob = 0;
+    {
+        auto ledger = openLedger(dir);
+        if (!ledger) return checks::result("test_load");
+        CHECK(ledger->registerUser("Ann", "ann@example.com", "9876543210", "secret1").ok());
+        auto registered = ledger->registerUser("Bob", "bob@example.com", "9876543211", "secret2");
+        CHECK(registered.ok());
+        bob = registered.ok() ? registered.value() : 0;
+        CHECK(ledger->login("ann@example.com", "secret1").ok());
+        CHECK(ledger->addExpense("Dinner", 30.0, SplitMethod::EQUAL, {bob}).ok());
+        CHECK_EQ(malformed(*ledger), (uint64_t)0);
+    }
+
+    append(dir + "/users.txt", "x|Eve|eve@example.com|9876543212|hash");
+    append(dir + "/expenses.txt", "x|Lunch|10.00|EQUAL|1|2024-05-01 12:00:00|2:5.00,1:5.00");
+    append(dir + "/expenses.txt", "7|Lunch|1e999|EQUAL|1|2024-05-01 12:00:00|2:5.00,1:5.00");
+    append(dir + "/expenses.txt", "8|Lunch|10.00|EQUAL|1|2024-05-01 12:00:00|2:5.00,one:5.00");
+    append(dir + "/expenses.txt", "9|Lunch|10.00|EQUAL|99999999999|2024-05-01 12:00:00|2:5.00,1:5.00");
+
+    // Open skips the five bad lines and keeps the good ones
+    auto ledger = openLedger(dir);
+    if (!ledger) return checks::result("test_load");
+    CHECK(ledger->login("ann@example.com", "secret1").ok());
+    CHECK_EQ(myExpenseCount(*ledger), (size_t)1);
+    CHECK_EQ(malformed(*ledger), (uint64_t)5);
+
+    // The same on an incremental refresh, with good lines on either side
+    {
+        auto writer = openLedger(dir);
+        CHECK(writer->login("bob@example.com", "secret2").ok());
+        CHECK(writer->addExpense("Taxi", 12.0, SplitMethod::EQUAL, {1}).ok());
+        append(dir + "/expenses.txt", "10|Taxi|abc|EQUAL|1|2024-05-01 12:00:00|2:5.00,1:5.00");
+        append(dir + "/tombstones.txt", "not-a-global-id|2024-05-02 09:00:00");
+        CHECK(writer->addExpense("Museum", 20.0, SplitMethod::EQUAL, {1}).ok());
+    }
+    CHECK(ledger->refresh().ok());
+    CHECK_EQ(myExpenseCount(*ledger), (size_t)3);
+    CHECK_EQ(malformed(*ledger), (uint64_t)7);
+
+    // A writer that ignores the lock leaves half a line just before an
+    // append of ours, which glues onto it. The ledger must not step over
+    // bytes it did not write: after a refresh it sees what a fresh load sees.
+    {
+        ofstream(dir + "/expenses.txt", ios::app | ios::binary) << "11|Half";
+    }
+    CHECK(ledger->addExpense("Cinema", 15.0, SplitMethod::EQUAL, {bob}).ok());
+    CHECK(ledger->refresh().ok());
+    auto fresh = openLedger(dir);
+    if (!fresh) return checks::result("test_load");
+    CHECK(fresh->login("ann@example.com", "secret1").ok());
+    CHECK_EQ(myExpenseCount(*ledger), myExpenseCount(*fresh));
+    CHECK_EQ(malformed(*ledger), malformed(*fresh));
+
+    return checks::result("test_load");
+}
@@ -0,0 +1,153 @@
+/*
+===============================================================================
+    TESTS: OFFLINE MERGE
+
+    Two data directories exchanging records through Ledger::mergeFrom:
+    user ID mapping, the per-peer cursor, tombstones winning over copies,
+    merging back the other way, and expenses that name a user the merge
+    has not seen yet, retried by a later merge even after a restart.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_merge.cpp -L. -lexpense -o test_merge
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense.h"
+#include "tests/check.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+using namespace std;
+using expense::Ledger;
+using expense::LedgerOptions;
+using expense::MergeInfo;
+using expense::Result;
+using expense::SplitMethod;
+
+namespace {
+
+unique_ptr<Ledger> openLedger(const string& dataDir) {
+    LedgerOptions options;
+    options.dataDir = dataDir;
+    Result<unique_ptr<Ledger>> opened = Ledger::open(options);
+    CHECK(opened.ok());
+    return opened.ok() ? move(opened.value()) : nullptr;
+}
+
+MergeInfo merge(Ledger& ledger, const string& peerDir) {
+    Result<MergeInfo> merged = ledger.mergeFrom(peerDir);
+    CHECK(merged.ok());
+    return merged.ok() ? merged.value() : MergeInfo();
+}
+
+size_t expenseCount(Ledger& ledger, const string& email, const string& password) {
+    if (!ledger.login(email, password).ok()) return (size_t)-1;
+    auto mine = ledger.myExpenses();
+    ledger.logout();
+    return mine.ok() ? mine.value().size() : (size_t)-1;
+}
+
+string readLine(const string& path) {
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    return line;
+}
+
+}  // namespace
+
+int main() {
+    const string a = checks::scratchDir("merge_a");
+    const string b = checks::scratchDir("merge_b");
+    int taxiId = 0;
+
+    // Replica A: two users and two expenses
+    {
+        auto ledger = openLedger(a);
+        if (!ledger) return checks::result("test_merge");
+        auto ann = ledger->registerUser("Ann", "ann@example.com", "9876543210", "secret1");
+        auto bob = ledger->registerUser("Bob", "bob@example.com", "9876543211", "secret2");
+        CHECK(ledger->login("ann@example.com", "secret1").ok());
+        CHECK(ledger->addExpense("Dinner", 30.0, SplitMethod::EQUAL, {bob.value()}).ok());
+        auto taxi = ledger->addExpense("Taxi", 10.0, SplitMethod::EQUAL, {bob.value()});
+        CHECK(ann.ok() && taxi.ok());
+        taxiId = taxi.ok() ? taxi.value() : 0;
+    }
+
+    // Replica B has its own first user, so A's users get other local IDs
+    auto replicaB = openLedger(b);
+    if (!replicaB) return checks::result("test_merge");
+    Ledger& ledgerB = *replicaB;
+    CHECK(ledgerB.registerUser("Zoe", "zoe@example.com", "9876543212", "secret3").ok());
+
+    MergeInfo first = merge(ledgerB, a);
+    CHECK_EQ(first.newUsers, (size_t)2);
+    CHECK_EQ(first.newExpenses, (size_t)2);
+    CHECK_EQ(first.skippedUnknownUser, (size_t)0);
+    CHECK_EQ(expenseCount(ledgerB, "ann@example.com", "secret1"), (size_t)2);
+    CHECK_EQ(expenseCount(ledgerB, "bob@example.com", "secret2"), (size_t)2);
+
+    // Nothing new on the peer: the cursor skips what was merged
+    MergeInfo again = merge(ledgerB, a);
+    CHECK_EQ(again.newUsers, (size_t)0);
+    CHECK_EQ(again.newExpenses, (size_t)0);
+    CHECK_EQ(again.peerBytesRead, (uint64_t)0);
+
+    // A deletion travels as a tombstone
+    {
+        auto ledger = openLedger(a);
+        CHECK(ledger->login("ann@example.com", "secret1").ok());
+        CHECK(ledger->deleteExpense(taxiId).ok());
+    }
+    MergeInfo deleted = merge(ledgerB, a);
+    CHECK_EQ(deleted.newDeletions, (size_t)1);
+    CHECK_EQ(expenseCount(ledgerB, "ann@example.com", "secret1"), (size_t)1);
+
+    // A record naming a user A has not written yet (another process may
+    // append the expense before the user line lands)
+    string replicaA = readLine(a + "/replica.id");
+    {
+        ofstream expenses(a + "/expenses.txt", ios::app);
+        expenses << "90|Hotel|40.00|EQUAL|1|2024-05-01 10:00:00|1:20.00,3:20.00|" << replicaA << "-90\n";
+    }
+    MergeInfo waiting = merge(ledgerB, a);
+    CHECK_EQ(waiting.newExpenses, (size_t)0);
+    CHECK_EQ(waiting.skippedUnknownUser, (size_t)1);
+
+    // The pending record survives a restart of B and merges once the user
+    // shows up, although the cursor has long moved past it
+    replicaB.reset();
+    {
+        auto ledger = openLedger(a);
+        CHECK(ledger->registerUser("Cat", "cat@example.com", "9876543213", "secret4").ok());
+    }
+    replicaB = openLedger(b);
+    if (!replicaB) return checks::result("test_merge");
+    MergeInfo retried = merge(*replicaB, a);
+    CHECK_EQ(retried.newUsers, (size_t)1);
+    CHECK_EQ(retried.newExpenses, (size_t)1);
+    CHECK_EQ(retried.skippedUnknownUser, (size_t)0);
+    CHECK_EQ(expenseCount(*replicaB, "cat@example.com", "secret4"), (size_t)1);
+    CHECK_EQ(expenseCount(*replicaB, "ann@example.com", "secret1"), (size_t)2);
+
+    MergeInfo settled = merge(*replicaB, a);
+    CHECK_EQ(settled.newExpenses, (size_t)0);
+    CHECK_EQ(settled.skippedUnknownUser, (size_t)0);
+
+    // Merging back: A only learns about Zoe; every expense is already there
+    // and the deleted one stays deleted
+    replicaB.reset();
+    {
+        auto ledger = openLedger(a);
+        MergeInfo back = merge(*ledger, b);
+        CHECK_EQ(back.newUsers, (size_t)1);
+        CHECK_EQ(back.newExpenses, (size_t)0);
+        CHECK_EQ(back.newDeletions, (size_t)0);
+        CHECK_EQ(expenseCount(*ledger, "ann@example.com", "secret1"), (size_t)2);
+        CHECK_EQ(expenseCount(*ledger, "zoe@example.com", "secret3"), (size_t)0);
+    }
+
+    return checks::result("test_merge");
+}
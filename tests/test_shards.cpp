@@ -0,0 +1,267 @@
+/*
+===============================================================================
+    TESTS: SHARDED LEDGER
+
+    ShardedLedger keeps the balances a single ledger would, gives every
+    expense a unique ID, and survives a restart: reopening replays the
+    shard logs, cuts off a torn last line, skips malformed lines, and
+    refuses a different shard count. One instance at a time holds a
+    directory, IDs stop at INT_MAX, and invalid expenses store nothing.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_shards.cpp -L. -lexpense -o test_shards
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense.h"
+#include "tests/check.h"
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+using expense::BalanceInfo;
+using expense::ErrorCode;
+using expense::ExpenseInfo;
+using expense::Result;
+using expense::ShardedLedger;
+using expense::ShardedLedgerOptions;
+using expense::ShardedLedgerStats;
+
+namespace {
+
+const int USERS = 40;
+
+unique_ptr<ShardedLedger> openShards(const string& dataDir, size_t shards) {
+    ShardedLedgerOptions options;
+    options.dataDir = dataDir;
+    options.shards = shards;
+    Result<unique_ptr<ShardedLedger>> opened = ShardedLedger::open(options);
+    CHECK(opened.ok());
+    return opened.ok() ? move(opened.value()) : nullptr;
+}
+
+ShardedLedgerStats statsOf(const ShardedLedger& ledger) {
+    Result<ShardedLedgerStats> stats = ledger.stats();
+    CHECK(stats.ok());
+    return stats.ok() ? stats.value() : ShardedLedgerStats();
+}
+
+// Payer i % USERS + 1 splits with the next two users; shares add up exactly
+vector<ExpenseInfo> makeExpenses(int count, int first) {
+    vector<ExpenseInfo> expenses;
+    for (int i = first; i < first + count; i++) {
+        ExpenseInfo expense;
+        expense.description = "Expense " + to_string(i);
+        expense.amount = 3.0 * (1 + i % 17);
+        expense.paidBy = i % USERS + 1;
+        for (int p = 0; p < 3; p++) expense.shares.push_back({(i + p) % USERS + 1, expense.amount / 3});
+        expenses.push_back(expense);
+    }
+    return expenses;
+}
+
+// Net balance per user, as a single ledger would keep it
+map<int, double> expectedNets(const vector<ExpenseInfo>& expenses) {
+    map<int, double> nets;
+    for (const auto& expense : expenses) {
+        for (const auto& share : expense.shares) {
+            if (share.userId == expense.paidBy) continue;
+            nets[expense.paidBy] += share.amount;
+            nets[share.userId] -= share.amount;
+        }
+    }
+    return nets;
+}
+
+// Every user's balances add up to the expected net
+bool matches(const ShardedLedger& ledger, const map<int, double>& nets) {
+    for (int userId = 1; userId <= USERS; userId++) {
+        Result<vector<BalanceInfo>> balances = ledger.balancesFor(userId);
+        if (!balances.ok()) return false;
+        double net = 0.0;
+        for (const auto& balance : balances.value()) net += balance.amount;
+        auto expected = nets.find(userId);
+        if (fabs(net - (expected == nets.end() ? 0.0 : expected->second)) > 0.01) return false;
+    }
+    Result<vector<BalanceInfo>> debtors = ledger.topDebtors(1);
+    if (!debtors.ok() || debtors.value().empty()) return false;
+    double lowest = 0.0;
+    for (const auto& [userId, net] : nets) lowest = min(lowest, net);
+    return fabs(debtors.value()[0].amount - lowest) <= 0.01;
+}
+
+void testAddAndReopen() {
+    const string dir = checks::scratchDir("shards_reopen");
+    vector<ExpenseInfo> expenses = makeExpenses(500, 0);
+    {
+        auto ledger = openShards(dir, 4);
+        if (!ledger) return;
+        Result<vector<int>> ids = ledger->addExpenses(expenses);
+        CHECK(ids.ok());
+        if (!ids.ok()) return;
+        CHECK_EQ(ids.value().size(), expenses.size());
+        CHECK_EQ(set<int>(ids.value().begin(), ids.value().end()).size(), expenses.size());
+        CHECK(ledger->drain().ok());
+        CHECK(matches(*ledger, expectedNets(expenses)));
+
+        ShardedLedgerStats stats = statsOf(*ledger);
+        CHECK_EQ(stats.shards, (size_t)4);
+        CHECK_EQ(stats.expenses, expenses.size());
+        CHECK(stats.remoteDeltas > 0);
+        CHECK_EQ(stats.recoveredExpenses, (size_t)0);
+    }
+
+    // A restart brings back every expense and keeps handing out new IDs
+    auto ledger = openShards(dir, 0);
+    if (!ledger) return;
+    ShardedLedgerStats stats = statsOf(*ledger);
+    CHECK_EQ(stats.shards, (size_t)4);
+    CHECK_EQ(stats.recoveredExpenses, expenses.size());
+    CHECK_EQ(stats.malformedLines, (uint64_t)0);
+    CHECK(matches(*ledger, expectedNets(expenses)));
+
+    vector<ExpenseInfo> more = makeExpenses(50, 500);
+    Result<vector<int>> ids = ledger->addExpenses(more);
+    CHECK(ids.ok());
+    CHECK(ledger->drain().ok());
+    expenses.insert(expenses.end(), more.begin(), more.end());
+    CHECK(matches(*ledger, expectedNets(expenses)));
+    CHECK_EQ(statsOf(*ledger).expenses, expenses.size());
+
+    // Another shard count would route users elsewhere
+    ShardedLedgerOptions options;
+    options.dataDir = dir;
+    options.shards = 3;
+    ledger.reset();
+    Result<unique_ptr<ShardedLedger>> resharded = ShardedLedger::open(options);
+    CHECK(!resharded.ok());
+    CHECK(resharded.status().code == ErrorCode::IO_ERROR);
+}
+
+void testDamagedLogs() {
+    const string dir = checks::scratchDir("shards_damaged");
+    vector<ExpenseInfo> expenses = makeExpenses(200, 0);
+    {
+        auto ledger = openShards(dir, 2);
+        if (!ledger) return;
+        CHECK(ledger->addExpenses(expenses).ok());
+    }
+
+    // A crash mid-append leaves a line without its newline; another tool
+    // left a complete line that is not an expense
+    const string logPath = dir + "/shard-0.txt";
+    uintmax_t intact = filesystem::file_size(logPath);
+    {
+        ofstream(dir + "/shard-1.txt", ios::app | ios::binary) << "not an expense\n";
+        ofstream(logPath, ios::app | ios::binary) << "999|Torn|12.5|EQUAL";
+    }
+
+    auto ledger = openShards(dir, 2);
+    if (!ledger) return;
+    ShardedLedgerStats stats = statsOf(*ledger);
+    CHECK_EQ(stats.recoveredExpenses, expenses.size());
+    CHECK_EQ(stats.malformedLines, (uint64_t)1);
+    CHECK_EQ(filesystem::file_size(logPath), intact);
+    CHECK(matches(*ledger, expectedNets(expenses)));
+
+    // Appends after the cut start on a clean line
+    vector<ExpenseInfo> more = makeExpenses(20, 200);
+    CHECK(ledger->addExpenses(more).ok());
+    ledger.reset();
+    ledger = openShards(dir, 2);
+    if (!ledger) return;
+    expenses.insert(expenses.end(), more.begin(), more.end());
+    CHECK_EQ(statsOf(*ledger).recoveredExpenses, expenses.size());
+    CHECK(matches(*ledger, expectedNets(expenses)));
+}
+
+void testExclusiveAndIdLimit() {
+    const string dir = checks::scratchDir("shards_exclusive");
+    {
+        auto ledger = openShards(dir, 1);
+        if (!ledger) return;
+        ShardedLedgerOptions options;
+        options.dataDir = dir;
+        Result<unique_ptr<ShardedLedger>> second = ShardedLedger::open(options);
+        CHECK(!second.ok());
+        CHECK(second.status().code == ErrorCode::IO_ERROR);
+        CHECK(ledger->addExpenses(makeExpenses(1, 0)).ok());
+    }
+
+    // Move the one logged expense up to the last ID but one
+    const string logPath = dir + "/shard-0.txt";
+    string line;
+    {
+        ifstream log(logPath);
+        CHECK(getline(log, line).good());
+    }
+    line = to_string(numeric_limits<int>::max() - 1) + line.substr(line.find('|'));
+    ofstream(logPath, ios::trunc | ios::binary) << line << "\n";
+
+    auto ledger = openShards(dir, 1);
+    if (!ledger) return;
+    CHECK_EQ(statsOf(*ledger).recoveredExpenses, (size_t)1);
+    Result<vector<int>> tooMany = ledger->addExpenses(makeExpenses(2, 1));
+    CHECK(!tooMany.ok());
+    CHECK(tooMany.status().code == ErrorCode::RESOURCE_EXHAUSTED);
+    Result<vector<int>> last = ledger->addExpenses(makeExpenses(1, 1));
+    CHECK(last.ok() && last.value() == vector<int>{numeric_limits<int>::max()});
+    Result<vector<int>> none = ledger->addExpenses(makeExpenses(1, 2));
+    CHECK(!none.ok());
+    CHECK_EQ(statsOf(*ledger).expenses, (size_t)2);
+}
+
+void testValidation() {
+    auto ledger = openShards(checks::scratchDir("shards_validation"), 2);
+    if (!ledger) return;
+
+    vector<ExpenseInfo> batch = makeExpenses(3, 0);
+    auto rejected = [&](ExpenseInfo bad) {
+        vector<ExpenseInfo> attempt = batch;
+        attempt.push_back(bad);
+        Result<vector<int>> ids = ledger->addExpenses(attempt);
+        return !ids.ok() && ids.status().code == ErrorCode::INVALID_ARGUMENT;
+    };
+
+    ExpenseInfo bad = batch[0];
+    bad.shares[0].amount += 1.0;
+    CHECK(rejected(bad));
+    bad = batch[0];
+    bad.description = "Lunch | dinner";
+    CHECK(rejected(bad));
+    bad = batch[0];
+    bad.amount = -bad.amount;
+    CHECK(rejected(bad));
+    bad = batch[0];
+    bad.paidBy = 0;
+    CHECK(rejected(bad));
+    bad = batch[0];
+    bad.shares.clear();
+    CHECK(rejected(bad));
+    bad = batch[0];
+    bad.shares[1].userId = -3;
+    CHECK(rejected(bad));
+
+    // Nothing from a rejected batch was stored
+    CHECK_EQ(statsOf(*ledger).expenses, (size_t)0);
+    CHECK(ledger->addExpenses(batch).ok());
+    CHECK_EQ(statsOf(*ledger).expenses, batch.size());
+}
+
+}  // namespace
+
+int main() {
+    testAddAndReopen();
+    testDamagedLogs();
+    testExclusiveAndIdLimit();
+    testValidation();
+    return checks::result("test_shards");
+}
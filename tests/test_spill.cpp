@@ -0,0 +1,105 @@
+/*
+===============================================================================
+    TESTS: EXPENSE SPILL FILES
+
+    Ledgers with a memory budget spill cold expense pages to a file of
+    their own. Another ledger opening and closing on the same data
+    directory must not touch it: the first ledger still reads every
+    expense back, compacts them all to disk, and leaves no spill file
+    behind.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_spill.cpp -L. -lexpense -o test_spill
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense.h"
+#include "tests/check.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+
+using namespace std;
+using expense::ExpenseInfo;
+using expense::Ledger;
+using expense::LedgerOptions;
+using expense::Result;
+using expense::SplitMethod;
+
+namespace {
+
+const int EXPENSES = 3000;
+
+unique_ptr<Ledger> openLedger(const string& dataDir, size_t budgetBytes) {
+    LedgerOptions options;
+    options.dataDir = dataDir;
+    options.memoryBudgetBytes = budgetBytes;
+    Result<unique_ptr<Ledger>> opened = Ledger::open(options);
+    CHECK(opened.ok());
+    return opened.ok() ? move(opened.value()) : nullptr;
+}
+
+// Count and amount total of the logged-in user's expenses
+pair<size_t, double> myTotals(Ledger& ledger) {
+    Result<vector<ExpenseInfo>> mine = ledger.myExpenses();
+    CHECK(mine.ok());
+    if (!mine.ok()) return {0, 0.0};
+    double total = 0.0;
+    for (const auto& expense : mine.value()) total += expense.amount;
+    return {mine.value().size(), total};
+}
+
+size_t spillFiles(const string& dataDir) {
+    size_t found = 0;
+    for (const auto& entry : filesystem::directory_iterator(dataDir)) {
+        if (entry.path().filename().string().rfind("spill", 0) == 0) found++;
+    }
+    return found;
+}
+
+void testSharedDirectory() {
+    const string dir = checks::scratchDir("spill_shared");
+    double expectedTotal = 0.0;
+    {
+        auto first = openLedger(dir, 64 * 1024);
+        if (!first) return;
+        CHECK(first->registerUser("Ann", "ann@example.com", "9876543210", "secret1").ok());
+        auto bob = first->registerUser("Bob", "bob@example.com", "9876543211", "secret2");
+        CHECK(bob.ok());
+        if (!bob.ok()) return;
+        CHECK(first->login("ann@example.com", "secret1").ok());
+        for (int i = 1; i <= EXPENSES; i++) {
+            expectedTotal += 2.0 * i;
+            CHECK(first->addExpense("Expense " + to_string(i), 2.0 * i, SplitMethod::EQUAL, {bob.value()}).ok());
+        }
+
+        // A second ledger with its own budget comes and goes
+        {
+            auto second = openLedger(dir, 1024 * 1024);
+            if (!second) return;
+            CHECK(second->login("bob@example.com", "secret2").ok());
+            CHECK_EQ(myTotals(*second).first, (size_t)EXPENSES);
+        }
+
+        pair<size_t, double> totals = myTotals(*first);
+        CHECK_EQ(totals.first, (size_t)EXPENSES);
+        CHECK_EQ(totals.second, expectedTotal);
+        CHECK(first->compact().ok());
+    }
+    CHECK_EQ(spillFiles(dir), (size_t)0);
+
+    auto reloaded = openLedger(dir, 0);
+    if (!reloaded) return;
+    CHECK(reloaded->login("ann@example.com", "secret1").ok());
+    pair<size_t, double> totals = myTotals(*reloaded);
+    CHECK_EQ(totals.first, (size_t)EXPENSES);
+    CHECK_EQ(totals.second, expectedTotal);
+}
+
+}  // namespace
+
+int main() {
+    testSharedDirectory();
+    return checks::result("test_spill");
+}
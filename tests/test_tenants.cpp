@@ -0,0 +1,210 @@
+/*
+===============================================================================
+    TESTS: LEDGER POOL
+
+    LedgerPool keeps one ledger per tenant: tenants do not see each other's
+    users or expenses, an evicted tenant reloads from disk with its data,
+    a ledger the caller still holds keeps working after eviction and is
+    handed out again instead of a second copy, and the
+    memory budget evicts the least recently used tenants without counting
+    the shared string pool, which has a cap of its own.
+
+    Build: g++ -std=c++20 -pthread -I. tests/test_tenants.cpp -L. -lexpense -o test_tenants
+    Or all tests: sh tests/run_tests.sh
+===============================================================================
+*/
+
+#include "expense.h"
+#include "tests/check.h"
+
+#include <memory>
+#include <string>
+
+using namespace std;
+using expense::ErrorCode;
+using expense::Ledger;
+using expense::LedgerPool;
+using expense::LedgerPoolOptions;
+using expense::LedgerPoolStats;
+using expense::Result;
+using expense::SplitMethod;
+
+namespace {
+
+unique_ptr<LedgerPool> openPool(const string& baseDir, size_t budgetBytes) {
+    LedgerPoolOptions options;
+    options.baseDir = baseDir;
+    options.memoryBudgetBytes = budgetBytes;
+    Result<unique_ptr<LedgerPool>> opened = LedgerPool::open(options);
+    CHECK(opened.ok());
+    return opened.ok() ? move(opened.value()) : nullptr;
+}
+
+shared_ptr<Ledger> acquire(LedgerPool& pool, const string& tenantId) {
+    Result<shared_ptr<Ledger>> ledger = pool.acquire(tenantId);
+    CHECK(ledger.ok());
+    return ledger.ok() ? ledger.value() : nullptr;
+}
+
+size_t userCount(Ledger& ledger) {
+    auto users = ledger.users();
+    return users.ok() ? users.value().size() : (size_t)-1;
+}
+
+void testTenantIds() {
+    CHECK(LedgerPool::isValidTenantId("acme"));
+    CHECK(LedgerPool::isValidTenantId("team_7-eu"));
+    CHECK(!LedgerPool::isValidTenantId(""));
+    CHECK(!LedgerPool::isValidTenantId("../acme"));
+    CHECK(!LedgerPool::isValidTenantId("a b"));
+    CHECK(!LedgerPool::isValidTenantId(string(65, 'a')));
+
+    auto pool = openPool(checks::scratchDir("tenants_ids"), 0);
+    if (!pool) return;
+    Result<shared_ptr<Ledger>> bad = pool->acquire("../acme");
+    CHECK(!bad.ok());
+    CHECK(bad.status().code == ErrorCode::INVALID_ARGUMENT);
+    CHECK(pool->evict("acme").code == ErrorCode::NOT_FOUND);
+}
+
+void testIsolationAndReload() {
+    const string dir = checks::scratchDir("tenants_reload");
+    auto pool = openPool(dir, 0);
+    if (!pool) return;
+
+    auto acme = acquire(*pool, "acme");
+    auto globex = acquire(*pool, "globex");
+    if (!acme || !globex) return;
+    CHECK(acme->registerUser("Ann", "ann@example.com", "9876543210", "secret1").ok());
+    auto bob = acme->registerUser("Bob", "bob@example.com", "9876543211", "secret2");
+    CHECK(bob.ok());
+    CHECK(acme->login("ann@example.com", "secret1").ok());
+    CHECK(acme->addExpense("Dinner", 30.0, SplitMethod::EQUAL, {bob.ok() ? bob.value() : 0}).ok());
+
+    // The same email is free in another tenant
+    CHECK_EQ(userCount(*globex), (size_t)0);
+    CHECK(!globex->login("ann@example.com", "secret1").ok());
+    CHECK(globex->registerUser("Ann", "ann@example.com", "9876543210", "other1").ok());
+    CHECK_EQ(userCount(*globex), (size_t)1);
+
+    // Evicted but still held: the caller's ledger keeps working
+    CHECK(pool->evict("acme").ok());
+    CHECK(!pool->isResident("acme"));
+    auto mine = acme->myExpenses();
+    CHECK(mine.ok() && mine.value().size() == 1);
+    acme.reset();
+
+    // A fresh load reads the tenant's data back from disk
+    auto reloaded = acquire(*pool, "acme");
+    if (!reloaded) return;
+    CHECK(pool->isResident("acme"));
+    CHECK_EQ(userCount(*reloaded), (size_t)2);
+    CHECK(reloaded->login("ann@example.com", "secret1").ok());
+    auto balances = reloaded->balances();
+    CHECK(balances.ok() && balances.value().size() == 1 && balances.value()[0].amount == 15.0);
+
+    LedgerPoolStats stats = pool->stats();
+    CHECK_EQ(stats.loads, (uint64_t)3);
+    CHECK_EQ(stats.evictions, (uint64_t)1);
+    CHECK_EQ(stats.residentTenants, (size_t)2);
+}
+
+void testHeldAfterEviction() {
+    auto pool = openPool(checks::scratchDir("tenants_held"), 0);
+    if (!pool) return;
+    auto held = acquire(*pool, "acme");
+    if (!held) return;
+    CHECK(pool->evict("acme").ok());
+
+    // Still held: the same ledger comes back, nothing is loaded
+    auto again = acquire(*pool, "acme");
+    CHECK(again.get() == held.get());
+    CHECK(pool->isResident("acme"));
+    CHECK_EQ(pool->stats().loads, (uint64_t)1);
+
+    // Released by everyone: the next acquire loads a new one
+    CHECK(pool->evict("acme").ok());
+    held.reset();
+    again.reset();
+    acquire(*pool, "acme");
+    CHECK_EQ(pool->stats().loads, (uint64_t)2);
+}
+
+void testBudget() {
+    // Size one tenant first, then give the pool room for about three
+    const string dir = checks::scratchDir("tenants_budget");
+    size_t perTenant = 0;
+    {
+        auto probe = openPool(dir + "/probe", 0);
+        if (!probe) return;
+        acquire(*probe, "t0");
+        perTenant = probe->stats().residentBytes;
+    }
+    CHECK(perTenant > 0);
+
+    auto pool = openPool(dir + "/pool", perTenant * 3 + perTenant / 2);
+    if (!pool) return;
+    for (int i = 0; i < 10; i++) acquire(*pool, "t" + to_string(i));
+    LedgerPoolStats stats = pool->stats();
+
+    // The string pool is reported but does not squeeze tenants out
+    CHECK(stats.sharedStringBytes > 0);
+    CHECK(stats.residentTenants >= 2);
+    CHECK(stats.residentTenants < 10);
+    CHECK(stats.residentBytes <= stats.memoryBudgetBytes);
+    CHECK_EQ(stats.evictions, (uint64_t)(10 - stats.residentTenants));
+
+    // The most recent tenants stay, the oldest went first
+    CHECK(pool->isResident("t9"));
+    CHECK(pool->isResident("t8"));
+    CHECK(!pool->isResident("t0"));
+
+    // A hit makes a tenant the most recent again
+    acquire(*pool, "t8");
+    for (int i = 10; i < 10 + (int)stats.residentTenants - 1; i++) acquire(*pool, "t" + to_string(i));
+    CHECK(pool->isResident("t8"));
+    CHECK(!pool->isResident("t9"));
+}
+
+// Last: the string cap is process-wide and never goes back up
+void testStringBudget() {
+    LedgerPoolOptions options;
+    options.baseDir = checks::scratchDir("tenants_strings");
+    auto unlimited = openPool(options.baseDir, 0);
+    if (!unlimited) return;
+    options.stringBudgetBytes = unlimited->stats().sharedStringBytes + 32 * 1024;
+    Result<unique_ptr<LedgerPool>> opened = LedgerPool::open(options);
+    CHECK(opened.ok());
+    if (!opened.ok()) return;
+    LedgerPool& pool = *opened.value();
+    auto ledger = acquire(pool, "acme");
+    if (!ledger) return;
+
+    // Every user brings new strings; the cap stops them, not the process
+    Result<int> registered = 0;
+    int added = 0;
+    for (; added < 5000; added++) {
+        string id = to_string(added);
+        registered = ledger->registerUser("User " + id + string(80, 'x'), "user" + id + "@example.com",
+                                          "9876543210", "secret1");
+        if (!registered.ok()) break;
+    }
+    CHECK(added > 0 && added < 5000);
+    CHECK(registered.status().code == ErrorCode::RESOURCE_EXHAUSTED);
+
+    LedgerPoolStats stats = pool.stats();
+    CHECK_EQ(stats.stringBudgetBytes, options.stringBudgetBytes);
+    CHECK(stats.sharedStringBytes <= options.stringBudgetBytes + 1024);
+    CHECK(ledger->users().ok());
+}
+
+}  // namespace
+
+int main() {
+    testTenantIds();
+    testIsolationAndReload();
+    testHeldAfterEviction();
+    testBudget();
+    testStringBudget();
+    return checks::result("test_tenants");
+}